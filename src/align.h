@@ -2,6 +2,7 @@
 #define ALIGN_H
 
 #include <boost/multi_array.hpp>
+#include <boost/dynamic_bitset.hpp>
 
 #include <iostream>
 
@@ -79,6 +80,84 @@ namespace torali
     else return cost;
   }
 
+  // Column-major alignment profile, each column lists its non-zero bases
+  template<typename TProfileValue>
+  struct ScoreProfile {
+    std::vector<TProfileValue> p;
+    std::vector<uint8_t> base;
+    std::vector<uint8_t> nbase;
+  };
+
+  // DP and trace-back buffers, reused across the alignments of one thread
+  template<typename TScoreValue>
+  struct AlignWorkspace {
+    typedef TScoreValue TValue;
+    typedef boost::dynamic_bitset<> TBitSet;
+
+    std::vector<TScoreValue> s;
+    std::vector<TScoreValue> v;
+    std::vector<TScoreValue> mat[4];
+    TBitSet bit[4];
+    ScoreProfile<float> p1;
+    ScoreProfile<float> p2;
+    ScoreProfile<double> dp1;
+    ScoreProfile<double> dp2;
+    std::vector<char> trace;
+    std::vector<char> msa;
+  };
+
+  template<typename TBuffer>
+  inline void
+  _reserveWorkspace(TBuffer& buf, std::size_t const sz) {
+    if (buf.size() < sz) buf.resize(sz);
+  }
+
+  template<typename TScoreValue>
+  inline AlignWorkspace<TScoreValue>&
+  _alignWorkspace() {
+    static thread_local AlignWorkspace<TScoreValue> ws;
+    return ws;
+  }
+
+  // Retained workspace of a thread, the four full DP matrices of the largest longNeedle
+  #ifndef DELLY_WORKSPACE_BYTES
+  #define DELLY_WORKSPACE_BYTES 67108864
+  #endif
+
+  template<typename TBuffer>
+  inline std::size_t
+  _bufferBytes(TBuffer const& buf) {
+    return buf.capacity() * sizeof(typename TBuffer::value_type);
+  }
+
+  template<typename TProfileValue>
+  inline std::size_t
+  _bufferBytes(ScoreProfile<TProfileValue> const& sp) {
+    return _bufferBytes(sp.p) + _bufferBytes(sp.base) + _bufferBytes(sp.nbase);
+  }
+
+  // Frees all buffers if together they exceed DELLY_WORKSPACE_BYTES
+  template<typename TScoreValue>
+  inline void
+  _trimWorkspace(AlignWorkspace<TScoreValue>& ws) {
+    typedef typename AlignWorkspace<TScoreValue>::TBitSet TBitSet;
+    std::size_t bytes = _bufferBytes(ws.s) + _bufferBytes(ws.v) + _bufferBytes(ws.p1) + _bufferBytes(ws.p2) + _bufferBytes(ws.dp1) + _bufferBytes(ws.dp2) + _bufferBytes(ws.trace) + _bufferBytes(ws.msa);
+    for(uint32_t k = 0; k < 4; ++k) bytes += _bufferBytes(ws.mat[k]) + ws.bit[k].num_blocks() * sizeof(typename TBitSet::block_type);
+    if (bytes <= DELLY_WORKSPACE_BYTES) return;
+    ws = AlignWorkspace<TScoreValue>();
+  }
+
+  // Thread workspace for one alignment, trimmed when the alignment is done
+  template<typename TScoreValue>
+  struct ThreadWorkspace {
+    AlignWorkspace<TScoreValue>& ws;
+
+    ThreadWorkspace() : ws(_alignWorkspace<TScoreValue>()) {}
+    ~ThreadWorkspace() {
+      _trimWorkspace(ws);
+    }
+  };
+
   template<typename TChar, typename TDimension>
   inline std::size_t
   _size(boost::multi_array<TChar, 2> const& a, TDimension const i) {
@@ -100,19 +179,23 @@ namespace torali
     return (s1[row] == s2[col] ? sc.match : sc.mismatch );
   }
 
-  template<typename TChar, typename TProfile, typename TAIndex, typename TScore>
+  // Zero terms are skipped, the sum order of the remaining terms is unchanged
+  template<typename TChar, typename TProfileValue, typename TAIndex, typename TScore>
   inline int
-  _score(boost::multi_array<TChar, 2> const& a1, boost::multi_array<TChar, 2> const& a2, TProfile const& p1, TProfile const& p2, TAIndex row, TAIndex col, TScore const& sc)
+  _score(boost::multi_array<TChar, 2> const& a1, boost::multi_array<TChar, 2> const& a2, ScoreProfile<TProfileValue> const& p1, ScoreProfile<TProfileValue> const& p2, TAIndex row, TAIndex col, TScore const& sc)
   {
     if ((a1.shape()[0] == 1) && (a2.shape()[0] == 1)) {
       if (a1[0][row] == a2[0][col]) return sc.match;
       else return sc.mismatch;
     } else {
-      typedef typename TProfile::index TPIndex;
+      TProfileValue const* c1 = &p1.p[row * 5];
+      TProfileValue const* c2 = &p2.p[col * 5];
+      uint8_t const* b1 = &p1.base[row * 5];
+      uint8_t const* b2 = &p2.base[col * 5];
       float score = 0;
-      for(TPIndex k1 = 0; k1<5; ++k1) 
-	for(TPIndex k2 = 0; k2<5; ++k2) 
-	  score += p1[k1][row] * p2[k2][col] * ( (k1 == k2) ? sc.match : sc.mismatch );
+      for(uint8_t i = 0; i < p1.nbase[row]; ++i)
+	for(uint8_t j = 0; j < p2.nbase[col]; ++j)
+	  score += c1[b1[i]] * c2[b2[j]] * ( (b1[i] == b2[j]) ? sc.match : sc.mismatch );
       return ((int) score);
     }
   }
@@ -177,6 +260,35 @@ namespace torali
     }
   }
 
+  template<typename TAlign, typename TProfileValue>
+  inline void
+  _createScoreProfile(TAlign const& a, ScoreProfile<TProfileValue>& sp)
+  {
+    typedef boost::multi_array<TProfileValue, 2> TProfile;
+    typedef typename TProfile::index TPIndex;
+    TProfile p;
+    _createProfile(a, p);
+    std::size_t ncol = p.shape()[1];
+    sp.p.resize(ncol * 5);
+    sp.base.resize(ncol * 5);
+    sp.nbase.resize(ncol);
+    for(TPIndex j = 0; j < (TPIndex) ncol; ++j) {
+      sp.nbase[j] = 0;
+      for(TPIndex k = 0; k < 5; ++k) {
+	sp.p[j * 5 + k] = p[k][j];
+	if (p[k][j] != 0) sp.base[j * 5 + sp.nbase[j]++] = k;
+      }
+    }
+  }
+
+  template<typename TAlign1, typename TAlign2, typename TProfileValue>
+  inline void
+  _createScoreProfile(TAlign1 const& a1, TAlign2 const& a2, ScoreProfile<TProfileValue>& p1, ScoreProfile<TProfileValue>& p2)
+  {
+    _createScoreProfile(a1, p1);
+    _createScoreProfile(a2, p2);
+  }
+
   template<typename TTrace, typename TAlign>
   inline void
   _createLocalAlignment(TTrace const& trace, std::string const& s1, std::string const& s2, TAlign& align, int32_t const maxRow, int32_t const maxCol)
@@ -0,0 +1,105 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+namespace torali
+{
+
+  #ifndef DELLY_ARENA_BITS
+  #define DELLY_ARENA_BITS 16
+  #endif
+
+  // Bump allocator carving runs of values out of fixed-size blocks, runs never move and are released together with the arena
+  template<typename TValue>
+  struct Arena {
+    typedef std::vector<TValue> TBlock;
+
+    uint32_t bits;
+    uint64_t count;
+    std::vector<TBlock> block;
+
+    explicit Arena(uint32_t const b = DELLY_ARENA_BITS) : bits(b), count(0) {}
+  };
+
+  // Position of n contiguous values as block << 32 | offset, runs larger than a block get a block of their own
+  template<typename TValue>
+  inline uint64_t
+  arenaAllocate(Arena<TValue>& a, uint32_t const n) {
+    if ((a.block.empty()) || (a.block.back().size() + n > a.block.back().capacity())) {
+      a.block.push_back(typename Arena<TValue>::TBlock());
+      a.block.back().reserve(std::max(n, (uint32_t) 1 << a.bits));
+    }
+    uint64_t pos = ((uint64_t) (a.block.size() - 1) << 32) | a.block.back().size();
+    a.block.back().resize(a.block.back().size() + n);
+    a.count += n;
+    return pos;
+  }
+
+  template<typename TValue>
+  inline TValue*
+  arenaPtr(Arena<TValue>& a, uint64_t const pos) {
+    return &a.block[pos >> 32][(uint32_t) pos];
+  }
+
+  template<typename TValue>
+  inline TValue const*
+  arenaPtr(Arena<TValue> const& a, uint64_t const pos) {
+    return &a.block[pos >> 32][(uint32_t) pos];
+  }
+
+  // Single values fill every block completely, so the i-th value is found by shifting
+  template<typename TValue>
+  inline void
+  arenaPush(Arena<TValue>& a, TValue const& val) {
+    *arenaPtr(a, arenaAllocate(a, 1)) = val;
+  }
+
+  template<typename TValue>
+  inline TValue&
+  arenaAt(Arena<TValue>& a, uint64_t const i) {
+    return a.block[i >> a.bits][i & (((uint64_t) 1 << a.bits) - 1)];
+  }
+
+  template<typename TValue>
+  inline TValue const&
+  arenaAt(Arena<TValue> const& a, uint64_t const i) {
+    return a.block[i >> a.bits][i & (((uint64_t) 1 << a.bits) - 1)];
+  }
+
+  // Reserve the block directory, appends within it never move the directory so readers need no lock
+  template<typename TValue>
+  inline void
+  reserveArena(Arena<TValue>& a, uint32_t const nblocks) {
+    a.block.reserve(nblocks);
+  }
+
+  // True if n values fit without growing the block directory
+  template<typename TValue>
+  inline bool
+  arenaFits(Arena<TValue> const& a, uint32_t const n) {
+    if ((!a.block.empty()) && (a.block.back().size() + n <= a.block.back().capacity())) return true;
+    return (a.block.size() < a.block.capacity());
+  }
+
+  template<typename TValue>
+  inline void
+  releaseArena(Arena<TValue>& a) {
+    std::vector<typename Arena<TValue>::TBlock>().swap(a.block);
+    a.count = 0;
+  }
+
+  // Reserved bytes of all blocks
+  template<typename TValue>
+  inline uint64_t
+  arenaBytes(Arena<TValue> const& a) {
+    uint64_t bytes = 0;
+    for(uint32_t i = 0; i < a.block.size(); ++i) bytes += a.block[i].capacity() * sizeof(TValue);
+    return bytes;
+  }
+
+}
+
+#endif
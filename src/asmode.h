@@ -221,7 +221,8 @@ namespace torali {
    ProfilerStart("delly.prof");
 #endif
 
-   // Structural Variants
+   // Structural Variants, their sequences live in the pool of this run
+   SequencePoolScope poolScope;
    typedef std::vector<StructuralVariantRecord> TVariants;
    TVariants svs;
 
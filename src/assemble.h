@@ -22,12 +22,13 @@ namespace torali
   };
 
 
-  template<typename TAlign>
+  template<typename TAlign, typename TScoreValue>
   inline void
-  convertAlignment(std::string const& query, TAlign& align, EdlibAlignMode const modeCode, EdlibAlignResult& cigar) {
-    // Input alignment
-    TAlign alignIn;
-    alignIn.resize(boost::extents[align.shape()[0]][align.shape()[1]]);
+  convertAlignment(std::string const& query, TAlign& align, EdlibAlignMode const modeCode, EdlibAlignResult& cigar, AlignWorkspace<TScoreValue>& ws) {
+    // Input alignment, copied into the workspace
+    typedef boost::multi_array_ref<char, 2> TAlignIn;
+    _reserveWorkspace(ws.msa, align.num_elements());
+    TAlignIn alignIn(&ws.msa[0], boost::extents[align.shape()[0]][align.shape()[1]]);
     for(uint32_t i = 0; i < align.shape()[0]; ++i) {
       for(uint32_t j = 0; j < align.shape()[1]; ++j) {
 	alignIn[i][j] = align[i][j];
@@ -62,6 +63,13 @@ namespace torali
     }
   }
 
+  template<typename TAlign>
+  inline void
+  convertAlignment(std::string const& query, TAlign& align, EdlibAlignMode const modeCode, EdlibAlignResult& cigar) {
+    ThreadWorkspace<int> tw;
+    convertAlignment(query, align, modeCode, cigar, tw.ws);
+  }
+
   
   template<typename TAlign>
   inline void
@@ -125,9 +133,9 @@ namespace torali
   }
   
 
-  template<typename TConfig, typename TSplitReadSet>
+  template<typename TConfig, typename TSplitReadSet, typename TScoreValue>
   inline int
-  msaEdlib(TConfig const& c, TSplitReadSet& sps, std::string& cs) {
+  msaEdlib(TConfig const& c, TSplitReadSet& sps, std::string& cs, AlignWorkspace<TScoreValue>& ws) {
     // Pairwise scores
     std::vector<int32_t> edit(sps.size() * sps.size(), 0);
     for(uint32_t i = 0; i < sps.size(); ++i) {
@@ -198,7 +206,7 @@ namespace torali
 
       // Compute alignment
       EdlibAlignResult cigar = edlibAlign(sps[selectedIdx[i]].c_str(), sps[selectedIdx[i]].size(), alignStr.c_str(), alignStr.size(), edlibNewAlignConfig(-1, EDLIB_MODE_HW, EDLIB_TASK_PATH, additionalEqualities, 20));
-      convertAlignment(sps[selectedIdx[i]], align, EDLIB_MODE_HW, cigar);
+      convertAlignment(sps[selectedIdx[i]], align, EDLIB_MODE_HW, cigar, ws);
       edlibFreeAlignResult(cigar);
     }
     
@@ -225,6 +233,13 @@ namespace torali
     return align.shape()[0];
   }
 
+  template<typename TConfig, typename TSplitReadSet>
+  inline int
+  msaEdlib(TConfig const& c, TSplitReadSet& sps, std::string& cs) {
+    ThreadWorkspace<int> tw;
+    return msaEdlib(c, sps, cs, tw.ws);
+  }
+
 
   
   template<typename TConfig, typename TValidRegion, typename TSRStore>
@@ -247,6 +262,7 @@ namespace torali
     TIndex idx(c.files.size());
     for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
       samfile[file_c] = sam_open(c.files[file_c].string().c_str(), "r");
+      attachHtsThreadPool(samfile[file_c]);
       hts_set_fai_filename(samfile[file_c], c.genome.string().c_str());
       idx[file_c] = sam_index_load(samfile[file_c], c.files[file_c].string().c_str());
     }
@@ -316,8 +332,9 @@ namespace torali
 		      bool msaSuccess = false;
 		      if (seqStore[svid].size() > 1) {
 			//std::cerr << svs[svid].svStart << ',' << svs[svid].svEnd << ',' << svs[svid].svt << ',' << svid << " SV" << std::endl;
-			msaEdlib(c, seqStore[svid], svs[svid].consensus);
-			if (alignConsensus(c, hdr, seq, NULL, svs[svid], true)) msaSuccess = true;
+			std::string cons;
+			msaEdlib(c, seqStore[svid], cons);
+			if (alignConsensus(c, hdr, seq, NULL, cons, svs[svid], true)) msaSuccess = true;
 			//std::cerr << msaSuccess << std::endl;
 		      }
 		      if (!msaSuccess) {
@@ -360,8 +377,9 @@ namespace torali
 	      if (computeMSA) {
 		bool msaSuccess = false;
 		//std::cerr << svs[svid].svStart << ',' << svs[svid].svEnd << ',' << svs[svid].svt << ',' << svid << " SV" << std::endl;
-		msaEdlib(c, seqStore[svid], svs[svid].consensus);
-		if (alignConsensus(c, hdr, seq, sndSeq, svs[svid], true)) msaSuccess = true;
+		std::string cons;
+		msaEdlib(c, seqStore[svid], cons);
+		if (alignConsensus(c, hdr, seq, sndSeq, cons, svs[svid], true)) msaSuccess = true;
 		//std::cerr << msaSuccess << std::endl;
 		if (!msaSuccess) {
 		  svs[svid].consensus = "";
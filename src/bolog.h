@@ -85,9 +85,65 @@ struct BoLog {
  }
 
 
+// Running genotype likelihoods of one sample and SV, updated per counted read
+template<typename TPrecision>
+struct GenoRunning {
+  TPrecision gl[3];
+  uint32_t depth;
+  uint32_t skipped;
+  bool settled;
+
+  GenoRunning() : depth(0), skipped(0), settled(false) {
+    gl[0] = 0;
+    gl[1] = 0;
+    gl[2] = 0;
+  }
+};
+
+ template<typename TBoLog>
+ inline int32_t
+ _runningGQ(TBoLog const& bl, GenoRunning<typename TBoLog::value_type> const& gr) {
+   typedef typename TBoLog::value_type FLP;
+   if (!gr.depth) return 0;
+   FLP gl[3];
+   gl[0] = gr.gl[0];
+   gl[1] = gr.gl[1] - FLP(gr.depth) * std::log10(FLP(2));
+   gl[2] = gr.gl[2];
+   FLP glBestVal = std::max(gl[0], std::max(gl[1], gl[2]));
+   uint32_t pl[3];
+   for(unsigned int geno=0; geno<=2; ++geno) {
+     gl[geno] -= glBestVal;
+     gl[geno] = (gl[geno] > SMALLEST_GL) ? gl[geno] : SMALLEST_GL;
+     pl[geno] = (uint32_t) boost::math::round(-10 * gl[geno]);
+   }
+   if (pl[0] + pl[1] + pl[2] == 0) return 0;
+   FLP likelihood = (FLP) std::log10((1-1/(bl.phred2prob[pl[0]]+bl.phred2prob[pl[1]]+bl.phred2prob[pl[2]])));
+   likelihood = (likelihood > SMALLEST_GL) ? likelihood : SMALLEST_GL;
+   return (int32_t) boost::math::round(-10 * likelihood);
+ }
+
+ // Same per-read terms as _computeGLs, the genotype settles once its GQ reaches stopGQ (0 = never)
+ template<typename TBoLog>
+ inline void
+ _addRunningRead(TBoLog const& bl, GenoRunning<typename TBoLog::value_type>& gr, uint8_t const qual, bool const alt, uint32_t const stopGQ) {
+   typedef typename TBoLog::value_type FLP;
+   FLP p = bl.phred2prob[qual];
+   if (alt) {
+     gr.gl[0] += std::log10(FLP(1) - p);
+     gr.gl[1] += std::log10((FLP(1) - p) + p);
+     gr.gl[2] += std::log10(p);
+   } else {
+     gr.gl[0] += std::log10(p);
+     gr.gl[1] += std::log10(p + (FLP(1) - p));
+     gr.gl[2] += std::log10(FLP(1) - p);
+   }
+   ++gr.depth;
+   if ((stopGQ) && (_runningGQ(bl, gr) >= (int32_t) stopGQ)) gr.settled = true;
+ }
+
   template<typename TConfig>
   inline int32_t
-  _computeCNLs(TConfig const& c, double const mean, double const sd, float* gl, int32_t* gqval, int32_t const file_c) {
+  _computeCNLs(TConfig const&, double const mean, double const sd, float* gl, int32_t* gqval, int32_t const file_c, uint16_t const ploidy) {
     // Compute copy-number likelihoods
     boost::math::normal s(mean, sd);
     for(uint32_t geno=0; geno< MAX_CN; ++geno) {
@@ -116,7 +172,7 @@ struct BoLog {
     double glObs = std::log10(boost::math::pdf(s, mean));
     glObs = (glObs > SMALLEST_GL) ? glObs : SMALLEST_GL;
     uint32_t plVariant = (uint32_t) boost::math::round(-10 * glObs);
-    uint32_t plPloidy = (uint32_t) boost::math::round(-10 * gl[file_c * MAX_CN + c.ploidy]);
+    uint32_t plPloidy = (uint32_t) boost::math::round(-10 * gl[file_c * MAX_CN + ploidy]);
     int32_t varqual = plPloidy - plVariant;
     
     // GQ
@@ -132,6 +188,12 @@ struct BoLog {
     return varqual;
   }
 
+  template<typename TConfig>
+  inline int32_t
+  _computeCNLs(TConfig const& c, double const mean, double const sd, float* gl, int32_t* gqval, int32_t const file_c) {
+    return _computeCNLs(c, mean, sd, gl, gqval, file_c, c.ploidy);
+  }
+
   template<typename TConfig>
   inline int32_t
   _computeCNLs(TConfig const& c, double const mean, double const sd, float* gl, int32_t* gqval) {
@@ -0,0 +1,438 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <iostream>
+#include <fstream>
+#include <boost/functional/hash.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "tags.h"
+#include "util.h"
+#include "coverage.h"
+
+namespace torali
+{
+
+  #ifndef DELLY_CHECKPOINT_VERSION
+  #define DELLY_CHECKPOINT_VERSION 2
+  #endif
+
+  // Pipeline stages of delly call
+  #ifndef DELLY_STAGE_NONE
+  #define DELLY_STAGE_NONE 0
+  #define DELLY_STAGE_CLUSTER 1
+  #define DELLY_STAGE_ASSEMBLY 2
+  #define DELLY_STAGE_COVERAGE 3
+  #endif
+
+  inline std::string
+  _stageName(int32_t const stage) {
+    switch (stage) {
+    case DELLY_STAGE_CLUSTER: return "clustering";
+    case DELLY_STAGE_ASSEMBLY: return "assembly";
+    case DELLY_STAGE_COVERAGE: return "coverage annotation";
+    default: return "none";
+    }
+  }
+
+  // Fingerprint of all inputs and parameters read by the scan, assembly and coverage stages
+  template<typename TConfig>
+  inline uint64_t
+  checkpointKey(TConfig const& c) {
+    std::size_t seed = DELLY_CHECKPOINT_VERSION;
+    std::vector<boost::filesystem::path> inputs(c.files.begin(), c.files.end());
+    inputs.push_back(c.genome);
+    if (c.hasExcludeFile) inputs.push_back(c.exclude);
+    if (c.hasVcfFile) inputs.push_back(c.vcffile);
+    if (c.hasRdInput) inputs.push_back(c.rdinput);
+    if (c.hasEvidenceDir) {
+      boost::hash_combine(seed, c.evidencedir.string());
+      if (c.hasVcfFile) {
+	for(uint32_t file_c = 0; file_c < c.files.size(); ++file_c) inputs.push_back(c.evidencedir / (c.sampleName[file_c] + ".dei"));
+      }
+    }
+    for(uint32_t i = 0; i < inputs.size(); ++i) {
+      boost::hash_combine(seed, inputs[i].string());
+      if (boost::filesystem::exists(inputs[i])) {
+	boost::hash_combine(seed, (uint64_t) boost::filesystem::file_size(inputs[i]));
+	boost::hash_combine(seed, (int64_t) boost::filesystem::last_write_time(inputs[i]));
+      }
+    }
+    for(std::set<int32_t>::const_iterator it = c.svtset.begin(); it != c.svtset.end(); ++it) boost::hash_combine(seed, *it);
+    boost::hash_combine(seed, c.hasEvidenceDir);
+    boost::hash_combine(seed, c.approxGeno);
+    boost::hash_combine(seed, c.hasRdInput);
+    boost::hash_combine(seed, c.minMapQual);
+    boost::hash_combine(seed, c.minTraQual);
+    boost::hash_combine(seed, c.minGenoQual);
+    boost::hash_combine(seed, c.madCutoff);
+    boost::hash_combine(seed, c.madNormalCutoff);
+    boost::hash_combine(seed, c.minConsWindow);
+    boost::hash_combine(seed, c.graphPruning);
+    boost::hash_combine(seed, c.minRefSep);
+    boost::hash_combine(seed, c.maxReadSep);
+    boost::hash_combine(seed, c.minClip);
+    boost::hash_combine(seed, c.maxGenoReadCount);
+    boost::hash_combine(seed, c.genoStopGQ);
+    boost::hash_combine(seed, c.minCliqueSize);
+    boost::hash_combine(seed, c.minimumFlankSize);
+    boost::hash_combine(seed, c.indelsize);
+    boost::hash_combine(seed, c.flankQuality);
+    boost::hash_combine(seed, c.aliscore.match);
+    boost::hash_combine(seed, c.aliscore.mismatch);
+    boost::hash_combine(seed, c.aliscore.go);
+    boost::hash_combine(seed, c.aliscore.ge);
+    return (uint64_t) seed;
+  }
+
+  // Pool handles are process-local, sequences are stored verbatim
+  inline void
+  _ckpWrite(std::ostream& out, PooledSeq const& ps) {
+    _ckpWrite(out, ps.str());
+  }
+
+  inline bool
+  _ckpRead(std::istream& in, PooledSeq& ps) {
+    std::string s;
+    if (!_ckpRead(in, s)) return false;
+    ps = s;
+    return true;
+  }
+
+  inline void
+  _ckpWrite(std::ostream& out, StructuralVariantRecord const& sv) {
+    _ckpWrite(out, sv.chr);
+    _ckpWrite(out, sv.svStart);
+    _ckpWrite(out, sv.chr2);
+    _ckpWrite(out, sv.svEnd);
+    _ckpWrite(out, sv.ciposlow);
+    _ckpWrite(out, sv.ciposhigh);
+    _ckpWrite(out, sv.ciendlow);
+    _ckpWrite(out, sv.ciendhigh);
+    _ckpWrite(out, sv.srSupport);
+    _ckpWrite(out, sv.srMapQuality);
+    _ckpWrite(out, sv.mapq);
+    _ckpWrite(out, sv.insLen);
+    _ckpWrite(out, sv.svt);
+    _ckpWrite(out, sv.id);
+    _ckpWrite(out, sv.homLen);
+    _ckpWrite(out, sv.peSupport);
+    _ckpWrite(out, sv.peMapQuality);
+    _ckpWrite(out, sv.srAlignQuality);
+    _ckpWrite(out, sv.precise);
+    _ckpWrite(out, sv.alleles);
+    _ckpWrite(out, sv.consensus);
+  }
+
+  inline bool
+  _ckpRead(std::istream& in, StructuralVariantRecord& sv) {
+    _ckpRead(in, sv.chr);
+    _ckpRead(in, sv.svStart);
+    _ckpRead(in, sv.chr2);
+    _ckpRead(in, sv.svEnd);
+    _ckpRead(in, sv.ciposlow);
+    _ckpRead(in, sv.ciposhigh);
+    _ckpRead(in, sv.ciendlow);
+    _ckpRead(in, sv.ciendhigh);
+    _ckpRead(in, sv.srSupport);
+    _ckpRead(in, sv.srMapQuality);
+    _ckpRead(in, sv.mapq);
+    _ckpRead(in, sv.insLen);
+    _ckpRead(in, sv.svt);
+    _ckpRead(in, sv.id);
+    _ckpRead(in, sv.homLen);
+    _ckpRead(in, sv.peSupport);
+    _ckpRead(in, sv.peMapQuality);
+    _ckpRead(in, sv.srAlignQuality);
+    _ckpRead(in, sv.precise);
+    _ckpRead(in, sv.alleles);
+    return _ckpRead(in, sv.consensus);
+  }
+
+  inline void
+  _ckpWrite(std::ostream& out, ReadCount const& rc) {
+    _ckpWrite(out, rc.leftRC);
+    _ckpWrite(out, rc.rc);
+    _ckpWrite(out, rc.rightRC);
+  }
+
+  inline bool
+  _ckpRead(std::istream& in, ReadCount& rc) {
+    _ckpRead(in, rc.leftRC);
+    _ckpRead(in, rc.rc);
+    return _ckpRead(in, rc.rightRC);
+  }
+
+  template<typename TRefAlt>
+  inline void
+  _ckpWriteRefAlt(std::ostream& out, TRefAlt const& ra) {
+    _ckpWrite(out, ra.ref);
+    _ckpWrite(out, ra.alt);
+  }
+
+  template<typename TRefAlt>
+  inline bool
+  _ckpReadRefAlt(std::istream& in, TRefAlt& ra) {
+    _ckpRead(in, ra.ref);
+    return _ckpRead(in, ra.alt);
+  }
+
+  inline void
+  _ckpWrite(std::ostream& out, JunctionCount const& jc) { _ckpWriteRefAlt(out, jc); }
+
+  inline bool
+  _ckpRead(std::istream& in, JunctionCount& jc) { return _ckpReadRefAlt(in, jc); }
+
+  inline void
+  _ckpWrite(std::ostream& out, SpanningCount const& sc) { _ckpWriteRefAlt(out, sc); }
+
+  inline bool
+  _ckpRead(std::istream& in, SpanningCount& sc) { return _ckpReadRefAlt(in, sc); }
+
+  template<typename TRecord>
+  inline void
+  _ckpWrite(std::ostream& out, std::vector<TRecord> const& v) {
+    uint64_t len = v.size();
+    _ckpWrite(out, len);
+    for(uint64_t i = 0; i < len; ++i) _ckpWrite(out, v[i]);
+  }
+
+  template<typename TRecord>
+  inline bool
+  _ckpRead(std::istream& in, std::vector<TRecord>& v) {
+    uint64_t len = 0;
+    if (!_ckpRead(in, len)) return false;
+    v.clear();
+    v.resize(len);
+    for(uint64_t i = 0; i < len; ++i) {
+      if (!_ckpRead(in, v[i])) return false;
+    }
+    return true;
+  }
+
+  // Split-read store (position, read hash) -> SV per chromosome
+  template<typename TKey, typename TValue>
+  inline void
+  _ckpWrite(std::ostream& out, boost::unordered_map<TKey, TValue> const& m) {
+    uint64_t len = m.size();
+    _ckpWrite(out, len);
+    for(typename boost::unordered_map<TKey, TValue>::const_iterator it = m.begin(); it != m.end(); ++it) {
+      _ckpWrite(out, it->first.first);
+      _ckpWrite(out, (uint64_t) it->first.second);
+      _ckpWrite(out, it->second);
+    }
+  }
+
+  template<typename TKey, typename TValue>
+  inline bool
+  _ckpRead(std::istream& in, boost::unordered_map<TKey, TValue>& m) {
+    uint64_t len = 0;
+    if (!_ckpRead(in, len)) return false;
+    m.clear();
+    for(uint64_t i = 0; i < len; ++i) {
+      typename TKey::first_type pos;
+      uint64_t hv;
+      TValue val;
+      _ckpRead(in, pos);
+      _ckpRead(in, hv);
+      if (!_ckpRead(in, val)) return false;
+      m[std::make_pair(pos, (typename TKey::second_type) hv)] = val;
+    }
+    return true;
+  }
+
+  // Unique discordant pairs of the scan, the other library parameters are re-estimated on resume
+  template<typename TSampleLibrary>
+  inline void
+  _ckpWriteLibrary(std::ostream& out, TSampleLibrary const& sampleLib) {
+    _ckpWrite(out, (uint32_t) sampleLib.size());
+    for(uint32_t file_c = 0; file_c < sampleLib.size(); ++file_c) _ckpWrite(out, sampleLib[file_c].abnormal_pairs);
+  }
+
+  template<typename TSampleLibrary>
+  inline bool
+  _ckpReadLibrary(std::istream& in, TSampleLibrary& sampleLib) {
+    uint32_t ns = 0;
+    if ((!_ckpRead(in, ns)) || (ns != sampleLib.size())) return false;
+    for(uint32_t file_c = 0; file_c < ns; ++file_c) {
+      if (!_ckpRead(in, sampleLib[file_c].abnormal_pairs)) return false;
+    }
+    return true;
+  }
+
+  // Checkpoint file layout: magic, version, key, stage, payload
+  template<typename TConfig>
+  inline bool
+  _openCheckpoint(TConfig const& c, std::ifstream& in, int32_t& stage) {
+    stage = DELLY_STAGE_NONE;
+    if (!boost::filesystem::exists(c.ckpfile)) return false;
+    in.open(c.ckpfile.string().c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!in.is_open()) return false;
+    char magic[8];
+    in.read(magic, 8);
+    if ((!in.good()) || (std::string(magic, 8) != "DELLYCKP")) {
+      std::cerr << "Warning: " << c.ckpfile.string() << " is not a delly checkpoint file!" << std::endl;
+      return false;
+    }
+    uint32_t version = 0;
+    uint64_t key = 0;
+    _ckpRead(in, version);
+    _ckpRead(in, key);
+    if (!_ckpRead(in, stage)) return false;
+    if (version != DELLY_CHECKPOINT_VERSION) {
+      std::cerr << "Warning: Checkpoint version mismatch, starting from scratch." << std::endl;
+      stage = DELLY_STAGE_NONE;
+      return false;
+    }
+    if (key != checkpointKey(c)) {
+      std::cerr << "Warning: Checkpoint was created with different input files or parameters, starting from scratch." << std::endl;
+      stage = DELLY_STAGE_NONE;
+      return false;
+    }
+    return true;
+  }
+
+  // Peek at the last completed stage
+  template<typename TConfig>
+  inline int32_t
+  checkpointStage(TConfig const& c) {
+    std::ifstream in;
+    int32_t stage = DELLY_STAGE_NONE;
+    if (!_openCheckpoint(c, in, stage)) return DELLY_STAGE_NONE;
+    return stage;
+  }
+
+  template<typename TConfig>
+  inline std::ofstream*
+  _beginCheckpoint(TConfig const& c, int32_t const stage) {
+    std::string tmpfile = c.ckpfile.string() + ".tmp";
+    std::ofstream* out = new std::ofstream(tmpfile.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!out->is_open()) {
+      std::cerr << "Warning: Fail to open checkpoint file " << tmpfile << std::endl;
+      delete out;
+      return NULL;
+    }
+    out->write("DELLYCKP", 8);
+    _ckpWrite(*out, (uint32_t) DELLY_CHECKPOINT_VERSION);
+    _ckpWrite(*out, checkpointKey(c));
+    _ckpWrite(*out, stage);
+    return out;
+  }
+
+  // Atomically replace the previous checkpoint
+  template<typename TConfig>
+  inline bool
+  _endCheckpoint(TConfig const& c, std::ofstream* out, int32_t const stage) {
+    bool ok = out->good();
+    out->close();
+    delete out;
+    std::string tmpfile = c.ckpfile.string() + ".tmp";
+    if (!ok) {
+      std::cerr << "Warning: Fail to write checkpoint file " << tmpfile << std::endl;
+      boost::filesystem::remove(tmpfile);
+      return false;
+    }
+    boost::filesystem::rename(tmpfile, c.ckpfile);
+    boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
+    std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] " << "Checkpoint after " << _stageName(stage) << std::endl;
+    return true;
+  }
+
+  // Clustered PE and SR candidates including the split-read store
+  template<typename TConfig, typename TSampleLibrary, typename TVariants, typename TGenomicPosReadSV>
+  inline bool
+  writeCheckpoint(TConfig const& c, TSampleLibrary const& sampleLib, TVariants const& svs, TVariants const& srSVs, TGenomicPosReadSV const& srStore) {
+    std::ofstream* out = _beginCheckpoint(c, DELLY_STAGE_CLUSTER);
+    if (out == NULL) return false;
+    _ckpWriteLibrary(*out, sampleLib);
+    _ckpWrite(*out, svs);
+    _ckpWrite(*out, srSVs);
+    _ckpWrite(*out, (uint32_t) srStore.size());
+    for(uint32_t i = 0; i < srStore.size(); ++i) _ckpWrite(*out, srStore[i]);
+    return _endCheckpoint(c, out, DELLY_STAGE_CLUSTER);
+  }
+
+  template<typename TConfig, typename TSampleLibrary, typename TVariants, typename TGenomicPosReadSV>
+  inline bool
+  readCheckpoint(TConfig const& c, TSampleLibrary& sampleLib, TVariants& svs, TVariants& srSVs, TGenomicPosReadSV& srStore) {
+    std::ifstream in;
+    int32_t stage = DELLY_STAGE_NONE;
+    if ((!_openCheckpoint(c, in, stage)) || (stage != DELLY_STAGE_CLUSTER)) return false;
+    if (!_ckpReadLibrary(in, sampleLib)) return false;
+    _ckpRead(in, svs);
+    _ckpRead(in, srSVs);
+    uint32_t nchr = 0;
+    _ckpRead(in, nchr);
+    srStore.resize(nchr);
+    for(uint32_t i = 0; i < nchr; ++i) {
+      if (!_ckpRead(in, srStore[i])) return false;
+    }
+    return true;
+  }
+
+  // Merged and assembled SV candidates
+  template<typename TConfig, typename TSampleLibrary, typename TVariants>
+  inline bool
+  writeCheckpoint(TConfig const& c, TSampleLibrary const& sampleLib, TVariants const& svs) {
+    std::ofstream* out = _beginCheckpoint(c, DELLY_STAGE_ASSEMBLY);
+    if (out == NULL) return false;
+    _ckpWriteLibrary(*out, sampleLib);
+    _ckpWrite(*out, svs);
+    return _endCheckpoint(c, out, DELLY_STAGE_ASSEMBLY);
+  }
+
+  template<typename TConfig, typename TSampleLibrary, typename TVariants>
+  inline bool
+  readCheckpoint(TConfig const& c, TSampleLibrary& sampleLib, TVariants& svs) {
+    std::ifstream in;
+    int32_t stage = DELLY_STAGE_NONE;
+    if ((!_openCheckpoint(c, in, stage)) || (stage != DELLY_STAGE_ASSEMBLY)) return false;
+    if (!_ckpReadLibrary(in, sampleLib)) return false;
+    return _ckpRead(in, svs);
+  }
+
+  // Genotyped SVs with read counts
+  template<typename TConfig, typename TSampleLibrary, typename TVariants, typename TSampleSVReadCount, typename TSampleSVJunctionMap, typename TSampleSVSpanningMap>
+  inline bool
+  writeCheckpoint(TConfig const& c, TSampleLibrary const& sampleLib, TVariants const& svs, TSampleSVReadCount const& rcMap, TSampleSVJunctionMap const& jctMap, TSampleSVSpanningMap const& spanMap) {
+    std::ofstream* out = _beginCheckpoint(c, DELLY_STAGE_COVERAGE);
+    if (out == NULL) return false;
+    _ckpWriteLibrary(*out, sampleLib);
+    _ckpWrite(*out, svs);
+    _ckpWrite(*out, (uint32_t) rcMap.size());
+    for(uint32_t i = 0; i < rcMap.size(); ++i) _ckpWrite(*out, rcMap[i]);
+    _ckpWrite(*out, (uint32_t) jctMap.size());
+    for(uint32_t i = 0; i < jctMap.size(); ++i) _ckpWrite(*out, jctMap[i]);
+    _ckpWrite(*out, (uint32_t) spanMap.size());
+    for(uint32_t i = 0; i < spanMap.size(); ++i) _ckpWrite(*out, spanMap[i]);
+    return _endCheckpoint(c, out, DELLY_STAGE_COVERAGE);
+  }
+
+  template<typename TConfig, typename TSampleLibrary, typename TVariants, typename TSampleSVReadCount, typename TSampleSVJunctionMap, typename TSampleSVSpanningMap>
+  inline bool
+  readCheckpoint(TConfig const& c, TSampleLibrary& sampleLib, TVariants& svs, TSampleSVReadCount& rcMap, TSampleSVJunctionMap& jctMap, TSampleSVSpanningMap& spanMap) {
+    std::ifstream in;
+    int32_t stage = DELLY_STAGE_NONE;
+    if ((!_openCheckpoint(c, in, stage)) || (stage != DELLY_STAGE_COVERAGE)) return false;
+    if (!_ckpReadLibrary(in, sampleLib)) return false;
+    _ckpRead(in, svs);
+    uint32_t ns = 0;
+    _ckpRead(in, ns);
+    rcMap.resize(ns);
+    for(uint32_t i = 0; i < ns; ++i) _ckpRead(in, rcMap[i]);
+    _ckpRead(in, ns);
+    jctMap.resize(ns);
+    for(uint32_t i = 0; i < ns; ++i) _ckpRead(in, jctMap[i]);
+    _ckpRead(in, ns);
+    spanMap.resize(ns);
+    for(uint32_t i = 0; i < ns; ++i) {
+      if (!_ckpRead(in, spanMap[i])) return false;
+    }
+    return true;
+  }
+
+}
+
+#endif
@@ -20,21 +20,19 @@ namespace torali
 {
 
 
-  // Reduced bam alignment record data structure
+  // Reduced bam alignment record data structure (32 bytes)
   struct BamAlignRecord {
     int32_t tid;         
     int32_t pos;
     int32_t mtid; 
     int32_t mpos;
-    int32_t alen;
-    int32_t malen;
     int32_t Median;
-    int32_t Mad;
     int32_t maxNormalISize;
-    uint32_t flag;
+    uint16_t alen;
+    uint16_t malen;
     uint8_t MapQuality;
   
-    BamAlignRecord(bam1_t* rec, uint8_t pairQuality, uint16_t a, uint16_t ma, int32_t median, int32_t mad, int32_t maxISize) : tid(rec->core.tid), pos(rec->core.pos), mtid(rec->core.mtid), mpos(rec->core.mpos), alen(a), malen(ma), Median(median), Mad(mad), maxNormalISize(maxISize), flag(rec->core.flag), MapQuality(pairQuality) {}
+    BamAlignRecord(bam1_t* rec, uint8_t pairQuality, uint16_t a, uint16_t ma, int32_t median, int32_t maxISize) : tid(rec->core.tid), pos(rec->core.pos), mtid(rec->core.mtid), mpos(rec->core.mpos), Median(median), maxNormalISize(maxISize), alen(a), malen(ma), MapQuality(pairQuality) {}
   };
 
   // Sort reduced bam alignment records
@@ -536,7 +534,7 @@ namespace torali
 	if (bamIt->mtid != bamItNext->mtid) continue;
 	
 	// Check combinability of pairs
-	if (_pairsDisagree(minCoord, maxCoord, bamIt->alen, bamIt->maxNormalISize, _minCoord(bamItNext->pos, bamItNext->mpos, svt), _maxCoord(bamItNext->pos, bamItNext->mpos, svt), bamItNext->alen, bamItNext->maxNormalISize, svt)) continue;
+	if (_pairsDisagree(minCoord, maxCoord, (int32_t) bamIt->alen, bamIt->maxNormalISize, _minCoord(bamItNext->pos, bamItNext->mpos, svt), _maxCoord(bamItNext->pos, bamItNext->mpos, svt), (int32_t) bamItNext->alen, bamItNext->maxNormalISize, svt)) continue;
 	
 	// Update last connected node
 	if (bamItIndexNext > lastConnectedNode ) lastConnectedNode = bamItIndexNext;
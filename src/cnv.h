@@ -22,6 +22,8 @@
 #include <htslib/vcf.h>
 #include <htslib/sam.h>
 #include "util.h"
+#include "rdmatrix.h"
+#include "ploidy.h"
 
 
 namespace torali
@@ -56,13 +58,150 @@ namespace torali
   };
 
 
+  // Coverage, expected coverage and count of GC/mappability-valid bases as prefix sums every 64 bp, with a bit mask of valid bases
+  template<typename TGcBias, typename TCoverage>
+  struct MaskedCoverage {
+    std::vector<uint16_t> const& gcContent;
+    TGcBias const& gcbias;
+    TCoverage const& cov;
+    uint32_t len;
+    std::vector<uint64_t> mask;
+    std::vector<uint64_t> obs;
+    std::vector<double> exp;
+    std::vector<uint32_t> valid;
+
+    template<typename TConfig>
+    MaskedCoverage(TConfig const& c, std::pair<uint32_t, uint32_t> const& gcbound, std::vector<uint16_t> const& gcC, std::vector<uint16_t> const& uniqContent, TGcBias const& gcb, TCoverage const& cv, uint32_t const l) : gcContent(gcC), gcbias(gcb), cov(cv), len(l) {
+      uint32_t nblocks = (len + 63) / 64;
+      mask.resize(nblocks, 0);
+      obs.resize(nblocks + 1, 0);
+      exp.resize(nblocks + 1, 0);
+      valid.resize(nblocks + 1, 0);
+      for(uint32_t b = 0; b < nblocks; ++b) {
+	uint64_t osum = 0;
+	double esum = 0;
+	uint64_t m = 0;
+	for(uint32_t pos = b * 64; ((pos < (b + 1) * 64) && (pos < len)); ++pos) {
+	  if ((gcContent[pos] > gcbound.first) && (gcContent[pos] < gcbound.second) && (uniqContent[pos] >= c.fragmentUnique * c.meanisize)) {
+	    m |= (1ULL << (pos & 63));
+	    osum += cov[pos];
+	    esum += gcbias[gcContent[pos]].coverage;
+	  }
+	}
+	mask[b] = m;
+	obs[b + 1] = obs[b] + osum;
+	exp[b + 1] = exp[b] + esum;
+	valid[b + 1] = valid[b] + _popcount64(m);
+      }
+    }
+  };
+
+
+  // Number of valid bases in [0, pos)
+  template<typename TMaskedCoverage>
+  inline uint32_t
+  _maskedRank(TMaskedCoverage const& mc, uint32_t const pos) {
+    uint32_t b = pos / 64;
+    if (pos & 63) return mc.valid[b] + _popcount64(mc.mask[b] & ((1ULL << (pos & 63)) - 1));
+    return mc.valid[b];
+  }
+
+  // Sums over valid bases in [0, pos)
+  template<typename TMaskedCoverage>
+  inline void
+  _maskedPrefix(TMaskedCoverage const& mc, uint32_t const pos, double& covsum, double& expcov, uint32_t& winlen) {
+    uint32_t b = pos / 64;
+    uint64_t osum = mc.obs[b];
+    expcov = mc.exp[b];
+    winlen = mc.valid[b];
+    if (pos & 63) {
+      uint64_t m = mc.mask[b] & ((1ULL << (pos & 63)) - 1);
+      winlen += _popcount64(m);
+      for(; m; m &= m - 1) {
+	uint32_t k = b * 64 + _ctz64(m);
+	osum += mc.cov[k];
+	expcov += mc.gcbias[mc.gcContent[k]].coverage;
+      }
+    }
+    covsum = osum;
+  }
+
+  // Sums over valid bases in [start, end), clipped to the chromosome
+  template<typename TMaskedCoverage>
+  inline uint32_t
+  maskedSum(TMaskedCoverage const& mc, int32_t start, int32_t end, double& covsum, double& expcov) {
+    covsum = 0;
+    expcov = 0;
+    if (start < 0) start = 0;
+    if (end > (int32_t) mc.len) end = mc.len;
+    if (start >= end) return 0;
+    double precov = 0;
+    double preexp = 0;
+    uint32_t prelen = 0;
+    uint32_t winlen = 0;
+    _maskedPrefix(mc, start, precov, preexp, prelen);
+    _maskedPrefix(mc, end, covsum, expcov, winlen);
+    covsum -= precov;
+    expcov -= preexp;
+    return winlen - prelen;
+  }
+
+  // Valid bases, coverage and expected coverage of fixed bins, the read-depth matrix fields of one sample
+  template<typename TMaskedCoverage>
+  inline void
+  maskedBins(TMaskedCoverage const& mc, int32_t const binSize, std::vector<std::vector<float> >& fields) {
+    uint32_t nbins = (mc.len + binSize - 1) / binSize;
+    fields.assign(3, std::vector<float>(nbins, 0));
+    for(uint32_t b = 0; b < nbins; ++b) {
+      double covsum = 0;
+      double expcov = 0;
+      fields[0][b] = maskedSum(mc, b * binSize, (b + 1) * binSize, covsum, expcov);
+      fields[1][b] = covsum;
+      fields[2][b] = expcov;
+    }
+  }
+
+  inline std::vector<std::string>
+  maskedBinFields() {
+    std::vector<std::string> fields;
+    fields.push_back("mappable");
+    fields.push_back("covsum");
+    fields.push_back("expcov");
+    return fields;
+  }
+
+  // Position of the valid base with the given rank, rank < valid bases on the chromosome
+  template<typename TMaskedCoverage>
+  inline uint32_t
+  _maskedSelect(TMaskedCoverage const& mc, uint32_t const rank) {
+    uint32_t b = std::upper_bound(mc.valid.begin(), mc.valid.end(), rank) - mc.valid.begin() - 1;
+    uint64_t m = mc.mask[b];
+    for(uint32_t r = mc.valid[b]; r < rank; ++r) m &= m - 1;
+    return b * 64 + _ctz64(m);
+  }
+
+  // Valid bases in [start, end)
+  template<typename TMaskedCoverage>
+  inline void
+  _maskedPositions(TMaskedCoverage const& mc, int32_t start, int32_t end, std::vector<int32_t>& validpos) {
+    if (start < 0) start = 0;
+    if (end > (int32_t) mc.len) end = mc.len;
+    for(int32_t b = start / 64; b * 64 < end; ++b) {
+      for(uint64_t m = mc.mask[b]; m; m &= m - 1) {
+	int32_t k = b * 64 + _ctz64(m);
+	if ((k >= start) && (k < end)) validpos.push_back(k);
+      }
+    }
+  }
+
+
   template<typename TConfig>
   inline void
   mergeCNVs(TConfig const& c, std::vector<CNV>& chrcnv, std::vector<CNV>& cnvs) {
-    // Merge neighboring segments if too similar
+    // Merge neighboring segments if too similar, in place
     bool merged = true;
-    std::vector<CNV> newcnv;
     while(merged) {
+      uint32_t nseg = 0;
       int32_t k = -1;
       for(int32_t i = 0; i < (int32_t) chrcnv.size(); ++i) {
 	if (i <= k) continue;
@@ -83,16 +222,14 @@ namespace torali
 	  // Merge
 	  double cn = (chrcnv[i].cn + chrcnv[k].cn) / 2.0;
 	  double mp = (chrcnv[i].mappable + chrcnv[k].mappable) / 2.0;
-	  newcnv.push_back(CNV(chrcnv[i].chr, chrcnv[i].start, chrcnv[k].end, chrcnv[i].ciposlow, chrcnv[i].ciposhigh, chrcnv[k].ciendlow, chrcnv[k].ciendhigh, cn, mp));	  
-	} else {
-	  newcnv.push_back(chrcnv[i]);
+	  chrcnv[nseg] = CNV(chrcnv[i].chr, chrcnv[i].start, chrcnv[k].end, chrcnv[i].ciposlow, chrcnv[i].ciposhigh, chrcnv[k].ciendlow, chrcnv[k].ciendhigh, cn, mp);
+	} else if ((int32_t) nseg != i) {
+	  chrcnv[nseg] = chrcnv[i];
 	}
+	++nseg;
       }
-      if (newcnv.size() == chrcnv.size()) merged = false;
-      else {
-	chrcnv = newcnv;
-	newcnv.clear();
-      }
+      if (nseg == chrcnv.size()) merged = false;
+      else chrcnv.resize(nseg);
     }
 
     // Insert into global CNV vector
@@ -103,9 +240,9 @@ namespace torali
   }
 
 
-  template<typename TConfig, typename TGcBias, typename TCoverage, typename TGenomicBreakpoints>
+  template<typename TConfig, typename TMaskedCoverage, typename TGenomicBreakpoints>
   inline void
-  breakpointRefinement(TConfig const& c, std::pair<uint32_t, uint32_t> const& gcbound, std::vector<uint16_t> const& gcContent, std::vector<uint16_t> const& uniqContent, TGcBias const& gcbias, TCoverage const& cov, bam_hdr_t const* hdr, int32_t const refIndex, TGenomicBreakpoints const& svbp, std::vector<CNV>& cnvs) {
+  breakpointRefinement(TConfig const& c, TMaskedCoverage const& mc, int32_t const refIndex, TGenomicBreakpoints const& svbp, std::vector<CNV>& cnvs) {
     typedef typename TGenomicBreakpoints::value_type TSVs;
     
     // Estimate CN shift
@@ -115,19 +252,9 @@ namespace torali
       double preexpcov = 0;
       double succovsum = 0;
       double sucexpcov = 0;
-      int32_t pos = cnvs[n-1].start;
-      while((pos < cnvs[n].end) && (pos < (int32_t) hdr->target_len[refIndex])) {
-	if ((gcContent[pos] > gcbound.first) && (gcContent[pos] < gcbound.second) && (uniqContent[pos] >= c.fragmentUnique * c.meanisize)) {
-	  if (pos < cnvs[n-1].end) {
-	    precovsum += cov[pos];
-	    preexpcov += gcbias[gcContent[pos]].coverage;
-	  } else {
-	    succovsum += cov[pos];
-	    sucexpcov += gcbias[gcContent[pos]].coverage;
-	  }
-	}
-	++pos;
-      }
+      int32_t split = std::max(cnvs[n-1].start, std::min(cnvs[n-1].end, cnvs[n].end));
+      maskedSum(mc, cnvs[n-1].start, split, precovsum, preexpcov);
+      maskedSum(mc, split, cnvs[n].end, succovsum, sucexpcov);
       double precndiff = std::abs((c.ploidy * precovsum / preexpcov) - (c.ploidy * succovsum / sucexpcov));
 
       // Intersect with delly SVs
@@ -146,23 +273,9 @@ namespace torali
       }
       if ((itbest != svbp[refIndex].end()) && (itbest->qual >= 50)) {
 	// Check refined CNV
-	precovsum = 0;
-	preexpcov = 0;
-	succovsum = 0;
-	sucexpcov = 0;
-	pos = cnvs[n-1].start;
-	while((pos < cnvs[n].end) && (pos < (int32_t) hdr->target_len[refIndex])) {
-	  if ((gcContent[pos] > gcbound.first) && (gcContent[pos] < gcbound.second) && (uniqContent[pos] >= c.fragmentUnique * c.meanisize)) {
-	    if (pos < itbest->pos) {
-	      precovsum += cov[pos];
-	      preexpcov += gcbias[gcContent[pos]].coverage;
-	    } else {
-	      succovsum += cov[pos];
-	      sucexpcov += gcbias[gcContent[pos]].coverage;
-	    }
-	  }
-	  ++pos;
-	}
+	split = std::max(cnvs[n-1].start, std::min(itbest->pos, cnvs[n].end));
+	maskedSum(mc, cnvs[n-1].start, split, precovsum, preexpcov);
+	maskedSum(mc, split, cnvs[n].end, succovsum, sucexpcov);
 	double postcndiff = std::abs((c.ploidy * precovsum / preexpcov) - (c.ploidy * succovsum / sucexpcov));
 	//std::cerr << cnvs[n-1].end << ',' << itbest->pos << ',' << precndiff << ',' << postcndiff << std::endl;
 	if ((precndiff < postcndiff + c.cn_offset) && (std::abs(cnvs[n].start - itbest->pos) < 50000)) {
@@ -179,9 +292,9 @@ namespace torali
   }
   
 
-  template<typename TConfig, typename TGcBias, typename TCoverage>
+  template<typename TConfig, typename TMaskedCoverage>
   inline void
-  breakpointRefinement2(TConfig const& c, std::pair<uint32_t, uint32_t> const& gcbound, std::vector<uint16_t> const& gcContent, std::vector<uint16_t> const& uniqContent, TGcBias const& gcbias, TCoverage const& cov, bam_hdr_t const* hdr, int32_t const refIndex, std::vector<CNV>& cnvs) {
+  breakpointRefinement2(TConfig const& c, TMaskedCoverage const& mc, std::vector<CNV>& cnvs) {
 
     int32_t maxbpshift = 10000;
 	
@@ -195,21 +308,11 @@ namespace torali
       double preexpcov = 0;
       double succovsum = 0;
       double sucexpcov = 0;
-      int32_t pos = cnvs[n-1].start;
+      int32_t split = std::max(cnvs[n-1].start, std::min(prehalf, cnvs[n].end));
+      maskedSum(mc, cnvs[n-1].start, split, precovsum, preexpcov);
+      maskedSum(mc, split, cnvs[n].end, succovsum, sucexpcov);
       std::vector<int32_t> validpos;
-      while((pos < cnvs[n].end) && (pos < (int32_t) hdr->target_len[refIndex])) {
-	if ((gcContent[pos] > gcbound.first) && (gcContent[pos] < gcbound.second) && (uniqContent[pos] >= c.fragmentUnique * c.meanisize)) {
-	  if (pos < prehalf) {
-	    precovsum += cov[pos];
-	    preexpcov += gcbias[gcContent[pos]].coverage;
-	  } else {
-	    if (pos <= suchalf) validpos.push_back(pos);
-	    succovsum += cov[pos];
-	    sucexpcov += gcbias[gcContent[pos]].coverage;
-	  }
-	}
-	++pos;
-      }
+      _maskedPositions(mc, split, std::min(cnvs[n].end, suchalf + 1), validpos);
       double precn = c.ploidy * precovsum / preexpcov;
       double succn = c.ploidy * succovsum / sucexpcov;
       // Shift Bp
@@ -223,10 +326,10 @@ namespace torali
 	  //std::cerr << validpos[idx] << ',' << precn << ',' << succn << ',' << diffcn[idx] << std::endl;
 	}
 	// Add to pre, remove from suc
-	precovsum += cov[validpos[idx]];
-	preexpcov += gcbias[gcContent[validpos[idx]]].coverage;
-	succovsum -= cov[validpos[idx]];
-	sucexpcov -= gcbias[gcContent[validpos[idx]]].coverage;
+	precovsum += mc.cov[validpos[idx]];
+	preexpcov += mc.gcbias[mc.gcContent[validpos[idx]]].coverage;
+	succovsum -= mc.cov[validpos[idx]];
+	sucexpcov -= mc.gcbias[mc.gcContent[validpos[idx]]].coverage;
       }
       // Find best
       int32_t bestIdx = -1;
@@ -239,63 +342,169 @@ namespace torali
 	cnvs[n].start = validpos[bestIdx];
       }
     }
-    //for(uint32_t n = 0; n < cnvs.size(); ++n) std::cerr << hdr->target_name[cnvs[n].chr] << '\t' << cnvs[n].start << '\t' << cnvs[n].end << "\tRefinement" << std::endl;
+    //for(uint32_t n = 0; n < cnvs.size(); ++n) std::cerr << cnvs[n].chr << '\t' << cnvs[n].start << '\t' << cnvs[n].end << "\tRefinement" << std::endl;
   }
   
 
-  template<typename TConfig, typename TGcBias, typename TCoverage>
+  // Copy-number, mappable fraction and SD of one segment, cn is -1 if too few bases are valid
+  template<typename TConfig, typename TMaskedCoverage>
+  inline void
+  _genotypeSegment(TConfig const& c, TMaskedCoverage const& mc, int32_t const start, int32_t const end, double& cn, double& mp, double& sd) {
+    double covsum = 0;
+    double expcov = 0;
+    int32_t winlen = maskedSum(mc, start, end, covsum, expcov);
+    cn = c.ploidy;
+    if (expcov > 0) cn = c.ploidy * covsum / expcov;
+    mp = (double) winlen / (double) (end - start);
+
+    // Estimate SD
+    boost::accumulators::accumulator_set<double, boost::accumulators::features<boost::accumulators::tag::mean, boost::accumulators::tag::variance> > acc;
+    uint32_t wsz = winlen / 10;
+    if (wsz > 1) {
+      // Windows of wsz valid bases
+      int32_t wstart = std::max(start, 0);
+      uint32_t rank = _maskedRank(mc, wstart);
+      for(uint32_t w = wsz; w <= (uint32_t) winlen; w += wsz) {
+	int32_t wend = _maskedSelect(mc, rank + w - 1) + 1;
+	maskedSum(mc, wstart, wend, covsum, expcov);
+	double wcn = c.ploidy;
+	if (expcov > 0) wcn = c.ploidy * covsum / expcov;
+	acc(wcn);
+	wstart = wend;
+      }
+      sd = sqrt(boost::accumulators::variance(acc));
+      if (sd < 0.025) sd = 0.025;
+    } else {
+      // Invalid
+      cn = -1;
+      sd = 0.025;
+    }
+  }
+
+  template<typename TConfig, typename TMaskedCoverage>
   inline void
-  genotypeCNVs(TConfig const& c, std::pair<uint32_t, uint32_t> const& gcbound, std::vector<uint16_t> const& gcContent, std::vector<uint16_t> const& uniqContent, TGcBias const& gcbias, TCoverage const& cov, bam_hdr_t const* hdr, int32_t const refIndex, std::vector<CNV>& cnvs) {
+  genotypeCNVs(TConfig const& c, TMaskedCoverage const& mc, int32_t const refIndex, std::vector<CNV>& cnvs) {
     for(uint32_t n = 0; n < cnvs.size(); ++n) {
       if (cnvs[n].chr != refIndex) continue;
-      double covsum = 0;
-      double expcov = 0;
-      int32_t winlen = 0;
-      int32_t pos = cnvs[n].start;
-      while((pos < cnvs[n].end) && (pos < (int32_t) hdr->target_len[refIndex])) {
-	if ((gcContent[pos] > gcbound.first) && (gcContent[pos] < gcbound.second) && (uniqContent[pos] >= c.fragmentUnique * c.meanisize)) {
-	  covsum += cov[pos];
-	  expcov += gcbias[gcContent[pos]].coverage;
-	  ++winlen;
-	}
-	++pos;
-      }
-      double cn = c.ploidy;
-      if (expcov > 0) cn = c.ploidy * covsum / expcov;
-      double mp = (double) winlen / (double) (cnvs[n].end - cnvs[n].start);
-      cnvs[n].cn = cn;
-      cnvs[n].mappable = mp;
-
-      // Estimate SD
-      boost::accumulators::accumulator_set<double, boost::accumulators::features<boost::accumulators::tag::mean, boost::accumulators::tag::variance> > acc;
-      uint32_t wsz = winlen / 10;
-      if (wsz > 1) {
-	covsum = 0;
-	expcov = 0;
-	winlen = 0;
-	pos = cnvs[n].start;
-	while((pos < cnvs[n].end) && (pos < (int32_t) hdr->target_len[refIndex])) {
-	  if ((gcContent[pos] > gcbound.first) && (gcContent[pos] < gcbound.second) && (uniqContent[pos] >= c.fragmentUnique * c.meanisize)) {
-	    covsum += cov[pos];
-	    expcov += gcbias[gcContent[pos]].coverage;
-	    ++winlen;
-	    if (winlen % wsz == 0) {
-	      double cn = c.ploidy;
-	      if (expcov > 0) cn = c.ploidy * covsum / expcov;
-	      acc(cn);
-	      covsum = 0;
-	      expcov = 0;
-	    }
-	  }
-	  ++pos;
+      _genotypeSegment(c, mc, cnvs[n].start, cnvs[n].end, cnvs[n].cn, cnvs[n].mappable, cnvs[n].sd);
+    }
+  }
+  
+  // Read-depth matrix genotype of one segment, bins at the segment ends are weighted by their overlap
+  template<typename TConfig>
+  inline void
+  _rdGenotypeSegment(TConfig const& c, RdMatrixFile& rf, uint32_t const sample, int32_t const refIndex, int32_t const segStart, int32_t const segEnd, double& cn, double& mp, double& sd) {
+    cn = -1;
+    sd = 0.025;
+    int32_t start = std::max(segStart, 0);
+    int32_t end = std::min(segEnd, (int32_t) rf.tlen[refIndex]);
+    if (start >= end) return;
+    uint32_t firstBin = start / rf.binSize;
+    uint32_t lastBin = (end - 1) / rf.binSize + 1;
+    std::vector<std::vector<float> > fields(3);
+    for(uint32_t f = 0; f < 3; ++f) {
+      if (!readRdBins(rf, refIndex, sample, f, firstBin, lastBin, fields[f])) return;
+    }
+    std::vector<double> frac(fields[0].size(), 1);
+    double winlen = 0;
+    double covsum = 0;
+    double expcov = 0;
+    for(uint32_t i = 0; i < frac.size(); ++i) {
+      int32_t bstart = (firstBin + i) * rf.binSize;
+      int32_t bend = std::min(bstart + rf.binSize, (int32_t) rf.tlen[refIndex]);
+      frac[i] = (double) (std::min(end, bend) - std::max(start, bstart)) / (double) (bend - bstart);
+      winlen += frac[i] * fields[0][i];
+      covsum += frac[i] * fields[1][i];
+      expcov += frac[i] * fields[2][i];
+    }
+    double segcn = c.ploidy;
+    if (expcov > 0) segcn = c.ploidy * covsum / expcov;
+    mp = winlen / (double) (segEnd - segStart);
+
+    // Estimate SD over groups of bins with at least a tenth of the valid bases
+    boost::accumulators::accumulator_set<double, boost::accumulators::features<boost::accumulators::tag::mean, boost::accumulators::tag::variance> > acc;
+    double wsz = (double) ((uint32_t) winlen / 10);
+    if (wsz > 1) {
+      double gcov = 0;
+      double gexp = 0;
+      double glen = 0;
+      for(uint32_t i = 0; i < frac.size(); ++i) {
+	gcov += frac[i] * fields[1][i];
+	gexp += frac[i] * fields[2][i];
+	glen += frac[i] * fields[0][i];
+	if (glen >= wsz) {
+	  double gcn = c.ploidy;
+	  if (gexp > 0) gcn = c.ploidy * gcov / gexp;
+	  acc(gcn);
+	  gcov = 0;
+	  gexp = 0;
+	  glen = 0;
 	}
-	cnvs[n].sd = sqrt(boost::accumulators::variance(acc));
-	if (cnvs[n].sd < 0.025) cnvs[n].sd = 0.025;
-      } else {
-	// Invalid
-	cnvs[n].cn = -1;
-	cnvs[n].sd = 0.025;
       }
+      cn = segcn;
+      sd = sqrt(boost::accumulators::variance(acc));
+      if (sd < 0.025) sd = 0.025;
+    }
+  }
+
+  // CNV sites grouped by chromosome with float read-depth genotypes of all samples
+  struct CnvTable {
+    uint32_t nsamples;
+    std::vector<uint32_t> chrBegin;  // rows of chromosome refIndex are [chrBegin[refIndex], chrBegin[refIndex+1])
+    std::vector<uint32_t> site;      // input index of each row
+    std::vector<int32_t> start;
+    std::vector<int32_t> end;
+    std::vector<float> cn;           // input index * nsamples + sample
+    std::vector<float> sd;
+
+    CnvTable() : nsamples(0) {}
+  };
+
+  inline void
+  initCnvTable(std::vector<CNV> const& cnvs, int32_t const nchr, uint32_t const nsamples, CnvTable& ct) {
+    ct.nsamples = nsamples;
+    ct.chrBegin.assign(nchr + 1, 0);
+    for(uint32_t i = 0; i < cnvs.size(); ++i) {
+      if ((cnvs[i].chr >= 0) && (cnvs[i].chr < nchr)) ++ct.chrBegin[cnvs[i].chr + 1];
+    }
+    for(int32_t refIndex = 0; refIndex < nchr; ++refIndex) ct.chrBegin[refIndex + 1] += ct.chrBegin[refIndex];
+    ct.site.resize(ct.chrBegin[nchr]);
+    ct.start.resize(ct.chrBegin[nchr]);
+    ct.end.resize(ct.chrBegin[nchr]);
+    std::vector<uint32_t> fill(ct.chrBegin.begin(), ct.chrBegin.end() - 1);
+    for(uint32_t i = 0; i < cnvs.size(); ++i) {
+      if ((cnvs[i].chr < 0) || (cnvs[i].chr >= nchr)) continue;
+      uint32_t row = fill[cnvs[i].chr]++;
+      ct.site[row] = i;
+      ct.start[row] = cnvs[i].start;
+      ct.end[row] = cnvs[i].end;
+    }
+    ct.cn.assign((uint64_t) cnvs.size() * nsamples, -1);
+    ct.sd.assign((uint64_t) cnvs.size() * nsamples, 0.025);
+  }
+
+  // Genotype all sites of one chromosome in one sample
+  template<typename TConfig, typename TMaskedCoverage>
+  inline void
+  genotypeCnvTable(TConfig const& c, TMaskedCoverage const& mc, int32_t const refIndex, uint32_t const sample, CnvTable& ct) {
+    for(uint32_t row = ct.chrBegin[refIndex]; row < ct.chrBegin[refIndex + 1]; ++row) {
+      double cn, mp, sd;
+      _genotypeSegment(c, mc, ct.start[row], ct.end[row], cn, mp, sd);
+      uint64_t k = (uint64_t) ct.site[row] * ct.nsamples + sample;
+      ct.cn[k] = cn;
+      ct.sd[k] = sd;
+    }
+  }
+
+  template<typename TConfig>
+  inline void
+  rdGenotypeCnvTable(TConfig const& c, RdMatrixFile& rf, int32_t const refIndex, uint32_t const sample, CnvTable& ct) {
+    for(uint32_t row = ct.chrBegin[refIndex]; row < ct.chrBegin[refIndex + 1]; ++row) {
+      double cn, mp, sd;
+      _rdGenotypeSegment(c, rf, sample, refIndex, ct.start[row], ct.end[row], cn, mp, sd);
+      uint64_t k = (uint64_t) ct.site[row] * ct.nsamples + sample;
+      ct.cn[k] = cn;
+      ct.sd[k] = sd;
     }
   }
   
@@ -563,9 +772,11 @@ namespace torali
   }
 
   
+  // Copy-number genotypes of one or more samples, ct holds the read-depth estimates of CNV i in sample s at i * nsamples + s
+  // Each sample is genotyped against the ploidy of the CNV contig in pm
   template<typename TConfig>
   inline void
-  cnvVCF(TConfig const& c, std::vector<CNV> const& cnvs) {
+  cnvVCF(TConfig const& c, std::vector<std::string> const& sampleNames, std::vector<CNV> const& cnvs, CnvTable const& ct, PloidyMap const& pm) {
     // Open one bam file header
     samFile* samfile = sam_open(c.bamFile.string().c_str(), "r");
     hts_set_fai_filename(samfile, c.genome.string().c_str());
@@ -575,6 +786,7 @@ namespace torali
     std::string fmtout = "wb";
     if (c.outfile.string() == "-") fmtout = "w";
     htsFile *fp = hts_open(c.outfile.string().c_str(), fmtout.c_str());
+    attachHtsThreadPool(fp);
     bcf_hdr_t *hdr = bcf_hdr_init("w");
 
     // Print vcf header
@@ -611,7 +823,7 @@ namespace torali
       bcf_hdr_append(hdr, refname.c_str());
     }
     // Add samples
-    bcf_hdr_add_sample(hdr, c.sampleName.c_str());
+    for(uint32_t file_c = 0; file_c < sampleNames.size(); ++file_c) bcf_hdr_add_sample(hdr, sampleNames[file_c].c_str());
     bcf_hdr_add_sample(hdr, NULL);
     if (bcf_hdr_write(fp, hdr) != 0) std::cerr << "Error: Failed to write BCF header!" << std::endl;
 
@@ -634,11 +846,17 @@ namespace torali
       bcf1_t *rec = bcf_init();
       for(uint32_t i = 0; i < cnvs.size(); ++i) {
 	// Invalid CNV?
-	if ((!c.hasGenoFile) && (cnvs[i].cn == -1)) continue;
+	float const* rdcn = &ct.cn[(uint64_t) i * ct.nsamples];
+	float const* rdsd = &ct.sd[(uint64_t) i * ct.nsamples];
+	if ((!c.hasGenoFile) && (rdcn[0] == -1)) continue;
 
 	// Integer copy-number
-	int32_t absCN = (int32_t) boost::math::round(cnvs[i].cn);
-	if ((!c.segmentation) && (absCN == c.ploidy)) continue;
+	bool allPloidy = true;
+	for(int32_t file_c = 0; file_c < bcf_hdr_nsamples(hdr); ++file_c) {
+	  cnval[file_c] = (int32_t) boost::math::round(rdcn[file_c]);
+	  if (cnval[file_c] != _refPloidy(c, pm, file_c, cnvs[i].chr)) allPloidy = false;
+	}
+	if ((!c.segmentation) && (allPloidy)) continue;
       
 	// Output main vcf fields
 	rec->rid = bcf_hdr_name2id(hdr, bamhd->target_name[cnvs[i].chr]);
@@ -676,20 +894,23 @@ namespace torali
 	bcf_update_info_float(hdr, rec, "MP", &tmpf, 1);
 
 	// Genotyping
-	cnval[0] = absCN;
-	cnrdval[0] = cnvs[i].cn;
-	cnsdval[0] = cnvs[i].sd;
-	gts[0] = bcf_gt_missing;
-	gts[1] = bcf_gt_missing;
-	int32_t qval = _computeCNLs(c, cnvs[i].cn, cnvs[i].sd, cnl, gqval);
+	int32_t qval = 0;
+	for(int32_t file_c = 0; file_c < bcf_hdr_nsamples(hdr); ++file_c) {
+	  cnrdval[file_c] = rdcn[file_c];
+	  cnsdval[file_c] = rdsd[file_c];
+	  gts[file_c * 2] = bcf_gt_missing;
+	  gts[file_c * 2 + 1] = bcf_gt_missing;
+	  int32_t sampleQual = _computeCNLs(c, rdcn[file_c], rdsd[file_c], cnl, gqval, file_c, _refPloidy(c, pm, file_c, cnvs[i].chr));
+	  if (file_c == 0) qval = sampleQual;
+	  if (gqval[file_c] < 15) ftarr[file_c] = "LowQual";
+	  else ftarr[file_c] = "PASS";
+	}
 	if (c.hasGenoFile) rec->qual = cnvs[i].qval;  // Leave site quality in genotyping mode
 	else rec->qual = qval;
 	tmpi = bcf_hdr_id2int(hdr, BCF_DT_ID, "PASS");
 	if (rec->qual < 15) tmpi = bcf_hdr_id2int(hdr, BCF_DT_ID, "LowQual");
 	bcf_update_filter(hdr, rec, &tmpi, 1);
 	
-	if (gqval[0] < 15) ftarr[0] = "LowQual";
-	else ftarr[0] = "PASS";
 	std::vector<const char*> strp(bcf_hdr_nsamples(hdr));
 	std::transform(ftarr.begin(), ftarr.end(), strp.begin(), cstyle_str());	
 	bcf_update_genotypes(hdr, rec, gts, bcf_hdr_nsamples(hdr) * 2);
@@ -724,6 +945,20 @@ namespace torali
     // Build index
     if (c.outfile.string() != "-") bcf_index_build(c.outfile.string().c_str(), 14);
   }
+
+  template<typename TConfig>
+  inline void
+  cnvVCF(TConfig const& c, std::vector<CNV> const& cnvs, PloidyMap const& pm) {
+    CnvTable ct;
+    ct.nsamples = 1;
+    ct.cn.resize(cnvs.size());
+    ct.sd.resize(cnvs.size());
+    for(uint32_t i = 0; i < cnvs.size(); ++i) {
+      ct.cn[i] = cnvs[i].cn;
+      ct.sd[i] = cnvs[i].sd;
+    }
+    cnvVCF(c, std::vector<std::string>(1, c.sampleName), cnvs, ct, pm);
+  }
  
 
 }
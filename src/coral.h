@@ -2,6 +2,7 @@
 #define CORAL_H
 
 #include <limits>
+#include <sstream>
 
 #include <boost/icl/split_interval_map.hpp>
 #include <boost/dynamic_bitset.hpp>
@@ -17,11 +18,21 @@
 #include "scan.h"
 #include "gcbias.h"
 #include "cnv.h"
+#include "rlecov.h"
+#include "winplan.h"
 #include "version.h"
 
+#ifdef OPENMP
+#include <omp.h>
+#endif
+
 namespace torali
 {
 
+  #ifndef DELLY_CORAL_BYTES_PER_BP
+  #define DELLY_CORAL_BYTES_PER_BP 8
+  #endif
+
   struct CountDNAConfig {
     bool adaptive;
     bool hasStatsFile;
@@ -31,6 +42,10 @@ namespace torali
     bool segmentation;
     bool hasGenoFile;
     bool hasVcfFile;
+    bool hasRdFile;
+    bool hasRdInput;
+    bool hasPloidyFile;
+    bool inferPloidy;
     uint32_t nchr;
     uint32_t meanisize;
     uint32_t window_size;
@@ -41,6 +56,10 @@ namespace torali
     uint16_t minQual;
     uint16_t mad;
     uint16_t ploidy;
+    uint16_t ioThreads;
+    uint16_t threads;
+    uint32_t memory;
+    uint32_t cohortBatch;
     float exclgc;
     float uniqueToTotalCovRatio;
     float fracWindow;
@@ -53,12 +72,16 @@ namespace torali
     boost::filesystem::path genofile;
     boost::filesystem::path outfile;
     boost::filesystem::path covfile;
+    boost::filesystem::path rdfile;
+    boost::filesystem::path rdinput;
+    boost::filesystem::path ploidyFile;
     boost::filesystem::path genome;
     boost::filesystem::path statsFile;
     boost::filesystem::path mapFile;
     boost::filesystem::path bamFile;
     boost::filesystem::path bedFile;
     boost::filesystem::path scanFile;
+    std::vector<boost::filesystem::path> files;
   };
   
   struct CountDNAConfigLib {
@@ -68,11 +91,199 @@ namespace torali
     std::vector<boost::filesystem::path> files;
   };
   
+  template<typename TChrTask>
+  struct SortChrTasks : public std::binary_function<TChrTask, TChrTask, bool>
+  {
+    inline bool operator()(TChrTask const& t1, TChrTask const& t2) {
+      return ((t1.first > t2.first) || ((t1.first == t2.first) && (t1.second < t2.second)));
+    }
+  };
+
+  // Fragment midpoint coverage of one chromosome
+  template<typename TConfig>
+  inline void
+  _fragmentCoverage(TConfig const& c, LibraryInfo const& li, samFile* samfile, hts_idx_t* idx, bam_hdr_t* hdr, int32_t const refIndex, RleCoverage& cov) {
+    // Mate map
+    typedef boost::unordered_map<std::size_t, bool> TMateMap;
+    TMateMap mateMap;
+	
+    // Count reads
+    hts_itr_t* iter = sam_itr_queryi(idx, refIndex, 0, hdr->target_len[refIndex]);
+    bam1_t* rec = bam_init1();
+    int32_t lastAlignedPos = 0;
+    std::set<std::size_t> lastAlignedPosReads;
+    while (sam_itr_next(samfile, iter, rec) >= 0) {
+      if (rec->core.flag & (BAM_FQCFAIL | BAM_FDUP | BAM_FUNMAP | BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) continue;
+      if (rec->core.qual < c.minQual) continue;
+      if ((rec->core.flag & BAM_FPAIRED) && ((rec->core.flag & BAM_FMUNMAP) || (rec->core.tid != rec->core.mtid))) continue;
+      streamCoverage(cov, rec->core.pos - li.maxNormalISize);
+
+      int32_t midPoint = rec->core.pos + halfAlignmentLength(rec);
+      if (rec->core.flag & BAM_FPAIRED) {
+	// Clean-up the read store for identical alignment positions
+	if (rec->core.pos > lastAlignedPos) {
+	  lastAlignedPosReads.clear();
+	  lastAlignedPos = rec->core.pos;
+	}
+	    
+	if ((rec->core.pos < rec->core.mpos) || ((rec->core.pos == rec->core.mpos) && (lastAlignedPosReads.find(hash_string(bam_get_qname(rec))) == lastAlignedPosReads.end()))) {
+	  // First read
+	  lastAlignedPosReads.insert(hash_string(bam_get_qname(rec)));
+	  std::size_t hv = hash_pair(rec);
+	  mateMap[hv] = true;
+	  continue;
+	} else {
+	  // Second read
+	  std::size_t hv = hash_pair_mate(rec);
+	  if ((mateMap.find(hv) == mateMap.end()) || (!mateMap[hv])) continue; // Mate discarded
+	  mateMap[hv] = false;
+	}
+	    
+	// update midpoint
+	int32_t isize = (rec->core.pos + alignmentLength(rec)) - rec->core.mpos;
+	if ((li.minNormalISize < isize) && (isize < li.maxNormalISize)) midPoint = rec->core.mpos + (int32_t) (isize/2);
+      }
+	  
+      // Count fragment
+      addCoverage(cov, midPoint, midPoint + 1);
+    }
+    closeCoverage(cov);
+    // Clean-up
+    bam_destroy1(rec);
+    hts_itr_destroy(iter);
+  }
+
+  // Adaptive windows over the valid bases of the sample
+  template<typename TConfig, typename TMaskedCoverage>
+  inline void
+  _adaptiveWindows(TConfig const& c, TMaskedCoverage const& mc, TWindowPlan const& itv, uint32_t const firstStart, std::string const& chrName, std::ostream& dataOut) {
+    if (c.covfile.empty()) return;
+    TWindowPlan wp;
+    planAdaptiveWindows(c, mc, itv, firstStart, wp);
+    adaptiveWindowCoverage(c, mc, itv, wp, chrName, dataOut);
+  }
+
+  // Count fragments, call or genotype CNVs and tile read-depth windows for one chromosome
+  template<typename TConfig, typename TRegionsGenome, typename TGenomicBreakpoints>
+  inline void
+  _countChromosome(TConfig const& c, LibraryInfo const& li, std::vector<GcBias> const& gcbias, std::pair<uint32_t, uint32_t> const& gcbound, samFile* samfile, hts_idx_t* idx, bam_hdr_t* hdr, faidx_t* faiMap, faidx_t* faiRef, TRegionsGenome const& bedRegions, TGenomicBreakpoints const& svbp, int32_t const refIndex, std::vector<CNV>& cnvs, std::ostream& dataOut, std::vector<std::vector<float> >& rdBins) {
+    typedef typename TRegionsGenome::value_type TChrIntervals;
+
+    if ((!c.hasGenoFile) && (chrNoData(c, refIndex, idx))) return;
+
+    // Get GC and Mappability
+    std::vector<uint16_t> gcContent;
+    std::vector<uint16_t> uniqContent;
+    if (!_refProfile(c, hdr, faiMap, faiRef, refIndex, gcContent, uniqContent)) return;
+
+    // Coverage track
+    typedef RleCoverage TCoverage;
+    TCoverage cov(hdr->target_len[refIndex]);
+    _fragmentCoverage(c, li, samfile, idx, hdr, refIndex, cov);
+
+    // Masked coverage prefix sums
+    typedef MaskedCoverage<std::vector<GcBias>, TCoverage> TMaskedCoverage;
+    TMaskedCoverage mc(c, gcbound, gcContent, uniqContent, gcbias, cov, hdr->target_len[refIndex]);
+
+    // CNV discovery
+    if (!c.hasGenoFile) {
+      // Call CNVs
+      std::vector<CNV> chrcnv;
+      callCNVs(c, gcbound, gcContent, uniqContent, gcbias, cov, hdr, refIndex, chrcnv);
+
+      // Merge adjacent CNVs lacking read-depth shift
+      mergeCNVs(c, chrcnv, cnvs);
+
+      // Refine breakpoints
+      if (c.hasVcfFile) breakpointRefinement(c, mc, refIndex, svbp, cnvs);
+    }
+      
+    // CNV genotyping
+    genotypeCNVs(c, mc, refIndex, cnvs);
+
+    // Read-depth matrix bins
+    if (c.hasRdFile) maskedBins(mc, DELLY_RDMATRIX_BINSIZE, rdBins);
+
+    // BED File (target intervals)
+    if (c.hasBedFile) {
+      if (c.adaptive) {
+	// Merge overlapping BED entries
+	TChrIntervals citv;
+	_mergeOverlappingBedEntries(bedRegions[refIndex], citv);
+
+	// Tile merged intervals
+	TWindowPlan itv;
+	for(typename TChrIntervals::iterator it = citv.begin(); it != citv.end(); ++it) {
+	  if ((it->first < it->second) && (it->second <= hdr->target_len[refIndex])) itv.push_back(*it);
+	}
+	if (!citv.empty()) _adaptiveWindows(c, mc, itv, citv.begin()->first, hdr->target_name[refIndex], dataOut);
+      } else {
+	// Fixed Window Length
+	for(typename TChrIntervals::iterator it = bedRegions[refIndex].begin(); it != bedRegions[refIndex].end(); ++it) {
+	  if ((it->first < it->second) && (it->second <= hdr->target_len[refIndex])) {
+	    double covsum = 0;
+	    double expcov = 0;
+	    double obsexp = 0;
+	    uint32_t winlen = 0;
+	    for(uint32_t pos = it->first; pos < it->second; ++pos) {
+	      if ((gcContent[pos] > gcbound.first) && (gcContent[pos] < gcbound.second) && (uniqContent[pos] >= c.fragmentUnique * c.meanisize)) {
+		covsum += cov[pos];
+		obsexp += gcbias[gcContent[pos]].obsexp;
+		expcov += gcbias[gcContent[pos]].coverage;
+		++winlen;
+	      }
+	    }
+	    if (winlen >= c.fracWindow * (it->second - it->first)) {
+	      obsexp /= (double) winlen;
+	      double count = ((double) covsum / obsexp ) * (double) (it->second - it->first) / (double) winlen;
+	      double cn = c.ploidy;
+	      if (expcov > 0) cn = c.ploidy * covsum / expcov;
+	      if (!c.covfile.empty()) dataOut << std::string(hdr->target_name[refIndex]) << "\t" << it->first << "\t" << it->second << "\t" << winlen << "\t" << count << "\t" << cn << std::endl;
+	    } else {
+	      if (!c.covfile.empty()) dataOut << std::string(hdr->target_name[refIndex]) << "\t" << it->first << "\t" << it->second << "\tNA\tNA\tNA" << std::endl;
+	    }
+	  }
+	}
+      }
+    } else {
+      // Genome-wide
+      if (c.adaptive) {
+	_adaptiveWindows(c, mc, TWindowPlan(1, std::make_pair((uint32_t) 0, hdr->target_len[refIndex])), 0, hdr->target_name[refIndex], dataOut);
+      } else {
+	// Fixed windows (genomic tiling)
+	for(uint32_t start = 0; start < hdr->target_len[refIndex]; start = start + c.window_offset) {
+	  if (start + c.window_size < hdr->target_len[refIndex]) {
+	    double covsum = 0;
+	    double expcov = 0;
+	    double obsexp = 0;
+	    uint32_t winlen = 0;
+	    for(uint32_t pos = start; pos < start + c.window_size; ++pos) {
+	      if ((gcContent[pos] > gcbound.first) && (gcContent[pos] < gcbound.second) && (uniqContent[pos] >= c.fragmentUnique * c.meanisize)) {
+		covsum += cov[pos];
+		obsexp += gcbias[gcContent[pos]].obsexp;
+		expcov += gcbias[gcContent[pos]].coverage;
+		++winlen;
+	      }
+	    }
+	    if (winlen >= c.fracWindow * c.window_size) {
+	      obsexp /= (double) winlen;
+	      double count = ((double) covsum / obsexp ) * (double) c.window_size / (double) winlen;
+	      double cn = c.ploidy;
+	      if (expcov > 0) cn = c.ploidy * covsum / expcov;
+	      if (!c.covfile.empty()) dataOut << std::string(hdr->target_name[refIndex]) << "\t" << start << "\t" << (start + c.window_size) << "\t" << winlen << "\t" << count << "\t" << cn << std::endl;
+	    }
+	  }
+	}
+      }
+    }
+  }
+
   template<typename TConfig>
   inline int32_t
-  bamCount(TConfig const& c, LibraryInfo const& li, std::vector<GcBias> const& gcbias, std::pair<uint32_t, uint32_t> const& gcbound) {
+  bamCount(TConfig const& c, LibraryInfo const& li, std::vector<GcBias> const& gcbias, std::pair<uint32_t, uint32_t> const& gcbound, PloidyMap const& pm) {
     // Load bam file
     samFile* samfile = sam_open(c.bamFile.string().c_str(), "r");
+    attachHtsThreadPool(samfile);
     hts_set_fai_filename(samfile, c.genome.string().c_str());
     hts_idx_t* idx = sam_index_load(samfile, c.bamFile.string().c_str());
     bam_hdr_t* hdr = sam_hdr_read(samfile);
@@ -100,6 +311,15 @@ namespace torali
       dataOut << "chr\tstart\tend\t" << c.sampleName << "_mappable\t" << c.sampleName << "_counts\t" << c.sampleName << "_CN" << std::endl;
     }
 
+    // Read-depth matrix
+    RdMatrixFile rdOut;
+    if (c.hasRdFile) {
+      if (!openRdMatrix(c.rdfile, hdr, DELLY_RDMATRIX_BINSIZE, std::vector<std::string>(1, c.sampleName), maskedBinFields(), rdOut)) {
+	std::cerr << "Fail to open read-depth matrix " << c.rdfile.string() << std::endl;
+	return 1;
+      }
+    }
+
     // CNVs
     std::vector<CNV> cnvs;
     if (c.hasGenoFile) parseVcfCNV(c, hdr, cnvs);
@@ -118,334 +338,551 @@ namespace torali
       for (uint32_t i = 0; i < svbp.size(); ++i) sort(svbp[i].begin(), svbp[i].end(), SortSVBreakpoint<SVBreakpoint>());
     }
     
-    // Iterate chromosomes
-    faidx_t* faiMap = fai_load(c.mapFile.string().c_str());
-    faidx_t* faiRef = fai_load(c.genome.string().c_str());
+    // Chromosome tasks, largest first, CNV discovery skips contigs of ploidy 0
+    std::vector<std::pair<uint32_t, int32_t> > tasks;
     for(int32_t refIndex=0; refIndex < (int32_t) hdr->n_targets; ++refIndex) {
-      if ((!c.hasGenoFile) && (chrNoData(c, refIndex, idx))) continue;
-      
-      // Check presence in mappability map
-      std::string tname(hdr->target_name[refIndex]);
-      int32_t seqlen = faidx_seq_len(faiMap, tname.c_str());
-      if (seqlen == - 1) continue;
-      else seqlen = -1;
-      char* seq = faidx_fetch_seq(faiMap, tname.c_str(), 0, faidx_seq_len(faiMap, tname.c_str()), &seqlen);
-
-      // Check presence in reference
-      seqlen = faidx_seq_len(faiRef, tname.c_str());
-      if (seqlen == - 1) continue;
-      else seqlen = -1;
-      char* ref = faidx_fetch_seq(faiRef, tname.c_str(), 0, faidx_seq_len(faiRef, tname.c_str()), &seqlen);
-
-      // Get GC and Mappability
-      std::vector<uint16_t> uniqContent(hdr->target_len[refIndex], 0);
-      std::vector<uint16_t> gcContent(hdr->target_len[refIndex], 0);
-      {
-	// Mappability map
-	typedef boost::dynamic_bitset<> TBitSet;
-	TBitSet uniq(hdr->target_len[refIndex], false);
-	for(uint32_t i = 0; i < hdr->target_len[refIndex]; ++i) {
-	  if (seq[i] == 'C') uniq[i] = 1;
-	}
+      if ((!c.hasGenoFile) && (_absentContig(pm, 0, refIndex))) continue;
+      tasks.push_back(std::make_pair(hdr->target_len[refIndex], refIndex));
+    }
+    std::sort(tasks.begin(), tasks.end(), SortChrTasks<std::pair<uint32_t, int32_t> >());
 
-	// GC map
-	typedef boost::dynamic_bitset<> TBitSet;
-	TBitSet gcref(hdr->target_len[refIndex], false);
-	for(uint32_t i = 0; i < hdr->target_len[refIndex]; ++i) {
-	  if ((ref[i] == 'c') || (ref[i] == 'C') || (ref[i] == 'g') || (ref[i] == 'G')) gcref[i] = 1;
-	}
+    // Threads and resident chromosomes within the memory budget
+    int32_t nthreads = 1;
+#ifdef OPENMP
+    if (c.threads) nthreads = c.threads;
+    else nthreads = omp_get_max_threads();
+#endif
+    int32_t resident = 0;
+    uint64_t memsum = 0;
+    for(uint32_t i = 0; ((i < tasks.size()) && (resident < nthreads)); ++i, ++resident) {
+      memsum += (uint64_t) tasks[i].first * DELLY_CORAL_BYTES_PER_BP;
+      if ((c.memory) && (resident) && (memsum > (uint64_t) c.memory * 1024 * 1024)) break;
+    }
+    if (resident < 1) resident = 1;
+    now = boost::posix_time::second_clock::local_time();
+    std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] " << "Chromosome tasks: " << tasks.size() << ", concurrent: " << resident << std::endl;
 
-	// Sum across fragment
-	int32_t halfwin = (int32_t) (c.meanisize / 2);
-	int32_t usum = 0;
-	int32_t gcsum = 0;
-	for(int32_t pos = halfwin; pos < (int32_t) hdr->target_len[refIndex] - halfwin; ++pos) {
-	  if (pos == halfwin) {
-	    for(int32_t i = pos - halfwin; i<=pos+halfwin; ++i) {
-	      usum += uniq[i];
-	      gcsum += gcref[i];
-	    }
-	  } else {
-	    usum -= uniq[pos - halfwin - 1];
-	    gcsum -= gcref[pos - halfwin - 1];
-	    usum += uniq[pos + halfwin];
-	    gcsum += gcref[pos + halfwin];
+    // Per-chromosome results, merged in chromosome order
+    std::vector<std::vector<CNV> > chrCnvs(hdr->n_targets, std::vector<CNV>());
+    std::vector<std::string> chrCov(hdr->n_targets, std::string());
+#pragma omp parallel num_threads(resident) default(shared)
+    {
+      samFile* tfile = sam_open(c.bamFile.string().c_str(), "r");
+      attachHtsThreadPool(tfile);
+      hts_set_fai_filename(tfile, c.genome.string().c_str());
+      hts_idx_t* tidx = sam_index_load(tfile, c.bamFile.string().c_str());
+      faidx_t* tfaiMap = fai_load(c.mapFile.string().c_str());
+      faidx_t* tfaiRef = fai_load(c.genome.string().c_str());
+#pragma omp for schedule(dynamic, 1)
+      for(int32_t i = 0; i < (int32_t) tasks.size(); ++i) {
+	int32_t refIndex = tasks[i].second;
+	std::ostringstream chrOut;
+	std::vector<std::vector<float> > rdBins;
+	if (c.hasGenoFile) _countChromosome(c, li, gcbias, gcbound, tfile, tidx, hdr, tfaiMap, tfaiRef, bedRegions, svbp, refIndex, cnvs, chrOut, rdBins);
+	else _countChromosome(c, li, gcbias, gcbound, tfile, tidx, hdr, tfaiMap, tfaiRef, bedRegions, svbp, refIndex, chrCnvs[refIndex], chrOut, rdBins);
+	chrCov[refIndex] = chrOut.str();
+	if (!rdBins.empty()) {
+#pragma omp critical
+	  {
+	    for(uint32_t f = 0; f < rdBins.size(); ++f) writeRdColumn(rdOut, refIndex, 0, f, rdBins[f]);
 	  }
-	  gcContent[pos] = gcsum;
-	  uniqContent[pos] = usum;
 	}
       }
+      fai_destroy(tfaiRef);
+      fai_destroy(tfaiMap);
+      hts_idx_destroy(tidx);
+      sam_close(tfile);
+    }
+    for(int32_t refIndex = 0; refIndex < (int32_t) hdr->n_targets; ++refIndex) {
+      cnvs.insert(cnvs.end(), chrCnvs[refIndex].begin(), chrCnvs[refIndex].end());
+      if (!c.covfile.empty()) dataOut << chrCov[refIndex];
+    }
+
+    if ((c.hasRdFile) && (!closeRdMatrix(rdOut))) {
+      std::cerr << "Fail to write read-depth matrix " << c.rdfile.string() << std::endl;
+      return 1;
+    }
+
+    // Sort CNVs
+    sort(cnvs.begin(), cnvs.end(), SortCNVs<CNV>());
+
+    // Genotype CNVs
+    cnvVCF(c, cnvs, pm);
+
+    // clean-up
+    bam_hdr_destroy(hdr);
+    hts_idx_destroy(idx);
+    sam_close(samfile);
+    if (!c.covfile.empty()) {
+      dataOut.pop();
+      dataOut.pop();
+    }
+    
+    return 0;
+  }
+
+  // Library parameters and sample name of one alignment file
+  template<typename TConfig>
+  inline bool
+  _sampleLibrary(TConfig& c, boost::filesystem::path const& bamFile, LibraryInfo& li, std::string& sampleName) {
+    if (!(boost::filesystem::exists(bamFile) && boost::filesystem::is_regular_file(bamFile) && boost::filesystem::file_size(bamFile))) {
+      std::cerr << "Alignment file is missing: " << bamFile.string() << std::endl;
+      return false;
+    }
+    
+    // Get scan regions
+    typedef boost::icl::interval_set<uint32_t> TChrIntervals;
+    typedef typename TChrIntervals::interval_type TIVal;
+    typedef std::vector<TChrIntervals> TRegionsGenome;
+    TRegionsGenome scanRegions;
+
+    // Open BAM file
+    samFile* samfile = sam_open(bamFile.string().c_str(), "r");
+    if (samfile == NULL) {
+      std::cerr << "Fail to open file " << bamFile.string() << std::endl;
+      return false;
+    }
+    hts_idx_t* idx = sam_index_load(samfile, bamFile.string().c_str());
+    if (idx == NULL) {
+      if (bam_index_build(bamFile.string().c_str(), 0) != 0) {
+	std::cerr << "Fail to open index for " << bamFile.string() << std::endl;
+	return false;
+      }
+    }
+    bam_hdr_t* hdr = sam_hdr_read(samfile);
+    if (hdr == NULL) {
+      std::cerr << "Fail to open header for " << bamFile.string() << std::endl;
+      return false;
+    }
+    if ((c.nchr) && (c.nchr != (uint32_t) hdr->n_targets)) {
+      std::cerr << "Alignment files disagree in the number of chromosomes: " << bamFile.string() << std::endl;
+      return false;
+    }
+    c.nchr = hdr->n_targets;
+    c.minChrLen = setMinChrLen(hdr, 0.95);
+    sampleName = "unknown";
+    getSMTag(std::string(hdr->text), bamFile.stem().string(), sampleName);
+
+    // Check matching chromosome names
+    faidx_t* faiRef = fai_load(c.genome.string().c_str());
+    faidx_t* faiMap = fai_load(c.mapFile.string().c_str());
+    uint32_t mapFound = 0;
+    uint32_t refFound = 0;
+    for(int32_t refIndex=0; refIndex < hdr->n_targets; ++refIndex) {
+      std::string tname(hdr->target_name[refIndex]);
+      if (faidx_has_seq(faiMap, tname.c_str())) ++mapFound;
+      if (faidx_has_seq(faiRef, tname.c_str())) ++refFound;
+      else {
+	std::cerr << "Warning: BAM chromosome " << tname << " not present in reference genome!" << std::endl;
+      }
+    }
+    fai_destroy(faiRef);
+    fai_destroy(faiMap);
+    if (!mapFound) {
+      std::cerr << "Mappability map chromosome naming disagrees with BAM file!" << std::endl;
+      return false;
+    }
+    if (!refFound) {
+      std::cerr << "Reference genome chromosome naming disagrees with BAM file!" << std::endl;
+      return false;
+    }
+
+    // Estimate library params
+    if (c.hasScanFile) {
+      if (!_parseBedIntervals(c.scanFile.string(), c.hasScanFile, hdr, scanRegions)) {
+	std::cerr << "Warning: Couldn't parse BED intervals. Do the chromosome names match?" << std::endl;
+	return false;
+      }
+    } else {
+      scanRegions.resize(hdr->n_targets);
+      for (int32_t refIndex = 0; refIndex < hdr->n_targets; ++refIndex) {
+	scanRegions[refIndex].insert(TIVal::right_open(0, hdr->target_len[refIndex]));
+      }
+    }
+    typedef std::vector<LibraryInfo> TSampleLibrary;
+    TSampleLibrary sampleLib(1, LibraryInfo());
+    CountDNAConfigLib dellyConf;
+    dellyConf.genome = c.genome;
+    dellyConf.files.push_back(bamFile);
+    dellyConf.madCutoff = 9;
+    dellyConf.madNormalCutoff = c.mad;
+    getLibraryParams(dellyConf, scanRegions, sampleLib);
+    li = sampleLib[0];
+    if (!li.median) {
+      li.median = 250;
+      li.mad = 15;
+      li.minNormalISize = 0;
+      li.maxNormalISize = 400;
+    }
       
-      // Coverage track
-      typedef uint16_t TCount;
-      uint32_t maxCoverage = std::numeric_limits<TCount>::max();
-      typedef std::vector<TCount> TCoverage;
-      TCoverage cov(hdr->target_len[refIndex], 0);
-
-      {
-	// Mate map
-	typedef boost::unordered_map<std::size_t, bool> TMateMap;
-	TMateMap mateMap;
-	
-	// Count reads
-	hts_itr_t* iter = sam_itr_queryi(idx, refIndex, 0, hdr->target_len[refIndex]);
-	bam1_t* rec = bam_init1();
-	int32_t lastAlignedPos = 0;
-	std::set<std::size_t> lastAlignedPosReads;
-	while (sam_itr_next(samfile, iter, rec) >= 0) {
-	  if (rec->core.flag & (BAM_FQCFAIL | BAM_FDUP | BAM_FUNMAP | BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) continue;
-	  if (rec->core.qual < c.minQual) continue;	  
-	  if ((rec->core.flag & BAM_FPAIRED) && ((rec->core.flag & BAM_FMUNMAP) || (rec->core.tid != rec->core.mtid))) continue;
-
-	  int32_t midPoint = rec->core.pos + halfAlignmentLength(rec);
-	  if (rec->core.flag & BAM_FPAIRED) {
-	    // Clean-up the read store for identical alignment positions
-	    if (rec->core.pos > lastAlignedPos) {
-	      lastAlignedPosReads.clear();
-	      lastAlignedPos = rec->core.pos;
-	    }
-	    
-	    if ((rec->core.pos < rec->core.mpos) || ((rec->core.pos == rec->core.mpos) && (lastAlignedPosReads.find(hash_string(bam_get_qname(rec))) == lastAlignedPosReads.end()))) {
-	      // First read
-	      lastAlignedPosReads.insert(hash_string(bam_get_qname(rec)));
-	      std::size_t hv = hash_pair(rec);
-	      mateMap[hv] = true;
-	      continue;
-	    } else {
-	      // Second read
-	      std::size_t hv = hash_pair_mate(rec);
-	      if ((mateMap.find(hv) == mateMap.end()) || (!mateMap[hv])) continue; // Mate discarded
-	      mateMap[hv] = false;
-	    }
-	    
-	    // update midpoint
-	    int32_t isize = (rec->core.pos + alignmentLength(rec)) - rec->core.mpos;
-	    if ((li.minNormalISize < isize) && (isize < li.maxNormalISize)) midPoint = rec->core.mpos + (int32_t) (isize/2);
+    // Clean-up
+    bam_hdr_destroy(hdr);
+    if (idx != NULL) hts_idx_destroy(idx);
+    sam_close(samfile);
+    return true;
+  }
+
+  // Median scan window coverage must support GC bias estimation
+  inline bool
+  _checkScanCoverage(std::vector< std::vector<ScanWindow> > const& scanCounts) {
+    std::vector<uint32_t> sampleScanVec;
+    for(uint32_t i = 0; i < scanCounts.size(); ++i) {
+      for(uint32_t j = 0; j < scanCounts[i].size(); ++j) {
+	sampleScanVec.push_back(scanCounts[i][j].cov);
+      }
+      if (sampleScanVec.size() > 1000000) break;
+    }
+    std::sort(sampleScanVec.begin(), sampleScanVec.end());
+    if (sampleScanVec.empty()) {
+      std::cerr << "Not enough windows!" << std::endl;
+      return false;
+    }
+    if (sampleScanVec[sampleScanVec.size()/2] < 5) {
+      std::cerr << "Please increase the window size. Coverage is too low!" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // Cohort mode: reference GC and mappability profiles are computed once per chromosome and shared by all samples of a batch
+  template<typename TConfig>
+  inline int32_t
+  cohortCount(TConfig const& c, std::vector<LibraryInfo> const& lib, std::vector<std::string> const& sampleNames) {
+    typedef std::vector<ScanWindow> TWindowCounts;
+    typedef std::vector<TWindowCounts> TGenomicWindowCounts;
+    typedef std::pair<uint32_t, uint32_t> TGCBound;
+    typedef RleCoverage TCoverage;
+    typedef MaskedCoverage<std::vector<GcBias>, TCoverage> TMaskedCoverage;
+    
+    // Bin layout of the first sample
+    samFile* samfile = sam_open(c.files[0].string().c_str(), "r");
+    bam_hdr_t* hdr = sam_hdr_read(samfile);
+    
+    // BED regions
+    typedef std::set<std::pair<uint32_t, uint32_t> > TChrIntervals;
+    typedef std::vector<TChrIntervals> TRegionsGenome;
+    TRegionsGenome bedRegions;
+    if (c.hasBedFile) {
+      if (!_parsePotOverlappingIntervals(c.bedFile.string(), c.hasBedFile, hdr, bedRegions)) {
+	std::cerr << "Couldn't parse BED intervals. Do the chromosome names match?" << std::endl;
+	return 1;
+      }
+    }
+
+    // Read-depth windows, genomic tiling or BED intervals
+    typedef std::vector<std::pair<uint32_t, uint32_t> > TChrWindows;
+    std::vector<TChrWindows> windows(hdr->n_targets, TChrWindows());
+    uint64_t nwin = 0;
+    if (!c.covfile.empty()) {
+      for(int32_t refIndex = 0; refIndex < (int32_t) hdr->n_targets; ++refIndex) {
+	if (c.hasBedFile) {
+	  for(typename TChrIntervals::iterator it = bedRegions[refIndex].begin(); it != bedRegions[refIndex].end(); ++it) {
+	    if ((it->first < it->second) && (it->second <= hdr->target_len[refIndex])) windows[refIndex].push_back(*it);
 	  }
-	  
-	  // Count fragment
-	  if ((midPoint >= 0) && (midPoint < (int32_t) hdr->target_len[refIndex]) && (cov[midPoint] < maxCoverage - 1)) ++cov[midPoint];
+	} else {
+	  for(uint32_t start = 0; start + c.window_size < hdr->target_len[refIndex]; start = start + c.window_offset) windows[refIndex].push_back(std::make_pair(start, start + c.window_size));
 	}
-	// Clean-up
-	if (seq != NULL) free(seq);
-	if (ref != NULL) free(ref);
-	bam_destroy1(rec);
-	hts_itr_destroy(iter);
+	nwin += windows[refIndex].size();
       }
+    }
+    std::vector<uint64_t> winOffset(hdr->n_targets + 1, 0);
+    for(int32_t refIndex = 0; refIndex < (int32_t) hdr->n_targets; ++refIndex) winOffset[refIndex + 1] = winOffset[refIndex] + windows[refIndex].size();
+    
+    // Copy-number matrix, window x sample
+    uint32_t nsamples = c.files.size();
+    std::vector<float> wincn(nwin * nsamples, std::numeric_limits<float>::quiet_NaN());
 
-      // CNV discovery
-      if (!c.hasGenoFile) {
-	// Call CNVs
-	std::vector<CNV> chrcnv;
-	callCNVs(c, gcbound, gcContent, uniqContent, gcbias, cov, hdr, refIndex, chrcnv);
+    // CNVs to genotype
+    std::vector<CNV> cnvs;
+    if (c.hasGenoFile) parseVcfCNV(c, hdr, cnvs);
+    CnvTable ct;
+    initCnvTable(cnvs, hdr->n_targets, nsamples, ct);
 
-	// Merge adjacent CNVs lacking read-depth shift
-	mergeCNVs(c, chrcnv, cnvs);
+    // Contig ploidies
+    PloidyMap pm;
+    if (!initPloidyMap(c, hdr, sampleNames, pm)) {
+      bam_hdr_destroy(hdr);
+      sam_close(samfile);
+      return 1;
+    }
 
-	// Refine breakpoints
-	if (c.hasVcfFile) breakpointRefinement(c, gcbound, gcContent, uniqContent, gcbias, cov, hdr, refIndex, svbp, cnvs);
+    // Read-depth matrix
+    RdMatrixFile rdOut;
+    if (c.hasRdFile) {
+      if (!openRdMatrix(c.rdfile, hdr, DELLY_RDMATRIX_BINSIZE, sampleNames, maskedBinFields(), rdOut)) {
+	std::cerr << "Fail to open read-depth matrix " << c.rdfile.string() << std::endl;
+	return 1;
       }
+    }
+
+    // Threads
+#ifdef OPENMP
+    int32_t nthreads = omp_get_max_threads();
+    if (c.threads) nthreads = c.threads;
+#endif
+
+    // Sample batches
+    faidx_t* faiMap = fai_load(c.mapFile.string().c_str());
+    faidx_t* faiRef = fai_load(c.genome.string().c_str());
+    bool failed = false;
+    for(uint32_t batchStart = 0; ((batchStart < nsamples) && (!failed)); batchStart += c.cohortBatch) {
+      uint32_t batchEnd = std::min(nsamples, batchStart + c.cohortBatch);
+      int32_t bsize = batchEnd - batchStart;
+      boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
+      std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] " << "Sample batch " << (batchStart + 1) << "-" << batchEnd << " of " << nsamples << std::endl;
       
-      // CNV genotyping
-      genotypeCNVs(c, gcbound, gcContent, uniqContent, gcbias, cov, hdr, refIndex, cnvs);
-
-      // BED File (target intervals)
-      if (c.hasBedFile) {
-	if (c.adaptive) {
-	  // Merge overlapping BED entries
-	  TChrIntervals citv;
-	  _mergeOverlappingBedEntries(bedRegions[refIndex], citv);
-
-	  // Tile merged intervals
-	  double covsum = 0;
-	  double expcov = 0;
-	  double obsexp = 0;
-	  uint32_t winlen = 0;
-	  uint32_t start = 0;
-	  bool endOfWindow = true;
-	  typename TChrIntervals::iterator it = citv.begin();
-	  if (it != citv.end()) start = it->first;
-	  while(endOfWindow) {
-	    endOfWindow = false;
-	    for(it = citv.begin(); ((it != citv.end()) && (!endOfWindow)); ++it) {
-	      if ((it->first < it->second) && (it->second <= hdr->target_len[refIndex])) {
-		if (start >= it->second) {
-		  if (start == it->second) {
-		    // Special case
-		    typename TChrIntervals::iterator itNext = it;
-		    ++itNext;
-		    if (itNext != citv.end()) start = itNext->first;
-		  }
-		  continue;
-		}
-		for(uint32_t pos = it->first; ((pos < it->second) && (!endOfWindow)); ++pos) {
-		  if (pos < start) continue;
-		  if ((gcContent[pos] > gcbound.first) && (gcContent[pos] < gcbound.second) && (uniqContent[pos] >= c.fragmentUnique * c.meanisize)) {
-		    covsum += cov[pos];
-		    obsexp += gcbias[gcContent[pos]].obsexp;
-		    expcov += gcbias[gcContent[pos]].coverage;
-		    ++winlen;
-		    if (winlen == c.window_size) {
-		      obsexp /= (double) winlen;
-		      double count = ((double) covsum / obsexp ) * (double) c.window_size / (double) winlen;
-		      double cn = c.ploidy;
-		      if (expcov > 0) cn = c.ploidy * covsum / expcov;
-		      if (!c.covfile.empty()) dataOut << std::string(hdr->target_name[refIndex]) << "\t" << start << "\t" << (pos + 1) << "\t" << winlen << "\t" << count << "\t" << cn << std::endl;
-		      // reset
-		      covsum = 0;
-		      expcov = 0;
-		      obsexp = 0;
-		      winlen = 0;
-		      if (c.window_offset == c.window_size) {
-			// Move on
-			start = pos + 1;
-			endOfWindow = true;
-		      } else {
-			// Rewind
-			for(typename TChrIntervals::iterator sit = citv.begin(); ((sit != citv.end()) && (!endOfWindow)); ++sit) {
-			  if ((sit->first < sit->second) && (sit->second <= hdr->target_len[refIndex])) {
-			    if (start >= sit->second) continue;
-			    for(uint32_t k = sit->first; ((k < sit->second) && (!endOfWindow)); ++k) {
-			      if (k < start) continue;
-			      if ((gcContent[k] > gcbound.first) && (gcContent[k] < gcbound.second) && (uniqContent[k] >= c.fragmentUnique * c.meanisize)) {
-				++winlen;
-				if (winlen == c.window_offset) {
-				  start = k + 1;
-				  winlen = 0;
-				  endOfWindow = true;
-				}
-			      }
-			    }
-			  }
-			}
-		      }
-		    }
-		  }
-		}
-	      }
-	    }
+      // Open alignment files
+      std::vector<samFile*> sf(bsize);
+      std::vector<hts_idx_t*> sidx(bsize);
+      std::vector<bam_hdr_t*> shdr(bsize);
+      for(int32_t b = 0; b < bsize; ++b) {
+	if (failed) continue;
+	sf[b] = sam_open(c.files[batchStart + b].string().c_str(), "r");
+	if (sf[b] == NULL) {
+	  std::cerr << "Fail to open file " << c.files[batchStart + b].string() << std::endl;
+	  failed = true;
+	  continue;
+	}
+	attachHtsThreadPool(sf[b]);
+	hts_set_fai_filename(sf[b], c.genome.string().c_str());
+	sidx[b] = sam_index_load(sf[b], c.files[batchStart + b].string().c_str());
+	if (sidx[b] == NULL) {
+	  std::cerr << "Fail to open index for " << c.files[batchStart + b].string() << std::endl;
+	  failed = true;
+	  continue;
+	}
+	shdr[b] = sam_hdr_read(sf[b]);
+	if (shdr[b] == NULL) {
+	  std::cerr << "Fail to read header of " << c.files[batchStart + b].string() << std::endl;
+	  failed = true;
+	  continue;
+	}
+	if (shdr[b]->n_targets != hdr->n_targets) {
+	  std::cerr << "Number of chromosomes disagrees with " << c.files[0].string() << ": " << c.files[batchStart + b].string() << std::endl;
+	  failed = true;
+	  continue;
+	}
+	for(int32_t refIndex = 0; refIndex < (int32_t) hdr->n_targets; ++refIndex) {
+	  if ((std::string(shdr[b]->target_name[refIndex]) != std::string(hdr->target_name[refIndex])) || (shdr[b]->target_len[refIndex] != hdr->target_len[refIndex])) {
+	    std::cerr << "Chromosome names or lengths disagree with " << c.files[0].string() << ": " << c.files[batchStart + b].string() << std::endl;
+	    failed = true;
+	    break;
 	  }
-	} else {
-	  // Fixed Window Length
-	  for(typename TChrIntervals::iterator it = bedRegions[refIndex].begin(); it != bedRegions[refIndex].end(); ++it) {
-	    if ((it->first < it->second) && (it->second <= hdr->target_len[refIndex])) {
-	      double covsum = 0;
-	      double expcov = 0;
-	      double obsexp = 0;
-	      uint32_t winlen = 0;
-	      for(uint32_t pos = it->first; pos < it->second; ++pos) {
-		if ((gcContent[pos] > gcbound.first) && (gcContent[pos] < gcbound.second) && (uniqContent[pos] >= c.fragmentUnique * c.meanisize)) {
-		  covsum += cov[pos];
-		  obsexp += gcbias[gcContent[pos]].obsexp;
-		  expcov += gcbias[gcContent[pos]].coverage;
-		  ++winlen;
-		}
-	      }
-	      if (winlen >= c.fracWindow * (it->second - it->first)) {
-		obsexp /= (double) winlen;
-		double count = ((double) covsum / obsexp ) * (double) (it->second - it->first) / (double) winlen;
-		double cn = c.ploidy;
-		if (expcov > 0) cn = c.ploidy * covsum / expcov;
-		if (!c.covfile.empty()) dataOut << std::string(hdr->target_name[refIndex]) << "\t" << it->first << "\t" << it->second << "\t" << winlen << "\t" << count << "\t" << cn << std::endl;
-	      } else {
-		if (!c.covfile.empty()) dataOut << std::string(hdr->target_name[refIndex]) << "\t" << it->first << "\t" << it->second << "\tNA\tNA\tNA" << std::endl;
-	      }
-	    }
+	}
+      }
+      
+      // Scan windows
+      now = boost::posix_time::second_clock::local_time();
+      std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] " << "Scanning Windows" << std::endl;
+      std::vector<TGenomicWindowCounts> scanCounts(bsize, TGenomicWindowCounts(c.nchr, TWindowCounts()));
+      std::vector<uint64_t> totalCov(bsize, 0);
+      std::vector<std::vector<std::vector<float> > > density(bsize, std::vector<std::vector<float> >(hdr->n_targets, std::vector<float>()));
+      for(int32_t b = 0; b < bsize; ++b) _initScanWindows(c, hdr, scanCounts[b]);
+      for(int32_t refIndex = 0; ((refIndex < (int32_t) hdr->n_targets) && (!failed)); ++refIndex) {
+	std::vector<bool> skip(bsize, true);
+	bool anySample = false;
+	for(int32_t b = 0; b < bsize; ++b) {
+	  skip[b] = _skipScanChromosome(c, pm, batchStart + b, shdr[b], sidx[b], refIndex, totalCov[b]);
+	  if (!skip[b]) anySample = true;
+	}
+	if (!anySample) continue;
+	std::vector<uint16_t> gcContent;
+	std::vector<uint16_t> uniqContent;
+	if (!_refProfile(c, hdr, faiMap, NULL, refIndex, gcContent, uniqContent)) continue;
+#pragma omp parallel for num_threads(nthreads) default(shared) schedule(dynamic, 1)
+	for(int32_t b = 0; b < bsize; ++b) {
+	  if (!skip[b]) {
+	    _scanChromosome(c, lib[batchStart + b], sf[b], sidx[b], shdr[b], refIndex, uniqContent, scanCounts[b], totalCov[b]);
+	    if (c.inferPloidy) _uniqueDensity(c, uniqContent, scanCounts[b][refIndex], density[b][refIndex]);
 	  }
 	}
-      } else {
-	// Genome-wide
-	if (c.adaptive) {
-	  double covsum = 0;
-	  double expcov = 0;
-	  double obsexp = 0;
-	  uint32_t winlen = 0;
-	  uint32_t start = 0;
-	  uint32_t pos = 0;
-	  while(pos < hdr->target_len[refIndex]) {
-	    if ((gcContent[pos] > gcbound.first) && (gcContent[pos] < gcbound.second) && (uniqContent[pos] >= c.fragmentUnique * c.meanisize)) {
-	      covsum += cov[pos];
-	      obsexp += gcbias[gcContent[pos]].obsexp;
-	      expcov += gcbias[gcContent[pos]].coverage;
-	      ++winlen;
-	      if (winlen == c.window_size) {
-		obsexp /= (double) winlen;
-		double count = ((double) covsum / obsexp ) * (double) c.window_size / (double) winlen;
-		double cn = c.ploidy;
-		if (expcov > 0) cn = c.ploidy * covsum / expcov;
-		if (!c.covfile.empty()) dataOut << std::string(hdr->target_name[refIndex]) << "\t" << start << "\t" << (pos + 1) << "\t" << winlen << "\t" << count << "\t" << cn << std::endl;
-		// reset
-		covsum = 0;
-		expcov = 0;
-		obsexp = 0;
-		winlen = 0;
-		if (c.window_offset == c.window_size) {
-		  // Move on
-		  start = pos + 1;
-		} else {
-		  // Rewind
-		  for(uint32_t k = start; k < hdr->target_len[refIndex]; ++k) {
-		    if ((gcContent[k] > gcbound.first) && (gcContent[k] < gcbound.second) && (uniqContent[k] >= c.fragmentUnique * c.meanisize)) {
-		      ++winlen;
-		      if (winlen == c.window_offset) {
-			start = k + 1;
-			pos = k;
-			winlen = 0;
-			break;
-		      }
-		    }
-		  }
-		}
-	      }
+      }
+      for(int32_t b = 0; ((b < bsize) && (!failed)); ++b) {
+	if (c.inferPloidy) inferPloidy(c, hdr, sampleNames[batchStart + b], batchStart + b, density[b], pm);
+	_baselineScanWindows(c, pm, batchStart + b, scanCounts[b]);
+	if (!_checkScanCoverage(scanCounts[b])) {
+	  std::cerr << "Sample: " << sampleNames[batchStart + b] << std::endl;
+	  failed = true;
+	}
+	else selectWindows(c, scanCounts[b]);
+      }
+
+      // GC bias
+      now = boost::posix_time::second_clock::local_time();
+      std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] " << "Estimate GC bias" << std::endl;
+      std::vector<std::vector<GcBias> > gcbias(bsize, std::vector<GcBias>(c.meanisize + 1, GcBias()));
+      std::vector<TGCBound> gcbound(bsize);
+      for(int32_t refIndex = 0; ((refIndex < (int32_t) hdr->n_targets) && (!failed)); ++refIndex) {
+	bool anySample = false;
+	for(int32_t b = 0; b < bsize; ++b) {
+	  if (!scanCounts[b][refIndex].empty()) anySample = true;
+	}
+	if (!anySample) continue;
+	std::vector<uint16_t> gcContent;
+	std::vector<uint16_t> uniqContent;
+	if (!_refProfile(c, hdr, faiMap, faiRef, refIndex, gcContent, uniqContent)) continue;
+#pragma omp parallel for num_threads(nthreads) default(shared) schedule(dynamic, 1)
+	for(int32_t b = 0; b < bsize; ++b) {
+	  if (!scanCounts[b][refIndex].empty()) _gcBiasChromosome(c, lib[batchStart + b], sf[b], sidx[b], shdr[b], refIndex, gcContent, uniqContent, scanCounts[b], gcbias[b]);
+	}
+      }
+      if (!failed) {
+	for(int32_t b = 0; b < bsize; ++b) _gcBiasSummary(c, gcbias[b], gcbound[b]);
+      }
+
+      // Count fragments, genotype CNVs and fill read-depth windows
+      now = boost::posix_time::second_clock::local_time();
+      std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] " << "Count fragments" << std::endl;
+      for(int32_t refIndex = 0; ((refIndex < (int32_t) hdr->n_targets) && (!failed)); ++refIndex) {
+	if ((ct.chrBegin[refIndex] == ct.chrBegin[refIndex + 1]) && (windows[refIndex].empty()) && (!c.hasRdFile)) continue;
+	std::vector<uint16_t> gcContent;
+	std::vector<uint16_t> uniqContent;
+	if (!_refProfile(c, hdr, faiMap, faiRef, refIndex, gcContent, uniqContent)) continue;
+#pragma omp parallel for num_threads(nthreads) default(shared) schedule(dynamic, 1)
+	for(int32_t b = 0; b < bsize; ++b) {
+	  uint32_t s = batchStart + b;
+	  TCoverage cov(hdr->target_len[refIndex]);
+	  _fragmentCoverage(c, lib[s], sf[b], sidx[b], shdr[b], refIndex, cov);
+	  TMaskedCoverage mc(c, gcbound[b], gcContent, uniqContent, gcbias[b], cov, hdr->target_len[refIndex]);
+
+	  // CNV genotyping
+	  genotypeCnvTable(c, mc, refIndex, s, ct);
+
+	  // Read-depth windows
+	  for(uint32_t w = 0; w < windows[refIndex].size(); ++w) {
+	    double covsum = 0;
+	    double expcov = 0;
+	    int32_t winlen = maskedSum(mc, windows[refIndex][w].first, windows[refIndex][w].second, covsum, expcov);
+	    if (winlen >= c.fracWindow * (windows[refIndex][w].second - windows[refIndex][w].first)) {
+	      double cn = c.ploidy;
+	      if (expcov > 0) cn = c.ploidy * covsum / expcov;
+	      wincn[(winOffset[refIndex] + w) * nsamples + s] = cn;
 	    }
-	    ++pos;
 	  }
-	} else {
-	  // Fixed windows (genomic tiling)
-	  for(uint32_t start = 0; start < hdr->target_len[refIndex]; start = start + c.window_offset) {
-	    if (start + c.window_size < hdr->target_len[refIndex]) {
-	      double covsum = 0;
-	      double expcov = 0;
-	      double obsexp = 0;
-	      uint32_t winlen = 0;
-	      for(uint32_t pos = start; pos < start + c.window_size; ++pos) {
-		if ((gcContent[pos] > gcbound.first) && (gcContent[pos] < gcbound.second) && (uniqContent[pos] >= c.fragmentUnique * c.meanisize)) {
-		  covsum += cov[pos];
-		  obsexp += gcbias[gcContent[pos]].obsexp;
-		  expcov += gcbias[gcContent[pos]].coverage;
-		  ++winlen;
-		}
-	      }
-	      if (winlen >= c.fracWindow * c.window_size) {
-		obsexp /= (double) winlen;
-		double count = ((double) covsum / obsexp ) * (double) c.window_size / (double) winlen;
-		double cn = c.ploidy;
-		if (expcov > 0) cn = c.ploidy * covsum / expcov;
-		if (!c.covfile.empty()) dataOut << std::string(hdr->target_name[refIndex]) << "\t" << start << "\t" << (start + c.window_size) << "\t" << winlen << "\t" << count << "\t" << cn << std::endl;
-	      }
+
+	  // Read-depth matrix bins
+	  if (c.hasRdFile) {
+	    std::vector<std::vector<float> > rdBins;
+	    maskedBins(mc, DELLY_RDMATRIX_BINSIZE, rdBins);
+#pragma omp critical
+	    {
+	      for(uint32_t f = 0; f < rdBins.size(); ++f) writeRdColumn(rdOut, refIndex, s, f, rdBins[f]);
 	    }
 	  }
 	}
       }
+      
+      // Clean-up
+      for(int32_t b = 0; b < bsize; ++b) {
+	if (shdr[b] != NULL) bam_hdr_destroy(shdr[b]);
+	if (sidx[b] != NULL) hts_idx_destroy(sidx[b]);
+	if (sf[b] != NULL) sam_close(sf[b]);
+      }
+    }
+    fai_destroy(faiRef);
+    fai_destroy(faiMap);
+    if ((c.hasRdFile) && (!closeRdMatrix(rdOut))) {
+      std::cerr << "Fail to write read-depth matrix " << c.rdfile.string() << std::endl;
+      failed = true;
+    }
+    if (failed) {
+      bam_hdr_destroy(hdr);
+      sam_close(samfile);
+      return 1;
     }
 
-    // Sort CNVs
-    sort(cnvs.begin(), cnvs.end(), SortCNVs<CNV>());
+    // Read-depth matrix
+    if (!c.covfile.empty()) {
+      boost::iostreams::filtering_ostream dataOut;
+      dataOut.push(boost::iostreams::gzip_compressor());
+      dataOut.push(boost::iostreams::file_sink(c.covfile.c_str(), std::ios_base::out | std::ios_base::binary));
+      dataOut << "chr\tstart\tend";
+      for(uint32_t s = 0; s < nsamples; ++s) dataOut << "\t" << sampleNames[s] << "_CN";
+      dataOut << std::endl;
+      for(int32_t refIndex = 0; refIndex < (int32_t) hdr->n_targets; ++refIndex) {
+	for(uint32_t w = 0; w < windows[refIndex].size(); ++w) {
+	  dataOut << hdr->target_name[refIndex] << "\t" << windows[refIndex][w].first << "\t" << windows[refIndex][w].second;
+	  for(uint32_t s = 0; s < nsamples; ++s) {
+	    float cn = wincn[(winOffset[refIndex] + w) * nsamples + s];
+	    if (cn == cn) dataOut << "\t" << cn;
+	    else dataOut << "\tNA";
+	  }
+	  dataOut << std::endl;
+	}
+      }
+      dataOut.pop();
+      dataOut.pop();
+    }
 
     // Genotype CNVs
-    cnvVCF(c, cnvs);
+    if (c.hasGenoFile) cnvVCF(c, sampleNames, cnvs, ct, pm);
 
-    // clean-up
-    fai_destroy(faiRef);
-    fai_destroy(faiMap);
+    // Clean-up
     bam_hdr_destroy(hdr);
-    hts_idx_destroy(idx);
     sam_close(samfile);
-    if (!c.covfile.empty()) {
-      dataOut.pop();
-      dataOut.pop();
+    return 0;
+  }
+
+  // CNV re-genotyping of all samples of a read-depth matrix, no fragment counting
+  template<typename TConfig>
+  inline int32_t
+  rdCount(TConfig const& c) {
+    samFile* samfile = sam_open(c.bamFile.string().c_str(), "r");
+    bam_hdr_t* hdr = sam_hdr_read(samfile);
+    RdMatrixFile rf;
+    if ((!readRdMatrixHeader(c.rdinput, rf)) || (!rdMatchesHeader(rf, hdr)) || (rf.field != maskedBinFields())) {
+      std::cerr << "Read-depth matrix is invalid or does not match " << c.bamFile.string() << ": " << c.rdinput.string() << std::endl;
+      bam_hdr_destroy(hdr);
+      sam_close(samfile);
+      return 1;
     }
-    
+    uint32_t nsamples = rf.sampleName.size();
+    boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
+    std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] " << "Genotype CNVs of " << nsamples << " samples from read-depth matrix" << std::endl;
+
+    // CNVs by chromosome
+    std::vector<CNV> cnvs;
+    parseVcfCNV(c, hdr, cnvs);
+    CnvTable ct;
+    initCnvTable(cnvs, hdr->n_targets, nsamples, ct);
+
+    // Contig ploidies
+    PloidyMap pm;
+    if (!initPloidyMap(c, hdr, rf.sampleName, pm)) {
+      bam_hdr_destroy(hdr);
+      sam_close(samfile);
+      return 1;
+    }
+
+    bool failed = false;
+#pragma omp parallel default(shared)
+    {
+      RdMatrixFile trf;
+      bool trfOpen = readRdMatrixHeader(c.rdinput, trf);
+      if (!trfOpen) {
+#pragma omp critical
+	{
+	  failed = true;
+	}
+      }
+#pragma omp for schedule(dynamic, 1)
+      for(int32_t s = 0; s < (int32_t) nsamples; ++s) {
+	if (!trfOpen) continue;
+	for(int32_t refIndex = 0; refIndex < (int32_t) hdr->n_targets; ++refIndex) {
+	  rdGenotypeCnvTable(c, trf, refIndex, s, ct);
+	}
+      }
+    }
+    if (failed) {
+      std::cerr << "Fail to read read-depth matrix " << c.rdinput.string() << std::endl;
+      bam_hdr_destroy(hdr);
+      sam_close(samfile);
+      return 1;
+    }
+    cnvVCF(c, rf.sampleName, cnvs, ct, pm);
+
+    bam_hdr_destroy(hdr);
+    sam_close(samfile);
     return 0;
   }
 
@@ -463,6 +900,10 @@ namespace torali
       ("ploidy,y", boost::program_options::value<uint16_t>(&c.ploidy)->default_value(2), "baseline ploidy")
       ("outfile,o", boost::program_options::value<boost::filesystem::path>(&c.outfile), "BCF output file")
       ("covfile,c", boost::program_options::value<boost::filesystem::path>(&c.covfile), "gzipped coverage file")
+      ("rdfile", boost::program_options::value<boost::filesystem::path>(&c.rdfile), "binary read-depth matrix output file (optional)")
+      ("io-threads", boost::program_options::value<uint16_t>(&c.ioThreads)->default_value(0), "threads for BAM/CRAM decoding and BCF encoding")
+      ("threads", boost::program_options::value<uint16_t>(&c.threads)->default_value(0), "chromosomes or cohort samples processed in parallel [0: OMP_NUM_THREADS]")
+      ("memory", boost::program_options::value<uint32_t>(&c.memory)->default_value(0), "memory budget in MB for concurrent chromosomes [0: unlimited]")
       ;
 
     boost::program_options::options_description cnv("CNV calling");
@@ -472,7 +913,10 @@ namespace torali
       ("cnv-size,z", boost::program_options::value<uint32_t>(&c.minCnvSize)->default_value(1000), "min. CNV size")
       ("svfile,l", boost::program_options::value<boost::filesystem::path>(&c.vcffile), "delly SV file for breakpoint refinement")
       ("vcffile,v", boost::program_options::value<boost::filesystem::path>(&c.genofile), "input VCF/BCF file for re-genotyping")
+      ("rdinput", boost::program_options::value<boost::filesystem::path>(&c.rdinput), "re-genotype from this read-depth matrix instead of the alignments")
       ("segmentation,u", "copy-number segmentation")
+      ("ploidy-file", boost::program_options::value<boost::filesystem::path>(&c.ploidyFile), "per-contig ploidy TSV: contig, ploidy [, sample], '.' for unknown")
+      ("infer-ploidy", "infer unknown contig ploidies (default: chrX, chrY) from coverage")
       ;
     
     boost::program_options::options_description window("Read-depth windows");
@@ -496,7 +940,8 @@ namespace torali
     
     boost::program_options::options_description hidden("Hidden options");
     hidden.add_options()
-      ("input-file", boost::program_options::value<boost::filesystem::path>(&c.bamFile), "input bam file")
+      ("input-file", boost::program_options::value< std::vector<boost::filesystem::path> >(&c.files), "input bam files")
+      ("cohort-batch", boost::program_options::value<uint32_t>(&c.cohortBatch)->default_value(64), "samples per cohort batch")
       ("fragment,e", boost::program_options::value<float>(&c.fragmentUnique)->default_value(0.97), "min. fragment uniqueness [0,1]")
       ("statsfile,s", boost::program_options::value<boost::filesystem::path>(&c.statsFile), "gzipped stats output file (optional)")
       ;
@@ -518,7 +963,7 @@ namespace torali
     // Check command line arguments
     if ((vm.count("help")) || (!vm.count("input-file")) || (!vm.count("genome")) || (!vm.count("mappability"))) {
       std::cerr << std::endl;
-      std::cerr << "Usage: delly " << argv[0] << " [OPTIONS] -g <genome.fa> -m <genome.map> <aligned.bam>" << std::endl;
+      std::cerr << "Usage: delly " << argv[0] << " [OPTIONS] -g <genome.fa> -m <genome.map> <aligned.bam> [<sample2.bam> ...]" << std::endl;
       std::cerr << visible_options << "\n";
       return 1;
     }
@@ -609,101 +1054,111 @@ namespace torali
       }
     }
     
-    // Check bam file
-    LibraryInfo li;
-    if (!(boost::filesystem::exists(c.bamFile) && boost::filesystem::is_regular_file(c.bamFile) && boost::filesystem::file_size(c.bamFile))) {
-      std::cerr << "Alignment file is missing: " << c.bamFile.string() << std::endl;
-      return 1;
-    } else {
-      // Get scan regions
-      typedef boost::icl::interval_set<uint32_t> TChrIntervals;
-      typedef typename TChrIntervals::interval_type TIVal;
-      typedef std::vector<TChrIntervals> TRegionsGenome;
-      TRegionsGenome scanRegions;
+    // Read-depth matrix
+    if (vm.count("rdfile")) c.hasRdFile = true;
+    else c.hasRdFile = false;
 
-      // Open BAM file
-      samFile* samfile = sam_open(c.bamFile.string().c_str(), "r");
-      if (samfile == NULL) {
-	std::cerr << "Fail to open file " << c.bamFile.string() << std::endl;
+    // Contig ploidies
+    if (vm.count("ploidy-file")) {
+      if (!(boost::filesystem::exists(c.ploidyFile) && boost::filesystem::is_regular_file(c.ploidyFile))) {
+	std::cerr << "Ploidy file is missing: " << c.ploidyFile.string() << std::endl;
 	return 1;
       }
-      hts_idx_t* idx = sam_index_load(samfile, c.bamFile.string().c_str());
-      if (idx == NULL) {
-	if (bam_index_build(c.bamFile.string().c_str(), 0) != 0) {
-	  std::cerr << "Fail to open index for " << c.bamFile.string() << std::endl;
-	  return 1;
-	}
+      c.hasPloidyFile = true;
+    } else c.hasPloidyFile = false;
+    if (vm.count("infer-ploidy")) c.inferPloidy = true;
+    else c.inferPloidy = false;
+    if (c.ploidy >= MAX_CN) {
+      std::cerr << "Baseline ploidy needs to be below " << MAX_CN << "!" << std::endl;
+      return 1;
+    }
+    if (vm.count("rdinput")) {
+      if (!(boost::filesystem::exists(c.rdinput) && boost::filesystem::is_regular_file(c.rdinput))) {
+	std::cerr << "Read-depth matrix is missing: " << c.rdinput.string() << std::endl;
+	return 1;
       }
-      bam_hdr_t* hdr = sam_hdr_read(samfile);
-      if (hdr == NULL) {
-	std::cerr << "Fail to open header for " << c.bamFile.string() << std::endl;
+      if (!c.hasGenoFile) {
+	std::cerr << "Re-genotyping from a read-depth matrix requires an input VCF/BCF file (-v)!" << std::endl;
 	return 1;
       }
-      c.nchr = hdr->n_targets;
-      c.minChrLen = setMinChrLen(hdr, 0.95);
-      std::string sampleName = "unknown";
-      getSMTag(std::string(hdr->text), c.bamFile.stem().string(), sampleName);
-      c.sampleName = sampleName;
-
-      // Check matching chromosome names
-      faidx_t* faiRef = fai_load(c.genome.string().c_str());
-      faidx_t* faiMap = fai_load(c.mapFile.string().c_str());
-      uint32_t mapFound = 0;
-      uint32_t refFound = 0;
-      for(int32_t refIndex=0; refIndex < hdr->n_targets; ++refIndex) {
-	std::string tname(hdr->target_name[refIndex]);
-	if (faidx_has_seq(faiMap, tname.c_str())) ++mapFound;
-	if (faidx_has_seq(faiRef, tname.c_str())) ++refFound;
-	else {
-	  std::cerr << "Warning: BAM chromosome " << tname << " not present in reference genome!" << std::endl;
-	}
+      c.hasRdInput = true;
+    } else c.hasRdInput = false;
+    
+    // htslib thread pool
+    if (!initHtsThreadPool(c.ioThreads)) return 1;
+    HtsThreadPoolScope poolScope;
+
+    // Re-genotyping from the read-depth matrix, the alignment header only provides the chromosomes
+    if (c.hasRdInput) {
+      c.bamFile = c.files[0];
+      if (rdCount(c)) return 1;
+      now = boost::posix_time::second_clock::local_time();
+      std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] " << "Done." << std::endl;
+      return 0;
+    }
+
+    // Library parameters
+    c.nchr = 0;
+    std::vector<LibraryInfo> lib(c.files.size(), LibraryInfo());
+    std::vector<std::string> sampleNames(c.files.size());
+    std::set<std::string> snames;
+    uint32_t ucount = 0;
+    for(uint32_t file_c = 0; file_c < c.files.size(); ++file_c) {
+      if (!_sampleLibrary(c, c.files[file_c], lib[file_c], sampleNames[file_c])) return 1;
+      while (snames.find(sampleNames[file_c]) != snames.end()) {
+	std::cerr << "Warning: Duplicate sample names: " << sampleNames[file_c] << std::endl;
+	sampleNames[file_c] += "_" + boost::lexical_cast<std::string>(ucount++);
+	std::cerr << "Warning: Changing sample name to " << sampleNames[file_c] << std::endl;
       }
-      fai_destroy(faiRef);
-      fai_destroy(faiMap);
-      if (!mapFound) {
-	std::cerr << "Mappability map chromosome naming disagrees with BAM file!" << std::endl;
+      snames.insert(sampleNames[file_c]);
+    }
+    c.bamFile = c.files[0];
+    c.sampleName = sampleNames[0];
+
+    // Cohort mode
+    if (c.files.size() > 1) {
+      if (c.adaptive) {
+	std::cerr << "Adaptive windowing is not supported in cohort mode!" << std::endl;
 	return 1;
       }
-      if (!refFound) {
-	std::cerr << "Reference genome chromosome naming disagrees with BAM file!" << std::endl;
+      if ((c.hasVcfFile) || (c.hasStatsFile)) {
+	std::cerr << "Breakpoint refinement and statistics output are not supported in cohort mode!" << std::endl;
 	return 1;
       }
-
-      // Estimate library params
-      if (c.hasScanFile) {
-	if (!_parseBedIntervals(c.scanFile.string(), c.hasScanFile, hdr, scanRegions)) {
-	  std::cerr << "Warning: Couldn't parse BED intervals. Do the chromosome names match?" << std::endl;
-	  return 1;
-	}
-      } else {
-	scanRegions.resize(hdr->n_targets);
-	for (int32_t refIndex = 0; refIndex < hdr->n_targets; ++refIndex) {
-	  scanRegions[refIndex].insert(TIVal::right_open(0, hdr->target_len[refIndex]));
-	}
+      if ((!c.hasGenoFile) && (c.covfile.empty())) {
+	std::cerr << "Cohort mode requires CNVs to genotype (-v) and/or a coverage file (-c)!" << std::endl;
+	return 1;
       }
-      typedef std::vector<LibraryInfo> TSampleLibrary;
-      TSampleLibrary sampleLib(1, LibraryInfo());
-      CountDNAConfigLib dellyConf;
-      dellyConf.genome = c.genome;
-      dellyConf.files.push_back(c.bamFile);
-      dellyConf.madCutoff = 9;
-      dellyConf.madNormalCutoff = c.mad;
-      getLibraryParams(dellyConf, scanRegions, sampleLib);
-      li = sampleLib[0];
-      if (!li.median) {
-	li.median = 250;
-	li.mad = 15;
-	li.minNormalISize = 0;
-	li.maxNormalISize = 400;
-      }
-      c.meanisize = ((int32_t) (li.median / 2)) * 2 + 1;
+      if (c.cohortBatch < 1) c.cohortBatch = 1;
+
+      // Shared fragment window, median across samples
+      std::vector<uint32_t> medians;
+      for(uint32_t file_c = 0; file_c < lib.size(); ++file_c) medians.push_back(lib[file_c].median);
+      std::sort(medians.begin(), medians.end());
+      c.meanisize = ((int32_t) (medians[medians.size() / 2] / 2)) * 2 + 1;
       
-      // Clean-up
+      if (cohortCount(c, lib, sampleNames)) {
+	std::cerr << "Read counting error!" << std::endl;
+	return 1;
+      }
+      now = boost::posix_time::second_clock::local_time();
+      std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] " << "Done." << std::endl;
+      return 0;
+    }
+    LibraryInfo li = lib[0];
+    c.meanisize = ((int32_t) (li.median / 2)) * 2 + 1;
+
+    // Contig ploidies
+    PloidyMap pm;
+    {
+      samFile* samfile = sam_open(c.bamFile.string().c_str(), "r");
+      bam_hdr_t* hdr = sam_hdr_read(samfile);
+      bool ploidyOk = initPloidyMap(c, hdr, std::vector<std::string>(1, c.sampleName), pm);
       bam_hdr_destroy(hdr);
-      hts_idx_destroy(idx);
       sam_close(samfile);
+      if (!ploidyOk) return 1;
     }
-
+    
     // GC bias estimation
     typedef std::pair<uint32_t, uint32_t> TGCBound;
     TGCBound gcbound;
@@ -713,27 +1168,10 @@ namespace torali
       typedef std::vector<ScanWindow> TWindowCounts;
       typedef std::vector<TWindowCounts> TGenomicWindowCounts;
       TGenomicWindowCounts scanCounts(c.nchr, TWindowCounts());
-      scan(c, li, scanCounts);
+      scan(c, li, pm, scanCounts);
 
       // Check coverage
-      {
-	std::vector<uint32_t> sampleScanVec;
-	for(uint32_t i = 0; i < scanCounts.size(); ++i) {
-	  for(uint32_t j = 0; j < scanCounts[i].size(); ++j) {
-	    sampleScanVec.push_back(scanCounts[i][j].cov);
-	  }
-	  if (sampleScanVec.size() > 1000000) break;
-	}
-	std::sort(sampleScanVec.begin(), sampleScanVec.end());
-	if (sampleScanVec.empty()) {
-	  std::cerr << "Not enough windows!" << std::endl;
-	  return 1;
-	}
-	if (sampleScanVec[sampleScanVec.size()/2] < 5) {
-	  std::cerr << "Please increase the window size. Coverage is too low!" << std::endl;
-	  return 1;
-	}
-      }
+      if (!_checkScanCoverage(scanCounts)) return 1;
     
       // Select stable windows
       selectWindows(c, scanCounts);
@@ -773,7 +1211,7 @@ namespace torali
     }
       
     // Count reads
-    if (bamCount(c, li, gcbias, gcbound)) {
+    if (bamCount(c, li, gcbias, gcbound, pm)) {
       std::cerr << "Read counting error!" << std::endl;
       return 1;
     }
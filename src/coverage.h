@@ -1,8 +1,8 @@
 #ifndef COVERAGE_H
 #define COVERAGE_H
 
+#include <sstream>
 #include <boost/container/flat_set.hpp>
-#include <boost/dynamic_bitset.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/iostreams/stream_buffer.hpp>
 #include <boost/iostreams/device/file.hpp>
@@ -16,6 +16,11 @@
 #include "util.h"
 #include "msa.h"
 #include "split.h"
+#include "readcache.h"
+#include "rlecov.h"
+#include "rdmatrix.h"
+#include "schedule.h"
+#include "bolog.h"
 
 
 namespace torali {
@@ -54,6 +59,24 @@ namespace torali {
     }
   };
   
+  // Breakpoint windows still below the genotyping read cap, nextOpen[i] == i for open windows
+  inline uint32_t
+  _nextOpenBp(std::vector<uint32_t>& nextOpen, uint32_t idx) {
+    uint32_t root = idx;
+    while (nextOpen[root] != root) root = nextOpen[root];
+    while (nextOpen[idx] != root) {
+      uint32_t nx = nextOpen[idx];
+      nextOpen[idx] = root;
+      idx = nx;
+    }
+    return root;
+  }
+
+  inline void
+  _closeBp(std::vector<uint32_t>& nextOpen, uint32_t const idx) {
+    nextOpen[idx] = idx + 1;
+  }
+
   struct SpanningCount {
     std::vector<uint8_t> ref;
     std::vector<uint8_t> alt;
@@ -142,6 +165,7 @@ namespace torali {
 
     TProbes refProbes(svs.size());
     faidx_t* fai = fai_load(c.genome.string().c_str());
+    std::string consensus; // Unpacked consensus, reused across SVs
     for(int32_t refIndex=0; refIndex < (int32_t) hdr->n_targets; ++refIndex) {
       char* seq = NULL;
 
@@ -162,29 +186,30 @@ namespace torali {
 	  itSV->alleles = _addAlleles(boost::to_upper_copy(std::string(seq + itSV->svStart - 1, seq + itSV->svStart)), std::string(hdr->target_name[itSV->chr2]), *itSV, itSV->svt);
 	}
 	if (!itSV->precise) continue;
+	itSV->consensus.str(consensus);
 
 	// Get the reference sequence
 	if ((itSV->chr != itSV->chr2) && (itSV->chr2 == refIndex)) {
 	  Breakpoint bp(*itSV);
-	  _initBreakpoint(hdr, bp, (int32_t) itSV->consensus.size(), itSV->svt);
+	  _initBreakpoint(hdr, bp, (int32_t) consensus.size(), itSV->svt);
 	  refProbes[itSV->id] = _getSVRef(c, seq, bp, refIndex, itSV->svt);
 	}
 	if (itSV->chr == refIndex) {
 	  Breakpoint bp(*itSV);
 	  if (_translocation(itSV->svt)) bp.part1 = refProbes[itSV->id];
 	  if (itSV->svt ==4) {
-	    int32_t bufferSpace = std::max((int32_t) ((itSV->consensus.size() - itSV->insLen) / 3), c.minimumFlankSize);
+	    int32_t bufferSpace = std::max((int32_t) ((consensus.size() - itSV->insLen) / 3), c.minimumFlankSize);
 	    _initBreakpoint(hdr, bp, bufferSpace, itSV->svt);
-	  } else _initBreakpoint(hdr, bp, (int32_t) itSV->consensus.size(), itSV->svt);
+	  } else _initBreakpoint(hdr, bp, (int32_t) consensus.size(), itSV->svt);
 	  std::string svRefStr = _getSVRef(c, seq, bp, refIndex, itSV->svt);
 	  
 	  // Find breakpoint to reference
 	  typedef boost::multi_array<char, 2> TAlign;
 	  TAlign align;
-	  if (!_consRefAlignment(itSV->consensus, svRefStr, align, itSV->svt)) continue;
+	  if (!_consRefAlignment(consensus, svRefStr, align, itSV->svt)) continue;
 
 	  AlignDescriptor ad;
-	  if (!_findSplit(c, itSV->consensus, svRefStr, align, ad, itSV->svt)) continue;
+	  if (!_findSplit(c, consensus, svRefStr, align, ad, itSV->svt)) continue;
 	  
 	  // Debug consensus to reference alignment
 	  //std::cerr << itSV->id << std::endl;
@@ -216,7 +241,7 @@ namespace torali {
 	      cutRefEnd = _cutRefEnd(ad.rStart, ad.rEnd, ad.homRight + c.minimumFlankSize, bpPoint, itSV->svt);
 	      bppos = itSV->svStart;
 	    }
-	    consProbeArr[bpPoint][itSV->id] = itSV->consensus.substr(cutConsStart, (cutConsEnd - cutConsStart));
+	    consProbeArr[bpPoint][itSV->id] = consensus.substr(cutConsStart, (cutConsEnd - cutConsStart));
 	    refProbeArr[bpPoint][itSV->id] = svRefStr.substr(cutRefStart, (cutRefEnd - cutRefStart));
 	    bpRegion[regionChr].push_back(BpRegion(regionStart, regionEnd, bppos, ad.homLeft, ad.homRight, itSV->svt, itSV->id, bpPoint));
 	  }
@@ -232,29 +257,150 @@ namespace torali {
     }
   }
 
-  template<typename TConfig, typename TSampleLibrary, typename TSVs, typename TCoverageCount, typename TCountMap, typename TSpanMap>
+  // Left flank, SV and right flank read-depth windows, base counts for small SVs and fragment counts otherwise
+  struct DepthWindows {
+    int32_t start[3];
+    int32_t end[3];
+    bool smallSV;
+  };
+
+  template<typename TConfig, typename TSV>
+  inline void
+  _depthWindows(TConfig const& c, TSV const& sv, int32_t const tlen, DepthWindows& dw) {
+    bool insTra = ((_translocation(sv.svt)) || (sv.svt == 4));
+    int32_t halfSize = (sv.svEnd - sv.svStart)/2;
+    if (insTra) halfSize = 500;
+    dw.smallSV = ((insTra) || ((sv.svEnd - sv.svStart) <= c.indelsize));
+    dw.start[0] = std::max(sv.svStart - halfSize, 0);
+    dw.end[0] = std::min(sv.svStart, tlen);
+    if (insTra) {
+      dw.start[1] = std::max(sv.svStart - halfSize, 0);
+      dw.end[1] = std::min(sv.svStart + halfSize, tlen);
+      dw.start[2] = sv.svStart;
+      dw.end[2] = std::min(sv.svStart + halfSize, tlen);
+    } else {
+      dw.start[1] = sv.svStart;
+      dw.end[1] = std::min(sv.svEnd, tlen);
+      dw.start[2] = sv.svEnd;
+      dw.end[2] = std::min(sv.svEnd + halfSize, tlen);
+    }
+  }
+
+  inline bool
+  _rdMatrixWindow(RdMatrixFile const* rf, int32_t const start, int32_t const end) {
+    return ((rf != NULL) && (end - start >= DELLY_RDMATRIX_MINBINS * rf->binSize));
+  }
+
+  // Depth windows too narrow for the read-depth matrix, sorted and merged
+  template<typename TConfig, typename TSVs>
   inline void
+  _exactDepthWindows(TConfig const& c, TSVs const& svs, RdMatrixFile const* rf, int32_t const refIndex, int32_t const tlen, std::vector<std::pair<int32_t, int32_t> >& exact) {
+    exact.clear();
+    for(uint32_t i = 0; i < svs.size(); ++i) {
+      if (svs[i].chr != refIndex) continue;
+      DepthWindows dw;
+      _depthWindows(c, svs[i], tlen, dw);
+      for(uint32_t k = 0; k < 3; ++k) {
+	if ((dw.start[k] < dw.end[k]) && (!_rdMatrixWindow(rf, dw.start[k], dw.end[k]))) exact.push_back(std::make_pair(dw.start[k], dw.end[k]));
+      }
+    }
+    std::sort(exact.begin(), exact.end());
+    uint32_t k = 0;
+    for(uint32_t i = 0; i < exact.size(); ++i) {
+      if ((k) && (exact[i].first <= exact[k - 1].second)) exact[k - 1].second = std::max(exact[k - 1].second, exact[i].second);
+      else exact[k++] = exact[i];
+    }
+    exact.resize(k);
+  }
+
+  // Does the position fall into one of the merged windows?
+  inline bool
+  _inExactWindow(std::vector<std::pair<int32_t, int32_t> > const& exact, int32_t const pos) {
+    std::vector<std::pair<int32_t, int32_t> >::const_iterator it = std::upper_bound(exact.begin(), exact.end(), std::make_pair(pos, std::numeric_limits<int32_t>::max()));
+    if (it == exact.begin()) return false;
+    --it;
+    return (pos < it->second);
+  }
+
+  // Coverage sum of an SV region from the read-depth matrix if the window spans enough bins, otherwise from the alignment tracks
+  inline int32_t
+  _regionCoverage(RdMatrixFile* rf, int32_t const sample, RleCoverage const& covBases, RleCoverage const& covFragment, bool const smallSV, int32_t const refIndex, int32_t const start, int32_t const end) {
+    if (_rdMatrixWindow(rf, start, end)) return (int32_t) (rdSum(*rf, refIndex, sample, (smallSV) ? 0 : 1, start, end) + 0.5);
+    if (smallSV) return coverageSum(covBases, start, end);
+    return coverageSum(covFragment, start, end);
+  }
+
+  // Genotyping event of an SV joining two chromosomes, replayed in chromosome order by the last task of the sample
+  // Types are 0: reference read, 1: alternative read, 2: read without alternative support, 3: reference spanning pair
+  struct GenoEvent {
+    uint32_t id;
+    uint8_t qual;
+    uint8_t type;
+    bool pass;
+    int32_t dump;
+
+    GenoEvent(uint32_t const i, uint8_t const q, uint8_t const ty, bool const p, int32_t const d) : id(i), qual(q), type(ty), pass(p), dump(d) {}
+  };
+
+  // Inter-chromosomal pair read, first reads carry the mate quality and second reads the SVs they span
+  struct GenoTraRead {
+    bool first;
+    uint8_t qual;
+    std::size_t hv;
+    uint32_t hitStart;
+    uint32_t hitEnd;
+
+    GenoTraRead(bool const f, uint8_t const q, std::size_t const h, uint32_t const s, uint32_t const e) : first(f), qual(q), hv(h), hitStart(s), hitEnd(e) {}
+  };
+
+  // Deferred counts of one genotyping task
+  struct GenoScan {
+    std::vector<GenoEvent> events;
+    std::vector<GenoTraRead> tra;
+    std::vector<std::pair<uint32_t, int32_t> > traHit;
+    std::vector<std::string> dump;
+  };
+
+  template<typename TConfig>
+  inline std::string
+  _genoDumpLine(TConfig const& c, uint32_t const file_c, bam_hdr_t const* hdr, bam1_t const* rec, int32_t const svt, uint32_t const id, std::string const& type) {
+    std::string svid(_addID(svt));
+    std::string padNumber = boost::lexical_cast<std::string>(id);
+    padNumber.insert(padNumber.begin(), 8 - padNumber.length(), '0');
+    svid += padNumber;
+    std::ostringstream line;
+    line << svid << "\t" << c.files[file_c].string() << "\t" << bam_get_qname(rec) << "\t" << hdr->target_name[rec->core.tid] << "\t" << rec->core.pos << "\t" << hdr->target_name[rec->core.mtid] << "\t" << rec->core.mpos << "\t" << (int32_t) rec->core.qual << "\t" << type;
+    return line.str();
+  }
+
+  template<typename TConfig, typename TSampleLibrary, typename TSVs, typename TCoverageCount, typename TCountMap, typename TSpanMap>
+  inline bool
   annotateCoverage(TConfig& c, TSampleLibrary& sampleLib, TSVs& svs, TCoverageCount& covCount, TCountMap& countMap, TSpanMap& spanMap)
   {
     typedef typename TCoverageCount::value_type::value_type TCovPair;
     typedef typename TSpanMap::value_type::value_type TSpanPair;
     typedef typename TCountMap::value_type::value_type TCountPair;
     typedef std::vector<uint8_t> TQuality;
+
+    // Running genotype likelihoods for adaptive early termination, only with --geno-stop-gq and only while a sample is genotyped
+    BoLog<double> bl;
+    typedef GenoRunning<double> TGenoRunning;
+    std::vector<std::vector<TGenoRunning> > genoRunning(c.files.size());
+    uint64_t settledGeno = 0;
+    uint64_t skippedReads = 0;
   
-    // Open file handles
-    typedef std::vector<samFile*> TSamFile;
-    typedef std::vector<hts_idx_t*> TIndex;
-    typedef std::vector<bam_hdr_t*> THeader;
-    TSamFile samfile(c.files.size());
-    TIndex idx(c.files.size());
-    THeader hdr(c.files.size());
-    int32_t totalTarget = 0;
-    for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-      samfile[file_c] = sam_open(c.files[file_c].string().c_str(), "r");
-      hts_set_fai_filename(samfile[file_c], c.genome.string().c_str());
-      idx[file_c] = sam_index_load(samfile[file_c], c.files[file_c].string().c_str());
-      hdr[file_c] = sam_hdr_read(samfile[file_c]);
-      totalTarget += hdr[file_c]->n_targets;
+    // Reference header, alignment files are opened by their genotyping task
+    samFile* rfile = sam_open(c.files[0].string().c_str(), "r");
+    bam_hdr_t* rhdr = sam_hdr_read(rfile);
+
+    // Mapped reads of each sample and chromosome
+    TaskScheduler ts;
+    initScheduler(c, ts);
+    std::vector<std::vector<uint64_t> > mapped;
+    if (!loadMappedReads(c, rhdr, mapped)) {
+      bam_hdr_destroy(rhdr);
+      sam_close(rfile);
+      return false;
     }
 
     // Initialize coverage count maps
@@ -278,11 +424,11 @@ namespace torali {
     }
     typedef std::vector<BpRegion> TBpRegion;
     typedef std::vector<TBpRegion> TGenomicBpRegion;
-    TGenomicBpRegion bpRegion(hdr[0]->n_targets, TBpRegion());
-    std::vector<bool> svOnChr(hdr[0]->n_targets, false);
+    TGenomicBpRegion bpRegion(rhdr->n_targets, TBpRegion());
+    std::vector<bool> svOnChr(rhdr->n_targets, false);
     
     // Generate probes
-    _generateProbes(c, hdr[0], svs, refProbeArr, consProbeArr, bpRegion, svOnChr);
+    _generateProbes(c, rhdr, svs, refProbeArr, consProbeArr, bpRegion, svOnChr);
   
     // Debug
     //for(uint32_t k = 0; k < 2; ++k) {
@@ -313,86 +459,163 @@ namespace torali {
       dumpOut << "#svid\tbam\tqname\tchr\tpos\tmatechr\tmatepos\tmapq\ttype" << std::endl;
     }
 
-#pragma omp parallel for default(shared)
-    for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-      // Pair qualities and features
-      typedef boost::unordered_map<std::size_t, uint8_t> TQualities;
-      TQualities qualities;
-      TQualities qualitiestra;
-      typedef boost::unordered_map<std::size_t, bool> TClip;
-      TClip clip;
-      TClip cliptra;
-      
-      // Iterate chromosomes
-      for(int32_t refIndex=0; refIndex < (int32_t) hdr[file_c]->n_targets; ++refIndex) {
-      
-	// Any SV breakpoints on this chromosome?
+    // Binned read-depth, fields 0: aligned bases, 1: fragment mid-points
+    std::vector<std::string> rdFields;
+    rdFields.push_back("bases");
+    rdFields.push_back("fragments");
+    RdMatrixFile rdOut;
+    bool rdWrite = false;
+    if (c.hasRdFile) {
+      rdWrite = openRdMatrix(c.rdfile, rhdr, DELLY_RDMATRIX_BINSIZE, c.sampleName, rdFields, rdOut);
+      if (!rdWrite) std::cerr << "Warning: Read-depth matrix cannot be written: " << c.rdfile.string() << std::endl;
+    }
+    bool rdRead = false;
+    if (c.hasRdInput) {
+      RdMatrixFile rf;
+      if ((readRdMatrixHeader(c.rdinput, rf)) && (rdMatchesHeader(rf, rhdr)) && (rf.field == rdFields)) rdRead = true;
+      else std::cerr << "Warning: Read-depth matrix does not match the alignments, coverage is counted instead: " << c.rdinput.string() << std::endl;
+    }
+
+    // SVs joining two chromosomes are counted by two tasks of a sample and merged in chromosome order
+    std::vector<bool> svTra(svs.size(), false);
+    for(uint32_t i = 0; i < svs.size(); ++i) svTra[svs[i].id] = (svs[i].chr != svs[i].chr2);
+
+    // One task per sample and chromosome with SV breakpoints, sized by the mapped reads of the chromosome
+    for(uint32_t file_c = 0; file_c < c.files.size(); ++file_c) {
+      std::string suffix("cram");
+      std::string str(c.files[file_c].string());
+      bool cram = ((str.size() >= suffix.size()) && (str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0));
+      for(int32_t refIndex = 0; refIndex < rhdr->n_targets; ++refIndex) {
 	if (!svOnChr[refIndex]) continue;
 
 	// Check we have mapped reads on this chromosome
-	bool nodata = true;
-	std::string suffix("cram");
-	std::string str(c.files[file_c].string());
-	if ((str.size() >= suffix.size()) && (str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0)) nodata = false;
-	uint64_t mapped = 0;
-	uint64_t unmapped = 0;
-	hts_idx_get_stat(idx[file_c], refIndex, &mapped, &unmapped);
-	if (mapped) nodata = false;
-	if (nodata) continue;
-	
-	// Coverage track
-	typedef uint16_t TCount;
-	uint32_t maxCoverage = std::numeric_limits<TCount>::max();
-	typedef std::vector<TCount> TCoverage;
-	TCoverage covFragment(hdr[file_c]->target_len[refIndex], 0);
-	TCoverage covBases(hdr[file_c]->target_len[refIndex], 0);
-	
-	// Flag breakpoint regions
-	typedef boost::dynamic_bitset<> TBitSet;
-	TBitSet bpOccupied(hdr[file_c]->target_len[refIndex]);
-	for(uint32_t i = 0; i < bpRegion[refIndex].size(); ++i) {
-	  for(int32_t k = bpRegion[refIndex][i].regionStart; k < bpRegion[refIndex][i].regionEnd; ++k) {
-	    bpOccupied[k] = 1;
+	if ((!cram) && (!mapped[file_c][refIndex])) continue;
+	uint64_t reads = _mappedReads(mapped[file_c], rhdr, refIndex);
+	addTask(ts, file_c, refIndex, reads, reads * DELLY_GENO_BYTES_PER_READ);
+      }
+    }
+    sortTasks(ts);
+    std::vector<std::vector<std::pair<int32_t, int32_t> > > sampleTasks(c.files.size());
+    for(int32_t t = 0; t < (int32_t) ts.tasks.size(); ++t) sampleTasks[ts.tasks[t].file_c].push_back(std::make_pair(ts.tasks[t].refIndex, t));
+    for(uint32_t file_c = 0; file_c < c.files.size(); ++file_c) std::sort(sampleTasks[file_c].begin(), sampleTasks[file_c].end());
+    std::vector<GenoScan> taskScan(ts.tasks.size());
+    now = boost::posix_time::second_clock::local_time();
+    std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] " << "Genotyping tasks: " << ts.tasks.size() << ", threads: " << ts.nthreads << std::endl;
+
+    // Decoded reads shared between SVs
+    uint64_t cacheHits = 0;
+    uint64_t cacheMisses = 0;
+
+#pragma omp parallel num_threads(ts.nthreads) default(shared)
+    {
+      // Alignment file and read-depth matrix of the last task
+      int32_t tfile_c = -1;
+      samFile* tfile = NULL;
+      hts_idx_t* tidx = NULL;
+      RdMatrixFile rdIn;
+      int32_t rdSampleIdx = -1;
+      bool rdOpen = false;
+
+      // Alignment buffers and decoded reads, reused across reads and SVs
+      AlignWorkspace<int> ws;
+      ReadCache rc;
+      std::string sequence;
+
+#pragma omp for schedule(dynamic, 1)
+      for(int32_t t = 0; t < (int32_t) ts.tasks.size(); ++t) {
+	uint32_t file_c = ts.tasks[t].file_c;
+	int32_t refIndex = ts.tasks[t].refIndex;
+	GenoScan& gs = taskScan[t];
+	startTask(ts, t);
+	TGenoRunning noGeno;
+	if (c.genoStopGQ) {
+#pragma omp critical
+	  {
+	    if (genoRunning[file_c].empty()) genoRunning[file_c].resize(svs.size(), TGenoRunning());
+	  }
+	}
+	if (tfile_c != (int32_t) file_c) {
+	  if (tfile != NULL) {
+	    hts_idx_destroy(tidx);
+	    sam_close(tfile);
+	  }
+	  tfile = sam_open(c.files[file_c].string().c_str(), "r");
+	  attachHtsThreadPool(tfile);
+	  hts_set_fai_filename(tfile, c.genome.string().c_str());
+	  tidx = sam_index_load(tfile, c.files[file_c].string().c_str());
+	  tfile_c = file_c;
+
+	  // Read-depth matrix input
+	  rdSampleIdx = -1;
+	  if (rdRead) {
+	    if (!rdOpen) rdOpen = readRdMatrixHeader(c.rdinput, rdIn);
+	    if (rdOpen) rdSampleIdx = rdSample(rdIn, c.sampleName[file_c]);
 	  }
 	}
+
+	// Pair qualities and features, inter-chromosomal pairs are completed by the last task of the sample
+	typedef boost::unordered_map<std::size_t, uint8_t> TQualities;
+	TQualities qualities;
+	typedef boost::unordered_map<std::size_t, bool> TClip;
+	TClip clip;
+
+	// Coverage track
+	typedef RleCoverage TCoverage;
+	TCoverage covFragment(rhdr->target_len[refIndex]);
+	TCoverage covBases(rhdr->target_len[refIndex]);
+	bool rdChr = ((rdSampleIdx >= 0) && (hasRdColumn(rdIn, refIndex, rdSampleIdx, 0)) && (hasRdColumn(rdIn, refIndex, rdSampleIdx, 1)));
+	if ((rdChr) && (rdWrite) && (rdIn.binSize != DELLY_RDMATRIX_BINSIZE)) rdChr = false; // Output bins cannot be copied
+	RdMatrixFile* rdRegion = (rdChr) ? &rdIn : NULL;
+
+	// Narrow depth windows are still counted from the alignments if the matrix is used
+	std::vector<std::pair<int32_t, int32_t> > exact;
+	if (rdChr) _exactDepthWindows(c, svs, rdRegion, refIndex, rhdr->target_len[refIndex], exact);
+	uint32_t exactIdx = 0;
+	
+	// Open breakpoint windows, closed once their SV reaches maxGenoReadCount
+	std::vector<uint32_t> openBp(bpRegion[refIndex].size() + 1);
+	for(uint32_t i = 0; i < openBp.size(); ++i) openBp[i] = i;
 	
-	// Flag spanning breakpoints
+	// Spanning breakpoints
 	typedef std::vector<SpanPoint> TSpanPoint;
 	TSpanPoint spanPoint;
-	typedef boost::dynamic_bitset<> TBitSet;
-	TBitSet spanBp(hdr[file_c]->target_len[refIndex]);
 	for(typename TSVs::iterator itSV = svs.begin(); itSV != svs.end(); ++itSV) {
 	  if (itSV->peSupport == 0) continue;
-	  if ((itSV->chr == refIndex) && (itSV->svStart < (int32_t) hdr[file_c]->target_len[refIndex])) {
-	    spanBp[itSV->svStart] = 1;
-	    spanPoint.push_back(SpanPoint(itSV->svStart, itSV->svt, itSV->id, itSV->chr2, itSV->svEnd));
-	  }
-	  if ((itSV->chr2 == refIndex) && (itSV->svEnd < (int32_t) hdr[file_c]->target_len[refIndex])) {
-	    spanBp[itSV->svEnd] = 1;
-	    spanPoint.push_back(SpanPoint(itSV->svEnd, itSV->svt, itSV->id, itSV->chr, itSV->svStart));
-	  }
+	  if ((itSV->chr == refIndex) && (itSV->svStart < (int32_t) rhdr->target_len[refIndex])) spanPoint.push_back(SpanPoint(itSV->svStart, itSV->svt, itSV->id, itSV->chr2, itSV->svEnd));
+	  if ((itSV->chr2 == refIndex) && (itSV->svEnd < (int32_t) rhdr->target_len[refIndex])) spanPoint.push_back(SpanPoint(itSV->svEnd, itSV->svt, itSV->id, itSV->chr, itSV->svStart));
 	}
 	std::sort(spanPoint.begin(), spanPoint.end(), SortBp<SpanPoint>());
+
+	// Galloping cursors of the sorted breakpoint tables, one per query stream
+	typename TBpRegion::iterator bpHint = bpRegion[refIndex].begin();
+	typename TSpanPoint::iterator refSpanHint = spanPoint.begin();
+	typename TSpanPoint::iterator altSpanHint = spanPoint.begin();
       
 	// Count reads
-	hts_itr_t* iter = sam_itr_queryi(idx[file_c], refIndex, 0, hdr[file_c]->target_len[refIndex]);
+	hts_itr_t* iter = sam_itr_queryi(tidx, refIndex, 0, rhdr->target_len[refIndex]);
 	bam1_t* rec = bam_init1();
 	int32_t lastAlignedPos = 0;
 	std::set<std::size_t> lastAlignedPosReads;
-	while (sam_itr_next(samfile[file_c], iter, rec) >= 0) {
+	while (sam_itr_next(tfile, iter, rec) >= 0) {
 	  if (rec->core.flag & (BAM_FSECONDARY | BAM_FQCFAIL | BAM_FDUP | BAM_FSUPPLEMENTARY | BAM_FUNMAP | BAM_FMUNMAP)) continue;
 	  if (rec->core.qual < c.minGenoQual) continue;
+	  evictReads(rc, rec->core.pos);
+	  streamCoverage(covFragment, rec->core.pos);
+	  streamCoverage(covBases, rec->core.pos);
 	  
 	  // Count aligned basepair (small InDels)
-	  {
+	  bool countBases = true;
+	  if (rdChr) {
+	    for(; ((exactIdx < exact.size()) && (exact[exactIdx].second <= rec->core.pos)); ++exactIdx);
+	    countBases = ((exactIdx < exact.size()) && (exact[exactIdx].first < (int32_t) lastAlignedPosition(rec)));
+	  }
+	  if (countBases) {
 	    uint32_t rp = 0; // reference pointer
 	    uint32_t* cigar = bam_get_cigar(rec);
 	    for (std::size_t i = 0; i < rec->core.n_cigar; ++i) {
 	      if (bam_cigar_op(cigar[i]) == BAM_CMATCH) {
-		for(std::size_t k = 0; k<bam_cigar_oplen(cigar[i]);++k) {
-		  if ((rec->core.pos + rp < hdr[file_c]->target_len[refIndex]) && (covBases[rec->core.pos + rp] < maxCoverage - 1)) ++covBases[rec->core.pos + rp];
-		  ++rp;
-		}
+		addCoverage(covBases, rec->core.pos + rp, rec->core.pos + rp + bam_cigar_oplen(cigar[i]));
+		rp += bam_cigar_oplen(cigar[i]);
 	      } else if (bam_cigar_op(cigar[i]) == BAM_CDEL) {
 		rp += bam_cigar_oplen(cigar[i]);
 	      } else if (bam_cigar_op(cigar[i]) == BAM_CREF_SKIP) {
@@ -416,96 +639,99 @@ namespace torali {
 	  
 	  // Check read length for junction annotation
 	  if (rec->core.l_qseq >= (2 * c.minimumFlankSize)) {
-	    bool bpvalid = false;
+	    // Fetch all open breakpoint windows within the read
 	    int32_t rbegin = std::max(0, (int32_t) rec->core.pos - leadingSC);
-	    for(int32_t k = rbegin; ((k < (rec->core.pos + rec->core.l_qseq)) && (k < (int32_t) hdr[file_c]->target_len[refIndex])); ++k) {
-	      if (bpOccupied[k]) {
-		bpvalid = true;
-		break;
+	    uint32_t bpIdx = _nextOpenBp(openBp, _gallopLowerBound(bpRegion[refIndex].begin(), bpRegion[refIndex].end(), bpHint, BpRegion(rbegin), SortBp<BpRegion>()) - bpRegion[refIndex].begin());
+	    for(; ((bpIdx < bpRegion[refIndex].size()) && (rec->core.pos + rec->core.l_qseq >= bpRegion[refIndex][bpIdx].bppos)); bpIdx = _nextOpenBp(openBp, bpIdx + 1)) {
+	      typename TBpRegion::iterator itBp = bpRegion[refIndex].begin() + bpIdx;
+	      TGenoRunning& gr = (c.genoStopGQ) ? genoRunning[file_c][itBp->id] : noGeno;
+	      bool tra = svTra[itBp->id];
+	      if ((!tra) && ((countMap[file_c][itBp->id].ref.size() + countMap[file_c][itBp->id].alt.size() + gr.skipped) >= c.maxGenoReadCount)) {
+		_closeBp(openBp, bpIdx);
+		continue;
 	      }
-	    }
-	    if (bpvalid) {
-	      // Fetch all relevant SVs
-	      typename TBpRegion::iterator itBp = std::lower_bound(bpRegion[refIndex].begin(), bpRegion[refIndex].end(), BpRegion(rbegin), SortBp<BpRegion>());
-	      for(; ((itBp != bpRegion[refIndex].end()) && (rec->core.pos + rec->core.l_qseq >= itBp->bppos)); ++itBp) {
-		if ((countMap[file_c][itBp->id].ref.size() + countMap[file_c][itBp->id].alt.size()) >= c.maxGenoReadCount) continue;
-		// Read spans breakpoint?
-		if ((hasSoftClip) || ((!hasClip) && (rec->core.pos + c.minimumFlankSize + itBp->homLeft <= itBp->bppos) &&  (rec->core.pos + rec->core.l_qseq >= itBp->bppos + c.minimumFlankSize + itBp->homRight))) {
-		  std::string consProbe = consProbeArr[itBp->bpPoint][itBp->id];
-		  std::string refProbe = refProbeArr[itBp->bpPoint][itBp->id];
+	      // Read spans breakpoint?
+	      if ((hasSoftClip) || ((!hasClip) && (rec->core.pos + c.minimumFlankSize + itBp->homLeft <= itBp->bppos) &&  (rec->core.pos + rec->core.l_qseq >= itBp->bppos + c.minimumFlankSize + itBp->homRight))) {
+		// Genotype already confident?
+		if ((!tra) && (gr.settled)) {
+		  ++gr.skipped;
+		  continue;
+		}
+		std::string const& consProbe = consProbeArr[itBp->bpPoint][itBp->id];
+		std::string const& refProbe = refProbeArr[itBp->bpPoint][itBp->id];
 		  
-		  // Get sequence
-		  std::string sequence;
-		  sequence.resize(rec->core.l_qseq);
-		  uint8_t* seqptr = bam_get_seq(rec);
-		  for (int i = 0; i < rec->core.l_qseq; ++i) sequence[i] = "=ACMGRSVTWYHKDBN"[bam_seqi(seqptr, i)];
-		  _adjustOrientation(sequence, itBp->bpPoint, itBp->svt);
+		// Get sequence
+		unpackRead(cachedRead(rc, rec), _reverseOrientation(itBp->bpPoint, itBp->svt), sequence);
 		
-		  // Compute alignment to alternative haplotype
-		  typedef boost::multi_array<char, 2> TAlign;
-		  TAlign alignAlt;
-		  DnaScore<int> simple(5, -4, -4, -4);
-		  AlignConfig<true, false> semiglobal;
-		  int32_t scoreA = needle(consProbe, sequence, alignAlt, semiglobal, simple);
-		  int32_t scoreAltThreshold = (int32_t) (c.flankQuality * consProbe.size() * simple.match + (1.0 - c.flankQuality) * consProbe.size() * simple.mismatch);
-		  double scoreAlt = (double) scoreA / (double) scoreAltThreshold;
+		// Compute alignment to alternative haplotype
+		typedef boost::multi_array<char, 2> TAlign;
+		TAlign alignAlt;
+		DnaScore<int> simple(5, -4, -4, -4);
+		AlignConfig<true, false> semiglobal;
+		int32_t scoreA = needle(consProbe, sequence, alignAlt, semiglobal, simple, ws);
+		int32_t scoreAltThreshold = (int32_t) (c.flankQuality * consProbe.size() * simple.match + (1.0 - c.flankQuality) * consProbe.size() * simple.mismatch);
+		double scoreAlt = (double) scoreA / (double) scoreAltThreshold;
 		  
-		  // Compute alignment to reference haplotype
-		  TAlign alignRef;
-		  int32_t scoreR = needle(refProbe, sequence, alignRef, semiglobal, simple);
-		  int32_t scoreRefThreshold = (int32_t) (c.flankQuality * refProbe.size() * simple.match + (1.0 - c.flankQuality) * refProbe.size() * simple.mismatch);
-		  double scoreRef = (double) scoreR / (double) scoreRefThreshold;
+		// Compute alignment to reference haplotype
+		TAlign alignRef;
+		int32_t scoreR = needle(refProbe, sequence, alignRef, semiglobal, simple, ws);
+		int32_t scoreRefThreshold = (int32_t) (c.flankQuality * refProbe.size() * simple.match + (1.0 - c.flankQuality) * refProbe.size() * simple.mismatch);
+		double scoreRef = (double) scoreR / (double) scoreRefThreshold;
 		  
-		  // Any confident alignment?
-		  if ((scoreRef > 1) || (scoreAlt > 1)) {
-		    // Debug alignment to REF and ALT
-		    //std::cerr << "Alt:\t" << scoreAlt << "\tRef:\t" << scoreRef << std::endl;
-		    //for(TAIndex i = 0; i< (TAIndex) alignAlt.shape()[0]; ++i) {
-		    //for(TAIndex j = 0; j< (TAIndex) alignAlt.shape()[1]; ++j) std::cerr << alignAlt[i][j];
-		    //std::cerr << std::endl;
-		    //}
-		    //for(TAIndex i = 0; i< (TAIndex) alignRef.shape()[0]; ++i) {
-		    //for(TAIndex j = 0; j< (TAIndex) alignRef.shape()[1]; ++j) std::cerr << alignRef[i][j];
-		    //std::cerr << std::endl;
-		    //}
+		// Any confident alignment?
+		if ((scoreRef > 1) || (scoreAlt > 1)) {
+		  // Debug alignment to REF and ALT
+		  //std::cerr << "Alt:\t" << scoreAlt << "\tRef:\t" << scoreRef << std::endl;
+		  //for(TAIndex i = 0; i< (TAIndex) alignAlt.shape()[0]; ++i) {
+		  //for(TAIndex j = 0; j< (TAIndex) alignAlt.shape()[1]; ++j) std::cerr << alignAlt[i][j];
+		  //std::cerr << std::endl;
+		  //}
+		  //for(TAIndex i = 0; i< (TAIndex) alignRef.shape()[0]; ++i) {
+		  //for(TAIndex j = 0; j< (TAIndex) alignRef.shape()[1]; ++j) std::cerr << alignRef[i][j];
+		  //std::cerr << std::endl;
+		  //}
 		    
-		    if (scoreRef > scoreAlt) {
-		      // Account for reference bias
-		      if (++refAlignedReadCount[file_c][itBp->id] % 2) {
-			TQuality quality;
-			quality.resize(rec->core.l_qseq);
-			uint8_t* qualptr = bam_get_qual(rec);
-			for (int i = 0; i < rec->core.l_qseq; ++i) quality[i] = qualptr[i];
-			uint32_t rq = _getAlignmentQual(alignRef, quality);
-			if (rq >= c.minGenoQual) {
-#pragma omp critical
-			  {
-			    countMap[file_c][itBp->id].ref.push_back((uint8_t) std::min(rq, (uint32_t) rec->core.qual));
-			  }
-			}
-		      }
-		    } else {
+		  if (scoreRef > scoreAlt) {
+		    // Account for reference bias
+		    if ((tra) || (++refAlignedReadCount[file_c][itBp->id] % 2)) {
 		      TQuality quality;
 		      quality.resize(rec->core.l_qseq);
 		      uint8_t* qualptr = bam_get_qual(rec);
 		      for (int i = 0; i < rec->core.l_qseq; ++i) quality[i] = qualptr[i];
-		      uint32_t aq = _getAlignmentQual(alignAlt, quality);
-		      if (aq >= c.minGenoQual) {
+		      uint32_t rq = _getAlignmentQual(alignRef, quality);
+		      if (tra) gs.events.push_back(GenoEvent(itBp->id, (uint8_t) std::min(rq, (uint32_t) rec->core.qual), 0, (rq >= c.minGenoQual), -1));
+		      else if (rq >= c.minGenoQual) {
+			if (c.genoStopGQ) _addRunningRead(bl, gr, (uint8_t) std::min(rq, (uint32_t) rec->core.qual), false, c.genoStopGQ);
 #pragma omp critical
 			{
-			  if (c.hasDumpFile) {
-			    std::string svid(_addID(itBp->svt));
-			    std::string padNumber = boost::lexical_cast<std::string>(itBp->id);
-			    padNumber.insert(padNumber.begin(), 8 - padNumber.length(), '0');
-			    svid += padNumber;
-			    dumpOut << svid << "\t" << c.files[file_c].string() << "\t" << bam_get_qname(rec) << "\t" << hdr[file_c]->target_name[rec->core.tid] << "\t" << rec->core.pos << "\t" << hdr[file_c]->target_name[rec->core.mtid] << "\t" << rec->core.mpos << "\t" << (int32_t) rec->core.qual << "\tSR" << std::endl;
-			  }
-			  countMap[file_c][itBp->id].alt.push_back((uint8_t) std::min(aq, (uint32_t) rec->core.qual));
+			  countMap[file_c][itBp->id].ref.push_back((uint8_t) std::min(rq, (uint32_t) rec->core.qual));
 			}
 		      }
 		    }
+		  } else {
+		    TQuality quality;
+		    quality.resize(rec->core.l_qseq);
+		    uint8_t* qualptr = bam_get_qual(rec);
+		    for (int i = 0; i < rec->core.l_qseq; ++i) quality[i] = qualptr[i];
+		    uint32_t aq = _getAlignmentQual(alignAlt, quality);
+		    if ((tra) && (aq >= c.minGenoQual)) {
+		      int32_t dump = -1;
+		      if (c.hasDumpFile) {
+			dump = gs.dump.size();
+			gs.dump.push_back(_genoDumpLine(c, file_c, rhdr, rec, itBp->svt, itBp->id, "SR"));
+		      }
+		      gs.events.push_back(GenoEvent(itBp->id, (uint8_t) std::min(aq, (uint32_t) rec->core.qual), 1, true, dump));
+		    } else if ((tra) && (c.genoStopGQ)) gs.events.push_back(GenoEvent(itBp->id, 0, 2, false, -1));
+		    else if (aq >= c.minGenoQual) {
+		      if (c.genoStopGQ) _addRunningRead(bl, gr, (uint8_t) std::min(aq, (uint32_t) rec->core.qual), true, c.genoStopGQ);
+#pragma omp critical
+		      {
+			if (c.hasDumpFile) dumpOut << _genoDumpLine(c, file_c, rhdr, rec, itBp->svt, itBp->id, "SR") << std::endl;
+			countMap[file_c][itBp->id].alt.push_back((uint8_t) std::min(aq, (uint32_t) rec->core.qual));
+		      }
+		    }
 		  }
-		}
+		} else if ((tra) && (c.genoStopGQ)) gs.events.push_back(GenoEvent(itBp->id, 0, 2, false, -1)); // Counts as skipped once the genotype is confident
 	      }
 	    }
 	  }
@@ -526,10 +752,7 @@ namespace torali {
 	    if (rec->core.tid == rec->core.mtid) {
 	      qualities[hv] = rec->core.qual;
 	      clip[hv] = hasSoftClip;
-	    } else {
-	      qualitiestra[hv] = rec->core.qual;
-	      cliptra[hv] = hasSoftClip;
-	    }
+	    } else gs.tra.push_back(GenoTraRead(true, rec->core.qual, hv, 0, 0));
 	  } else {
 	    // Second read
 	    std::size_t hv = hash_pair_mate(rec);
@@ -541,13 +764,7 @@ namespace torali {
 	      if ((clip[hv]) || (hasSoftClip)) pairClip = true;
 	      qualities[hv] = 0;
 	      clip[hv] = false;
-	    } else {
-	      if (qualitiestra.find(hv) == qualitiestra.end()) continue; // Mate discarded
-	      pairQuality = std::min((uint8_t) qualitiestra[hv], (uint8_t) rec->core.qual);
-	      if ((cliptra[hv]) || (hasSoftClip)) pairClip = true;
-	      qualitiestra[hv] = 0;
-	      cliptra[hv] = false;
-	    }
+	    } else pairQuality = rec->core.qual; // Mate quality is applied by the last task of the sample
 
 	    // Pair quality
 	    if (pairQuality < c.minGenoQual) continue; // Low quality pair
@@ -556,7 +773,7 @@ namespace torali {
 	    if (rec->core.tid == rec->core.mtid) {
 	      // Count mid point (fragment counting)
 	      int32_t midPoint = rec->core.pos + halfAlignmentLength(rec);
-	      if ((midPoint < (int32_t) hdr[file_c]->target_len[refIndex]) && (covFragment[midPoint] < maxCoverage - 1)) ++covFragment[midPoint];
+	      if ((!rdChr) || (_inExactWindow(exact, midPoint))) addCoverage(covFragment, midPoint, midPoint + 1);
 	    }
 
 	    // Spanning counting
@@ -573,19 +790,14 @@ namespace torali {
 	      int32_t spanlen = 0.8 * outerISize;
 	      int32_t pbegin = std::min((int32_t) rec->core.pos, (int32_t) rec->core.mpos);
 	      int32_t st = pbegin + (outerISize - spanlen) / 2;
-	      bool spanvalid = false;
-	      for(int32_t i = st; ((i < (st + spanlen)) &&  (i < (int32_t) hdr[file_c]->target_len[refIndex])); ++i) {
-		if (spanBp[i]) {
-		  spanvalid = true;
-		  break;
-		}
-	      }
+	      typename TSpanPoint::iterator itSpan = _gallopLowerBound(spanPoint.begin(), spanPoint.end(), refSpanHint, SpanPoint(st), SortBp<SpanPoint>());
+	      bool spanvalid = ((itSpan != spanPoint.end()) && (itSpan->bppos < st + spanlen));
 	      if (spanvalid) {
 		// Fetch all relevant SVs
-		typename TSpanPoint::iterator itSpan = std::lower_bound(spanPoint.begin(), spanPoint.end(), SpanPoint(st), SortBp<SpanPoint>());
 		for(; ((itSpan != spanPoint.end()) && (st + spanlen >= itSpan->bppos)); ++itSpan) {
 		  // Account for reference bias
-		  if (++refAlignedSpanCount[file_c][itSpan->id] % 2) {
+		  if (svTra[itSpan->id]) gs.events.push_back(GenoEvent(itSpan->id, pairQuality, 3, true, -1));
+		  else if (++refAlignedSpanCount[file_c][itSpan->id] % 2) {
 #pragma omp critical
 		    {
 		      spanMap[file_c][itSpan->id].ref.push_back(pairQuality);
@@ -602,36 +814,34 @@ namespace torali {
 	      if (svt == -1) continue;
 	      
 	      // Spanning a breakpoint?
-	      bool spanvalid = false;
 	      int32_t pbegin = rec->core.pos;
-	      int32_t pend = std::min((int32_t) rec->core.pos + sampleLib[file_c].maxNormalISize, (int32_t) hdr[file_c]->target_len[refIndex]);
+	      int32_t pend = std::min((int32_t) rec->core.pos + sampleLib[file_c].maxNormalISize, (int32_t) rhdr->target_len[refIndex]);
 	      if (rec->core.flag & BAM_FREVERSE) {
 		pbegin = std::max(0, (int32_t) rec->core.pos + rec->core.l_qseq - sampleLib[file_c].maxNormalISize);
-		pend = std::min((int32_t) rec->core.pos + rec->core.l_qseq, (int32_t) hdr[file_c]->target_len[refIndex]);
-	      }
-	      for(int32_t i = pbegin; i < pend; ++i) {
-		if (spanBp[i]) {
-		  spanvalid = true;
-		  break;
-		}
+		pend = std::min((int32_t) rec->core.pos + rec->core.l_qseq, (int32_t) rhdr->target_len[refIndex]);
 	      }
+	      typename TSpanPoint::iterator itSpan = _gallopLowerBound(spanPoint.begin(), spanPoint.end(), altSpanHint, SpanPoint(pbegin), SortBp<SpanPoint>());
+	      bool spanvalid = ((itSpan != spanPoint.end()) && (itSpan->bppos < pend));
+	      uint32_t hitStart = gs.traHit.size();
 	      if (spanvalid) {
 		// Fetch all relevant SVs
-		typename TSpanPoint::iterator itSpan = std::lower_bound(spanPoint.begin(), spanPoint.end(), SpanPoint(pbegin), SortBp<SpanPoint>());
 		for(; ((itSpan != spanPoint.end()) && (pend >= itSpan->bppos)); ++itSpan) {
 		  if (svt == itSpan->svt) {
 		    // Make sure, mate is correct
 		    if (rec->core.mtid == itSpan->chr2) {
 		      if (std::abs((int32_t) rec->core.mpos - itSpan->otherBppos) < sampleLib[file_c].maxNormalISize) {
-#pragma omp critical
-			{
+			if (rec->core.tid != rec->core.mtid) {
+			  int32_t dump = -1;
 			  if (c.hasDumpFile) {
-			    std::string svid(_addID(itSpan->svt));
-			    std::string padNumber = boost::lexical_cast<std::string>(itSpan->id);
-			    padNumber.insert(padNumber.begin(), 8 - padNumber.length(), '0');
-			    svid += padNumber;
-			    dumpOut << svid << "\t" << c.files[file_c].string() << "\t" << bam_get_qname(rec) << "\t" << hdr[file_c]->target_name[rec->core.tid] << "\t" << rec->core.pos << "\t" << hdr[file_c]->target_name[rec->core.mtid] << "\t" << rec->core.mpos << "\t" << (int32_t) rec->core.qual << "\tPE" << std::endl;
+			    dump = gs.dump.size();
+			    gs.dump.push_back(_genoDumpLine(c, file_c, rhdr, rec, itSpan->svt, itSpan->id, "PE"));
 			  }
+			  gs.traHit.push_back(std::make_pair(itSpan->id, dump));
+			  continue;
+			}
+#pragma omp critical
+			{
+			  if (c.hasDumpFile) dumpOut << _genoDumpLine(c, file_c, rhdr, rec, itSpan->svt, itSpan->id, "PE") << std::endl;
 			  spanMap[file_c][itSpan->id].alt.push_back(pairQuality);
 			}
 		      }
@@ -639,75 +849,155 @@ namespace torali {
 		  }
 		}
 	      }
+	      if (gs.traHit.size() > hitStart) gs.tra.push_back(GenoTraRead(false, rec->core.qual, hv, hitStart, gs.traHit.size()));
 	    }
 	  }
 	}
 	// Clean-up
 	bam_destroy1(rec);
 	hts_itr_destroy(iter);
-	qualities.clear();
-	clip.clear();
+	clearReadCache(rc);
+	closeCoverage(covFragment);
+	closeCoverage(covBases);
+
+	// Binned read-depth output, copied from the input matrix if the chromosome was not counted
+	if (rdWrite) {
+	  uint32_t nbins = rdBins(rdOut, refIndex);
+	  std::vector<float> binBases(nbins, 0);
+	  std::vector<float> binFrag(nbins, 0);
+	  if (rdChr) {
+	    readRdBins(rdIn, refIndex, rdSampleIdx, 0, 0, nbins, binBases);
+	    readRdBins(rdIn, refIndex, rdSampleIdx, 1, 0, nbins, binFrag);
+	  } else {
+	    for(uint32_t b = 0; b < nbins; ++b) {
+	      int32_t bstart = b * DELLY_RDMATRIX_BINSIZE;
+	      int32_t bend = std::min(bstart + DELLY_RDMATRIX_BINSIZE, (int32_t) rhdr->target_len[refIndex]);
+	      binBases[b] = coverageSum(covBases, bstart, bend);
+	      binFrag[b] = coverageSum(covFragment, bstart, bend);
+	    }
+	  }
+#pragma omp critical
+	  {
+	    writeRdColumn(rdOut, refIndex, file_c, 0, binBases);
+	    writeRdColumn(rdOut, refIndex, file_c, 1, binFrag);
+	  }
+	}
 	
 	// Assign fragment and base counts to SVs
 	for(uint32_t i = 0; i < svs.size(); ++i) {
 	  if (svs[i].chr == refIndex) {
-	    // Small or large SV
-	    bool smallSV = false;
-	    int32_t halfSize = (svs[i].svEnd - svs[i].svStart)/2;
-	    if ((_translocation(svs[i].svt)) || (svs[i].svt == 4)) {
-	      halfSize = 500;
-	      smallSV = true;
-	    } else {
-	      if ((svs[i].svEnd - svs[i].svStart) <= c.indelsize) smallSV = true;
-	    }
-
-	    // Left region
-	    int32_t lstart = std::max(svs[i].svStart - halfSize, 0);
-	    int32_t lend = svs[i].svStart;
-	    int32_t covbase = 0;
-	    for(uint32_t k = lstart; ((k < (uint32_t) lend) && (k < hdr[0]->target_len[refIndex])); ++k) {
-	      if (smallSV) covbase += covBases[k];
-	      else covbase += covFragment[k];
+	    DepthWindows dw;
+	    _depthWindows(c, svs[i], rhdr->target_len[refIndex], dw);
+	    covCount[file_c][svs[i].id].leftRC = _regionCoverage(rdRegion, rdSampleIdx, covBases, covFragment, dw.smallSV, refIndex, dw.start[0], dw.end[0]);
+	    covCount[file_c][svs[i].id].rc = _regionCoverage(rdRegion, rdSampleIdx, covBases, covFragment, dw.smallSV, refIndex, dw.start[1], dw.end[1]);
+	    covCount[file_c][svs[i].id].rightRC = _regionCoverage(rdRegion, rdSampleIdx, covBases, covFragment, dw.smallSV, refIndex, dw.start[2], dw.end[2]);
+	  }
+	}
+	if (!finishTask(ts, t)) continue;
+
+	// Last task of the sample, SVs joining two chromosomes are counted in chromosome order
+	typedef boost::unordered_map<std::size_t, uint8_t> TMateQual;
+	TMateQual matetra;
+	for(uint32_t k = 0; k < sampleTasks[file_c].size(); ++k) {
+	  GenoScan& ps = taskScan[sampleTasks[file_c][k].second];
+
+	  // Junction reads and reference spanning pairs
+	  for(uint32_t i = 0; i < ps.events.size(); ++i) {
+	    GenoEvent const& ev = ps.events[i];
+	    if (ev.type == 3) {
+	      if (++refAlignedSpanCount[file_c][ev.id] % 2) spanMap[file_c][ev.id].ref.push_back(ev.qual);
+	      continue;
 	    }
-	    covCount[file_c][svs[i].id].leftRC = covbase;
-
-	    // Actual SV
-	    covbase = 0;
-	    int32_t mstart = svs[i].svStart;
-	    int32_t mend = svs[i].svEnd;
-	    if ((_translocation(svs[i].svt)) || (svs[i].svt == 4)) {
-	      mstart = std::max(svs[i].svStart - halfSize, 0);
-	      mend = std::min(svs[i].svStart + halfSize, (int32_t) hdr[0]->target_len[refIndex]);
+	    TGenoRunning& gr = (c.genoStopGQ) ? genoRunning[file_c][ev.id] : noGeno;
+	    TCountPair& cp = countMap[file_c][ev.id];
+	    if ((cp.ref.size() + cp.alt.size() + gr.skipped) >= c.maxGenoReadCount) continue;
+	    if (gr.settled) {
+	      ++gr.skipped;
+	      continue;
 	    }
-	    for(uint32_t k = mstart; ((k < (uint32_t) mend) && (k < hdr[0]->target_len[refIndex])); ++k) {
-	      if (smallSV) covbase += covBases[k];
-	      else covbase += covFragment[k];
+	    if (ev.type == 0) {
+	      if ((++refAlignedReadCount[file_c][ev.id] % 2) && (ev.pass)) {
+		if (c.genoStopGQ) _addRunningRead(bl, gr, ev.qual, false, c.genoStopGQ);
+		cp.ref.push_back(ev.qual);
+	      }
+	    } else if (ev.type == 1) {
+	      if (c.genoStopGQ) _addRunningRead(bl, gr, ev.qual, true, c.genoStopGQ);
+	      cp.alt.push_back(ev.qual);
+	      if (ev.dump >= 0) {
+#pragma omp critical
+		{
+		  dumpOut << ps.dump[ev.dump] << std::endl;
+		}
+	      }
 	    }
-	    covCount[file_c][svs[i].id].rc = covbase;
-
-	    // Right region
-	    covbase = 0;
-	    int32_t rstart = svs[i].svEnd;
-	    int32_t rend = std::min(svs[i].svEnd + halfSize, (int32_t) hdr[0]->target_len[refIndex]);
-	    if ((_translocation(svs[i].svt)) || (svs[i].svt == 4)) {
-	      rstart = svs[i].svStart;
-	      rend = std::min(svs[i].svStart + halfSize, (int32_t) hdr[0]->target_len[refIndex]);
+	  }
+
+	  // Inter-chromosomal pairs, first reads always come from the lower chromosome
+	  for(uint32_t i = 0; i < ps.tra.size(); ++i) {
+	    GenoTraRead const& tr = ps.tra[i];
+	    if (tr.first) {
+	      matetra[tr.hv] = tr.qual;
+	      continue;
 	    }
-	    for(uint32_t k = rstart; ((k < (uint32_t) rend) && (k < hdr[0]->target_len[refIndex])); ++k) {
-	      if (smallSV) covbase += covBases[k];
-	      else covbase += covFragment[k];
+	    TMateQual::iterator itMate = matetra.find(tr.hv);
+	    if (itMate == matetra.end()) continue; // Mate discarded
+	    uint8_t pairQuality = std::min(itMate->second, tr.qual);
+	    itMate->second = 0;
+	    if (pairQuality < c.minGenoQual) continue; // Low quality pair
+	    for(uint32_t h = tr.hitStart; h < tr.hitEnd; ++h) {
+	      spanMap[file_c][ps.traHit[h].first].alt.push_back(pairQuality);
+	      if (ps.traHit[h].second >= 0) {
+#pragma omp critical
+		{
+		  dumpOut << ps.dump[ps.traHit[h].second] << std::endl;
+		}
+	      }
 	    }
-	    covCount[file_c][svs[i].id].rightRC = covbase;
+	  }
+	  ps = GenoScan();
+	}
+
+	// Early termination statistics, the running state of the sample is no longer needed
+	if (c.genoStopGQ) {
+	  uint64_t settled = 0;
+	  uint64_t skipped = 0;
+	  for(uint32_t i = 0; i < genoRunning[file_c].size(); ++i) {
+	    if (genoRunning[file_c][i].settled) ++settled;
+	    skipped += genoRunning[file_c][i].skipped;
+	  }
+	  std::vector<TGenoRunning>().swap(genoRunning[file_c]);
+#pragma omp critical
+	  {
+	    settledGeno += settled;
+	    skippedReads += skipped;
 	  }
 	}
       }
+
+      // Close alignment file
+      if (tfile != NULL) {
+	hts_idx_destroy(tidx);
+	sam_close(tfile);
+      }
+#pragma omp critical
+      {
+	cacheHits += rc.hits;
+	cacheMisses += rc.misses;
+      }
     }
+
+    // Read cache use and alignments saved by adaptive early termination
+    now = boost::posix_time::second_clock::local_time();
+    std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] " << "Read cache hits: " << cacheHits << ", misses: " << cacheMisses;
+    if (c.genoStopGQ) std::cerr << ", early-terminated genotypes: " << settledGeno << ", skipped alignments: " << 2 * skippedReads;
+    std::cerr << std::endl;
+    
+    if ((rdWrite) && (!closeRdMatrix(rdOut))) std::cerr << "Warning: Read-depth matrix cannot be written: " << c.rdfile.string() << std::endl;
+    
     // Clean-up
-    for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-      bam_hdr_destroy(hdr[file_c]);
-      hts_idx_destroy(idx[file_c]);
-      sam_close(samfile[file_c]);    
-    }
+    bam_hdr_destroy(rhdr);
+    sam_close(rfile);
+    return true;
   }
 
 }
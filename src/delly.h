@@ -37,6 +37,7 @@
 #include "split.h"
 #include "shortpe.h"
 #include "modvcf.h"
+#include "checkpoint.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -54,6 +55,8 @@ namespace torali
     uint16_t minGenoQual;
     uint16_t madCutoff;
     uint16_t madNormalCutoff;
+    uint16_t ioThreads;
+    uint16_t threads;
     int32_t nchr;
     int32_t minimumFlankSize;
     int32_t indelsize;
@@ -63,11 +66,19 @@ namespace torali
     uint32_t maxReadSep;
     uint32_t minClip;
     uint32_t maxGenoReadCount;
+    uint32_t genoStopGQ;
     uint32_t minCliqueSize;
+    uint32_t memory;
     float flankQuality;
     bool hasExcludeFile;
     bool hasVcfFile;
     bool hasDumpFile;
+    bool hasCheckpointFile;
+    bool hasEvidenceDir;
+    bool hasRdFile;
+    bool hasRdInput;
+    bool approxGeno;
+    bool resume;
     std::set<int32_t> svtset;
     DnaScore<int> aliscore;
     boost::filesystem::path outfile;
@@ -75,6 +86,10 @@ namespace torali
     boost::filesystem::path genome;
     boost::filesystem::path exclude;
     boost::filesystem::path dumpfile;
+    boost::filesystem::path ckpfile;
+    boost::filesystem::path evidencedir;
+    boost::filesystem::path rdfile;
+    boost::filesystem::path rdinput;
     std::vector<boost::filesystem::path> files;
     std::vector<std::string> sampleName;
   };
@@ -86,7 +101,8 @@ namespace torali
     ProfilerStart("delly.prof");
 #endif
 
-    // Collect all promising structural variants
+    // Collect all promising structural variants, their sequences live in the pool of this run
+    SequencePoolScope poolScope;
     typedef std::vector<StructuralVariantRecord> TVariants;
     TVariants svs;
     
@@ -115,7 +131,13 @@ namespace torali
     // Create library objects
     typedef std::vector<LibraryInfo> TSampleLibrary;
     TSampleLibrary sampleLib(c.files.size(), LibraryInfo());
-    getLibraryParams(c, validRegions, sampleLib);
+    if ((c.hasVcfFile) && (c.hasEvidenceDir)) {
+      if (!getEvidenceLibraryParams(c, sampleLib)) {
+	bam_hdr_destroy(hdr);
+	sam_close(samfile);
+	return 1;
+      }
+    } else getLibraryParams(c, validRegions, sampleLib);
     for(uint32_t i = 0; i<sampleLib.size(); ++i) {
       if (sampleLib[i].rs == 0) {
 	std::cerr << "Sample has not enough data to estimate library parameters! File: " << c.files[i].string() << std::endl;
@@ -125,36 +147,6 @@ namespace torali
       }
     }
     
-    // SV Discovery
-    if (!c.hasVcfFile) {
-      // Split-read SVs
-      typedef std::vector<StructuralVariantRecord> TVariants;
-      TVariants srSVs;
-      
-      // SR Store
-      {
-	typedef std::pair<int32_t, std::size_t> TPosRead;
-	typedef boost::unordered_map<TPosRead, int32_t> TPosReadSV;
-	typedef std::vector<TPosReadSV> TGenomicPosReadSV;
-	TGenomicPosReadSV srStore(c.nchr, TPosReadSV());
-	scanPEandSR(c, validRegions, svs, srSVs, srStore, sampleLib);
-	
-	// Assemble split-read calls
-	assembleSplitReads(c, validRegions, srStore, srSVs);
-      }
-
-      // Sort and merge PE and SR calls
-      mergeSort(svs, srSVs);
-    } else vcfParse(c, hdr, svs);
-    // Clean-up
-    bam_hdr_destroy(hdr);
-    sam_close(samfile);
-
-    // Re-number SVs
-    sort(svs.begin(), svs.end(), SortSVs<StructuralVariantRecord>());    
-    uint32_t cliqueCount = 0;
-    for(typename TVariants::iterator svIt = svs.begin(); svIt != svs.end(); ++svIt, ++cliqueCount) svIt->id = cliqueCount;
-    
     // Annotate junction reads
     typedef std::vector<JunctionCount> TSVJunctionMap;
     typedef std::vector<TSVJunctionMap> TSampleSVJunctionMap;
@@ -169,12 +161,103 @@ namespace torali
     typedef std::vector<ReadCount> TSVReadCount;
     typedef std::vector<TSVReadCount> TSampleSVReadCount;
     TSampleSVReadCount rcMap;
+
+    // Resume from checkpoint?
+    int32_t resumeStage = DELLY_STAGE_NONE;
+    if (c.resume) {
+      resumeStage = checkpointStage(c);
+
+      // The evidence index is written by the scan, it is only skipped if all indexes are in place
+      if ((resumeStage != DELLY_STAGE_NONE) && (c.hasEvidenceDir) && (!c.hasVcfFile)) {
+	for(uint32_t file_c = 0; file_c < c.files.size(); ++file_c) {
+	  EvidenceFile ef;
+	  if ((!readEvidenceHeader(c, file_c, ef)) || ((int32_t) ef.tname.size() != hdr->n_targets)) {
+	    std::cerr << "Warning: Evidence index is missing or invalid, checkpoint is ignored: " << evidenceFile(c, file_c).string() << std::endl;
+	    resumeStage = DELLY_STAGE_NONE;
+	    break;
+	  }
+	}
+      }
+      boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
+      if (resumeStage == DELLY_STAGE_NONE) std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] " << "No valid checkpoint found" << std::endl;
+      else std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] " << "Resume after " << _stageName(resumeStage) << std::endl;
+    }
+
+    if (resumeStage == DELLY_STAGE_COVERAGE) {
+      if (!readCheckpoint(c, sampleLib, svs, rcMap, jctMap, spanMap)) {
+	std::cerr << "Fail to read checkpoint file " << c.ckpfile.string() << std::endl;
+	bam_hdr_destroy(hdr);
+	sam_close(samfile);
+	return 1;
+      }
+      bam_hdr_destroy(hdr);
+      sam_close(samfile);
+    } else {
+      // SV Discovery
+      if (resumeStage == DELLY_STAGE_ASSEMBLY) {
+	if (!readCheckpoint(c, sampleLib, svs)) {
+	  std::cerr << "Fail to read checkpoint file " << c.ckpfile.string() << std::endl;
+	  bam_hdr_destroy(hdr);
+	  sam_close(samfile);
+	  return 1;
+	}
+      } else if (!c.hasVcfFile) {
+	// Split-read SVs
+	typedef std::vector<StructuralVariantRecord> TVariants;
+	TVariants srSVs;
+	
+	// SR Store
+	{
+	  typedef std::pair<int32_t, std::size_t> TPosRead;
+	  typedef boost::unordered_map<TPosRead, int32_t> TPosReadSV;
+	  typedef std::vector<TPosReadSV> TGenomicPosReadSV;
+	  TGenomicPosReadSV srStore(c.nchr, TPosReadSV());
+	  if (resumeStage == DELLY_STAGE_CLUSTER) {
+	    if (!readCheckpoint(c, sampleLib, svs, srSVs, srStore)) {
+	      std::cerr << "Fail to read checkpoint file " << c.ckpfile.string() << std::endl;
+	      bam_hdr_destroy(hdr);
+	      sam_close(samfile);
+	      return 1;
+	    }
+	  } else {
+	    if (!scanPEandSR(c, validRegions, svs, srSVs, srStore, sampleLib)) {
+	      bam_hdr_destroy(hdr);
+	      sam_close(samfile);
+	      return 1;
+	    }
+	    if (c.hasCheckpointFile) writeCheckpoint(c, sampleLib, svs, srSVs, srStore);
+	  }
+	  
+	  // Assemble split-read calls
+	  assembleSplitReads(c, validRegions, srStore, srSVs);
+	}
+	
+	// Sort and merge PE and SR calls
+	mergeSort(svs, srSVs);
+      } else vcfParse(c, hdr, svs);
+      // Clean-up
+      bam_hdr_destroy(hdr);
+      sam_close(samfile);
+
+      // Re-number SVs
+      if (resumeStage != DELLY_STAGE_ASSEMBLY) {
+	sort(svs.begin(), svs.end(), SortSVs<StructuralVariantRecord>());    
+	uint32_t cliqueCount = 0;
+	for(typename TVariants::iterator svIt = svs.begin(); svIt != svs.end(); ++svIt, ++cliqueCount) svIt->id = cliqueCount;
+	if (c.hasCheckpointFile) writeCheckpoint(c, sampleLib, svs);
+      }
     
-    // SV Genotyping
-    if (!svs.empty()) annotateCoverage(c, sampleLib, svs, rcMap, jctMap, spanMap);
+      // SV Genotyping
+      if (!svs.empty()) {
+	if ((c.hasVcfFile) && (c.hasEvidenceDir)) {
+	  if (!annotateEvidence(c, sampleLib, svs, rcMap, jctMap, spanMap)) return 1;
+	} else if (!annotateCoverage(c, sampleLib, svs, rcMap, jctMap, spanMap)) return 1;
+      }
+      if (c.hasCheckpointFile) writeCheckpoint(c, sampleLib, svs, rcMap, jctMap, spanMap);
+    }
     
     // VCF output
-    vcfOutput(c, svs, jctMap, rcMap, spanMap);
+    vcfOutput(c, svs, jctMap, rcMap, spanMap, c.approxGeno);
     
     // Output library statistics
     boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
@@ -207,6 +290,9 @@ namespace torali
       ("genome,g", boost::program_options::value<boost::filesystem::path>(&c.genome), "genome fasta file")
       ("exclude,x", boost::program_options::value<boost::filesystem::path>(&c.exclude), "file with regions to exclude")
       ("outfile,o", boost::program_options::value<boost::filesystem::path>(&c.outfile), "BCF output file")
+      ("io-threads", boost::program_options::value<uint16_t>(&c.ioThreads)->default_value(0), "threads for BAM/CRAM decoding and BCF encoding")
+      ("threads", boost::program_options::value<uint16_t>(&c.threads)->default_value(0), "sample regions processed in parallel [0: OMP_NUM_THREADS]")
+      ("memory", boost::program_options::value<uint32_t>(&c.memory)->default_value(0), "memory budget in MB for concurrent sample regions [0: unlimited]")
       ;
     
     boost::program_options::options_description disc("Discovery options");
@@ -225,6 +311,10 @@ namespace torali
       ("vcffile,v", boost::program_options::value<boost::filesystem::path>(&c.vcffile), "input VCF/BCF file for genotyping")
       ("geno-qual,u", boost::program_options::value<uint16_t>(&c.minGenoQual)->default_value(5), "min. mapping quality for genotyping")
       ("dump,d", boost::program_options::value<boost::filesystem::path>(&c.dumpfile), "gzipped output file for SV-reads (optional)")
+      ("evidence,e", boost::program_options::value<boost::filesystem::path>(&c.evidencedir), "evidence index directory, written during discovery and read instead of the alignments for approximate genotyping")
+      ("approx-geno", "approximate genotyping from the evidence index (-e), junction alt reads are clipped reads at the breakpoint, not realigned")
+      ("rdfile", boost::program_options::value<boost::filesystem::path>(&c.rdfile), "binary read-depth matrix output file (optional)")
+      ("rdinput", boost::program_options::value<boost::filesystem::path>(&c.rdinput), "binary read-depth matrix used for SV read-depth instead of counting")
       ;
 
     // Define hidden options
@@ -234,6 +324,13 @@ namespace torali
       ("pruning,j", boost::program_options::value<uint32_t>(&c.graphPruning)->default_value(1000), "PE graph pruning cutoff")
       ("cons-window,w", boost::program_options::value<int32_t>(&c.minConsWindow)->default_value(100), "consensus window")
       ("max-geno-count,a", boost::program_options::value<uint32_t>(&c.maxGenoReadCount)->default_value(250), "max. number of reads aligned for SR genotyping")
+      ("geno-stop-gq", boost::program_options::value<uint32_t>(&c.genoStopGQ)->default_value(0), "stop SR genotyping of an SV once its GQ reaches this value [0: off]")
+      ;
+
+    boost::program_options::options_description ckp("Checkpoint options");
+    ckp.add_options()
+      ("checkpoint,k", boost::program_options::value<boost::filesystem::path>(&c.ckpfile), "checkpoint file storing completed stages")
+      ("resume", "resume from the last completed stage of the checkpoint file")
       ;
     
     boost::program_options::positional_options_description pos_args;
@@ -241,9 +338,9 @@ namespace torali
     
     // Set the visibility
     boost::program_options::options_description cmdline_options;
-    cmdline_options.add(generic).add(disc).add(geno).add(hidden);
+    cmdline_options.add(generic).add(disc).add(geno).add(ckp).add(hidden);
     boost::program_options::options_description visible_options;
-    visible_options.add(generic).add(disc).add(geno);
+    visible_options.add(generic).add(disc).add(geno).add(ckp);
     boost::program_options::variables_map vm;
     boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(cmdline_options).positional(pos_args).run(), vm);
     boost::program_options::notify(vm);
@@ -376,6 +473,61 @@ namespace torali
       }
     }
     
+    // Evidence index
+    if (vm.count("evidence")) {
+      c.hasEvidenceDir = true;
+      if (c.hasVcfFile) {
+	for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
+	  if (!(boost::filesystem::exists(evidenceFile(c, file_c)) && boost::filesystem::is_regular_file(evidenceFile(c, file_c)))) {
+	    std::cerr << "Evidence index is missing: " << evidenceFile(c, file_c).string() << std::endl;
+	    return 1;
+	  }
+	}
+      } else {
+	boost::system::error_code ec;
+	if (!boost::filesystem::exists(c.evidencedir)) boost::filesystem::create_directories(c.evidencedir, ec);
+	if (!boost::filesystem::is_directory(c.evidencedir)) {
+	  std::cerr << "Evidence index directory cannot be created: " << c.evidencedir.string() << std::endl;
+	  return 1;
+	}
+      }
+    } else c.hasEvidenceDir = false;
+    if (vm.count("approx-geno")) {
+      if ((!c.hasVcfFile) || (!c.hasEvidenceDir)) {
+	std::cerr << "Approximate genotyping (--approx-geno) requires an input VCF (-v) and an evidence index (-e)." << std::endl;
+	return 1;
+      }
+      c.approxGeno = true;
+    } else {
+      if ((c.hasVcfFile) && (c.hasEvidenceDir)) {
+	std::cerr << "Genotyping from the evidence index (-e) is approximate, please confirm with --approx-geno or genotype from the alignments." << std::endl;
+	return 1;
+      }
+      c.approxGeno = false;
+    }
+
+    // Read-depth matrix
+    if (vm.count("rdfile")) c.hasRdFile = true;
+    else c.hasRdFile = false;
+    if (vm.count("rdinput")) {
+      if (!(boost::filesystem::exists(c.rdinput) && boost::filesystem::is_regular_file(c.rdinput))) {
+	std::cerr << "Read-depth matrix is missing: " << c.rdinput.string() << std::endl;
+	return 1;
+      }
+      c.hasRdInput = true;
+    } else c.hasRdInput = false;
+
+    // Checkpointing
+    if (vm.count("checkpoint")) c.hasCheckpointFile = true;
+    else c.hasCheckpointFile = false;
+    if (vm.count("resume")) {
+      if (!c.hasCheckpointFile) {
+	std::cerr << "Please specify the checkpoint file (-k) to resume from." << std::endl;
+	return 1;
+      }
+      c.resume = true;
+    } else c.resume = false;
+    
     // Show cmd
     boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
     std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] ";
@@ -391,7 +543,10 @@ namespace torali
     c.flankQuality = 0.95;
     c.minimumFlankSize = 13;
     c.indelsize = 1000;
-    return dellyRun(c);
+    if (!initHtsThreadPool(c.ioThreads)) return 1;
+    int ret = dellyRun(c);
+    destroyHtsThreadPool();
+    return ret;
   }
 
 }
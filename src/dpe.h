@@ -27,6 +27,10 @@
 #include <htslib/vcf.h>
 #include <htslib/sam.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+
 #include "tags.h"
 #include "coverage.h"
 #include "version.h"
@@ -45,16 +49,164 @@ namespace torali
   };
 
   struct SVCarrier {
-    typedef boost::dynamic_bitset<> TBitSet;
+    typedef std::vector<uint64_t> TBitSet;  // Carrier bits packed into 64-bit words
     
     int32_t start;
     int32_t end;
     std::string id;
     TBitSet carrier;
     
-    SVCarrier(int32_t s, int32_t e, std::string i, TBitSet c) : start(s), end(e), id(i), carrier(c) {}
+    SVCarrier(int32_t s, int32_t e, std::string i, TBitSet const& c) : start(s), end(e), id(i), carrier(c) {}
   };
 
+  template<typename TSVCarrier>
+  struct SortCarrierStart : public std::binary_function<uint32_t, uint32_t, bool> {
+    TSVCarrier const& car;
+    explicit SortCarrierStart(TSVCarrier const& c) : car(c) {}
+    inline bool operator()(uint32_t const i1, uint32_t const i2) const {
+      return ((car[i1].start < car[i2].start) || ((car[i1].start == car[i2].start) && (i1 < i2)));
+    }
+  };
+
+  // Carrier count kernels: |a & b| and |a | b| over n words
+  typedef void (*TCarrierCountKernel)(uint64_t const*, uint64_t const*, uint32_t const, uint32_t&, uint32_t&);
+
+  inline void
+  _carrierCountScalar(uint64_t const* a, uint64_t const* b, uint32_t const n, uint32_t& common, uint32_t& all) {
+    common = 0;
+    all = 0;
+    for(uint32_t k = 0; k < n; ++k) {
+      common += _popcount64(a[k] & b[k]);
+      all += _popcount64(a[k] | b[k]);
+    }
+  }
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __attribute__((target("popcnt"))) inline void
+  _carrierCountPopcnt(uint64_t const* a, uint64_t const* b, uint32_t const n, uint32_t& common, uint32_t& all) {
+    common = 0;
+    all = 0;
+    for(uint32_t k = 0; k < n; ++k) {
+      common += __builtin_popcountll(a[k] & b[k]);
+      all += __builtin_popcountll(a[k] | b[k]);
+    }
+  }
+
+  // Nibble lookup popcount (Mula), 4 words per iteration
+  __attribute__((target("avx2,popcnt"))) inline void
+  _carrierCountAvx2(uint64_t const* a, uint64_t const* b, uint32_t const n, uint32_t& common, uint32_t& all) {
+    __m256i const lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    __m256i const lowMask = _mm256_set1_epi8(0x0f);
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i accCommon = zero;
+    __m256i accAll = zero;
+    uint32_t k = 0;
+    for(; k + 4 <= n; k += 4) {
+      __m256i va = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(a + k));
+      __m256i vb = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(b + k));
+      __m256i vand = _mm256_and_si256(va, vb);
+      __m256i vor = _mm256_or_si256(va, vb);
+      __m256i cntAnd = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, _mm256_and_si256(vand, lowMask)), _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(vand, 4), lowMask)));
+      __m256i cntOr = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, _mm256_and_si256(vor, lowMask)), _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(vor, 4), lowMask)));
+      accCommon = _mm256_add_epi64(accCommon, _mm256_sad_epu8(cntAnd, zero));
+      accAll = _mm256_add_epi64(accAll, _mm256_sad_epu8(cntOr, zero));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), accCommon);
+    common = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), accAll);
+    all = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for(; k < n; ++k) {
+      common += __builtin_popcountll(a[k] & b[k]);
+      all += __builtin_popcountll(a[k] | b[k]);
+    }
+  }
+#endif
+
+  // Pick the kernel once for the running CPU
+  inline TCarrierCountKernel
+  _selectCarrierCountKernel() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return &_carrierCountAvx2;
+    if (__builtin_cpu_supports("popcnt")) return &_carrierCountPopcnt;
+#endif
+    return &_carrierCountScalar;
+  }
+
+  inline TCarrierCountKernel
+  _carrierCountKernel() {
+    static TCarrierCountKernel const kernel = _selectCarrierCountKernel();
+    return kernel;
+  }
+
+  // Carrier concordance (Jaccard index) of two packed carrier sets
+  inline float
+  _carrierConcordance(SVCarrier::TBitSet const& a, SVCarrier::TBitSet const& b) {
+    if (a.empty()) return 0;
+    uint32_t common = 0;
+    uint32_t all = 0;
+    _carrierCountKernel()(&a[0], &b[0], a.size(), common, all);
+    if (all > 0) return (float) common / (float) all;
+    return 0;
+  }
+
+  // Linked SVs: both calls overlap and one is shifted downstream of the other
+  template<typename TConfig>
+  inline bool
+  _linkedCarriers(TConfig const& c, SVCarrier const& s1, SVCarrier const& s2) {
+    if ((s1.end < s2.start) || (s2.end < s1.start)) return false;
+    return (((s1.start - c.wiggle < s2.start) && (s2.start < s1.end) && (s1.end - c.wiggle < s2.end)) || ((s2.start - c.wiggle < s1.start) && (s1.start < s2.end) && (s2.end - c.wiggle < s1.end)));
+  }
+
+  // Match the calls of two connection types, every partner is used at most once
+  template<typename TConfig, typename TSVCarrier>
+  inline void
+  matchCarriers(TConfig const& c, TSVCarrier const& ctI, TSVCarrier const& ctJ, std::vector<std::pair<int32_t, int32_t> >& matches, std::vector<float>& matchCC) {
+    // Sort partners by start, a partner can only overlap if it starts within the longest partner call upstream
+    std::vector<uint32_t> order(ctJ.size());
+    std::vector<int32_t> starts(ctJ.size());
+    int32_t maxLen = 0;
+    for(uint32_t jp = 0; jp < ctJ.size(); ++jp) {
+      order[jp] = jp;
+      maxLen = std::max(maxLen, ctJ[jp].end - ctJ[jp].start);
+    }
+    std::sort(order.begin(), order.end(), SortCarrierStart<TSVCarrier>(ctJ));
+    for(uint32_t k = 0; k < order.size(); ++k) starts[k] = ctJ[order[k]].start;
+
+    // Best partner per call
+    std::vector<int32_t> bestJP(ctI.size(), -1);
+    std::vector<float> bestCC(ctI.size(), -1);
+    for(uint32_t ip = 0; ip < ctI.size(); ++ip) {
+      int32_t qEnd = std::max(ctI[ip].end, ctI[ip].start + c.wiggle);
+      std::vector<int32_t>::const_iterator itBeg = std::lower_bound(starts.begin(), starts.end(), ctI[ip].start - maxLen);
+      std::vector<int32_t>::const_iterator itEnd = std::upper_bound(itBeg, (std::vector<int32_t>::const_iterator) starts.end(), qEnd);
+      for(uint32_t k = itBeg - starts.begin(); k < (uint32_t) (itEnd - starts.begin()); ++k) {
+	int32_t jp = order[k];
+	if (!_linkedCarriers(c, ctI[ip], ctJ[jp])) continue;
+	float cc = _carrierConcordance(ctI[ip].carrier, ctJ[jp].carrier);
+	if ((cc >= c.carconc) && ((cc > bestCC[ip]) || ((cc == bestCC[ip]) && (jp < bestJP[ip])))) {
+	  bestJP[ip] = jp;
+	  bestCC[ip] = cc;
+	}
+      }
+    }
+
+    // Resolve conflicts in one pass, a partner keeps the call with the highest concordance (ties: first call)
+    std::vector<int32_t> winner(ctJ.size(), -1);
+    for(uint32_t ip = 0; ip < ctI.size(); ++ip) {
+      if (bestJP[ip] < 0) continue;
+      int32_t& w = winner[bestJP[ip]];
+      if ((w < 0) || (bestCC[ip] > bestCC[w])) w = ip;
+    }
+    for(uint32_t ip = 0; ip < ctI.size(); ++ip) {
+      if ((bestJP[ip] >= 0) && (winner[bestJP[ip]] == (int32_t) ip)) {
+	matches.push_back(std::make_pair(ip, bestJP[ip]));
+	matchCC.push_back(bestCC[ip]);
+      }
+    }
+  }
+
   struct DPERecord {
     int32_t start1;
     int32_t end1;
@@ -68,6 +220,94 @@ namespace torali
   };
   
   
+  // Link SVs of one chromosome
+  template<typename TConfig, typename TDPERecords, typename TSvIds>
+  inline void
+  _linkSVs(TConfig const& c, htsFile* ifile, hts_idx_t* bcfidx, bcf_hdr_t* hdr, int32_t const refIndex, TDPERecords& dper, TSvIds& svIds) {
+    int32_t nsvend = 0;
+    int32_t* svend = NULL;
+    int32_t nsvt = 0;
+    char* svt = NULL;
+    int32_t nchr2 = 0;
+    char* chr2 = NULL;
+    int32_t nct = 0;
+    char* ct = NULL;
+    int ngt = 0;
+    int32_t* gt = NULL;
+
+    // Fetch SVs on this chromosome
+    int32_t maxCTs = 5;
+    typedef std::vector<SVCarrier> TSVCarrier;
+    typedef std::vector<TSVCarrier> TCTs;
+    TCTs cts(maxCTs);
+    hts_itr_t* itervcf = bcf_itr_querys(bcfidx, hdr, bcf_hdr_id2name(hdr, refIndex));
+    bcf1_t* rec = bcf_init();
+    while (bcf_itr_next(ifile, itervcf, rec) >= 0) {
+      // Fetch info
+      bcf_unpack(rec, BCF_UN_ALL);
+      bcf_get_format_int32(hdr, rec, "GT", &gt, &ngt);
+      bcf_get_info_int32(hdr, rec, "END", &svend, &nsvend);
+      bcf_get_info_string(hdr, rec, "SVTYPE", &svt, &nsvt);
+      std::string chr2Name("NA");
+      if (bcf_get_info_string(hdr, rec, "CHR2", &chr2, &nchr2) > 0) chr2Name = std::string(chr2);
+      uint8_t ict = 0;
+      if (bcf_get_info_string(hdr, rec, "CT", &ct, &nct) > 0) ict = _decodeOrientation(std::string(ct));
+      
+      // Fetch carriers
+      if ((*svend - rec->pos) < c.svsize) {
+	SVCarrier::TBitSet car((bcf_hdr_nsamples(hdr) + 63) / 64, 0);
+	for (int i = 0; i < bcf_hdr_nsamples(hdr); ++i) {
+	  if ((bcf_gt_allele(gt[i*2]) != -1) && (bcf_gt_allele(gt[i*2 + 1]) != -1)) {
+	    int gt_type = bcf_gt_allele(gt[i*2]) + bcf_gt_allele(gt[i*2 + 1]);
+	    if (gt_type > 0) car[i >> 6] |= (1ULL << (i & 63));
+	  }
+	}
+	cts[(int32_t) ict].push_back(SVCarrier(rec->pos, *svend, rec->d.id, car));
+      }
+    }
+    bcf_destroy(rec);
+    hts_itr_destroy(itervcf);
+    
+    // Process SVs
+    for(int32_t i = 0; i<maxCTs; ++i) {
+      if (!cts[i].empty()) {
+	for(int32_t j = i+1; j<maxCTs; ++j) {
+	  if (!cts[j].empty()) {
+	    // Compare these 2 CTs
+	    typedef std::vector<std::pair<int32_t, int32_t> > TMatches;
+	    TMatches matches;
+	    std::vector<float> matchCC;
+	    matchCarriers(c, cts[i], cts[j], matches, matchCC);
+	    for(uint32_t m = 0; m < matches.size(); ++m) {
+	      int32_t ip = matches[m].first;
+	      int32_t jp = matches[m].second;
+	      dper.push_back(DPERecord(cts[i][ip].start, cts[i][ip].end, cts[j][jp].start, cts[j][jp].end, matchCC[m], cts[i][ip].id, cts[j][jp].id));
+	      if (!svIds.insert(cts[i][ip].id).second) {
+#pragma omp critical
+		{
+		  std::cerr << "SV already exists!" << std::endl;
+		}
+	      }
+	      if (!svIds.insert(cts[j][jp].id).second) {
+#pragma omp critical
+		{
+		  std::cerr << "SV already exists!" << std::endl;
+		}
+	      }
+	    }
+	  }
+	}
+      }
+    }
+
+    // Clean-up
+    if (svend != NULL) free(svend);
+    if (svt != NULL) free(svt);
+    if (chr2 != NULL) free(chr2);
+    if (ct != NULL) free(ct);
+    if (gt != NULL) free(gt);
+  }
+
   inline int
   dpeRun(DoublePEConfig const& c)
   {
@@ -80,14 +320,6 @@ namespace torali
     // Read BCF file
     int32_t nsvend = 0;
     int32_t* svend = NULL;
-    int32_t nsvt = 0;
-    char* svt = NULL;
-    int32_t nchr2 = 0;
-    char* chr2 = NULL;
-    int32_t nct = 0;
-    char* ct = NULL;
-    int ngt = 0;
-    int32_t* gt = NULL;
     
     // Get sequences
     int32_t nseq = 0;
@@ -115,103 +347,28 @@ namespace torali
     bcf_hdr_append(hdr_out, "##INFO=<ID=CARCONC,Number=1,Type=Float,Description=\"Carrier concordance of the linked paired-end calls.\">");
     if (bcf_hdr_write(ofile, hdr_out) != 0) std::cerr << "Error: Failed to write BCF header!" << std::endl;
     
-    // Parse BCF
+    // Link SVs, chromosomes are processed in parallel with one file handle per thread
+    typedef std::vector<DPERecord> Tdper;
+    typedef std::set<std::string> TSvIds;
+    std::vector<Tdper> chrDper(nseq, Tdper());
+    std::vector<TSvIds> chrSvIds(nseq, TSvIds());
+#pragma omp parallel default(shared)
+    {
+      htsFile* tfile = bcf_open(c.infile.string().c_str(), "r");
+      hts_idx_t* tidx = bcf_index_load(c.infile.string().c_str());
+      bcf_hdr_t* thdr = bcf_hdr_read(tfile);
+#pragma omp for schedule(dynamic)
+      for(int32_t refIndex = 0; refIndex < nseq; ++refIndex) _linkSVs(c, tfile, tidx, thdr, refIndex, chrDper[refIndex], chrSvIds[refIndex]);
+      bcf_hdr_destroy(thdr);
+      hts_idx_destroy(tidx);
+      bcf_close(tfile);
+    }
+    
+    // Output in chromosome order
     for(int32_t refIndex = 0; refIndex < nseq; ++refIndex) {
-      // Fetch SVs on this chromosome
-      int32_t maxCTs = 5;
-      typedef std::vector<SVCarrier> TSVCarrier;
-      typedef std::vector<TSVCarrier> TCTs;
-      TCTs cts(maxCTs);
-      hts_itr_t* itervcf = bcf_itr_querys(bcfidx, hdr, bcf_hdr_id2name(hdr, refIndex));
-      bcf1_t* rec = bcf_init();
-      while (bcf_itr_next(ifile, itervcf, rec) >= 0) {
-	// Fetch info
-	bcf_unpack(rec, BCF_UN_ALL);
-	bcf_get_format_int32(hdr, rec, "GT", &gt, &ngt);
-	bcf_get_info_int32(hdr, rec, "END", &svend, &nsvend);
-	bcf_get_info_string(hdr, rec, "SVTYPE", &svt, &nsvt);
-	std::string chr2Name("NA");
-	if (bcf_get_info_string(hdr, rec, "CHR2", &chr2, &nchr2) > 0) chr2Name = std::string(chr2);
-	uint8_t ict = 0;
-	if (bcf_get_info_string(hdr, rec, "CT", &ct, &nct) > 0) ict = _decodeOrientation(std::string(ct));
-	
-	// Fetch carriers
-	if ((*svend - rec->pos) < c.svsize) {
-	  SVCarrier::TBitSet car(bcf_hdr_nsamples(hdr));
-	  for (int i = 0; i < bcf_hdr_nsamples(hdr); ++i) {
-	    if ((bcf_gt_allele(gt[i*2]) != -1) && (bcf_gt_allele(gt[i*2 + 1]) != -1)) {
-	      int gt_type = bcf_gt_allele(gt[i*2]) + bcf_gt_allele(gt[i*2 + 1]);
-	      if (gt_type > 0) car[i] = true;
-	    }
-	  }
-	  cts[(int32_t) ict].push_back(SVCarrier(rec->pos, *svend, rec->d.id, car));
-	}
-      }
-      bcf_destroy(rec);
-      hts_itr_destroy(itervcf);
-      
-      // Process SVs
-      typedef std::vector<DPERecord> Tdper;
-      Tdper dper;
-      typedef std::set<std::string> TSvIds;
-      TSvIds svIds;
-      for(int32_t i = 0; i<maxCTs; ++i) {
-	if (!cts[i].empty()) {
-	  for(int32_t j = i+1; j<maxCTs; ++j) {
-	    if (!cts[j].empty()) {
-	      // Compare these 2 CTs
-	      typedef std::vector<int32_t> TJPCount;
-	      TJPCount jpc(cts[j].size(), 0);
-	      typedef std::map<std::pair<int32_t, int32_t>, float> TScoreMap;
-	      TScoreMap scm;
-	      for(int32_t ip = 0; ip < (int32_t) cts[i].size(); ++ip) {
-		int32_t bestJP = -1;
-		float bestCC = -1;
-		for(int32_t jp = 0; jp < (int32_t) cts[j].size(); ++jp) {
-		  if ((cts[i][ip].end < cts[j][jp].start) || (cts[j][jp].end < cts[i][ip].start)) continue;
-		  if (((cts[i][ip].start - c.wiggle < cts[j][jp].start) && (cts[j][jp].start < cts[i][ip].end) && (cts[i][ip].end - c.wiggle < cts[j][jp].end)) || ((cts[j][jp].start - c.wiggle < cts[i][ip].start) && (cts[i][ip].start < cts[j][jp].end) && (cts[j][jp].end - c.wiggle < cts[i][ip].end))) {
-		    int32_t common = (cts[i][ip].carrier & cts[j][jp].carrier).count();
-		    int32_t all = (cts[i][ip].carrier | cts[j][jp].carrier).count();
-		    float cc = 0;
-		    if (all > 0) cc = (float) common / (float) all;
-		    if ((cc >= c.carconc) && (cc > bestCC)) {
-		      bestJP = jp;
-		      bestCC = cc;
-		    }
-		  }
-		}
-		if (bestJP >= 0) {
-		  scm.insert(std::make_pair(std::make_pair(ip, bestJP), bestCC));
-		  ++jpc[bestJP];
-		}
-	      }
-	      for(TScoreMap::iterator scmIt = scm.begin(); scmIt != scm.end(); ++scmIt) {
-		int32_t ip = scmIt->first.first;
-		int32_t jp = scmIt->first.second;
-		float cc = scmIt->second;
-		bool savePair = true;
-		if (jpc[jp] > 1) {
-		  for(TScoreMap::iterator scmSec = scm.begin(); scmSec != scm.end(); ++scmSec) {
-		    if ((ip != scmSec->first.first) && (jp == scmSec->first.second)) {
-		      if ((cc < scmSec->second) || ((cc == scmSec->second) && (ip > scmSec->first.first))) {
-			savePair = false;
-			break;
-		      }
-		    }
-		  }
-		}
-		if (savePair) {
-		  dper.push_back(DPERecord(cts[i][ip].start, cts[i][ip].end, cts[j][jp].start, cts[j][jp].end, cc, cts[i][ip].id, cts[j][jp].id));
-		  if (!svIds.insert(cts[i][ip].id).second) std::cerr << "SV already exists!" << std::endl;
-		  if (!svIds.insert(cts[j][jp].id).second) std::cerr << "SV already exists!" << std::endl;
-		}
-	      }
-	    }
-	  }
-	}
-      }
-      
-      
+      Tdper const& dper = chrDper[refIndex];
+      TSvIds const& svIds = chrSvIds[refIndex];
+      if (svIds.empty()) continue;
       hts_itr_t* ivcf = bcf_itr_querys(bcfidx, hdr, bcf_hdr_id2name(hdr, refIndex));
       bcf1_t* r = bcf_init();
       while (bcf_itr_next(ifile, ivcf, r) >= 0) {
@@ -267,10 +424,6 @@ namespace torali
     
     // Clean-up
     if (svend != NULL) free(svend);
-    if (svt != NULL) free(svt);
-    if (chr2 != NULL) free(chr2);
-    if (ct != NULL) free(ct);
-    if (gt != NULL) free(gt);
     
     // BCF clean-up
     bcf_hdr_destroy(hdr);
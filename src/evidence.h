@@ -0,0 +1,651 @@
+#ifndef EVIDENCE_H
+#define EVIDENCE_H
+
+#include <iostream>
+#include <fstream>
+#include <boost/filesystem.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <htslib/sam.h>
+
+#include "tags.h"
+#include "util.h"
+#include "coverage.h"
+#include "checkpoint.h"
+#include "schedule.h"
+
+namespace torali
+{
+
+  #ifndef DELLY_EVIDENCE_VERSION
+  #define DELLY_EVIDENCE_VERSION 3
+  #endif
+
+  // Serialized record sizes, stored in the header and checked on read
+  #define DELLY_EVIDENCE_BIN_BYTES 12
+  #define DELLY_EVIDENCE_PAIR_BYTES 20
+  #define DELLY_EVIDENCE_CLIP_BYTES 8
+
+  #ifndef DELLY_EVIDENCE_BINSIZE
+  #define DELLY_EVIDENCE_BINSIZE 100
+  #endif
+
+  // Discordant pair, stored for the second read with the window of breakpoints it can span
+  struct EvidencePair {
+    int32_t pos;
+    int32_t end;
+    int32_t mtid;
+    int32_t mpos;
+    uint16_t svt;
+    uint16_t qual;
+
+    EvidencePair() : pos(0), end(0), mtid(0), mpos(0), svt(0), qual(0) {}
+    EvidencePair(int32_t const p, int32_t const e, int32_t const mt, int32_t const mp, uint16_t const s, uint16_t const q) : pos(p), end(e), mtid(mt), mpos(mp), svt(s), qual(q) {}
+  };
+
+  // Clipped read position
+  struct EvidenceClip {
+    int32_t pos;
+    uint16_t qual;
+    uint16_t leading;
+
+    EvidenceClip() : pos(0), qual(0), leading(0) {}
+    EvidenceClip(int32_t const p, uint16_t const q, uint16_t const l) : pos(p), qual(q), leading(l) {}
+  };
+
+  // Binned coverage
+  struct EvidenceBin {
+    uint32_t bases;     // Aligned bases
+    uint16_t frag;      // Pair mid-points (fragment counting)
+    uint16_t span;      // Normal pair fragment centers
+    uint16_t starts;    // Unclipped read starts
+    uint8_t spanQual;   // Mean pair quality of span
+    uint8_t startQual;  // Mean mapping quality of starts
+
+    EvidenceBin() : bases(0), frag(0), span(0), starts(0), spanQual(0), startQual(0) {}
+  };
+
+  template<typename TRecord>
+  struct SortEvidencePos : public std::binary_function<TRecord, TRecord, bool> {
+    inline bool operator()(TRecord const& r1, TRecord const& r2) const {
+      return (r1.pos < r2.pos);
+    }
+  };
+
+  // Evidence of one chromosome
+  struct EvidenceIndex {
+    std::vector<EvidenceBin> bins;
+    std::vector<EvidencePair> pairs;
+    std::vector<EvidenceClip> clips;
+    std::vector<uint32_t> spanQualSum;
+    std::vector<uint32_t> startQualSum;
+  };
+
+  // Evidence file of one sample
+  struct EvidenceFile {
+    int32_t binSize;
+    LibraryInfo lib;
+    std::string sampleName;
+    std::vector<std::string> tname;
+    std::vector<uint32_t> tlen;
+    std::vector<uint64_t> blockOffset;
+    uint64_t fileSize;
+    std::fstream fs;
+
+    EvidenceFile() : binSize(DELLY_EVIDENCE_BINSIZE), fileSize(0) {}
+  };
+
+  template<typename TConfig>
+  inline boost::filesystem::path
+  evidenceFile(TConfig const& c, uint32_t const file_c) {
+    return c.evidencedir / (c.sampleName[file_c] + ".dei");
+  }
+
+  inline void
+  _ckpWrite(std::ostream& out, EvidenceBin const& r) {
+    _ckpWrite(out, r.bases);
+    _ckpWrite(out, r.frag);
+    _ckpWrite(out, r.span);
+    _ckpWrite(out, r.starts);
+    _ckpWrite(out, r.spanQual);
+    _ckpWrite(out, r.startQual);
+  }
+
+  inline bool
+  _ckpRead(std::istream& in, EvidenceBin& r) {
+    if (!_ckpRead(in, r.bases)) return false;
+    if (!_ckpRead(in, r.frag)) return false;
+    if (!_ckpRead(in, r.span)) return false;
+    if (!_ckpRead(in, r.starts)) return false;
+    if (!_ckpRead(in, r.spanQual)) return false;
+    return _ckpRead(in, r.startQual);
+  }
+
+  inline void
+  _ckpWrite(std::ostream& out, EvidencePair const& r) {
+    _ckpWrite(out, r.pos);
+    _ckpWrite(out, r.end);
+    _ckpWrite(out, r.mtid);
+    _ckpWrite(out, r.mpos);
+    _ckpWrite(out, r.svt);
+    _ckpWrite(out, r.qual);
+  }
+
+  inline bool
+  _ckpRead(std::istream& in, EvidencePair& r) {
+    if (!_ckpRead(in, r.pos)) return false;
+    if (!_ckpRead(in, r.end)) return false;
+    if (!_ckpRead(in, r.mtid)) return false;
+    if (!_ckpRead(in, r.mpos)) return false;
+    if (!_ckpRead(in, r.svt)) return false;
+    return _ckpRead(in, r.qual);
+  }
+
+  inline void
+  _ckpWrite(std::ostream& out, EvidenceClip const& r) {
+    _ckpWrite(out, r.pos);
+    _ckpWrite(out, r.qual);
+    _ckpWrite(out, r.leading);
+  }
+
+  inline bool
+  _ckpRead(std::istream& in, EvidenceClip& r) {
+    if (!_ckpRead(in, r.pos)) return false;
+    if (!_ckpRead(in, r.qual)) return false;
+    return _ckpRead(in, r.leading);
+  }
+
+  template<typename TRecord>
+  inline void
+  _evWrite(std::ostream& out, std::vector<TRecord> const& v) {
+    uint64_t len = v.size();
+    _ckpWrite(out, len);
+    for(uint64_t i = 0; i < len; ++i) _ckpWrite(out, v[i]);
+  }
+
+  // Record count is checked against the bytes left in the file before allocating
+  template<typename TRecord>
+  inline bool
+  _evRead(std::istream& in, uint64_t const fileSize, uint64_t const recordBytes, std::vector<TRecord>& v) {
+    uint64_t len = 0;
+    if (!_ckpRead(in, len)) return false;
+    std::streamoff pos = in.tellg();
+    if ((pos < 0) || ((uint64_t) pos > fileSize) || (len > (fileSize - pos) / recordBytes)) return false;
+    v.resize(len);
+    for(uint64_t i = 0; i < len; ++i) {
+      if (!_ckpRead(in, v[i])) return false;
+    }
+    return true;
+  }
+
+  inline void
+  _evidenceIncrement(uint16_t& val) {
+    if (val < std::numeric_limits<uint16_t>::max()) ++val;
+  }
+
+  inline void
+  initEvidence(bam_hdr_t* hdr, int32_t const refIndex, EvidenceIndex& ei) {
+    uint32_t nbins = hdr->target_len[refIndex] / DELLY_EVIDENCE_BINSIZE + 1;
+    ei.bins.assign(nbins, EvidenceBin());
+    ei.spanQualSum.assign(nbins, 0);
+    ei.startQualSum.assign(nbins, 0);
+    ei.pairs.clear();
+    ei.clips.clear();
+  }
+
+  // Aligned bases, clipped positions, read starts and normal pairs of a single read
+  template<typename TConfig>
+  inline void
+  _addEvidenceRead(TConfig const& c, bam1_t* rec, LibraryInfo const& lib, EvidenceIndex& ei) {
+    if (rec->core.flag & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) return;
+    int32_t nbins = ei.bins.size();
+    bool genoQual = (rec->core.qual >= c.minGenoQual);
+    bool hasClip = false;
+    bool hasSoftClip = false;
+    int32_t rp = rec->core.pos;
+    uint32_t* cigar = bam_get_cigar(rec);
+    for (std::size_t i = 0; i < rec->core.n_cigar; ++i) {
+      if (bam_cigar_op(cigar[i]) == BAM_CMATCH) {
+	if (genoQual) {
+	  int32_t rend = rp + bam_cigar_oplen(cigar[i]);
+	  for(int32_t b = rp / DELLY_EVIDENCE_BINSIZE; ((b < nbins) && (b * DELLY_EVIDENCE_BINSIZE < rend)); ++b) ei.bins[b].bases += std::min(rend, (b + 1) * DELLY_EVIDENCE_BINSIZE) - std::max(rp, b * DELLY_EVIDENCE_BINSIZE);
+	}
+	rp += bam_cigar_oplen(cigar[i]);
+      } else if ((bam_cigar_op(cigar[i]) == BAM_CEQUAL) || (bam_cigar_op(cigar[i]) == BAM_CDIFF) || (bam_cigar_op(cigar[i]) == BAM_CDEL) || (bam_cigar_op(cigar[i]) == BAM_CREF_SKIP)) {
+	rp += bam_cigar_oplen(cigar[i]);
+      } else if ((bam_cigar_op(cigar[i]) == BAM_CSOFT_CLIP) || (bam_cigar_op(cigar[i]) == BAM_CHARD_CLIP)) {
+	hasClip = true;
+	if (bam_cigar_op(cigar[i]) == BAM_CSOFT_CLIP) hasSoftClip = true;
+	if ((int32_t) bam_cigar_oplen(cigar[i]) >= c.minimumFlankSize) ei.clips.push_back(EvidenceClip(rp, rec->core.qual, (rp == rec->core.pos)));
+      }
+    }
+
+    // Unclipped read start
+    if ((genoQual) && (!hasClip) && (rec->core.l_qseq >= (2 * c.minimumFlankSize))) {
+      int32_t b = rec->core.pos / DELLY_EVIDENCE_BINSIZE;
+      if (b < nbins) {
+	_evidenceIncrement(ei.bins[b].starts);
+	ei.startQualSum[b] += rec->core.qual;
+      }
+    }
+
+    // Fragment counting and normal spanning pairs
+    if ((!genoQual) || (!(rec->core.flag & BAM_FPAIRED)) || (rec->core.flag & BAM_FMUNMAP) || (rec->core.tid != rec->core.mtid)) return;
+    if ((rec->core.pos < rec->core.mpos) || ((rec->core.pos == rec->core.mpos) && (!(rec->core.flag & BAM_FREAD2)))) return;
+    int32_t b = (rec->core.pos + halfAlignmentLength(rec)) / DELLY_EVIDENCE_BINSIZE;
+    if (b < nbins) _evidenceIncrement(ei.bins[b].frag);
+    if (lib.median == 0) return;
+    int32_t outerISize = rec->core.pos + rec->core.l_qseq - rec->core.mpos;
+    if ((!hasSoftClip) && (getSVType(rec) == 2) && (outerISize >= lib.minNormalISize) && (outerISize <= lib.maxNormalISize)) {
+      b = (rec->core.mpos + outerISize / 2) / DELLY_EVIDENCE_BINSIZE;
+      if (b < nbins) {
+	_evidenceIncrement(ei.bins[b].span);
+	ei.spanQualSum[b] += rec->core.qual;
+      }
+    }
+  }
+
+  // Discordant pair, recorded for the second read of the pair
+  inline EvidencePair
+  _evidencePair(bam1_t* rec, uint8_t const pairQuality, int32_t const svt, LibraryInfo const& lib) {
+    int32_t pbegin = rec->core.pos;
+    int32_t pend = rec->core.pos + lib.maxNormalISize;
+    if (rec->core.flag & BAM_FREVERSE) {
+      pbegin = std::max(0, (int32_t) rec->core.pos + rec->core.l_qseq - lib.maxNormalISize);
+      pend = rec->core.pos + rec->core.l_qseq;
+    }
+    return EvidencePair(pbegin, pend, rec->core.mtid, rec->core.mpos, svt, pairQuality);
+  }
+
+  inline void
+  _addEvidencePair(bam1_t* rec, uint8_t const pairQuality, int32_t const svt, LibraryInfo const& lib, EvidenceIndex& ei) {
+    ei.pairs.push_back(_evidencePair(rec, pairQuality, svt, lib));
+  }
+
+  template<typename TConfig>
+  inline bool
+  openEvidence(TConfig const& c, uint32_t const file_c, bam_hdr_t* hdr, LibraryInfo const& lib, EvidenceFile& ef) {
+    ef.fs.open(evidenceFile(c, file_c).string().c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!ef.fs.is_open()) return false;
+    ef.blockOffset.assign(hdr->n_targets, 0);
+    ef.fs.write("DELLYEVI", 8);
+    _ckpWrite(ef.fs, (uint32_t) DELLY_EVIDENCE_VERSION);
+    _ckpWrite(ef.fs, (uint32_t) DELLY_EVIDENCE_BIN_BYTES);
+    _ckpWrite(ef.fs, (uint32_t) DELLY_EVIDENCE_PAIR_BYTES);
+    _ckpWrite(ef.fs, (uint32_t) DELLY_EVIDENCE_CLIP_BYTES);
+    _ckpWrite(ef.fs, (int32_t) DELLY_EVIDENCE_BINSIZE);
+    _ckpWrite(ef.fs, c.minGenoQual);
+    _ckpWrite(ef.fs, c.sampleName[file_c]);
+    _ckpWrite(ef.fs, lib.rs);
+    _ckpWrite(ef.fs, lib.median);
+    _ckpWrite(ef.fs, lib.mad);
+    _ckpWrite(ef.fs, lib.minNormalISize);
+    _ckpWrite(ef.fs, lib.minISizeCutoff);
+    _ckpWrite(ef.fs, lib.maxNormalISize);
+    _ckpWrite(ef.fs, lib.maxISizeCutoff);
+    _ckpWrite(ef.fs, (int32_t) hdr->n_targets);
+    for(int32_t refIndex = 0; refIndex < hdr->n_targets; ++refIndex) {
+      _ckpWrite(ef.fs, std::string(hdr->target_name[refIndex]));
+      _ckpWrite(ef.fs, (uint32_t) hdr->target_len[refIndex]);
+    }
+    return ef.fs.good();
+  }
+
+  inline void
+  writeEvidenceBlock(EvidenceFile& ef, int32_t const refIndex, EvidenceIndex& ei) {
+    for(uint32_t b = 0; b < ei.bins.size(); ++b) {
+      if (ei.bins[b].span) ei.bins[b].spanQual = std::min(ei.spanQualSum[b] / ei.bins[b].span, (uint32_t) std::numeric_limits<uint8_t>::max());
+      if (ei.bins[b].starts) ei.bins[b].startQual = std::min(ei.startQualSum[b] / ei.bins[b].starts, (uint32_t) std::numeric_limits<uint8_t>::max());
+    }
+    std::sort(ei.pairs.begin(), ei.pairs.end(), SortEvidencePos<EvidencePair>());
+    std::sort(ei.clips.begin(), ei.clips.end(), SortEvidencePos<EvidenceClip>());
+    ef.blockOffset[refIndex] = ef.fs.tellp();
+    _evWrite(ef.fs, ei.bins);
+    _evWrite(ef.fs, ei.pairs);
+    _evWrite(ef.fs, ei.clips);
+  }
+
+  // Trailing chromosome offset table, its position is stored in the last 8 bytes
+  inline bool
+  closeEvidence(EvidenceFile& ef) {
+    uint64_t tableOffset = ef.fs.tellp();
+    for(uint32_t refIndex = 0; refIndex < ef.blockOffset.size(); ++refIndex) _ckpWrite(ef.fs, ef.blockOffset[refIndex]);
+    _ckpWrite(ef.fs, tableOffset);
+    bool ok = ef.fs.good();
+    ef.fs.close();
+    return ok;
+  }
+
+  // Header and chromosome offsets, the file is closed afterwards
+  template<typename TConfig>
+  inline bool
+  readEvidenceHeader(TConfig const& c, uint32_t const file_c, EvidenceFile& ef) {
+    ef.fs.open(evidenceFile(c, file_c).string().c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!ef.fs.is_open()) return false;
+    ef.fs.seekg(0, std::ios_base::end);
+    std::streamoff fileSize = ef.fs.tellg();
+    if (fileSize < 0) return false;
+    ef.fileSize = fileSize;
+    ef.fs.seekg(0, std::ios_base::beg);
+    char magic[8];
+    ef.fs.read(magic, 8);
+    if ((!ef.fs.good()) || (std::string(magic, magic + 8) != "DELLYEVI")) return false;
+    uint32_t version = 0;
+    if ((!_ckpRead(ef.fs, version)) || (version != DELLY_EVIDENCE_VERSION)) return false;
+    uint32_t binBytes = 0;
+    uint32_t pairBytes = 0;
+    uint32_t clipBytes = 0;
+    if ((!_ckpRead(ef.fs, binBytes)) || (!_ckpRead(ef.fs, pairBytes)) || (!_ckpRead(ef.fs, clipBytes))) return false;
+    if ((binBytes != DELLY_EVIDENCE_BIN_BYTES) || (pairBytes != DELLY_EVIDENCE_PAIR_BYTES) || (clipBytes != DELLY_EVIDENCE_CLIP_BYTES)) return false;
+    uint16_t minGenoQual = 0;
+    if (!_ckpRead(ef.fs, ef.binSize)) return false;
+    if (!_ckpRead(ef.fs, minGenoQual)) return false;
+    if (!_ckpRead(ef.fs, ef.sampleName)) return false;
+    if (!_ckpRead(ef.fs, ef.lib.rs)) return false;
+    if (!_ckpRead(ef.fs, ef.lib.median)) return false;
+    if (!_ckpRead(ef.fs, ef.lib.mad)) return false;
+    if (!_ckpRead(ef.fs, ef.lib.minNormalISize)) return false;
+    if (!_ckpRead(ef.fs, ef.lib.minISizeCutoff)) return false;
+    if (!_ckpRead(ef.fs, ef.lib.maxNormalISize)) return false;
+    if (!_ckpRead(ef.fs, ef.lib.maxISizeCutoff)) return false;
+    int32_t nchr = 0;
+    if (!_ckpRead(ef.fs, nchr)) return false;
+    if ((nchr < 0) || ((uint64_t) nchr > ef.fileSize / sizeof(uint64_t))) return false;
+    ef.tname.resize(nchr);
+    ef.tlen.resize(nchr);
+    for(int32_t refIndex = 0; refIndex < nchr; ++refIndex) {
+      if (!_ckpRead(ef.fs, ef.tname[refIndex])) return false;
+      if (!_ckpRead(ef.fs, ef.tlen[refIndex])) return false;
+    }
+    if (ef.binSize != DELLY_EVIDENCE_BINSIZE) return false;
+    if (minGenoQual != c.minGenoQual) std::cerr << "Warning: Evidence index of " << ef.sampleName << " was built with a different min. genotyping mapping quality!" << std::endl;
+
+    // Chromosome offsets
+    uint64_t tableOffset = 0;
+    ef.fs.seekg(-((std::streamoff) sizeof(uint64_t)), std::ios_base::end);
+    if (!_ckpRead(ef.fs, tableOffset)) return false;
+    if ((tableOffset > ef.fileSize) || ((ef.fileSize - tableOffset) / sizeof(uint64_t) < (uint64_t) nchr + 1)) return false;
+    ef.fs.seekg(tableOffset);
+    ef.blockOffset.resize(nchr);
+    for(int32_t refIndex = 0; refIndex < nchr; ++refIndex) {
+      if (!_ckpRead(ef.fs, ef.blockOffset[refIndex])) return false;
+      if (ef.blockOffset[refIndex] >= tableOffset) return false;
+    }
+    ef.fs.close();
+    return true;
+  }
+
+  // Block of one chromosome, located by the offsets of a header read before
+  inline bool
+  readEvidenceBlock(boost::filesystem::path const& path, EvidenceFile const& ef, int32_t const refIndex, EvidenceIndex& ei) {
+    ei = EvidenceIndex();
+    if (!ef.blockOffset[refIndex]) return true;
+    std::ifstream in(path.string().c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!in.is_open()) return false;
+    in.seekg(ef.blockOffset[refIndex]);
+    if (!_evRead(in, ef.fileSize, DELLY_EVIDENCE_BIN_BYTES, ei.bins)) return false;
+    if (!_evRead(in, ef.fileSize, DELLY_EVIDENCE_PAIR_BYTES, ei.pairs)) return false;
+    if (!_evRead(in, ef.fileSize, DELLY_EVIDENCE_CLIP_BYTES, ei.clips)) return false;
+    return true;
+  }
+
+  template<typename TConfig, typename TSampleLibrary>
+  inline bool
+  getEvidenceLibraryParams(TConfig const& c, TSampleLibrary& sampleLib) {
+    for(uint32_t file_c = 0; file_c < c.files.size(); ++file_c) {
+      EvidenceFile ef;
+      if (!readEvidenceHeader(c, file_c, ef)) {
+	std::cerr << "Evidence index is invalid: " << evidenceFile(c, file_c).string() << std::endl;
+	return false;
+      }
+      sampleLib[file_c] = ef.lib;
+    }
+    return true;
+  }
+
+  // Binned counts in [start, end), partially covered bins are weighted by their overlap
+  inline double
+  _evidenceCount(EvidenceIndex const& ei, int32_t const start, int32_t const end, int32_t const field, double& qualSum) {
+    double count = 0;
+    qualSum = 0;
+    if (start >= end) return count;
+    for(int32_t b = std::max(start, 0) / DELLY_EVIDENCE_BINSIZE; ((b < (int32_t) ei.bins.size()) && (b * DELLY_EVIDENCE_BINSIZE < end)); ++b) {
+      double frac = (double) (std::min(end, (b + 1) * DELLY_EVIDENCE_BINSIZE) - std::max(start, b * DELLY_EVIDENCE_BINSIZE)) / (double) DELLY_EVIDENCE_BINSIZE;
+      double val = 0;
+      if (field == 0) val = ei.bins[b].bases;
+      else if (field == 1) val = ei.bins[b].frag;
+      else if (field == 2) {
+	val = ei.bins[b].span;
+	qualSum += frac * val * ei.bins[b].spanQual;
+      } else {
+	val = ei.bins[b].starts;
+	qualSum += frac * val * ei.bins[b].startQual;
+      }
+      count += frac * val;
+    }
+    return count;
+  }
+
+  // Expected clip side at a breakpoint, 0: trailing, 1: leading, 2: either
+  inline uint16_t
+  _evidenceClipSide(int32_t const svt, uint8_t const bpPoint) {
+    if (svt == 4) return 2;
+    uint8_t ct = _getSpanOrientation(svt);
+    if (ct == 0) return 0;
+    else if (ct == 1) return 1;
+    else if (ct == 2) return (bpPoint) ? 1 : 0;
+    else return (bpPoint) ? 0 : 1;
+  }
+
+  // Reference reads are thinned by 2 like the alignment-based annotation to account for reference bias
+  inline void
+  _evidenceRefSupport(double const count, double const qualSum, std::size_t const maxCount, std::vector<uint8_t>& ref) {
+    if (count <= 0) return;
+    uint8_t qual = (uint8_t) std::min(qualSum / count + 0.5, (double) std::numeric_limits<uint8_t>::max());
+    std::size_t n = std::min((std::size_t) (count / 2 + 0.5), maxCount);
+    ref.insert(ref.end(), n, qual);
+  }
+
+  // Junction counts of an SV joining two chromosomes, merged in chromosome order
+  struct EvidenceTraBp {
+    uint32_t id;
+    double nref;
+    double qualSum;
+    std::vector<uint8_t> alt;
+
+    EvidenceTraBp(uint32_t const i, double const n, double const q) : id(i), nref(n), qualSum(q) {}
+  };
+
+  // Approximate SV annotation from the per-sample evidence index instead of the alignment files (--approx-geno)
+  // Junction reads are clipped reads at the breakpoint without realignment and reference reads are binned unclipped read starts
+  template<typename TConfig, typename TSampleLibrary, typename TSVs, typename TCoverageCount, typename TCountMap, typename TSpanMap>
+  inline bool
+  annotateEvidence(TConfig& c, TSampleLibrary& sampleLib, TSVs& svs, TCoverageCount& covCount, TCountMap& countMap, TSpanMap& spanMap)
+  {
+    typedef typename TCoverageCount::value_type::value_type TCovPair;
+    typedef typename TSpanMap::value_type::value_type TSpanPair;
+    typedef typename TCountMap::value_type::value_type TCountPair;
+
+    samFile* samfile = sam_open(c.files[0].string().c_str(), "r");
+    bam_hdr_t* hdr = sam_hdr_read(samfile);
+
+    // Initialize coverage count maps
+    covCount.resize(c.files.size());
+    countMap.resize(c.files.size());
+    spanMap.resize(c.files.size());
+    for(uint32_t file_c = 0; file_c < c.files.size(); ++file_c) {
+      covCount[file_c].resize(svs.size(), TCovPair(0, 0, 0));
+      countMap[file_c].resize(svs.size(), TCountPair());
+      spanMap[file_c].resize(svs.size(), TSpanPair());
+    }
+
+    // Reference and consensus probes, only the breakpoint regions are used
+    typedef std::vector<std::string> TProbes;
+    typedef std::vector<TProbes> TBreakProbes;
+    TBreakProbes refProbeArr(2, TProbes(svs.size()));
+    TBreakProbes consProbeArr(2, TProbes(svs.size()));
+    typedef std::vector<BpRegion> TBpRegion;
+    typedef std::vector<TBpRegion> TGenomicBpRegion;
+    TGenomicBpRegion bpRegion(hdr->n_targets, TBpRegion());
+    std::vector<bool> svOnChr(hdr->n_targets, false);
+    _generateProbes(c, hdr, svs, refProbeArr, consProbeArr, bpRegion, svOnChr);
+
+    boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
+    std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] " << "SV annotation from evidence index" << std::endl;
+
+    // SVs joining two chromosomes are counted by two tasks of a sample and merged in chromosome order
+    std::vector<bool> svTra(svs.size(), false);
+    for(uint32_t i = 0; i < svs.size(); ++i) svTra[svs[i].id] = (svs[i].chr != svs[i].chr2);
+
+    // SVs with a breakpoint on each chromosome
+    std::vector<std::vector<uint32_t> > chrSV(hdr->n_targets);
+    for(uint32_t i = 0; i < svs.size(); ++i) {
+      chrSV[svs[i].chr].push_back(i);
+      if (svs[i].chr2 != svs[i].chr) chrSV[svs[i].chr2].push_back(i);
+    }
+
+    // One task per sample and chromosome with SV breakpoints, the header of each sample is read once
+    bool success = true;
+    TaskScheduler ts;
+    initScheduler(c, ts);
+    std::vector<EvidenceFile> evFile(c.files.size());
+    for(uint32_t file_c = 0; file_c < c.files.size(); ++file_c) {
+      EvidenceFile& ef = evFile[file_c];
+      if ((!readEvidenceHeader(c, file_c, ef)) || ((int32_t) ef.tname.size() != hdr->n_targets)) {
+	std::cerr << "Evidence index is invalid: " << evidenceFile(c, file_c).string() << std::endl;
+	success = false;
+	continue;
+      }
+      for(int32_t refIndex = 0; refIndex < hdr->n_targets; ++refIndex) {
+	if ((svOnChr[refIndex]) && (ef.blockOffset[refIndex])) addTask(ts, file_c, refIndex, hdr->target_len[refIndex], 0);
+      }
+    }
+    if (!success) {
+      bam_hdr_destroy(hdr);
+      sam_close(samfile);
+      return false;
+    }
+    sortTasks(ts);
+    std::vector<std::vector<std::pair<int32_t, int32_t> > > sampleTasks(c.files.size());
+    for(int32_t t = 0; t < (int32_t) ts.tasks.size(); ++t) sampleTasks[ts.tasks[t].file_c].push_back(std::make_pair(ts.tasks[t].refIndex, t));
+    for(uint32_t file_c = 0; file_c < c.files.size(); ++file_c) std::sort(sampleTasks[file_c].begin(), sampleTasks[file_c].end());
+    std::vector<std::vector<EvidenceTraBp> > taskBp(ts.tasks.size());
+    std::vector<std::vector<std::pair<uint32_t, TSpanPair> > > taskSpan(ts.tasks.size());
+
+#pragma omp parallel for default(shared) num_threads(ts.nthreads) schedule(dynamic, 1)
+    for(int32_t t = 0; t < (int32_t) ts.tasks.size(); ++t) {
+      uint32_t file_c = ts.tasks[t].file_c;
+      int32_t refIndex = ts.tasks[t].refIndex;
+      startTask(ts, t);
+      LibraryInfo const& lib = sampleLib[file_c];
+      EvidenceIndex ei;
+      if (!readEvidenceBlock(evidenceFile(c, file_c), evFile[file_c], refIndex, ei)) {
+#pragma omp critical
+	{
+	  std::cerr << "Fail to read evidence index " << evidenceFile(c, file_c).string() << std::endl;
+	  success = false;
+	}
+	ei = EvidenceIndex();
+      }
+      if (!ei.bins.empty()) {
+	double qualSum = 0;
+
+	// Junction reads
+	for(uint32_t i = 0; i < bpRegion[refIndex].size(); ++i) {
+	  BpRegion const& bp = bpRegion[refIndex][i];
+	  std::vector<uint8_t> traAlt;
+	  std::vector<uint8_t>& alt = (svTra[bp.id]) ? traAlt : countMap[file_c][bp.id].alt;
+	  uint16_t side = _evidenceClipSide(bp.svt, bp.bpPoint);
+	  std::vector<EvidenceClip>::const_iterator itClip = std::lower_bound(ei.clips.begin(), ei.clips.end(), EvidenceClip(bp.bppos - bp.homLeft - 1, 0, 0), SortEvidencePos<EvidenceClip>());
+	  for(; ((itClip != ei.clips.end()) && (itClip->pos <= bp.bppos + bp.homRight + 1) && (alt.size() < c.maxGenoReadCount)); ++itClip) {
+	    if (itClip->qual < c.minGenoQual) continue;
+	    if ((side != 2) && (itClip->leading != side)) continue;
+	    alt.push_back(itClip->qual);
+	  }
+	  double nref = _evidenceCount(ei, bp.bppos + c.minimumFlankSize + bp.homRight - lib.rs, bp.bppos - c.minimumFlankSize - bp.homLeft + 1, 3, qualSum);
+	  if (svTra[bp.id]) {
+	    taskBp[t].push_back(EvidenceTraBp(bp.id, nref, qualSum));
+	    taskBp[t].back().alt.swap(traAlt);
+	  } else {
+	    std::size_t maxRef = (alt.size() < c.maxGenoReadCount) ? c.maxGenoReadCount - alt.size() : 0;
+	    _evidenceRefSupport(nref, qualSum, maxRef, countMap[file_c][bp.id].ref);
+	  }
+	}
+
+	for(uint32_t k = 0; k < chrSV[refIndex].size(); ++k) {
+	  uint32_t i = chrSV[refIndex][k];
+
+	  // Spanning pairs
+	  if (svs[i].peSupport) {
+	    for(uint8_t bpPoint = 0; bpPoint < 2; ++bpPoint) {
+	      int32_t bppos = (bpPoint) ? svs[i].svEnd : svs[i].svStart;
+	      int32_t otherChr = (bpPoint) ? svs[i].chr : svs[i].chr2;
+	      int32_t otherBppos = (bpPoint) ? svs[i].svStart : svs[i].svEnd;
+	      if (((bpPoint) ? svs[i].chr2 : svs[i].chr) != refIndex) continue;
+	      if (svTra[svs[i].id]) taskSpan[t].push_back(std::make_pair(svs[i].id, TSpanPair()));
+	      TSpanPair& span = (svTra[svs[i].id]) ? taskSpan[t].back().second : spanMap[file_c][svs[i].id];
+	      int32_t halfSpan = (int32_t) (0.4 * lib.median);
+	      double nref = _evidenceCount(ei, bppos - halfSpan, bppos + halfSpan + 1, 2, qualSum);
+	      _evidenceRefSupport(nref, qualSum, std::numeric_limits<std::size_t>::max(), span.ref);
+	      std::vector<EvidencePair>::const_iterator itPair = std::lower_bound(ei.pairs.begin(), ei.pairs.end(), EvidencePair(bppos - lib.maxNormalISize, 0, 0, 0, 0, 0), SortEvidencePos<EvidencePair>());
+	      for(; ((itPair != ei.pairs.end()) && (itPair->pos <= bppos)); ++itPair) {
+		if ((itPair->end < bppos) || (itPair->svt != svs[i].svt) || (itPair->qual < c.minGenoQual)) continue;
+		if ((itPair->mtid == otherChr) && (std::abs(itPair->mpos - otherBppos) < lib.maxNormalISize)) span.alt.push_back(itPair->qual);
+	      }
+	    }
+	  }
+
+	  // Read-depth
+	  if (svs[i].chr == refIndex) {
+	    bool smallSV = false;
+	    int32_t halfSize = (svs[i].svEnd - svs[i].svStart)/2;
+	    if ((_translocation(svs[i].svt)) || (svs[i].svt == 4)) {
+	      halfSize = 500;
+	      smallSV = true;
+	    } else {
+	      if ((svs[i].svEnd - svs[i].svStart) <= c.indelsize) smallSV = true;
+	    }
+	    int32_t field = (smallSV) ? 0 : 1;
+	    int32_t mstart = svs[i].svStart;
+	    int32_t mend = svs[i].svEnd;
+	    int32_t rstart = svs[i].svEnd;
+	    if ((_translocation(svs[i].svt)) || (svs[i].svt == 4)) {
+	      mstart = std::max(svs[i].svStart - halfSize, 0);
+	      mend = svs[i].svStart + halfSize;
+	      rstart = svs[i].svStart;
+	    }
+	    covCount[file_c][svs[i].id].leftRC = (int32_t) (_evidenceCount(ei, std::max(svs[i].svStart - halfSize, 0), svs[i].svStart, field, qualSum) + 0.5);
+	    covCount[file_c][svs[i].id].rc = (int32_t) (_evidenceCount(ei, mstart, mend, field, qualSum) + 0.5);
+	    covCount[file_c][svs[i].id].rightRC = (int32_t) (_evidenceCount(ei, rstart, rstart + halfSize, field, qualSum) + 0.5);
+	  }
+	}
+      }
+      if (!finishTask(ts, t)) continue;
+
+      // Last task of the sample, SVs joining two chromosomes are counted in chromosome order
+      for(uint32_t k = 0; k < sampleTasks[file_c].size(); ++k) {
+	int32_t tk = sampleTasks[file_c][k].second;
+	for(uint32_t i = 0; i < taskBp[tk].size(); ++i) {
+	  EvidenceTraBp const& tb = taskBp[tk][i];
+	  std::vector<uint8_t>& alt = countMap[file_c][tb.id].alt;
+	  for(uint32_t j = 0; ((j < tb.alt.size()) && (alt.size() < c.maxGenoReadCount)); ++j) alt.push_back(tb.alt[j]);
+	  std::size_t maxRef = (alt.size() < c.maxGenoReadCount) ? c.maxGenoReadCount - alt.size() : 0;
+	  _evidenceRefSupport(tb.nref, tb.qualSum, maxRef, countMap[file_c][tb.id].ref);
+	}
+	for(uint32_t i = 0; i < taskSpan[tk].size(); ++i) {
+	  TSpanPair& span = spanMap[file_c][taskSpan[tk][i].first];
+	  span.ref.insert(span.ref.end(), taskSpan[tk][i].second.ref.begin(), taskSpan[tk][i].second.ref.end());
+	  span.alt.insert(span.alt.end(), taskSpan[tk][i].second.alt.begin(), taskSpan[tk][i].second.alt.end());
+	}
+	std::vector<EvidenceTraBp>().swap(taskBp[tk]);
+	std::vector<std::pair<uint32_t, TSpanPair> >().swap(taskSpan[tk]);
+      }
+    }
+    bam_hdr_destroy(hdr);
+    sam_close(samfile);
+    return success;
+  }
+
+}
+
+#endif
@@ -13,6 +13,7 @@
 #include <htslib/sam.h>
 
 #include "util.h"
+#include "readcache.h"
 
 namespace torali
 {
@@ -180,6 +181,7 @@ namespace torali
     
     std::vector<std::string> refProbes(svs.size());
     faidx_t* fai = fai_load(c.genome.string().c_str());
+    std::string consensus; // Unpacked consensus, reused across SVs
     for(int32_t refIndex=0; refIndex < (int32_t) hdr->n_targets; ++refIndex) {
       char* seq = NULL;
 
@@ -199,28 +201,29 @@ namespace torali
 	  itSV->alleles = _addAlleles(boost::to_upper_copy(std::string(seq + itSV->svStart - 1, seq + itSV->svStart)), std::string(hdr->target_name[itSV->chr2]), *itSV, itSV->svt);
 	}
 	if (!itSV->precise) continue;
+	itSV->consensus.str(consensus);
 
 	// Get the reference sequence
 	if ((itSV->chr != itSV->chr2) && (itSV->chr2 == refIndex)) {
 	  Breakpoint bp(*itSV);
-	  _initBreakpoint(hdr, bp, (int32_t) itSV->consensus.size(), itSV->svt);
+	  _initBreakpoint(hdr, bp, (int32_t) consensus.size(), itSV->svt);
 	  refProbes[itSV->id] = _getSVRef(c, seq, bp, refIndex, itSV->svt);
 	}
 	if (itSV->chr == refIndex) {
 	  Breakpoint bp(*itSV);
 	  if (_translocation(itSV->svt)) bp.part1 = refProbes[itSV->id];
 	  if (itSV->svt ==4) {
-	    int32_t bufferSpace = std::max((int32_t) ((itSV->consensus.size() - itSV->insLen) / 3), c.minimumFlankSize);
+	    int32_t bufferSpace = std::max((int32_t) ((consensus.size() - itSV->insLen) / 3), c.minimumFlankSize);
 	    _initBreakpoint(hdr, bp, bufferSpace, itSV->svt);
-	  } else _initBreakpoint(hdr, bp, (int32_t) itSV->consensus.size(), itSV->svt);
+	  } else _initBreakpoint(hdr, bp, (int32_t) consensus.size(), itSV->svt);
 	  std::string svRefStr = _getSVRef(c, seq, bp, refIndex, itSV->svt);
 	  
 	  // Find breakpoint to reference
 	  TAlign align;
-	  if (!_consRefAlignment(itSV->consensus, svRefStr, align, itSV->svt)) continue;
+	  if (!_consRefAlignment(consensus, svRefStr, align, itSV->svt)) continue;
 
 	  AlignDescriptor ad;
-	  if (!_findSplit(c, itSV->consensus, svRefStr, align, ad, itSV->svt)) continue;
+	  if (!_findSplit(c, consensus, svRefStr, align, ad, itSV->svt)) continue;
 
 	  // Get exact alleles for INS and DEL
 	  if (itSV->svEnd - itSV->svStart <= c.indelsize) {
@@ -410,6 +413,7 @@ namespace torali
     THeader hdr(c.files.size());
     for(uint32_t file_c = 0; file_c < c.files.size(); ++file_c) {
       samfile[file_c] = sam_open(c.files[file_c].string().c_str(), "r");
+      attachHtsThreadPool(samfile[file_c]);
       hts_set_fai_filename(samfile[file_c], c.genome.string().c_str());
       idx[file_c] = sam_index_load(samfile[file_c], c.files[file_c].string().c_str());
       hdr[file_c] = sam_hdr_read(samfile[file_c]);
@@ -434,6 +438,8 @@ namespace torali
       dumpOut << "#svid\tbam\tqname\tchr\tpos\tsubsequence\tmapq\ttype" << std::endl;
     }
 
+    uint64_t cacheHits = 0;
+    uint64_t cacheMisses = 0;
 #pragma omp parallel for default(shared)    
     for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
 
@@ -444,6 +450,8 @@ namespace torali
       // Genotype SVs
       boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
       std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] " << "Align to REF and ALT" << std::endl;
+      ReadCache rc;
+      std::string subseq;
 
       for(int32_t refIndex=0; refIndex < (int32_t) hdr[file_c]->n_targets; ++refIndex) {
 	hts_itr_t* iter = sam_itr_queryi(idx[file_c], refIndex, 0, hdr[file_c]->target_len[refIndex]);
@@ -453,25 +461,21 @@ namespace torali
 	  if (rec->core.flag & (BAM_FQCFAIL | BAM_FDUP | BAM_FUNMAP | BAM_FSUPPLEMENTARY | BAM_FSECONDARY)) continue;
 	  std::size_t seed = hash_lr(rec);
 	  if (genoMap.find(seed) != genoMap.end()) {
-	    std::string sequence;
+	    evictReads(rc, rec->core.pos);
+	    PackedRead const* pr = NULL;
 	    for(uint32_t k = 0; k < genoMap[seed].size(); ++k) {
 	      int32_t svid = genoMap[seed][k].svid;
 	      int32_t probelen = std::max(refseq[svid].size(), altseq[svid].size());
 	      if (genoMap[seed][k].sp < probelen) continue;
 	      
 	      // Lazy-loading of sequence
-	      if (sequence.empty()) {
-		sequence.resize(rec->core.l_qseq);
-		uint8_t* seqptr = bam_get_seq(rec);
-		for (int i = 0; i < rec->core.l_qseq; ++i) sequence[i] = "=ACMGRSVTWYHKDBN"[bam_seqi(seqptr, i)];
-		if (rec->core.flag & BAM_FREVERSE) reverseComplement(sequence);
-	      }
-	      if ((int) sequence.size() < genoMap[seed][k].sp + probelen) continue;
+	      if (pr == NULL) pr = &cachedRead(rc, rec);
+	      if ((int) pr->len < genoMap[seed][k].sp + probelen) continue;
 
 	      //std::cerr << svs[svid].svStart << "-" << svs[svid].svEnd << "," << svs[svid].svt << std::endl;
 	      //std::cerr << seed << "," << genoMap[seed][k].sp << "," << genoMap[seed][k].rp << std::endl;
 	      //std::cerr << sequence.size() << ',' << probelen << std::endl;
-	      std::string subseq = sequence.substr(genoMap[seed][k].sp - probelen, 2 * probelen);
+	      unpackRead(*pr, (rec->core.flag & BAM_FREVERSE), genoMap[seed][k].sp - probelen, 2 * probelen, subseq);
 	      
 	      uint32_t maxGenoReadCount = 500;
 	      if ((jctMap[file_c][svid].ref.size() + jctMap[file_c][svid].alt.size()) >= maxGenoReadCount) continue;
@@ -541,8 +545,17 @@ namespace torali
 	// Clean-up
 	bam_destroy1(rec);
 	hts_itr_destroy(iter);
+	clearReadCache(rc);
+      }
+#pragma omp critical
+      {
+	cacheHits += rc.hits;
+	cacheMisses += rc.misses;
       }
     }
+    boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
+    std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] " << "Read cache hits: " << cacheHits << ", misses: " << cacheMisses << std::endl;
+
     // Clean-up
     for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
       bam_hdr_destroy(hdr[file_c]);	  
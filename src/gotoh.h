@@ -24,13 +24,10 @@ namespace torali
     TScoreValue prevsub = 0;
     
     // Create profile
-    typedef boost::multi_array<float, 2> TProfile;
+    typedef ScoreProfile<float> TProfile;
     TProfile p1;
     TProfile p2;
-    if ((_size(a1, 0) != 1) || (_size(a2, 0) != 1)) {
-      _createProfile(a1, p1);
-      _createProfile(a2, p2);
-    }
+    if ((_size(a1, 0) != 1) || (_size(a2, 0) != 1)) _createScoreProfile(a1, a2, p1, p2);
 
     // DP
     for(std::size_t row = 0; row <= m; ++row) {
@@ -70,34 +67,33 @@ namespace torali
   
   template<typename TAlign1, typename TAlign2, typename TAlign, typename TAlignConfig, typename TScoreObject>
   inline int
-    gotoh(TAlign1 const& a1, TAlign2 const& a2, TAlign& align, TAlignConfig const& ac, TScoreObject const& sc)
+  gotoh(TAlign1 const& a1, TAlign2 const& a2, TAlign& align, TAlignConfig const& ac, TScoreObject const& sc, AlignWorkspace<typename TScoreObject::TValue>& ws)
   {
     typedef typename TScoreObject::TValue TScoreValue;
 
     // DP variables
     std::size_t m = _size(a1, 1);
     std::size_t n = _size(a2, 1);
-    std::vector<TScoreValue> s(n+1, 0);
-    std::vector<TScoreValue> v(n+1, 0);
+    std::vector<TScoreValue>& s = ws.s;
+    std::vector<TScoreValue>& v = ws.v;
+    _reserveWorkspace(s, n+1);
+    _reserveWorkspace(v, n+1);
     TScoreValue newhoz = 0;
     TScoreValue prevsub = 0;
     
-    // Trace Matrix
+    // Trace Matrix, every cell is written below
     std::size_t mf = n+1;
-    typedef boost::dynamic_bitset<> TBitSet;
-    TBitSet bit1( (m+1) * (n+1), false);
-    TBitSet bit2( (m+1) * (n+1), false);
-    TBitSet bit3( (m+1) * (n+1), false);
-    TBitSet bit4( (m+1) * (n+1), false);
+    typedef typename AlignWorkspace<TScoreValue>::TBitSet TBitSet;
+    TBitSet& bit1 = ws.bit[0];
+    TBitSet& bit2 = ws.bit[1];
+    TBitSet& bit3 = ws.bit[2];
+    TBitSet& bit4 = ws.bit[3];
+    for(uint32_t k = 0; k < 4; ++k) _reserveWorkspace(ws.bit[k], (m+1) * (n+1));
 
     // Create profile
-    typedef boost::multi_array<float, 2> TProfile;
-    TProfile p1;
-    TProfile p2;
-    if ((_size(a1, 0) != 1) || (_size(a2, 0) != 1)) {
-      _createProfile(a1, p1);
-      _createProfile(a2, p2);
-    }
+    ScoreProfile<float>& p1 = ws.p1;
+    ScoreProfile<float>& p2 = ws.p2;
+    if ((_size(a1, 0) != 1) || (_size(a2, 0) != 1)) _createScoreProfile(a1, a2, p1, p2);
 
     // DP
     for(std::size_t row = 0; row <= m; ++row) {
@@ -109,17 +105,25 @@ namespace torali
 	  newhoz = -sc.inf;
 	  bit1[0] = true;
 	  bit2[0] = true;
+	  bit3[0] = false;
+	  bit4[0] = false;
 	} else if (row == 0) {
 	  v[col] = -sc.inf;
 	  s[col] = _horizontalGap(ac, 0, m, sc.go + col * sc.ge);
 	  newhoz = _horizontalGap(ac, 0, m, sc.go + col * sc.ge);
+	  bit1[col] = false;
+	  bit2[col] = false;
 	  bit3[col] = true;
+	  bit4[col] = false;
 	} else if (col == 0) {
 	  newhoz = -sc.inf;
 	  s[0] = _verticalGap(ac, 0, n, sc.go + row * sc.ge);
 	  if (row - 1 == 0) prevsub = 0;
 	  else prevsub = _verticalGap(ac, 0, n, sc.go + (row - 1) * sc.ge);
 	  v[0] = _verticalGap(ac, 0, n, sc.go + row * sc.ge);
+	  bit1[row * mf] = false;
+	  bit2[row * mf] = false;
+	  bit3[row * mf] = false;
 	  bit4[row * mf] = true;
 	} else {
 	  // Recursion
@@ -132,10 +136,10 @@ namespace torali
 	  s[col] = std::max(std::max(prevprevsub + _score(a1, a2, p1, p2, row-1, col-1, sc), newhoz), v[col]);
 
 	  // Trace
-	  if (s[col] == newhoz) bit3[row * mf + col] = true;
-	  else if (s[col] == v[col]) bit4[row * mf + col] = true;
-	  if (newhoz != prevhoz + _horizontalGap(ac, row, m, sc.ge)) bit1[row * mf + col] = true;
-	  if (v[col] != prevver + _verticalGap(ac, col, n, sc.ge)) bit2[row * mf + col] = true;
+	  bit3[row * mf + col] = (s[col] == newhoz);
+	  bit4[row * mf + col] = ((s[col] != newhoz) && (s[col] == v[col]));
+	  bit1[row * mf + col] = (newhoz != prevhoz + _horizontalGap(ac, row, m, sc.ge));
+	  bit2[row * mf + col] = (v[col] != prevver + _verticalGap(ac, col, n, sc.ge));
 	}
       }
     }
@@ -144,8 +148,8 @@ namespace torali
     std::size_t row = m;
     std::size_t col = n;
     char lastMatrix = 's';
-    typedef std::vector<char> TTrace;
-    TTrace btr;
+    std::vector<char>& btr = ws.trace;
+    btr.clear();
     while ((row>0) || (col>0)) {
       if (lastMatrix == 's') {
 	if (bit3[row * mf + col]) lastMatrix = 'h';
@@ -173,6 +177,14 @@ namespace torali
     return s[n];
   }
 
+  template<typename TAlign1, typename TAlign2, typename TAlign, typename TAlignConfig, typename TScoreObject>
+  inline int
+  gotoh(TAlign1 const& a1, TAlign2 const& a2, TAlign& align, TAlignConfig const& ac, TScoreObject const& sc)
+  {
+    ThreadWorkspace<typename TScoreObject::TValue> tw;
+    return gotoh(a1, a2, align, ac, sc, tw.ws);
+  }
+
   template<typename TAlign1, typename TAlign2, typename TAlign, typename TAlignConfig>
   inline int
   gotoh(TAlign1 const& a1, TAlign2 const& a2, TAlign& align, TAlignConfig const& ac) 
@@ -398,7 +398,7 @@ vcfParse(TConfig const& c, bam_hdr_t* hd, std::vector<TStructuralVariantRecord>&
 
 template<typename TConfig, typename TStructuralVariantRecord, typename TJunctionCountMap, typename TReadCountMap, typename TCountMap>
 inline void
-vcfOutput(TConfig const& c, std::vector<TStructuralVariantRecord> const& svs, TJunctionCountMap const& jctCountMap, TReadCountMap const& readCountMap, TCountMap const& spanCountMap)
+vcfOutput(TConfig const& c, std::vector<TStructuralVariantRecord> const& svs, TJunctionCountMap const& jctCountMap, TReadCountMap const& readCountMap, TCountMap const& spanCountMap, bool const approxGeno)
 {
   // BoLog class
   BoLog<double> bl;
@@ -412,6 +412,7 @@ vcfOutput(TConfig const& c, std::vector<TStructuralVariantRecord> const& svs, TJ
   std::string fmtout = "wb";
   if (c.outfile.string() == "-") fmtout = "w";
   htsFile *fp = hts_open(c.outfile.string().c_str(), fmtout.c_str());
+  attachHtsThreadPool(fp);
   bcf_hdr_t *hdr = bcf_hdr_init("w");
 
   // Print vcf header
@@ -426,6 +427,7 @@ vcfOutput(TConfig const& c, std::vector<TStructuralVariantRecord> const& svs, TJ
   bcf_hdr_append(hdr, "##ALT=<ID=BND,Description=\"Translocation\">");
   bcf_hdr_append(hdr, "##ALT=<ID=INS,Description=\"Insertion\">");
   bcf_hdr_append(hdr, "##FILTER=<ID=LowQual,Description=\"Poor quality and insufficient number of PEs and SRs.\">");
+  if (approxGeno) bcf_hdr_append(hdr, "##dellyGenotyping=approximate,Description=\"Genotypes from the evidence index, junction reads are clipped reads at the breakpoint without realignment and reference reads are estimated from binned read starts\"");
   bcf_hdr_append(hdr, "##INFO=<ID=CIEND,Number=2,Type=Integer,Description=\"PE confidence interval around END\">");
   bcf_hdr_append(hdr, "##INFO=<ID=CIPOS,Number=2,Type=Integer,Description=\"PE confidence interval around POS\">");
   bcf_hdr_append(hdr, "##INFO=<ID=CHR2,Number=1,Type=String,Description=\"Chromosome for POS2 coordinate in case of an inter-chromosomal translocation\">");
@@ -518,7 +520,7 @@ vcfOutput(TConfig const& c, std::vector<TStructuralVariantRecord> const& svs, TJ
       padNumber.insert(padNumber.begin(), 8 - padNumber.length(), '0');
       id += padNumber;
       bcf_update_id(hdr, rec, id.c_str());
-      std::string alleles = _replaceIUPAC(svIter->alleles);
+      std::string alleles = _replaceIUPAC(svIter->alleles.str());
       bcf_update_alleles_str(hdr, rec, alleles.c_str());
       bcf_update_filter(hdr, rec, &tmpi, 1);
       
@@ -568,9 +570,10 @@ vcfOutput(TConfig const& c, std::vector<TStructuralVariantRecord> const& svs, TJ
 	bcf_update_info_int32(hdr, rec, "SR", &tmpi, 1);
 	float tmpf = svIter->srAlignQuality;
 	bcf_update_info_float(hdr, rec, "SRQ", &tmpf, 1);
-	if (svIter->consensus.size()) {
-	  bcf_update_info_string(hdr, rec, "CONSENSUS", svIter->consensus.c_str());
-	  tmpf = entropy(svIter->consensus);
+	if (!svIter->consensus.empty()) {
+	  std::string consensus = svIter->consensus.str();
+	  bcf_update_info_string(hdr, rec, "CONSENSUS", consensus.c_str());
+	  tmpf = entropy(consensus);
 	  bcf_update_info_float(hdr, rec, "CE", &tmpf, 1);
 	}
       }
@@ -656,6 +659,13 @@ vcfOutput(TConfig const& c, std::vector<TStructuralVariantRecord> const& svs, TJ
   if (c.outfile.string() != "-") bcf_index_build(c.outfile.string().c_str(), 14);
 }
 
+template<typename TConfig, typename TStructuralVariantRecord, typename TJunctionCountMap, typename TReadCountMap, typename TCountMap>
+inline void
+vcfOutput(TConfig const& c, std::vector<TStructuralVariantRecord> const& svs, TJunctionCountMap const& jctCountMap, TReadCountMap const& readCountMap, TCountMap const& spanCountMap)
+{
+  vcfOutput(c, svs, jctCountMap, readCountMap, spanCountMap, false);
+}
+
 
 }
 
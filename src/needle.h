@@ -4,7 +4,10 @@
 #define BOOST_DISABLE_ASSERTS
 #include <boost/dynamic_bitset.hpp>
 #include <boost/multi_array.hpp>
+#include <boost/tuple/tuple.hpp>
+#include <boost/tuple/tuple_comparison.hpp>
 #include <iostream>
+#include <cctype>
 #include "align.h"
 
 namespace torali
@@ -12,28 +15,27 @@ namespace torali
 
   inline int32_t
   longestHomology(std::string const& s1, std::string const& s2, int32_t scoreThreshold)  {
-    // DP Matrix
-    typedef boost::multi_array<int32_t, 2> TMatrix;
+    // Diagonal band, band[h + k] holds the cell (row, row + h) of the current row
     int32_t m = s1.size();
     int32_t n = s2.size();
-    TMatrix mat(boost::extents[m+1][n+1]);
+    int32_t k = std::abs(scoreThreshold);
+    std::vector<int32_t> band(2 * k + 1, 0);
 
     // Initialization
-    int32_t k = std::abs(scoreThreshold);
-    mat[0][0] = 0;
-    for(int32_t col = 1; col <= k; ++col) mat[0][col] = mat[0][col-1] - 1;
-    for(int32_t row = 1; row <= k; ++row) mat[row][0] = mat[row-1][0] - 1;
+    for(int32_t h = 0; h <= k; ++h) band[h + k] = -h;
 
-    // Edit distance
+    // Edit distance, updated in place: diagonal h holds (row-1, col-1), h+1 holds (row-1, col) and h-1 already holds (row, col-1)
     for(int32_t row = 1; row <= m; ++row) {
       int32_t bestCol = scoreThreshold - 1;
       for(int32_t h = -k; h <= k; ++h) {
 	int32_t col = row + h;
-	if ((col >= 1) && (col <= n)) {
-	  mat[row][col] = mat[row-1][col-1] + (s1[row-1] == s2[col-1] ? 0 : -1);
-	  if ((row - 1 - col >= -k) && (row - 1 - col <= k)) mat[row][col] = std::max(mat[row][col], mat[row-1][col] - 1);
-	  if ((row - col + 1 >= -k) && (row - col + 1 <= k)) mat[row][col] = std::max(mat[row][col], mat[row][col-1] - 1);
-	  if (mat[row][col] > bestCol) bestCol = mat[row][col];
+	if (col == 0) band[h + k] = -row;
+	else if ((col >= 1) && (col <= n)) {
+	  int32_t val = band[h + k] + (s1[row-1] == s2[col-1] ? 0 : -1);
+	  if (h < k) val = std::max(val, band[h + k + 1] - 1);
+	  if (h > -k) val = std::max(val, band[h + k - 1] - 1);
+	  band[h + k] = val;
+	  if (val > bestCol) bestCol = val;
 	}
       }
       if (bestCol < scoreThreshold) return row - 1;
@@ -42,18 +44,50 @@ namespace torali
   }
 
 
+  // Prefix alignment, reference gap and the reverse complemented suffix alignment
+  template<typename TAlign>
+  inline void
+  _longNeedleConcat(TAlign const& fwd, TAlign const& rvs, std::string const& s2, std::size_t const refLeft, std::size_t const refRight, TAlign& align)
+  {
+    typedef typename TAlign::index TAIndex;
+    std::size_t n = s2.size();
+    std::size_t gapref = (n-refRight) - refLeft;
+    std::size_t alilen = fwd.shape()[1] + rvs.shape()[1] + gapref;
+    align.resize(boost::extents[2][alilen]);
+    TAIndex jEnd = rvs.shape()[1];
+    for(TAIndex i = 0; i < (TAIndex) fwd.shape()[0]; ++i) {
+      TAIndex alicol = 0;
+      for(;alicol < (TAIndex) fwd.shape()[1]; ++alicol) align[i][alicol]=fwd[i][alicol];
+      for(TAIndex j = refLeft; j < (TAIndex) (n-refRight); ++j, ++alicol) {
+	if (i==0) align[i][alicol] = '-';
+	else align[i][alicol] = s2[j];
+      }
+      for(TAIndex j = 0; j < (TAIndex) rvs.shape()[1]; ++j, ++alicol) {
+	switch (rvs[i][jEnd-j-1]) {
+	case 'A': align[i][alicol] = 'T'; break;
+	case 'C': align[i][alicol] = 'G'; break;
+	case 'G': align[i][alicol] = 'C'; break;
+	case 'T': align[i][alicol] = 'A'; break;
+	case 'N': align[i][alicol] = 'N'; break;
+	case '-': align[i][alicol] = '-'; break;
+	default: break;
+	}
+      }
+    }
+  }
+
   template<typename TAlign, typename TAlignConfig, typename TScoreObject>
   inline bool
-  longNeedle(std::string const& s1, std::string const& s2, TAlign& align, TAlignConfig const& ac, TScoreObject const& sc)
+  _longNeedleFull(std::string const& s1, std::string const& s2, TAlign& align, TAlignConfig const& ac, TScoreObject const& sc, AlignWorkspace<typename TScoreObject::TValue>& ws)
   {
     typedef typename TScoreObject::TValue TScoreValue;
-    typedef typename TAlign::index TAIndex;
 
-    // DP Matrix
-    typedef boost::multi_array<TScoreValue, 2> TMatrix;
+    // DP Matrix, views on the workspace buffers
+    typedef boost::multi_array_ref<TScoreValue, 2> TMatrix;
     std::size_t m = s1.size();
     std::size_t n = s2.size();
-    TMatrix mat(boost::extents[m+1][n+1]);
+    for(uint32_t k = 0; k < 4; ++k) _reserveWorkspace(ws.mat[k], (m+1) * (n+1));
+    TMatrix mat(&ws.mat[0][0], boost::extents[m+1][n+1]);
 
     // Initialization
     mat[0][0] = 0;
@@ -72,7 +106,7 @@ namespace torali
     reverseComplement(sRev2);
 
     // Reverse alignment
-    TMatrix rev(boost::extents[m+1][n+1]);
+    TMatrix rev(&ws.mat[1][0], boost::extents[m+1][n+1]);
     rev[0][0] = 0;
     for(std::size_t col = 1; col <= n; ++col) rev[0][col] = rev[0][col-1] + _horizontalGap(ac, 0, m, sc.ge);
     for(std::size_t row = 1; row <= m; ++row) rev[row][0] = rev[row-1][0] + _verticalGap(ac, 0, n, sc.ge);
@@ -85,7 +119,7 @@ namespace torali
       return false;
     } else {
       // Find best join
-      TMatrix bestMat(boost::extents[m+1][n+1]);
+      TMatrix bestMat(&ws.mat[2][0], boost::extents[m+1][n+1]);
       for(std::size_t row = 0; row <= m; ++row) {
 	bestMat[row][0] = mat[row][0];
 	for(std::size_t col = 1; col <= n; ++col) {
@@ -93,7 +127,7 @@ namespace torali
 	  else bestMat[row][col] = bestMat[row][col-1];
 	}
       }
-      TMatrix bestRev(boost::extents[m+1][n+1]);
+      TMatrix bestRev(&ws.mat[3][0], boost::extents[m+1][n+1]);
       for(std::size_t row = 0; row <= m; ++row) {
 	bestRev[row][0] = rev[row][0];
 	for(std::size_t col = 1; col <= n; ++col) {
@@ -194,32 +228,205 @@ namespace torali
       _createAlignment(rtrace, sRev1.substr(0, consRight), sRev2.substr(0, refRight), rvs);
 
       // Concat alignments
-      std::size_t gapref = (n-refRight) - refLeft;
-      std::size_t alilen = fwd.shape()[1] + rvs.shape()[1] + gapref;
-      align.resize(boost::extents[2][alilen]);
-      TAIndex jEnd = rvs.shape()[1];
-      for(TAIndex i = 0; i < (TAIndex) fwd.shape()[0]; ++i) {
-	TAIndex alicol = 0;
-	for(;alicol < (TAIndex) fwd.shape()[1]; ++alicol) align[i][alicol]=fwd[i][alicol];
-	for(TAIndex j = refLeft; j < (TAIndex) (n-refRight); ++j, ++alicol) {
-	  if (i==0) align[i][alicol] = '-';
-	  else align[i][alicol] = s2[j];
+      _longNeedleConcat(fwd, rvs, s2, refLeft, refRight, align);
+    }
+    return true;
+  }
+  
+  
+  #ifndef DELLY_LONGNEEDLE_MAXCELLS
+  #define DELLY_LONGNEEDLE_MAXCELLS 4194304
+  #endif
+
+  #ifndef DELLY_LONGNEEDLE_TRACEBLOCK
+  #define DELLY_LONGNEEDLE_TRACEBLOCK 65536
+  #endif
+
+  // The reverse pass of longNeedle compares complemented bases, i.e., case-insensitive
+  inline bool
+  _longNeedleEq(char const a, char const b) {
+    return (std::toupper(a) == std::toupper(b));
+  }
+
+  // Row i, columns 0 to j1, of the global alignment matrix of _longNeedleFull
+  template<typename TAlignConfig, typename TScoreObject>
+  inline void
+  _nwNextRow(std::string const& s1, std::string const& s2, std::size_t const i, std::size_t const j1, TAlignConfig const& ac, TScoreObject const& sc, typename TScoreObject::TValue const* prev, typename TScoreObject::TValue* row)
+  {
+    std::size_t m = s1.size();
+    std::size_t n = s2.size();
+    row[0] = prev[0] + _verticalGap(ac, 0, n, sc.ge);
+    for(std::size_t j = 1; j <= j1; ++j) row[j] = std::max(std::max(prev[j-1] + (s1[i-1] == s2[j-1] ? sc.match : sc.mismatch), prev[j] + _verticalGap(ac, j, n, sc.ge)), row[j-1] + _horizontalGap(ac, i, m, sc.ge));
+  }
+
+  // Trace-back from (i1, j) to the first cell in row i0, the rows in between are recomputed from row i0
+  template<typename TAlignConfig, typename TScoreObject, typename TTrace>
+  inline void
+  _nwTraceRows(std::string const& s1, std::string const& s2, std::size_t const i0, std::vector<typename TScoreObject::TValue> const& row0, std::size_t const i1, std::size_t& j, TAlignConfig const& ac, TScoreObject const& sc, TTrace& trace)
+  {
+    typedef typename TScoreObject::TValue TScoreValue;
+    std::size_t m = s1.size();
+    std::size_t n = s2.size();
+    std::size_t cols = j + 1;
+    if ((i1 - i0 > 1) && ((i1 - i0 + 1) * cols > DELLY_LONGNEEDLE_TRACEBLOCK)) {
+      // Lower half first, it ends the trace-back in the middle row
+      std::size_t mid = (i0 + i1) / 2;
+      std::vector<TScoreValue> rowMid(row0.begin(), row0.begin() + cols);
+      std::vector<TScoreValue> next(cols);
+      for(std::size_t i = i0 + 1; i <= mid; ++i) {
+	_nwNextRow(s1, s2, i, j, ac, sc, &rowMid[0], &next[0]);
+	rowMid.swap(next);
+      }
+      std::vector<TScoreValue>().swap(next);
+      _nwTraceRows(s1, s2, mid, rowMid, i1, j, ac, sc, trace);
+      std::vector<TScoreValue>().swap(rowMid);
+      _nwTraceRows(s1, s2, i0, row0, mid, j, ac, sc, trace);
+      return;
+    }
+
+    // Small blocks: full matrix of rows i0 to i1
+    std::vector<TScoreValue> mat((i1 - i0 + 1) * cols);
+    std::copy(row0.begin(), row0.begin() + cols, mat.begin());
+    for(std::size_t r = 1; r <= i1 - i0; ++r) _nwNextRow(s1, s2, i0 + r, j, ac, sc, &mat[(r-1) * cols], &mat[r * cols]);
+    std::size_t rr = i1;
+    std::size_t cc = j;
+    while (rr > i0) {
+      if (mat[(rr-i0) * cols + cc] == mat[(rr-i0-1) * cols + cc] + _verticalGap(ac, cc, n, sc.ge)) {
+	--rr;
+	trace.push_back('v');
+      } else if ((cc>0) && (mat[(rr-i0) * cols + cc] == mat[(rr-i0) * cols + cc - 1] + _horizontalGap(ac, rr, m, sc.ge))) {
+	--cc;
+	trace.push_back('h');
+      } else {
+	--rr;
+	--cc;
+	trace.push_back('s');
+      }
+    }
+    j = cc;
+  }
+
+  // Trace-back of _longNeedleFull from (i1, j1) in O((i1 + j1) log i1) space, moves in reverse order
+  template<typename TAlignConfig, typename TScoreObject, typename TTrace>
+  inline void
+  _nwTrace(std::string const& s1, std::string const& s2, std::size_t const i1, std::size_t const j1, TAlignConfig const& ac, TScoreObject const& sc, TTrace& trace)
+  {
+    typedef typename TScoreObject::TValue TScoreValue;
+    std::size_t m = s1.size();
+    std::vector<TScoreValue> row0(j1 + 1);
+    row0[0] = 0;
+    for(std::size_t j = 1; j <= j1; ++j) row0[j] = row0[j-1] + _horizontalGap(ac, 0, m, sc.ge);
+    std::size_t j = j1;
+    if (i1 > 0) _nwTraceRows(s1, s2, 0, row0, i1, j, ac, sc, trace);
+    for(; j > 0; --j) trace.push_back('h');
+  }
+
+  // Keeps the better join, ties go to the leftmost split as in the join search of _longNeedleFull
+  template<typename TScoreValue, typename TSplit>
+  inline void
+  _longNeedleJoin(TScoreValue const score, TSplit const& split, TScoreValue& bestScore, TSplit& bestSplit) {
+    if ((score > bestScore) || ((score == bestScore) && (split < bestSplit))) {
+      bestScore = score;
+      bestSplit = split;
+    }
+  }
+
+  // Linear-space longNeedle: best prefix alignment, free gap in s2 and best suffix alignment, same split and trace-back as _longNeedleFull
+  template<typename TAlign, typename TAlignConfig, typename TScoreObject>
+  inline bool
+  longNeedleLinear(std::string const& s1, std::string const& s2, TAlign& align, TAlignConfig const& ac, TScoreObject const& sc)
+  {
+    typedef typename TScoreObject::TValue TScoreValue;
+    std::size_t m = s1.size();
+    std::size_t n = s2.size();
+
+    // Forward sweep: global alignment (F), case-insensitive global alignment (U), best prefix with free s2 gap (J) and joined alignment (R)
+    std::vector<TScoreValue> prevF(n+1), curF(n+1), prevU(n+1), curU(n+1), curJ(n+1), prevR(n+1), curR(n+1);
+    std::vector<std::size_t> curJLeft(n+1);
+    typedef boost::tuple<std::size_t, std::size_t, std::size_t> TSplit;
+    std::vector<TSplit> prevSplit(n+1), curSplit(n+1);
+    for(std::size_t i = 0; i <= m; ++i) {
+      for(std::size_t j = 0; j <= n; ++j) {
+	if ((i == 0) && (j == 0)) {
+	  curF[0] = 0;
+	  curU[0] = 0;
+	} else if (i == 0) {
+	  curF[j] = curF[j-1] + _horizontalGap(ac, 0, m, sc.ge);
+	  curU[j] = curU[j-1] + _horizontalGap(ac, 0, m, sc.ge);
+	} else if (j == 0) {
+	  curF[0] = prevF[0] + _verticalGap(ac, 0, n, sc.ge);
+	  curU[0] = prevU[0] + _verticalGap(ac, 0, n, sc.ge);
+	} else {
+	  curF[j] = std::max(std::max(prevF[j-1] + (s1[i-1] == s2[j-1] ? sc.match : sc.mismatch), prevF[j] + _verticalGap(ac, j, n, sc.ge)), curF[j-1] + _horizontalGap(ac, i, m, sc.ge));
+	  curU[j] = std::max(std::max(prevU[j-1] + (_longNeedleEq(s1[i-1], s2[j-1]) ? sc.match : sc.mismatch), prevU[j] + _verticalGap(ac, j, n, sc.ge)), curU[j-1] + _horizontalGap(ac, i, m, sc.ge));
 	}
-	for(TAIndex j = 0; j < (TAIndex) rvs.shape()[1]; ++j, ++alicol) {
-	  switch (rvs[i][jEnd-j-1]) {
-	  case 'A': align[i][alicol] = 'T'; break;
-	  case 'C': align[i][alicol] = 'G'; break;
-	  case 'G': align[i][alicol] = 'C'; break;
-	  case 'T': align[i][alicol] = 'A'; break;
-	  case 'N': align[i][alicol] = 'N'; break;
-	  case '-': align[i][alicol] = '-'; break;
-	  default: break;
-	  }
+
+	// Best prefix alignment ending left of j
+	if ((j == 0) || (curF[j] > curJ[j-1])) {
+	  curJ[j] = curF[j];
+	  curJLeft[j] = j;
+	} else {
+	  curJ[j] = curJ[j-1];
+	  curJLeft[j] = curJLeft[j-1];
 	}
-      } 
+
+	// Suffix alignment, either continued or started at (i, j)
+	curR[j] = curJ[j];
+	curSplit[j] = TSplit(i, curJLeft[j], j);
+	if ((i > 0) && (j > 0)) _longNeedleJoin(prevR[j-1] + (_longNeedleEq(s1[i-1], s2[j-1]) ? sc.match : sc.mismatch), prevSplit[j-1], curR[j], curSplit[j]);
+	if (i > 0) _longNeedleJoin(prevR[j] + _verticalGap(ac, j, n, sc.ge), prevSplit[j], curR[j], curSplit[j]);
+	if (j > 0) _longNeedleJoin(curR[j-1] + _horizontalGap(ac, i, m, sc.ge), curSplit[j-1], curR[j], curSplit[j]);
+      }
+      prevF.swap(curF);
+      prevU.swap(curU);
+      prevR.swap(curR);
+      prevSplit.swap(curSplit);
     }
+    if (prevF[n] != prevU[n]) return false;
+    if (prevR[n] == prevF[n]) return false; // No split found
+    std::size_t consLeft = boost::get<0>(prevSplit[n]);
+    std::size_t refLeft = boost::get<1>(prevSplit[n]);
+    std::size_t refEnd = boost::get<2>(prevSplit[n]);
+
+    std::size_t consRight = m - consLeft;
+    std::size_t refRight = n - refEnd;
+
+    // Trace-back of the prefix and the reverse complemented suffix
+    typedef std::vector<char> TTrace;
+    TTrace trace;
+    _nwTrace(s1, s2, consLeft, refLeft, ac, sc, trace);
+    TAlign fwd;
+    _createAlignment(trace, s1.substr(0, consLeft), s2.substr(0, refLeft), fwd);
+    TTrace().swap(trace);
+    std::string sRev1 = s1;
+    reverseComplement(sRev1);
+    std::string sRev2 = s2;
+    reverseComplement(sRev2);
+    _nwTrace(sRev1, sRev2, consRight, refRight, ac, sc, trace);
+    TAlign rvs;
+    _createAlignment(trace, sRev1.substr(0, consRight), sRev2.substr(0, refRight), rvs);
+
+    // Concat alignments
+    _longNeedleConcat(fwd, rvs, s2, refLeft, refRight, align);
     return true;
   }
+
+  template<typename TAlign, typename TAlignConfig, typename TScoreObject>
+  inline bool
+  longNeedle(std::string const& s1, std::string const& s2, TAlign& align, TAlignConfig const& ac, TScoreObject const& sc, AlignWorkspace<typename TScoreObject::TValue>& ws)
+  {
+    // Four full DP matrices for short sequences, linear space otherwise
+    if ((s1.size() + 1) * (s2.size() + 1) <= DELLY_LONGNEEDLE_MAXCELLS) return _longNeedleFull(s1, s2, align, ac, sc, ws);
+    return longNeedleLinear(s1, s2, align, ac, sc);
+  }
+
+  template<typename TAlign, typename TAlignConfig, typename TScoreObject>
+  inline bool
+  longNeedle(std::string const& s1, std::string const& s2, TAlign& align, TAlignConfig const& ac, TScoreObject const& sc)
+  {
+    ThreadWorkspace<typename TScoreObject::TValue> tw;
+    return longNeedle(s1, s2, align, ac, sc, tw.ws);
+  }
   
   
   template<typename TAlign1, typename TAlign2, typename TAlignConfig, typename TScoreObject>
@@ -235,13 +442,10 @@ namespace torali
     TScoreValue prevsub = 0;
 
     // Create profile
-    typedef boost::multi_array<double, 2> TProfile;
+    typedef ScoreProfile<double> TProfile;
     TProfile p1;
     TProfile p2;
-    if ((_size(a1, 0) != 1) || (_size(a2, 0) != 1)) {
-      _createProfile(a1, p1);
-      _createProfile(a2, p2);
-    }
+    if ((_size(a1, 0) != 1) || (_size(a2, 0) != 1)) _createScoreProfile(a1, a2, p1, p2);
 
     // DP
     for(std::size_t row = 0; row <= m; ++row) {
@@ -323,30 +527,29 @@ namespace torali
   
   template<typename TAlign1, typename TAlign2, typename TAlign, typename TAlignConfig, typename TScoreObject>
   inline int
-  needle(TAlign1 const& a1, TAlign2 const& a2, TAlign& align, TAlignConfig const& ac, TScoreObject const& sc)
+  needle(TAlign1 const& a1, TAlign2 const& a2, TAlign& align, TAlignConfig const& ac, TScoreObject const& sc, AlignWorkspace<typename TScoreObject::TValue>& ws)
   {
     typedef typename TScoreObject::TValue TScoreValue;
 
     // DP Matrix
     std::size_t m = _size(a1, 1);
     std::size_t n = _size(a2, 1);
-    std::vector<TScoreValue> s(n+1, 0);
+    std::vector<TScoreValue>& s = ws.s;
+    _reserveWorkspace(s, n+1);
     TScoreValue prevsub = 0;
 
-    // Trace Matrix
+    // Trace Matrix, every cell is written below
     std::size_t mf = n+1;
-    typedef boost::dynamic_bitset<> TBitSet;
-    TBitSet bit3( (m+1) * (n+1), false);
-    TBitSet bit4( (m+1) * (n+1), false);
+    typedef typename AlignWorkspace<TScoreValue>::TBitSet TBitSet;
+    TBitSet& bit3 = ws.bit[2];
+    TBitSet& bit4 = ws.bit[3];
+    _reserveWorkspace(bit3, (m+1) * (n+1));
+    _reserveWorkspace(bit4, (m+1) * (n+1));
     
     // Create profile
-    typedef boost::multi_array<double, 2> TProfile;
-    TProfile p1;
-    TProfile p2;
-    if ((_size(a1, 0) != 1) || (_size(a2, 0) != 1)) {
-      _createProfile(a1, p1);
-      _createProfile(a2, p2);
-    }
+    ScoreProfile<double>& p1 = ws.dp1;
+    ScoreProfile<double>& p2 = ws.dp2;
+    if ((_size(a1, 0) != 1) || (_size(a2, 0) != 1)) _createScoreProfile(a1, a2, p1, p2);
 
     // DP
     for(std::size_t row = 0; row <= m; ++row) {
@@ -355,13 +558,17 @@ namespace torali
 	if ((row == 0) && (col == 0)) {
 	  s[0] = 0;
 	  prevsub = 0;
+	  bit3[0] = false;
+	  bit4[0] = false;
 	} else if (row == 0) {
 	  s[col] = _horizontalGap(ac, 0, m, col * sc.ge);
 	  bit3[col] = true;
+	  bit4[col] = false;
 	} else if (col == 0) {
 	  s[0] = _verticalGap(ac, 0, n, row * sc.ge);
 	  if (row - 1 == 0) prevsub = 0;
 	  else prevsub = _verticalGap(ac, 0, n, (row - 1) * sc.ge);
+	  bit3[row * mf] = false;
 	  bit4[row * mf] = true;
 	} else {
 	  // Recursion
@@ -370,8 +577,9 @@ namespace torali
 	  s[col] = std::max(std::max(prevprevsub + _score(a1, a2, p1, p2, row-1, col-1, sc), prevsub + _verticalGap(ac, col, n, sc.ge)), s[col-1] + _horizontalGap(ac, row, m, sc.ge));
 
 	  // Trace
-	  if (s[col] ==  s[col-1] + _horizontalGap(ac, row, m, sc.ge)) bit3[row * mf + col] = true;
-	  else if (s[col] == prevsub + _verticalGap(ac, col, n, sc.ge)) bit4[row * mf + col] = true;
+	  bool hoz = (s[col] ==  s[col-1] + _horizontalGap(ac, row, m, sc.ge));
+	  bit3[row * mf + col] = hoz;
+	  bit4[row * mf + col] = ((!hoz) && (s[col] == prevsub + _verticalGap(ac, col, n, sc.ge)));
 	}
       }
     }
@@ -379,8 +587,8 @@ namespace torali
     // Trace-back using pointers
     std::size_t row = m;
     std::size_t col = n;
-    typedef std::vector<char> TTrace;
-    TTrace trace;
+    std::vector<char>& trace = ws.trace;
+    trace.clear();
     while ((row>0) || (col>0)) {
       if (bit3[row * mf + col]) {
 	--col;
@@ -402,6 +610,14 @@ namespace torali
     return s[n];
   }
 
+  template<typename TAlign1, typename TAlign2, typename TAlign, typename TAlignConfig, typename TScoreObject>
+  inline int
+  needle(TAlign1 const& a1, TAlign2 const& a2, TAlign& align, TAlignConfig const& ac, TScoreObject const& sc)
+  {
+    ThreadWorkspace<typename TScoreObject::TValue> tw;
+    return needle(a1, a2, align, ac, sc, tw.ws);
+  }
+
   template<typename TAlign1, typename TAlign2, typename TAlign, typename TAlignConfig>
   inline int
   needle(TAlign1 const& a1, TAlign2 const& a2, TAlign& align, TAlignConfig const& ac)
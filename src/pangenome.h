@@ -403,7 +403,7 @@ namespace torali {
       std::string padNumber = boost::lexical_cast<std::string>(i);
       padNumber.insert(padNumber.begin(), 8 - padNumber.length(), '0');
       idname += padNumber;
-      std::cerr << idSegment[svs[i].chr] << '\t' << svs[i].svStart << '\t' << idSegment[svs[i].chr2] << '\t' << svs[i].svEnd << '\t' << idname << '\t' << _addID(svs[i].svt) << '\t' << _addOrientation(svs[i].svt) << '\t' << svs[i].peSupport << '\t' << svs[i].srSupport << '\t' << svs[i].consensus << std::endl;
+      std::cerr << idSegment[svs[i].chr] << '\t' << svs[i].svStart << '\t' << idSegment[svs[i].chr2] << '\t' << svs[i].svEnd << '\t' << idname << '\t' << _addID(svs[i].svt) << '\t' << _addOrientation(svs[i].svt) << '\t' << svs[i].peSupport << '\t' << svs[i].srSupport << '\t' << svs[i].consensus.str() << std::endl;
     }
   }
 
@@ -519,7 +519,9 @@ namespace torali {
 		  // Enough split-reads?
 		  if ((seqStore[svid].size() == c.maxReadPerSV) || ((int32_t) seqStore[svid].size() == svs[svid].srSupport)) {
 		    if (seqStore[svid].size() > 1) {
-		      msaEdlib(c, seqStore[svid], svs[svid].consensus);
+		      std::string cons;
+		      msaEdlib(c, seqStore[svid], cons);
+		      svs[svid].consensus = cons;
 
 		      // Debug
 		      //std::string idname(_addID(svs[svid].svt));
@@ -547,7 +549,11 @@ namespace torali {
     // Handle left-overs
     for(uint32_t svid = 0; svid < svcons.size(); ++svid) {
       if (!svcons[svid]) {
-	if (seqStore[svid].size() > 1) msaEdlib(c, seqStore[svid], svs[svid].consensus);
+	if (seqStore[svid].size() > 1) {
+	  std::string cons;
+	  msaEdlib(c, seqStore[svid], cons);
+	  svs[svid].consensus = cons;
+	}
 	seqStore[svid].clear();
 	svcons[svid] = true;
 
@@ -612,47 +618,49 @@ namespace torali {
   inline void
   alignToGraph(TConfig const& c, Graph& g, std::vector<StructuralVariantRecord>& svs) {
     // Generate pairwise alignment
+    std::string consensus;
     for(uint32_t svid = 0; svid < svs.size(); ++svid) {
-      std::cerr << "SV:" << svid << ',' << svs[svid].svStart << ',' << svs[svid].svEnd << '\t' << svs[svid].svt << ',' << svs[svid].consensus.size() << std::endl;
+      svs[svid].consensus.str(consensus);
+      std::cerr << "SV:" << svid << ',' << svs[svid].svStart << ',' << svs[svid].svEnd << '\t' << svs[svid].svt << ',' << consensus.size() << std::endl;
       bool validConsensusAlignment = false;
       AlignDescriptor ad;
-      if ( (int32_t) svs[svid].consensus.size() >= (2 * c.minimumFlankSize + svs[svid].insLen)) {
+      if ( (int32_t) consensus.size() >= (2 * c.minimumFlankSize + svs[svid].insLen)) {
 	if (svs[svid].svt == 2) { 	// Deletion
 	  uint32_t svsize = svs[svid].svEnd - svs[svid].svStart;
-	  if (svsize < svs[svid].consensus.size()) {
-	    int32_t startpos = svs[svid].svStart - svs[svid].consensus.size();
+	  if (svsize < consensus.size()) {
+	    int32_t startpos = svs[svid].svStart - consensus.size();
 	    std::vector<std::string> prefix;
 	    if (startpos < 0) {
 	      startpos = 0;
-	      _fillPrefix(g, svs[svid].chr, "", prefix, svs[svid].consensus.size() - svs[svid].svStart);
+	      _fillPrefix(g, svs[svid].chr, "", prefix, consensus.size() - svs[svid].svStart);
 	    }
 	    for(uint32_t i = 0; i < prefix.size(); ++i) std::cerr << "Prefix: " << prefix[i] << std::endl;
-	    int32_t endpos = svs[svid].svEnd + svs[svid].consensus.size();
+	    int32_t endpos = svs[svid].svEnd + consensus.size();
 	    std::vector<std::string> suffix;
 	    if (endpos > (int) g.nodelen(svs[svid].chr)) {
 	      endpos = g.nodelen(svs[svid].chr);
-	      _fillSuffix(g, svs[svid].chr, "", suffix, svs[svid].consensus.size() - (g.nodelen(svs[svid].chr) - svs[svid].svEnd));
+	      _fillSuffix(g, svs[svid].chr, "", suffix, consensus.size() - (g.nodelen(svs[svid].chr) - svs[svid].svEnd));
 	    }
 	    for(uint32_t i = 0; i < prefix.size(); ++i) std::cerr << "Suffix: " << suffix[i] << std::endl;
 	    std::string svRefStr = g.nodeseq(svs[svid].chr).substr(startpos, (endpos - startpos));
 	    std::cerr << "SV:" << svid << ',' << svRefStr << std::endl;
-	    std::cerr << "SV:" << svid << ',' << svs[svid].consensus << std::endl;
-	    if (_alignConsensus(c, svs[svid].consensus, svRefStr, svs[svid].svt, ad, true)) {
+	    std::cerr << "SV:" << svid << ',' << consensus << std::endl;
+	    if (_alignConsensus(c, consensus, svRefStr, svs[svid].svt, ad, true)) {
 	      validConsensusAlignment = true;
 	      std::cerr << "Valid alignment" << std::endl;
 	    }
 	  } else {
-	    int32_t startpos1 = svs[svid].svStart - svs[svid].consensus.size();
+	    int32_t startpos1 = svs[svid].svStart - consensus.size();
 	    if (startpos1 < 0) startpos1 = 0;
-	    int32_t endpos1 = svs[svid].svStart + svs[svid].consensus.size();
+	    int32_t endpos1 = svs[svid].svStart + consensus.size();
 	    if (endpos1 > (int) g.nodelen(svs[svid].chr)) endpos1 = g.nodelen(svs[svid].chr);
 	    std::string svRefStr = g.nodeseq(svs[svid].chr).substr(startpos1, (endpos1 - startpos1));
-	    int32_t startpos2 = svs[svid].svEnd - svs[svid].consensus.size();
+	    int32_t startpos2 = svs[svid].svEnd - consensus.size();
 	    if (startpos2 < 0) startpos2 = 0;
-	    int32_t endpos2 = svs[svid].svEnd + svs[svid].consensus.size();
+	    int32_t endpos2 = svs[svid].svEnd + consensus.size();
 	    if (endpos2 > (int) g.nodelen(svs[svid].chr)) endpos2 = g.nodelen(svs[svid].chr);
 	    svRefStr += g.nodeseq(svs[svid].chr).substr(startpos2, (endpos2 - startpos2));
-	    if (_alignConsensus(c, svs[svid].consensus, svRefStr, svs[svid].svt, ad, true)) {
+	    if (_alignConsensus(c, consensus, svRefStr, svs[svid].svt, ad, true)) {
 	      validConsensusAlignment = true;
 	      std::cerr << "Valid alignment" << std::endl;
 	    }	    
@@ -665,6 +673,7 @@ namespace torali {
 	//svs[svid].srSupport = 0;
 	//svs[svid].srAlignQuality = 0;
       } else {
+	svs[svid].consensus = consensus;
 	svs[svid].precise = true;
 	//sv.svStart=finalGapStart;
 	//sv.svEnd=finalGapEnd;
@@ -688,7 +697,8 @@ namespace torali {
    ProfilerStart("delly.prof");
 #endif
 
-   // Structural Variants
+   // Structural Variants, their sequences live in the pool of this run
+   SequencePoolScope poolScope;
    typedef std::vector<StructuralVariantRecord> TVariants;
    TVariants svs;
 
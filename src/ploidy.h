@@ -0,0 +1,178 @@
+#ifndef PLOIDY_H
+#define PLOIDY_H
+
+#include <iostream>
+#include <fstream>
+#include <boost/filesystem.hpp>
+#include <boost/tokenizer.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/math/special_functions/round.hpp>
+
+#include <htslib/sam.h>
+
+#include "util.h"
+
+namespace torali
+{
+
+  #ifndef DELLY_PLOIDY_UNKNOWN
+  #define DELLY_PLOIDY_UNKNOWN 65535
+  #endif
+
+  // Copy-number baseline of each sample and contig
+  // Contigs of unknown ploidy are left out of GC normalization and genotyped against the global ploidy, ploidy 0 contigs are skipped
+  struct PloidyMap {
+    uint32_t nchr;
+    std::vector<uint16_t> ploidy;  // sample * nchr + refIndex
+
+    PloidyMap() : nchr(0) {}
+  };
+
+  inline uint16_t
+  _contigPloidy(PloidyMap const& pm, uint32_t const sample, int32_t const refIndex) {
+    return pm.ploidy[sample * pm.nchr + refIndex];
+  }
+
+  // Reference copy-number for genotyping
+  template<typename TConfig>
+  inline uint16_t
+  _refPloidy(TConfig const& c, PloidyMap const& pm, uint32_t const sample, int32_t const refIndex) {
+    uint16_t p = _contigPloidy(pm, sample, refIndex);
+    if (p == DELLY_PLOIDY_UNKNOWN) return c.ploidy;
+    return p;
+  }
+
+  // Contig at baseline ploidy, used for scan windows and GC bias
+  template<typename TConfig>
+  inline bool
+  _baselineContig(TConfig const& c, PloidyMap const& pm, uint32_t const sample, int32_t const refIndex) {
+    return (_contigPloidy(pm, sample, refIndex) == c.ploidy);
+  }
+
+  inline bool
+  _absentContig(PloidyMap const& pm, uint32_t const sample, int32_t const refIndex) {
+    return (_contigPloidy(pm, sample, refIndex) == 0);
+  }
+
+  // Global ploidy everywhere except the sex chromosomes, optionally overridden by a ploidy file
+  template<typename TConfig>
+  inline bool
+  initPloidyMap(TConfig const& c, bam_hdr_t const* hdr, std::vector<std::string> const& sampleNames, PloidyMap& pm) {
+    pm.nchr = hdr->n_targets;
+    pm.ploidy.assign(sampleNames.size() * pm.nchr, c.ploidy);
+    for(uint32_t s = 0; s < sampleNames.size(); ++s) {
+      for(int32_t refIndex = 0; refIndex < hdr->n_targets; ++refIndex) {
+	std::string tname(hdr->target_name[refIndex]);
+	if ((tname == "chrX") || (tname == "chrY") || (tname == "X") || (tname == "Y")) pm.ploidy[s * pm.nchr + refIndex] = DELLY_PLOIDY_UNKNOWN;
+      }
+    }
+    if (!c.hasPloidyFile) return true;
+
+    // Tab-delimited contig, ploidy and optional sample, "." marks unknown ploidy
+    std::ifstream file(c.ploidyFile.string().c_str());
+    if (!file.is_open()) {
+      std::cerr << "Ploidy file is missing: " << c.ploidyFile.string() << std::endl;
+      return false;
+    }
+    typedef boost::tokenizer< boost::char_separator<char> > Tokenizer;
+    boost::char_separator<char> sep(" \t");
+    std::vector<std::pair<uint32_t, std::vector<std::string> > > entries;
+    std::string line;
+    uint32_t lineNo = 0;
+    while(std::getline(file, line)) {
+      ++lineNo;
+      if ((line.empty()) || (line[0] == '#')) continue;
+      Tokenizer tokens(line, sep);
+      std::vector<std::string> cols(tokens.begin(), tokens.end());
+      if (cols.empty()) continue;
+      if ((cols.size() < 2) || (cols.size() > 3)) {
+	std::cerr << "Ploidy file line " << lineNo << " needs contig, ploidy and an optional sample!" << std::endl;
+	return false;
+      }
+      entries.push_back(std::make_pair(lineNo, cols));
+    }
+
+    // All-sample lines first, then sample overrides
+    for(uint32_t pass = 2; pass <= 3; ++pass) {
+      for(uint32_t i = 0; i < entries.size(); ++i) {
+	std::vector<std::string> const& cols = entries[i].second;
+	if (cols.size() != pass) continue;
+	int32_t refIndex = bam_name2id(const_cast<bam_hdr_t*>(hdr), cols[0].c_str());
+	if (refIndex < 0) {
+	  if (pass == 2) std::cerr << "Warning: Ploidy file contig not in alignment header: " << cols[0] << std::endl;
+	  continue;
+	}
+	uint16_t p = DELLY_PLOIDY_UNKNOWN;
+	if (cols[1] != ".") {
+	  try {
+	    p = boost::lexical_cast<uint16_t>(cols[1]);
+	  } catch (boost::bad_lexical_cast&) {
+	    p = MAX_CN;
+	  }
+	  if (p >= MAX_CN) {
+	    std::cerr << "Ploidy file line " << entries[i].first << " has an invalid ploidy, max. " << (MAX_CN - 1) << ": " << cols[1] << std::endl;
+	    return false;
+	  }
+	}
+	for(uint32_t s = 0; s < sampleNames.size(); ++s) {
+	  if ((pass == 3) && (cols[2] != sampleNames[s])) continue;
+	  pm.ploidy[s * pm.nchr + refIndex] = p;
+	}
+      }
+    }
+    return true;
+  }
+
+  // Fragments in unique positions per unique base of each scan window with at least half of its bases unique
+  template<typename TConfig, typename TScanWindows>
+  inline void
+  _uniqueDensity(TConfig const& c, std::vector<uint16_t> const& uniqContent, TScanWindows const& sw, std::vector<float>& density) {
+    density.clear();
+    for(uint32_t i = 0; i < sw.size(); ++i) {
+      uint32_t ubases = 0;
+      for(int32_t pos = sw[i].start; ((pos < sw[i].end) && (pos < (int32_t) uniqContent.size())); ++pos) {
+	if (uniqContent[pos] >= c.fragmentUnique * c.meanisize) ++ubases;
+      }
+      if ((ubases) && (2 * ubases >= (uint32_t) (sw[i].end - sw[i].start))) density.push_back((float) sw[i].uniqcov / (float) ubases);
+    }
+  }
+
+  inline double
+  _medianDensity(std::vector<float> d) {
+    if (d.empty()) return 0;
+    std::nth_element(d.begin(), d.begin() + d.size() / 2, d.end());
+    return d[d.size() / 2];
+  }
+
+  // Unknown ploidies from the median unique-fragment density relative to the baseline contigs
+  template<typename TConfig>
+  inline void
+  inferPloidy(TConfig const& c, bam_hdr_t const* hdr, std::string const& sampleName, uint32_t const sample, std::vector<std::vector<float> > const& density, PloidyMap& pm) {
+    std::vector<float> base;
+    for(int32_t refIndex = 0; refIndex < (int32_t) density.size(); ++refIndex) {
+      if (_baselineContig(c, pm, sample, refIndex)) base.insert(base.end(), density[refIndex].begin(), density[refIndex].end());
+    }
+    double baseDensity = _medianDensity(base);
+    if (baseDensity <= 0) return;
+    for(int32_t refIndex = 0; refIndex < (int32_t) density.size(); ++refIndex) {
+      if (_contigPloidy(pm, sample, refIndex) != DELLY_PLOIDY_UNKNOWN) continue;
+      if (density[refIndex].size() < 10) continue;
+      int32_t p = (int32_t) boost::math::round(c.ploidy * _medianDensity(density[refIndex]) / baseDensity);
+      if (p >= MAX_CN) p = MAX_CN - 1;
+      pm.ploidy[sample * pm.nchr + refIndex] = p;
+      std::cerr << "Inferred ploidy " << sampleName << " " << hdr->target_name[refIndex] << ": " << p << std::endl;
+    }
+  }
+
+  // Keep scan windows of baseline contigs only
+  template<typename TConfig, typename TGenomicWindowCounts>
+  inline void
+  _baselineScanWindows(TConfig const& c, PloidyMap const& pm, uint32_t const sample, TGenomicWindowCounts& scanCounts) {
+    for(int32_t refIndex = 0; refIndex < (int32_t) scanCounts.size(); ++refIndex) {
+      if (!_baselineContig(c, pm, sample, refIndex)) scanCounts[refIndex].clear();
+    }
+  }
+
+}
+
+#endif
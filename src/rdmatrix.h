@@ -0,0 +1,301 @@
+#ifndef RDMATRIX_H
+#define RDMATRIX_H
+
+#include <iostream>
+#include <fstream>
+#include <zlib.h>
+#include <boost/filesystem.hpp>
+
+#include <htslib/sam.h>
+
+#include "util.h"
+
+namespace torali
+{
+
+  #ifndef DELLY_RDMATRIX_VERSION
+  #define DELLY_RDMATRIX_VERSION 1
+  #endif
+
+  #ifndef DELLY_RDMATRIX_BINSIZE
+  #define DELLY_RDMATRIX_BINSIZE 200
+  #endif
+
+  #ifndef DELLY_RDMATRIX_CHUNK
+  #define DELLY_RDMATRIX_CHUNK 4096
+  #endif
+
+  // Windows spanning fewer bins are counted from the alignments, pro-rated edge bins would dominate the sum
+  #ifndef DELLY_RDMATRIX_MINBINS
+  #define DELLY_RDMATRIX_MINBINS 10
+  #endif
+
+  // Deflated chunk of one column
+  struct RdChunk {
+    uint64_t offset;
+    uint32_t size;
+
+    RdChunk() : offset(0), size(0) {}
+    RdChunk(uint64_t const o, uint32_t const s) : offset(o), size(s) {}
+  };
+
+  // Read-depth matrix: fixed bins per chromosome, one float column per sample and field, stored in deflated chunks of DELLY_RDMATRIX_CHUNK bins
+  struct RdMatrixFile {
+    typedef std::vector<RdChunk> TColumn;
+
+    int32_t binSize;
+    std::vector<std::string> sampleName;
+    std::vector<std::string> field;
+    std::vector<std::string> tname;
+    std::vector<uint32_t> tlen;
+    std::vector<std::vector<TColumn> > index;
+    std::fstream fs;
+
+    // Last inflated chunk
+    int32_t cacheChr;
+    int32_t cacheCol;
+    int32_t cacheChunk;
+    std::vector<float> cache;
+
+    RdMatrixFile() : binSize(0), cacheChr(-1), cacheCol(-1), cacheChunk(-1) {}
+  };
+
+  inline uint32_t
+  rdBins(RdMatrixFile const& rf, int32_t const refIndex) {
+    return (rf.tlen[refIndex] + rf.binSize - 1) / rf.binSize;
+  }
+
+  inline int32_t
+  rdSample(RdMatrixFile const& rf, std::string const& sample) {
+    for(uint32_t i = 0; i < rf.sampleName.size(); ++i) {
+      if (rf.sampleName[i] == sample) return i;
+    }
+    return -1;
+  }
+
+  inline int32_t
+  rdField(RdMatrixFile const& rf, std::string const& name) {
+    for(uint32_t i = 0; i < rf.field.size(); ++i) {
+      if (rf.field[i] == name) return i;
+    }
+    return -1;
+  }
+
+  inline bool
+  openRdMatrix(boost::filesystem::path const& path, bam_hdr_t const* hdr, int32_t const binSize, std::vector<std::string> const& sampleName, std::vector<std::string> const& field, RdMatrixFile& rf) {
+    rf.fs.open(path.string().c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!rf.fs.is_open()) return false;
+    rf.binSize = binSize;
+    rf.sampleName = sampleName;
+    rf.field = field;
+    rf.tname.resize(hdr->n_targets);
+    rf.tlen.resize(hdr->n_targets);
+    rf.index.assign(hdr->n_targets, std::vector<RdMatrixFile::TColumn>(sampleName.size() * field.size(), RdMatrixFile::TColumn()));
+    rf.fs.write("DELLYRDM", 8);
+    _ckpWrite(rf.fs, (uint32_t) DELLY_RDMATRIX_VERSION);
+    _ckpWrite(rf.fs, binSize);
+    _ckpWrite(rf.fs, (int32_t) sampleName.size());
+    for(uint32_t i = 0; i < sampleName.size(); ++i) _ckpWrite(rf.fs, sampleName[i]);
+    _ckpWrite(rf.fs, (int32_t) field.size());
+    for(uint32_t i = 0; i < field.size(); ++i) _ckpWrite(rf.fs, field[i]);
+    _ckpWrite(rf.fs, (int32_t) hdr->n_targets);
+    for(int32_t refIndex = 0; refIndex < hdr->n_targets; ++refIndex) {
+      rf.tname[refIndex] = hdr->target_name[refIndex];
+      rf.tlen[refIndex] = hdr->target_len[refIndex];
+      _ckpWrite(rf.fs, rf.tname[refIndex]);
+      _ckpWrite(rf.fs, rf.tlen[refIndex]);
+    }
+    return rf.fs.good();
+  }
+
+  // Bytes of all values are grouped by significance before deflating, exponents and high mantissa bits then compress well
+  inline bool
+  writeRdColumn(RdMatrixFile& rf, int32_t const refIndex, uint32_t const sample, uint32_t const field, std::vector<float> const& values) {
+    RdMatrixFile::TColumn& col = rf.index[refIndex][sample * rf.field.size() + field];
+    col.clear();
+    std::vector<Bytef> plane;
+    std::vector<Bytef> buffer;
+    for(uint32_t k = 0; k < values.size(); k += DELLY_RDMATRIX_CHUNK) {
+      uint32_t n = std::min((uint32_t) values.size() - k, (uint32_t) DELLY_RDMATRIX_CHUNK);
+      plane.resize(n * sizeof(float));
+      Bytef const* raw = reinterpret_cast<Bytef const*>(&values[k]);
+      for(uint32_t i = 0; i < n; ++i) {
+	for(uint32_t b = 0; b < sizeof(float); ++b) plane[b * n + i] = raw[i * sizeof(float) + b];
+      }
+      uLongf destLen = compressBound(plane.size());
+      buffer.resize(destLen);
+      if (compress2(&buffer[0], &destLen, &plane[0], plane.size(), Z_DEFAULT_COMPRESSION) != Z_OK) return false;
+      col.push_back(RdChunk(rf.fs.tellp(), destLen));
+      rf.fs.write(reinterpret_cast<char const*>(&buffer[0]), destLen);
+    }
+    return rf.fs.good();
+  }
+
+  // Trailing chunk table, its position is stored in the last 8 bytes
+  inline bool
+  closeRdMatrix(RdMatrixFile& rf) {
+    uint64_t tableOffset = rf.fs.tellp();
+    for(uint32_t refIndex = 0; refIndex < rf.index.size(); ++refIndex) {
+      for(uint32_t col = 0; col < rf.index[refIndex].size(); ++col) {
+	_ckpWrite(rf.fs, (uint32_t) rf.index[refIndex][col].size());
+	for(uint32_t k = 0; k < rf.index[refIndex][col].size(); ++k) {
+	  _ckpWrite(rf.fs, rf.index[refIndex][col][k].offset);
+	  _ckpWrite(rf.fs, rf.index[refIndex][col][k].size);
+	}
+      }
+    }
+    _ckpWrite(rf.fs, tableOffset);
+    bool ok = rf.fs.good();
+    rf.fs.close();
+    return ok;
+  }
+
+  inline bool
+  _rdReadString(std::istream& in, uint64_t const fileSize, std::string& str) {
+    uint32_t len = 0;
+    if ((!_ckpRead(in, len)) || (len > fileSize)) return false;
+    str.resize(len);
+    if (len) in.read(&str[0], len);
+    return in.good();
+  }
+
+  inline bool
+  readRdMatrixHeader(boost::filesystem::path const& path, RdMatrixFile& rf) {
+    rf.fs.open(path.string().c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!rf.fs.is_open()) return false;
+    rf.fs.seekg(0, std::ios_base::end);
+    std::streamoff end = rf.fs.tellg();
+    if (end < 0) return false;
+    uint64_t fileSize = end;
+    rf.fs.seekg(0, std::ios_base::beg);
+    char magic[8];
+    rf.fs.read(magic, 8);
+    if ((!rf.fs.good()) || (std::string(magic, magic + 8) != "DELLYRDM")) return false;
+    uint32_t version = 0;
+    if ((!_ckpRead(rf.fs, version)) || (version != DELLY_RDMATRIX_VERSION)) return false;
+    if ((!_ckpRead(rf.fs, rf.binSize)) || (rf.binSize < 1)) return false;
+    // Counts are checked against the file size before anything is allocated, every string takes at least its 4-byte length
+    int32_t n = 0;
+    if ((!_ckpRead(rf.fs, n)) || (n < 0) || ((uint64_t) n > fileSize / 4)) return false;
+    rf.sampleName.resize(n);
+    for(int32_t i = 0; i < n; ++i) {
+      if (!_rdReadString(rf.fs, fileSize, rf.sampleName[i])) return false;
+    }
+    if ((!_ckpRead(rf.fs, n)) || (n < 0) || ((uint64_t) n > fileSize / 4)) return false;
+    rf.field.resize(n);
+    for(int32_t i = 0; i < n; ++i) {
+      if (!_rdReadString(rf.fs, fileSize, rf.field[i])) return false;
+    }
+    int32_t nchr = 0;
+    if ((!_ckpRead(rf.fs, nchr)) || (nchr < 0) || ((uint64_t) nchr > fileSize / 8)) return false;
+    rf.tname.resize(nchr);
+    rf.tlen.resize(nchr);
+    for(int32_t refIndex = 0; refIndex < nchr; ++refIndex) {
+      if (!_rdReadString(rf.fs, fileSize, rf.tname[refIndex])) return false;
+      if (!_ckpRead(rf.fs, rf.tlen[refIndex])) return false;
+    }
+
+    // Chunk table, one chunk count per chromosome and column followed by the trailing table offset
+    uint64_t tableOffset = 0;
+    rf.fs.seekg(-((std::streamoff) sizeof(uint64_t)), std::ios_base::end);
+    if (!_ckpRead(rf.fs, tableOffset)) return false;
+    uint64_t ncol = rf.sampleName.size() * rf.field.size();
+    if ((tableOffset > fileSize - sizeof(uint64_t)) || ((fileSize - sizeof(uint64_t) - tableOffset) / sizeof(uint32_t) < (uint64_t) nchr * ncol)) return false;
+    uint64_t tableLeft = fileSize - sizeof(uint64_t) - tableOffset;
+    rf.fs.seekg(tableOffset);
+    rf.index.assign(nchr, std::vector<RdMatrixFile::TColumn>(ncol, RdMatrixFile::TColumn()));
+    for(int32_t refIndex = 0; refIndex < nchr; ++refIndex) {
+      for(uint32_t col = 0; col < rf.index[refIndex].size(); ++col) {
+	uint32_t nchunk = 0;
+	if (!_ckpRead(rf.fs, nchunk)) return false;
+	tableLeft -= sizeof(uint32_t);
+	if (nchunk > tableLeft / (sizeof(uint64_t) + sizeof(uint32_t))) return false;
+	tableLeft -= nchunk * (sizeof(uint64_t) + sizeof(uint32_t));
+	rf.index[refIndex][col].resize(nchunk);
+	for(uint32_t k = 0; k < nchunk; ++k) {
+	  if (!_ckpRead(rf.fs, rf.index[refIndex][col][k].offset)) return false;
+	  if (!_ckpRead(rf.fs, rf.index[refIndex][col][k].size)) return false;
+	  if ((rf.index[refIndex][col][k].offset > tableOffset) || (rf.index[refIndex][col][k].size > tableOffset - rf.index[refIndex][col][k].offset)) return false;
+	}
+      }
+    }
+    return true;
+  }
+
+  // Chromosomes of the matrix must match the alignment header
+  inline bool
+  rdMatchesHeader(RdMatrixFile const& rf, bam_hdr_t const* hdr) {
+    if ((int32_t) rf.tname.size() != hdr->n_targets) return false;
+    for(int32_t refIndex = 0; refIndex < hdr->n_targets; ++refIndex) {
+      if ((rf.tname[refIndex] != hdr->target_name[refIndex]) || (rf.tlen[refIndex] != hdr->target_len[refIndex])) return false;
+    }
+    return true;
+  }
+
+  inline bool
+  hasRdColumn(RdMatrixFile const& rf, int32_t const refIndex, uint32_t const sample, uint32_t const field) {
+    return !rf.index[refIndex][sample * rf.field.size() + field].empty();
+  }
+
+  inline bool
+  _readRdChunk(RdMatrixFile& rf, int32_t const refIndex, int32_t const col, int32_t const k) {
+    if ((rf.cacheChr == refIndex) && (rf.cacheCol == col) && (rf.cacheChunk == k)) return true;
+    rf.cacheChr = -1;
+    RdChunk const& chunk = rf.index[refIndex][col][k];
+    uint32_t n = std::min(rdBins(rf, refIndex) - k * DELLY_RDMATRIX_CHUNK, (uint32_t) DELLY_RDMATRIX_CHUNK);
+    std::vector<Bytef> buffer(chunk.size);
+    rf.fs.seekg(chunk.offset);
+    rf.fs.read(reinterpret_cast<char*>(&buffer[0]), chunk.size);
+    if (!rf.fs.good()) return false;
+    std::vector<Bytef> plane(n * sizeof(float));
+    uLongf destLen = plane.size();
+    if ((uncompress(&plane[0], &destLen, &buffer[0], chunk.size) != Z_OK) || (destLen != plane.size())) return false;
+    rf.cache.resize(n);
+    Bytef* raw = reinterpret_cast<Bytef*>(&rf.cache[0]);
+    for(uint32_t i = 0; i < n; ++i) {
+      for(uint32_t b = 0; b < sizeof(float); ++b) raw[i * sizeof(float) + b] = plane[b * n + i];
+    }
+    rf.cacheChr = refIndex;
+    rf.cacheCol = col;
+    rf.cacheChunk = k;
+    return true;
+  }
+
+  // Values of bins [firstBin, lastBin), only the chunks overlapping the region are inflated
+  inline bool
+  readRdBins(RdMatrixFile& rf, int32_t const refIndex, uint32_t const sample, uint32_t const field, uint32_t firstBin, uint32_t lastBin, std::vector<float>& values) {
+    values.clear();
+    int32_t col = sample * rf.field.size() + field;
+    if (rf.index[refIndex][col].empty()) return false;
+    lastBin = std::min(lastBin, rdBins(rf, refIndex));
+    for(uint32_t b = firstBin; b < lastBin; ) {
+      uint32_t k = b / DELLY_RDMATRIX_CHUNK;
+      if (!_readRdChunk(rf, refIndex, col, k)) return false;
+      uint32_t chunkEnd = std::min(lastBin, (k + 1) * DELLY_RDMATRIX_CHUNK);
+      values.insert(values.end(), rf.cache.begin() + (b - k * DELLY_RDMATRIX_CHUNK), rf.cache.begin() + (chunkEnd - k * DELLY_RDMATRIX_CHUNK));
+      b = chunkEnd;
+    }
+    return true;
+  }
+
+  // Sum over [start, end), partially covered bins are weighted by their overlap
+  inline double
+  rdSum(RdMatrixFile& rf, int32_t const refIndex, uint32_t const sample, uint32_t const field, int32_t start, int32_t end) {
+    start = std::max(start, 0);
+    end = std::min(end, (int32_t) rf.tlen[refIndex]);
+    if (start >= end) return 0;
+    uint32_t firstBin = start / rf.binSize;
+    std::vector<float> values;
+    if (!readRdBins(rf, refIndex, sample, field, firstBin, (end - 1) / rf.binSize + 1, values)) return 0;
+    double sum = 0;
+    for(uint32_t i = 0; i < values.size(); ++i) {
+      int32_t bstart = (firstBin + i) * rf.binSize;
+      int32_t bend = std::min(bstart + rf.binSize, (int32_t) rf.tlen[refIndex]);
+      sum += values[i] * (double) (std::min(end, bend) - std::max(start, bstart)) / (double) (bend - bstart);
+    }
+    return sum;
+  }
+
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef READCACHE_H
+#define READCACHE_H
+
+#include <deque>
+#include <boost/unordered_map.hpp>
+
+#include <htslib/sam.h>
+
+#include "readid.h"
+
+namespace torali
+{
+
+  // Read sequence with 2 bits per base (ACGT) and a mask for N and other IUPAC codes, in both orientations
+  struct PackedRead {
+    int32_t end;
+    uint32_t len;
+    std::vector<uint64_t> seq[2];
+    std::vector<uint64_t> nmask[2];
+  };
+
+  // Decoded reads of the current region, shared by all SVs a read overlaps
+  struct ReadCache {
+    typedef boost::unordered_map<uint64_t, PackedRead> TReads;
+    typedef std::deque<std::pair<int32_t, uint64_t> > TQueue;
+
+    TReads reads;
+    TQueue queue;
+    uint64_t hits;
+    uint64_t misses;
+
+    ReadCache() : hits(0), misses(0) {}
+  };
+
+
+  inline uint64_t
+  _readCacheKey(bam1_t const* rec) {
+    uint64_t seed = hashReadId(bam_get_qname(rec));
+    seed = hashReadIdCombine(seed, rec->core.tid, rec->core.pos);
+    return hashReadIdCombine(seed, (rec->core.flag & (BAM_FREAD1 | BAM_FREAD2)), rec->core.l_qseq);
+  }
+
+  inline void
+  _packRead(bam1_t const* rec, PackedRead& pr) {
+    // BAM nibble to 2-bit code, 4 = masked
+    static const uint8_t code[16] = {4, 0, 1, 4, 2, 4, 4, 4, 3, 4, 4, 4, 4, 4, 4, 4};
+    pr.len = rec->core.l_qseq;
+    pr.end = rec->core.pos + rec->core.l_qseq;
+    uint32_t words = (pr.len + 31) / 32;
+    uint32_t maskWords = (pr.len + 63) / 64;
+    for(uint32_t k = 0; k < 2; ++k) {
+      pr.seq[k].assign(words, 0);
+      pr.nmask[k].assign(maskWords, 0);
+    }
+    uint8_t const* seqptr = bam_get_seq(rec);
+    for(uint32_t i = 0; i < pr.len; ++i) {
+      uint8_t b = code[bam_seqi(seqptr, i)];
+      uint32_t r = pr.len - i - 1;
+      if (b == 4) {
+	pr.nmask[0][i >> 6] |= (1ULL << (i & 63));
+	pr.nmask[1][r >> 6] |= (1ULL << (r & 63));
+      } else {
+	pr.seq[0][i >> 5] |= ((uint64_t) b << (2 * (i & 31)));
+	pr.seq[1][r >> 5] |= ((uint64_t) (3 - b) << (2 * (r & 31)));
+      }
+    }
+  }
+
+  inline PackedRead const&
+  cachedRead(ReadCache& rc, bam1_t const* rec) {
+    uint64_t key = _readCacheKey(rec);
+    ReadCache::TReads::iterator it = rc.reads.find(key);
+    if (it != rc.reads.end()) {
+      ++rc.hits;
+      return it->second;
+    }
+    ++rc.misses;
+    PackedRead& pr = rc.reads[key];
+    _packRead(rec, pr);
+    rc.queue.push_back(std::make_pair(pr.end, key));
+    return pr;
+  }
+
+  // Drop reads ending before pos, reads are expected in coordinate order
+  inline void
+  evictReads(ReadCache& rc, int32_t const pos) {
+    while ((!rc.queue.empty()) && (rc.queue.front().first < pos)) {
+      rc.reads.erase(rc.queue.front().second);
+      rc.queue.pop_front();
+    }
+  }
+
+  inline void
+  clearReadCache(ReadCache& rc) {
+    rc.reads.clear();
+    rc.queue.clear();
+  }
+
+  // Decode [start, start + len) of the forward or reverse-complemented read
+  inline void
+  unpackRead(PackedRead const& pr, bool const revComp, uint32_t const start, uint32_t const len, std::string& sequence) {
+    static const char nuc[4] = {'A', 'C', 'G', 'T'};
+    std::vector<uint64_t> const& seq = pr.seq[revComp];
+    std::vector<uint64_t> const& nmask = pr.nmask[revComp];
+    sequence.resize(len);
+    for(uint32_t i = start; i < start + len; ++i) {
+      if (nmask[i >> 6] & (1ULL << (i & 63))) sequence[i - start] = 'N';
+      else sequence[i - start] = nuc[(seq[i >> 5] >> (2 * (i & 31))) & 3];
+    }
+  }
+
+  inline void
+  unpackRead(PackedRead const& pr, bool const revComp, std::string& sequence) {
+    unpackRead(pr, revComp, 0, pr.len, sequence);
+  }
+
+}
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef READID_H
+#define READID_H
+
+#include <cstring>
+#include <stdint.h>
+
+namespace torali
+{
+
+  // 64-bit read identity hash following the wyhash construction (public domain, Wang Yi)
+  
+  // Portable 64x64->128 bit multiply, a receives the low and b the high word
+  inline void
+  _readIdMum(uint64_t& a, uint64_t& b) {
+    uint64_t ha = a >> 32;
+    uint64_t hb = b >> 32;
+    uint64_t la = (uint32_t) a;
+    uint64_t lb = (uint32_t) b;
+    uint64_t rh = ha * hb;
+    uint64_t rm0 = ha * lb;
+    uint64_t rm1 = hb * la;
+    uint64_t rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t carry = (t < rl);
+    uint64_t lo = t + (rm1 << 32);
+    carry += (lo < t);
+    a = lo;
+    b = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+  }
+
+  inline uint64_t
+  _readIdMix(uint64_t a, uint64_t b) {
+    _readIdMum(a, b);
+    return a ^ b;
+  }
+
+  inline uint64_t
+  _readIdR8(char const* p) {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    return v;
+  }
+
+  inline uint64_t
+  _readIdR4(char const* p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+  }
+
+  inline uint64_t
+  _readIdR3(char const* p, std::size_t const k) {
+    return (((uint64_t) (uint8_t) p[0]) << 16) | (((uint64_t) (uint8_t) p[k >> 1]) << 8) | ((uint64_t) (uint8_t) p[k - 1]);
+  }
+
+  inline uint64_t
+  hashReadId(char const* p, std::size_t const len, uint64_t seed) {
+    static uint64_t const s0 = 0xa0761d6478bd642fULL;
+    static uint64_t const s1 = 0xe7037ed1a0b428dbULL;
+    static uint64_t const s2 = 0x8ebc6af09c88c6e3ULL;
+    static uint64_t const s3 = 0x589965cc75374cc3ULL;
+    seed ^= _readIdMix(seed ^ s0, s1);
+    uint64_t a = 0;
+    uint64_t b = 0;
+    if (len <= 16) {
+      if (len >= 4) {
+	a = (_readIdR4(p) << 32) | _readIdR4(p + ((len >> 3) << 2));
+	b = (_readIdR4(p + len - 4) << 32) | _readIdR4(p + len - 4 - ((len >> 3) << 2));
+      } else if (len > 0) a = _readIdR3(p, len);
+    } else {
+      std::size_t i = len;
+      if (i > 48) {
+	uint64_t see1 = seed;
+	uint64_t see2 = seed;
+	do {
+	  seed = _readIdMix(_readIdR8(p) ^ s1, _readIdR8(p + 8) ^ seed);
+	  see1 = _readIdMix(_readIdR8(p + 16) ^ s2, _readIdR8(p + 24) ^ see1);
+	  see2 = _readIdMix(_readIdR8(p + 32) ^ s3, _readIdR8(p + 40) ^ see2);
+	  p += 48;
+	  i -= 48;
+	} while (i > 48);
+	seed ^= see1 ^ see2;
+      }
+      while (i > 16) {
+	seed = _readIdMix(_readIdR8(p) ^ s1, _readIdR8(p + 8) ^ seed);
+	i -= 16;
+	p += 16;
+      }
+      a = _readIdR8(p + i - 16);
+      b = _readIdR8(p + i - 8);
+    }
+    a ^= s1;
+    b ^= seed;
+    _readIdMum(a, b);
+    return _readIdMix(a ^ s0 ^ len, b ^ s1);
+  }
+
+  inline uint64_t
+  hashReadId(char const* qname) {
+    return hashReadId(qname, std::strlen(qname), 0);
+  }
+
+  // Mix alignment coordinates into a read identity
+  inline uint64_t
+  hashReadIdCombine(uint64_t const seed, int32_t const tid, int32_t const pos) {
+    return _readIdMix(seed ^ 0xe7037ed1a0b428dbULL, ((((uint64_t) (uint32_t) tid) << 32) | (uint64_t) (uint32_t) pos) ^ 0x8ebc6af09c88c6e3ULL);
+  }
+
+}
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef RLECOV_H
+#define RLECOV_H
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+namespace torali
+{
+
+  #ifndef DELLY_RLE_BLOCK
+  #define DELLY_RLE_BLOCK 32
+  #endif
+
+  #ifndef DELLY_RLE_PENDING
+  #define DELLY_RLE_PENDING 65536
+  #endif
+
+  // Per-base coverage as runs of equal counts, varint run length + zigzag value delta, indexed every DELLY_RLE_BLOCK runs
+  struct RleCoverage {
+    typedef uint16_t TCount;
+    typedef std::pair<int32_t, int32_t> TEvent;
+
+    uint32_t len;
+    TCount maxCount;
+    uint64_t total;
+    std::vector<uint8_t> data;
+    std::vector<uint32_t> blockStart;
+    std::vector<uint32_t> blockOffset;
+    std::vector<uint64_t> blockSum;
+    std::vector<TCount> blockValue;
+
+    // Streaming state, [0, tail) is final and [runStart, tail) is the open run
+    std::vector<TEvent> pending;
+    int32_t level;
+    uint32_t tail;
+    uint32_t runStart;
+    TCount runValue;
+    TCount prevValue;
+    uint32_t runs;
+    uint64_t sum;
+
+    // Sequential read cursor, not thread-safe
+    mutable uint32_t curBlock;
+    mutable uint32_t curOffset;
+    mutable uint32_t curStart;
+    mutable uint32_t curEnd;
+    mutable TCount curValue;
+
+    explicit RleCoverage(uint32_t const l) : len(l), maxCount(std::numeric_limits<TCount>::max() - 1), total(0), level(0), tail(0), runStart(0), runValue(0), prevValue(0), runs(0), sum(0), curBlock(0), curOffset(0), curStart(0), curEnd(0), curValue(0) {}
+
+    inline TCount operator[](uint32_t const pos) const;
+  };
+
+
+  inline void
+  _rlePutVarint(std::vector<uint8_t>& data, uint32_t val) {
+    while (val >= 128) {
+      data.push_back((uint8_t) ((val & 127) | 128));
+      val >>= 7;
+    }
+    data.push_back((uint8_t) val);
+  }
+
+  inline uint32_t
+  _rleGetVarint(std::vector<uint8_t> const& data, uint32_t& offset) {
+    uint32_t val = 0;
+    uint32_t shift = 0;
+    while (data[offset] & 128) {
+      val |= ((uint32_t) (data[offset++] & 127) << shift);
+      shift += 7;
+    }
+    val |= ((uint32_t) data[offset++] << shift);
+    return val;
+  }
+
+  inline void
+  _rleWriteRun(RleCoverage& rle, uint32_t const runlen, RleCoverage::TCount const val) {
+    if (rle.runs % DELLY_RLE_BLOCK == 0) {
+      rle.blockStart.push_back(rle.runStart);
+      rle.blockOffset.push_back(rle.data.size());
+      rle.blockSum.push_back(rle.sum);
+      rle.blockValue.push_back(rle.prevValue);
+    }
+    int32_t delta = (int32_t) val - (int32_t) rle.prevValue;
+    _rlePutVarint(rle.data, runlen);
+    _rlePutVarint(rle.data, (uint32_t) ((delta << 1) ^ (delta >> 31)));
+    rle.prevValue = val;
+    rle.sum += (uint64_t) val * runlen;
+    ++rle.runs;
+  }
+
+  // Extend the track with the current level up to pos
+  inline void
+  _rleExtend(RleCoverage& rle, uint32_t const pos) {
+    if (pos <= rle.tail) return;
+    RleCoverage::TCount val = (rle.level < (int32_t) rle.maxCount) ? rle.level : rle.maxCount;
+    if (val != rle.runValue) {
+      if (rle.tail > rle.runStart) _rleWriteRun(rle, rle.tail - rle.runStart, rle.runValue);
+      rle.runStart = rle.tail;
+      rle.runValue = val;
+    }
+    rle.tail = pos;
+  }
+
+  inline void
+  _rleSeek(RleCoverage const& rle, uint32_t const pos) {
+    rle.curBlock = std::upper_bound(rle.blockStart.begin(), rle.blockStart.end(), pos) - rle.blockStart.begin() - 1;
+    rle.curOffset = rle.blockOffset[rle.curBlock];
+    rle.curValue = rle.blockValue[rle.curBlock];
+    rle.curStart = rle.blockStart[rle.curBlock];
+    rle.curEnd = rle.curStart;
+  }
+
+  inline void
+  _rleNextRun(RleCoverage const& rle) {
+    if ((rle.curBlock + 1 < rle.blockOffset.size()) && (rle.curOffset == rle.blockOffset[rle.curBlock + 1])) ++rle.curBlock;
+    uint32_t runlen = _rleGetVarint(rle.data, rle.curOffset);
+    uint32_t z = _rleGetVarint(rle.data, rle.curOffset);
+    rle.curValue = (RleCoverage::TCount) ((int32_t) rle.curValue + ((int32_t) (z >> 1) ^ -((int32_t) (z & 1))));
+    rle.curStart = rle.curEnd;
+    rle.curEnd += runlen;
+  }
+
+  // Count at pos < len of a closed track, amortized O(1) for ascending positions
+  inline RleCoverage::TCount
+  RleCoverage::operator[](uint32_t const pos) const {
+    if ((pos < curStart) || (pos >= curEnd)) {
+      if ((pos < curStart) || ((curBlock + 1 < blockStart.size()) && (pos >= blockStart[curBlock + 1]))) _rleSeek(*this, pos);
+      while (pos >= curEnd) _rleNextRun(*this);
+    }
+    return curValue;
+  }
+
+  // Coverage plus one over [start, end), start positions must not fall behind the last flush
+  inline void
+  addCoverage(RleCoverage& rle, int32_t start, int32_t end) {
+    if (start < 0) start = 0;
+    if (end > (int32_t) rle.len) end = rle.len;
+    if (start >= end) return;
+    rle.pending.push_back(std::make_pair(start, 1));
+    if (end < (int32_t) rle.len) rle.pending.push_back(std::make_pair(end, -1));
+  }
+
+  // Encode all positions < upto, no later addCoverage may start before upto
+  inline void
+  flushCoverage(RleCoverage& rle, int32_t upto) {
+    if (upto > (int32_t) rle.len) upto = rle.len;
+    if (upto <= (int32_t) rle.tail) return;
+    std::sort(rle.pending.begin(), rle.pending.end());
+    uint32_t idx = 0;
+    for(; ((idx < rle.pending.size()) && (rle.pending[idx].first < upto)); ++idx) {
+      _rleExtend(rle, rle.pending[idx].first);
+      rle.level += rle.pending[idx].second;
+    }
+    _rleExtend(rle, upto);
+    rle.pending.erase(rle.pending.begin(), rle.pending.begin() + idx);
+  }
+
+  // Flush once enough events are buffered, pos is the smallest start of any future addCoverage
+  inline void
+  streamCoverage(RleCoverage& rle, int32_t const pos) {
+    if (rle.pending.size() >= DELLY_RLE_PENDING) flushCoverage(rle, pos);
+  }
+
+  inline void
+  closeCoverage(RleCoverage& rle) {
+    flushCoverage(rle, rle.len);
+    if (rle.tail > rle.runStart) _rleWriteRun(rle, rle.tail - rle.runStart, rle.runValue);
+    rle.runStart = rle.tail;
+    rle.total = rle.sum;
+    std::vector<RleCoverage::TEvent>().swap(rle.pending);
+    std::vector<uint8_t>(rle.data).swap(rle.data);
+    if (!rle.blockStart.empty()) _rleSeek(rle, 0);
+  }
+
+  // Coverage sum over [0, pos) of a closed track
+  inline uint64_t
+  _rlePrefix(RleCoverage const& rle, uint32_t const pos) {
+    if (pos >= rle.len) return rle.total;
+    if (rle.blockStart.empty()) return 0;
+    uint32_t b = std::upper_bound(rle.blockStart.begin(), rle.blockStart.end(), pos) - rle.blockStart.begin() - 1;
+    uint64_t s = rle.blockSum[b];
+    uint32_t offset = rle.blockOffset[b];
+    int32_t val = rle.blockValue[b];
+    uint32_t start = rle.blockStart[b];
+    while (true) {
+      uint32_t runlen = _rleGetVarint(rle.data, offset);
+      uint32_t z = _rleGetVarint(rle.data, offset);
+      val += ((int32_t) (z >> 1) ^ -((int32_t) (z & 1)));
+      if (pos < start + runlen) return s + (uint64_t) val * (pos - start);
+      s += (uint64_t) val * runlen;
+      start += runlen;
+    }
+  }
+
+  // Coverage sum over [start, end) of a closed track
+  inline uint64_t
+  coverageSum(RleCoverage const& rle, int32_t start, int32_t end) {
+    if (start < 0) start = 0;
+    if (end > (int32_t) rle.len) end = rle.len;
+    if (start >= end) return 0;
+    return _rlePrefix(rle, end) - _rlePrefix(rle, start);
+  }
+
+  inline uint64_t
+  coverageBytes(RleCoverage const& rle) {
+    return rle.data.capacity() + rle.blockStart.size() * (2 * sizeof(uint32_t) + sizeof(uint64_t) + sizeof(RleCoverage::TCount));
+  }
+
+}
+
+#endif
@@ -13,6 +13,7 @@
 
 #include "version.h"
 #include "util.h"
+#include "ploidy.h"
 
 
 namespace torali
@@ -74,17 +75,101 @@ namespace torali
     return std::make_pair(lowerBound, upperBound);
   }
 
-  template<typename TConfig>
+  // Bases of one class as a bit mask with cumulative counts per 64bp word
+  struct BaseMask {
+    std::vector<uint64_t> bits;
+    std::vector<uint32_t> cum;
+  };
+
+  // Mask bases equal to b1 (or b2), optionally ignoring case, 8 bytes at a time
   inline void
-  scan(TConfig const& c, LibraryInfo const& li, std::vector< std::vector<ScanWindow> >& scanCounts) {
+  _baseMask(char const* seq, uint32_t const len, char const b1, bool const nocase, BaseMask& bm, char const b2 = 0) {
+    uint64_t const ones = 0x0101010101010101ULL;
+    uint64_t const fold = nocase ? 0x20 * ones : 0;
+    uint64_t const p1 = (uint8_t) b1 * ones;
+    uint64_t const p2 = (uint8_t) (b2 ? b2 : b1) * ones;
+    uint32_t nwords = (len + 63) / 64;
+    bm.bits.assign(nwords, 0);
+    bm.cum.assign(nwords + 1, 0);
+    uint32_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+      uint64_t x = _load64(seq + i) | fold;
+      uint64_t hit = _zeroBytes64(x ^ p1) | _zeroBytes64(x ^ p2);
+      bm.bits[i / 64] |= hit << (i % 64);
+    }
+    for(; i < len; ++i) {
+      char ch = nocase ? (seq[i] | 0x20) : seq[i];
+      if ((ch == b1) || ((b2) && (ch == b2))) bm.bits[i / 64] |= (1ULL << (i % 64));
+    }
+    for(uint32_t w = 0; w < nwords; ++w) bm.cum[w+1] = bm.cum[w] + _popcount64(bm.bits[w]);
+  }
 
-    // Load bam file
-    samFile* samfile = sam_open(c.bamFile.string().c_str(), "r");
-    hts_set_fai_filename(samfile, c.genome.string().c_str());
-    hts_idx_t* idx = sam_index_load(samfile, c.bamFile.string().c_str());
-    bam_hdr_t* hdr = sam_hdr_read(samfile);
+  inline uint32_t
+  _maskBit(BaseMask const& bm, uint32_t const pos) {
+    return (bm.bits[pos / 64] >> (pos % 64)) & 1;
+  }
 
-    // Pre-defined scanning windows
+  // Masked bases in [start, end)
+  inline uint32_t
+  _maskCount(BaseMask const& bm, uint32_t const start, uint32_t const end) {
+    uint32_t cnt = bm.cum[end / 64] - bm.cum[start / 64];
+    if (end % 64) cnt += _popcount64(bm.bits[end / 64] & ((1ULL << (end % 64)) - 1));
+    if (start % 64) cnt -= _popcount64(bm.bits[start / 64] & ((1ULL << (start % 64)) - 1));
+    return cnt;
+  }
+
+  // GC and unique bases in a fragment-sized window around each position, faiRef == NULL skips GC
+  template<typename TConfig>
+  inline bool
+  _refProfile(TConfig const& c, bam_hdr_t const* hdr, faidx_t* faiMap, faidx_t* faiRef, int32_t const refIndex, std::vector<uint16_t>& gcContent, std::vector<uint16_t>& uniqContent) {
+    // Check presence in mappability map and reference
+    std::string tname(hdr->target_name[refIndex]);
+    if (faidx_seq_len(faiMap, tname.c_str()) == -1) return false;
+    if ((faiRef != NULL) && (faidx_seq_len(faiRef, tname.c_str()) == -1)) return false;
+    int32_t seqlen = -1;
+    char* seq = faidx_fetch_seq(faiMap, tname.c_str(), 0, faidx_seq_len(faiMap, tname.c_str()), &seqlen);
+    char* ref = NULL;
+    if (faiRef != NULL) ref = faidx_fetch_seq(faiRef, tname.c_str(), 0, faidx_seq_len(faiRef, tname.c_str()), &seqlen);
+
+    uniqContent.assign(hdr->target_len[refIndex], 0);
+    if (ref != NULL) gcContent.assign(hdr->target_len[refIndex], 0);
+    else gcContent.clear();
+    {
+      // Mappability map
+      BaseMask uniq;
+      _baseMask(seq, hdr->target_len[refIndex], 'C', false, uniq);
+
+      // GC map
+      BaseMask gcref;
+      if (ref != NULL) _baseMask(ref, hdr->target_len[refIndex], 'c', true, gcref, 'g');
+
+      // Sum across fragment
+      int32_t halfwin = (int32_t) (c.meanisize / 2);
+      if ((int32_t) hdr->target_len[refIndex] > 2 * halfwin) {
+	int32_t usum = _maskCount(uniq, 0, 2 * halfwin);
+	int32_t gcsum = 0;
+	if (ref != NULL) gcsum = _maskCount(gcref, 0, 2 * halfwin);
+	for(int32_t pos = halfwin; pos < (int32_t) hdr->target_len[refIndex] - halfwin; ++pos) {
+	  usum += _maskBit(uniq, pos + halfwin);
+	  uniqContent[pos] = usum;
+	  usum -= _maskBit(uniq, pos - halfwin);
+	  if (ref != NULL) {
+	    gcsum += _maskBit(gcref, pos + halfwin);
+	    gcContent[pos] = gcsum;
+	    gcsum -= _maskBit(gcref, pos - halfwin);
+	  }
+	}
+      }
+    }
+    if (seq != NULL) free(seq);
+    if (ref != NULL) free(ref);
+    return true;
+  }
+
+  // Pre-defined scanning windows
+  template<typename TConfig>
+  inline void
+  _initScanWindows(TConfig const& c, bam_hdr_t* hdr, std::vector< std::vector<ScanWindow> >& scanCounts) {
     if (c.hasScanFile) {
       typedef boost::icl::interval_set<uint32_t> TChrIntervals;
       typedef std::vector<TChrIntervals> TRegionsGenome;
@@ -108,6 +193,116 @@ namespace torali
 	sort(scanCounts[refIndex].begin(), scanCounts[refIndex].end(), SortScanWindow<ScanWindow>());
       }
     }
+  }
+
+  template<typename TConfig>
+  inline bool
+  _skipScanChromosome(TConfig const& c, PloidyMap const& pm, uint32_t const sample, bam_hdr_t const* hdr, hts_idx_t const* idx, int32_t const refIndex, uint64_t const totalCov) {
+    // Exclude contigs off baseline ploidy, unknown ones are scanned to infer their ploidy
+    if (!_baselineContig(c, pm, sample, refIndex)) {
+      if ((!c.inferPloidy) || (_contigPloidy(pm, sample, refIndex) != DELLY_PLOIDY_UNKNOWN)) return true;
+    }
+    if (chrNoData(c, refIndex, idx)) return true;
+    // Exclude small chromosomes
+    if ((hdr->target_len[refIndex] < c.minChrLen) && (totalCov > 1000000)) return true;
+    return false;
+  }
+
+  // Count fragments per scan window of one chromosome
+  template<typename TConfig>
+  inline void
+  _scanChromosome(TConfig const& c, LibraryInfo const& li, samFile* samfile, hts_idx_t* idx, bam_hdr_t* hdr, int32_t const refIndex, std::vector<uint16_t> const& uniqContent, std::vector< std::vector<ScanWindow> >& scanCounts, uint64_t& totalCov) {
+    // Bins on this chromosome
+    std::vector<uint16_t> binMap;
+    if (!c.hasScanFile) {
+      uint32_t allbins = hdr->target_len[refIndex] / c.scanWindow;
+      scanCounts[refIndex].resize(allbins, ScanWindow());
+      for(uint32_t i = 0; i < allbins; ++i) {
+	scanCounts[refIndex][i].start = i * c.scanWindow;
+	scanCounts[refIndex][i].end = (i+1) * c.scanWindow;
+      }
+    } else {
+      // Fill bin map
+      binMap.resize(hdr->target_len[refIndex], LAST_BIN);
+      if (scanCounts[refIndex].size() >= LAST_BIN) {
+	std::cerr << "Warning: Too many scan windows on " << hdr->target_name[refIndex] << std::endl;
+      }
+      for(uint32_t bin = 0;((bin < scanCounts[refIndex].size()) && (bin < LAST_BIN)); ++bin) {
+	for(int32_t k = scanCounts[refIndex][bin].start; k < scanCounts[refIndex][bin].end; ++k) binMap[k] = bin;
+      }
+    }
+	
+    // Mate map
+    typedef boost::unordered_map<std::size_t, bool> TMateMap;
+    TMateMap mateMap;
+
+    // Count reads
+    hts_itr_t* iter = sam_itr_queryi(idx, refIndex, 0, hdr->target_len[refIndex]);
+    bam1_t* rec = bam_init1();
+    int32_t lastAlignedPos = 0;
+    std::set<std::size_t> lastAlignedPosReads;
+    while (sam_itr_next(samfile, iter, rec) >= 0) {
+      if (rec->core.flag & (BAM_FSECONDARY | BAM_FQCFAIL | BAM_FDUP | BAM_FSUPPLEMENTARY | BAM_FUNMAP)) continue;
+      if ((rec->core.flag & BAM_FPAIRED) && ((rec->core.flag & BAM_FMUNMAP) || (rec->core.tid != rec->core.mtid))) continue;
+      if (rec->core.qual < c.minQual) continue;
+      if (getSVType(rec) != 2) continue;
+
+      int32_t midPoint = rec->core.pos + halfAlignmentLength(rec);
+      if (rec->core.flag & BAM_FPAIRED) {
+	// Clean-up the read store for identical alignment positions
+	if (rec->core.pos > lastAlignedPos) {
+	  lastAlignedPosReads.clear();
+	  lastAlignedPos = rec->core.pos;
+	}
+	
+	if ((rec->core.pos < rec->core.mpos) || ((rec->core.pos == rec->core.mpos) && (lastAlignedPosReads.find(hash_string(bam_get_qname(rec))) == lastAlignedPosReads.end()))) {
+	  // First read
+	  lastAlignedPosReads.insert(hash_string(bam_get_qname(rec)));
+	  std::size_t hv = hash_pair(rec);
+	  mateMap[hv] = true;
+	  continue;
+	} else {
+	  // Second read
+	  std::size_t hv = hash_pair_mate(rec);
+	  if ((mateMap.find(hv) == mateMap.end()) || (!mateMap[hv])) continue; // Mate discarded
+	  mateMap[hv] = false;
+	}
+
+	// Insert size filter
+	int32_t isize = (rec->core.pos + alignmentLength(rec)) - rec->core.mpos;
+	if ((li.minNormalISize < isize) && (isize < li.maxNormalISize)) midPoint = rec->core.mpos + (int32_t) (isize/2);
+	else continue;
+      }
+
+      // Count fragment
+      if ((midPoint >= 0) && (midPoint < (int32_t) hdr->target_len[refIndex])) {
+	int32_t bin = _findScanWindow(c, hdr->target_len[refIndex], binMap, midPoint);
+	if (bin >= 0) {
+	  ++scanCounts[refIndex][bin].cov;
+	    
+	  if (uniqContent[midPoint] >= c.fragmentUnique * c.meanisize) ++scanCounts[refIndex][bin].uniqcov;
+	  ++totalCov;
+	}
+      }
+    }
+    // Clean-up
+    bam_destroy1(rec);
+    hts_itr_destroy(iter);
+  }
+
+  template<typename TConfig>
+  inline void
+  scan(TConfig const& c, LibraryInfo const& li, PloidyMap& pm, std::vector< std::vector<ScanWindow> >& scanCounts) {
+
+    // Load bam file
+    samFile* samfile = sam_open(c.bamFile.string().c_str(), "r");
+    attachHtsThreadPool(samfile);
+    hts_set_fai_filename(samfile, c.genome.string().c_str());
+    hts_idx_t* idx = sam_index_load(samfile, c.bamFile.string().c_str());
+    bam_hdr_t* hdr = sam_hdr_read(samfile);
+
+    // Pre-defined scanning windows
+    _initScanWindows(c, hdr, scanCounts);
     
     // Parse BAM file
     boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
@@ -115,123 +310,24 @@ namespace torali
 
     // Iterate chromosomes
     uint64_t totalCov = 0;
+    std::vector<std::vector<float> > density(hdr->n_targets, std::vector<float>());
     faidx_t* faiMap = fai_load(c.mapFile.string().c_str());
     for(int32_t refIndex=0; refIndex < (int32_t) hdr->n_targets; ++refIndex) {
-      if (chrNoData(c, refIndex, idx)) continue;
-      // Exclude small chromosomes
-      if ((hdr->target_len[refIndex] < c.minChrLen) && (totalCov > 1000000)) continue;
-      // Exclude sex chromosomes
-      if ((std::string(hdr->target_name[refIndex]) == "chrX") || (std::string(hdr->target_name[refIndex]) == "chrY") || (std::string(hdr->target_name[refIndex]) == "X") || (std::string(hdr->target_name[refIndex]) == "Y")) continue;
-
-      // Check presence in mappability map
-      std::string tname(hdr->target_name[refIndex]);
-      int32_t seqlen = faidx_seq_len(faiMap, tname.c_str());
-      if (seqlen == -1) continue;
-      else seqlen = -1;
-      char* seq = faidx_fetch_seq(faiMap, tname.c_str(), 0, faidx_seq_len(faiMap, tname.c_str()), &seqlen);
+      if (_skipScanChromosome(c, pm, 0, hdr, idx, refIndex, totalCov)) continue;
 
       // Get Mappability
-      std::vector<uint16_t> uniqContent(hdr->target_len[refIndex], 0);
-      {
-	// Mappability map
-	typedef boost::dynamic_bitset<> TBitSet;
-	TBitSet uniq(hdr->target_len[refIndex], false);
-	for(uint32_t i = 0; i < hdr->target_len[refIndex]; ++i) {
-	  if (seq[i] == 'C') uniq[i] = 1;
-	}
+      std::vector<uint16_t> gcContent;
+      std::vector<uint16_t> uniqContent;
+      if (!_refProfile(c, hdr, faiMap, NULL, refIndex, gcContent, uniqContent)) continue;
 
-	// Sum across fragments
-	int32_t halfwin = (int32_t) (c.meanisize / 2);
-	int32_t usum = 0;
-	for(int32_t pos = halfwin; pos < (int32_t) hdr->target_len[refIndex] - halfwin; ++pos) {
-	  if (pos == halfwin) {
-	    for(int32_t i = pos - halfwin; i<=pos+halfwin; ++i) usum += uniq[i];
-	  } else {
-	    usum -= uniq[pos - halfwin - 1];
-	    usum += uniq[pos + halfwin];
-	  }
-	  uniqContent[pos] = usum;
-	}
-      }
-
-      // Bins on this chromosome
-      std::vector<uint16_t> binMap;
-      if (!c.hasScanFile) {
-	uint32_t allbins = hdr->target_len[refIndex] / c.scanWindow;
-	scanCounts[refIndex].resize(allbins, ScanWindow());
-	for(uint32_t i = 0; i < allbins; ++i) {
-	  scanCounts[refIndex][i].start = i * c.scanWindow;
-	  scanCounts[refIndex][i].end = (i+1) * c.scanWindow;
-	}
-      } else {
-	// Fill bin map
-	binMap.resize(hdr->target_len[refIndex], LAST_BIN);
-	if (scanCounts[refIndex].size() >= LAST_BIN) {
-	  std::cerr << "Warning: Too many scan windows on " << hdr->target_name[refIndex] << std::endl;
-	}
-	for(uint32_t bin = 0;((bin < scanCounts[refIndex].size()) && (bin < LAST_BIN)); ++bin) {
-	  for(int32_t k = scanCounts[refIndex][bin].start; k < scanCounts[refIndex][bin].end; ++k) binMap[k] = bin;
-	}
-      }
-	
-      // Mate map
-      typedef boost::unordered_map<std::size_t, bool> TMateMap;
-      TMateMap mateMap;
-
-      // Count reads
-      hts_itr_t* iter = sam_itr_queryi(idx, refIndex, 0, hdr->target_len[refIndex]);
-      bam1_t* rec = bam_init1();
-      int32_t lastAlignedPos = 0;
-      std::set<std::size_t> lastAlignedPosReads;
-      while (sam_itr_next(samfile, iter, rec) >= 0) {
-	if (rec->core.flag & (BAM_FSECONDARY | BAM_FQCFAIL | BAM_FDUP | BAM_FSUPPLEMENTARY | BAM_FUNMAP)) continue;
-	if ((rec->core.flag & BAM_FPAIRED) && ((rec->core.flag & BAM_FMUNMAP) || (rec->core.tid != rec->core.mtid))) continue;
-	if (rec->core.qual < c.minQual) continue;
-	if (getSVType(rec) != 2) continue;
-
-	int32_t midPoint = rec->core.pos + halfAlignmentLength(rec);
-	if (rec->core.flag & BAM_FPAIRED) {
-	  // Clean-up the read store for identical alignment positions
-	  if (rec->core.pos > lastAlignedPos) {
-	    lastAlignedPosReads.clear();
-	    lastAlignedPos = rec->core.pos;
-	  }
-	
-	  if ((rec->core.pos < rec->core.mpos) || ((rec->core.pos == rec->core.mpos) && (lastAlignedPosReads.find(hash_string(bam_get_qname(rec))) == lastAlignedPosReads.end()))) {
-	    // First read
-	    lastAlignedPosReads.insert(hash_string(bam_get_qname(rec)));
-	    std::size_t hv = hash_pair(rec);
-	    mateMap[hv] = true;
-	    continue;
-	  } else {
-	    // Second read
-	    std::size_t hv = hash_pair_mate(rec);
-	    if ((mateMap.find(hv) == mateMap.end()) || (!mateMap[hv])) continue; // Mate discarded
-	    mateMap[hv] = false;
-	  }
-
-	  // Insert size filter
-	  int32_t isize = (rec->core.pos + alignmentLength(rec)) - rec->core.mpos;
-	  if ((li.minNormalISize < isize) && (isize < li.maxNormalISize)) midPoint = rec->core.mpos + (int32_t) (isize/2);
-	  else continue;
-	}
-
-	// Count fragment
-	if ((midPoint >= 0) && (midPoint < (int32_t) hdr->target_len[refIndex])) {
-	  int32_t bin = _findScanWindow(c, hdr->target_len[refIndex], binMap, midPoint);
-	  if (bin >= 0) {
-	    ++scanCounts[refIndex][bin].cov;
-	    
-	    if (uniqContent[midPoint] >= c.fragmentUnique * c.meanisize) ++scanCounts[refIndex][bin].uniqcov;
-	    ++totalCov;
-	  }
-	}
-      }
-      // Clean-up
-      bam_destroy1(rec);
-      hts_itr_destroy(iter);
-      if (seq != NULL) free(seq);
+      // Count fragments
+      _scanChromosome(c, li, samfile, idx, hdr, refIndex, uniqContent, scanCounts, totalCov);
+      if (c.inferPloidy) _uniqueDensity(c, uniqContent, scanCounts[refIndex], density[refIndex]);
     }
+
+    // Ploidy of unknown contigs, only baseline contigs normalize GC
+    if (c.inferPloidy) inferPloidy(c, hdr, c.sampleName, 0, density, pm);
+    _baselineScanWindows(c, pm, 0, scanCounts);
     
     // clean-up
     fai_destroy(faiMap);
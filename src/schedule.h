@@ -0,0 +1,185 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <iostream>
+
+#include <htslib/sam.h>
+
+#ifdef OPENMP
+#include <omp.h>
+#include <mutex>
+#include <condition_variable>
+#endif
+
+#include "util.h"
+
+namespace torali
+{
+
+  // Working-set estimates per mapped read of a task, rough averages rather than measured bounds
+  // Discordant pairs and junctions of a scanning task
+  #ifndef DELLY_SCAN_BYTES_PER_READ
+  #define DELLY_SCAN_BYTES_PER_READ 8
+  #endif
+
+  // Coverage runs of both depth tracks and the pair quality maps of a genotyping task
+  #ifndef DELLY_GENO_BYTES_PER_READ
+  #define DELLY_GENO_BYTES_PER_READ 48
+  #endif
+
+  // One alignment file and one chromosome, or all chromosomes if refIndex is -1
+  struct SampleTask {
+    uint32_t file_c;
+    int32_t refIndex;
+    uint64_t cost;
+    uint64_t memory;
+
+    SampleTask(uint32_t const f, int32_t const r, uint64_t const c, uint64_t const m) : file_c(f), refIndex(r), cost(c), memory(m) {}
+  };
+
+  // Sample by sample, largest sample first and within a sample largest task first
+  template<typename TTask>
+  struct SortSampleTasks : public std::binary_function<TTask, TTask, bool>
+  {
+    std::vector<uint64_t> const& sampleCost;
+    explicit SortSampleTasks(std::vector<uint64_t> const& sc) : sampleCost(sc) {}
+
+    inline bool operator()(TTask const& t1, TTask const& t2) const {
+      if (sampleCost[t1.file_c] != sampleCost[t2.file_c]) return (sampleCost[t1.file_c] > sampleCost[t2.file_c]);
+      if (t1.file_c != t2.file_c) return (t1.file_c < t2.file_c);
+      return ((t1.cost > t2.cost) || ((t1.cost == t2.cost) && (t1.refIndex < t2.refIndex)));
+    }
+  };
+
+  // Tasks are handed out in order to idle threads; a task is admitted once its memory estimate fits into the budget
+  // A task releases its memory when it finishes, an idle scheduler always admits the next task
+  // Waiting threads sleep until a finishing task releases memory
+  struct TaskScheduler {
+    int32_t nthreads;
+    uint64_t budget;
+    uint64_t inUse;
+    uint32_t running;
+    std::vector<SampleTask> tasks;
+    std::vector<uint32_t> open;
+    std::vector<uint64_t> sampleCost;
+#ifdef OPENMP
+    std::mutex lock;
+    std::condition_variable released;
+#endif
+
+    TaskScheduler() : nthreads(1), budget(0), inUse(0), running(0) {}
+  };
+
+  template<typename TConfig>
+  inline void
+  initScheduler(TConfig const& c, TaskScheduler& ts) {
+    ts.nthreads = 1;
+#ifdef OPENMP
+    if (c.threads) ts.nthreads = c.threads;
+    else ts.nthreads = omp_get_max_threads();
+#endif
+    ts.budget = (uint64_t) c.memory * 1024 * 1024;
+    ts.inUse = 0;
+    ts.running = 0;
+    ts.tasks.clear();
+    ts.open.assign(c.files.size(), 0);
+    ts.sampleCost.assign(c.files.size(), 0);
+  }
+
+  inline void
+  addTask(TaskScheduler& ts, uint32_t const file_c, int32_t const refIndex, uint64_t const cost, uint64_t const memory) {
+    ts.tasks.push_back(SampleTask(file_c, refIndex, cost, memory));
+    ts.sampleCost[file_c] += cost;
+    ++ts.open[file_c];
+  }
+
+  // Fix the task order and limit the threads to the number of tasks
+  inline void
+  sortTasks(TaskScheduler& ts) {
+    std::sort(ts.tasks.begin(), ts.tasks.end(), SortSampleTasks<SampleTask>(ts.sampleCost));
+    if (ts.nthreads > (int32_t) ts.tasks.size()) ts.nthreads = ts.tasks.size();
+    if (ts.nthreads < 1) ts.nthreads = 1;
+  }
+
+  // Mapped reads of a chromosome, chromosome length as a proxy if the index has no counts (CRAM)
+  inline uint64_t
+  _mappedReads(std::vector<uint64_t> const& mapped, bam_hdr_t const* hdr, int32_t const refIndex) {
+    if (mapped[refIndex]) return mapped[refIndex];
+    return hdr->target_len[refIndex] / 100;
+  }
+
+  // Index counts of mapped reads per sample and chromosome, 0 if the index has none, the indexes are loaded in parallel
+  template<typename TConfig>
+  inline bool
+  loadMappedReads(TConfig const& c, bam_hdr_t const* hdr, std::vector<std::vector<uint64_t> >& mapped) {
+    mapped.assign(c.files.size(), std::vector<uint64_t>(hdr->n_targets, 0));
+    std::vector<uint8_t> failed(c.files.size(), 0);
+#ifdef OPENMP
+    int32_t nthreads = omp_get_max_threads();
+    if (c.threads) nthreads = c.threads;
+#endif
+#pragma omp parallel for default(shared) num_threads(nthreads) schedule(dynamic, 1)
+    for(int32_t file_c = 0; file_c < (int32_t) c.files.size(); ++file_c) {
+      samFile* sfile = sam_open(c.files[file_c].string().c_str(), "r");
+      if (sfile == NULL) {
+	failed[file_c] = 1;
+	continue;
+      }
+      hts_idx_t* sidx = sam_index_load(sfile, c.files[file_c].string().c_str());
+      if (sidx == NULL) {
+	failed[file_c] = 2;
+	sam_close(sfile);
+	continue;
+      }
+      for(int32_t refIndex = 0; refIndex < hdr->n_targets; ++refIndex) {
+	uint64_t unmapped = 0;
+	if (hts_idx_get_stat(sidx, refIndex, &mapped[file_c][refIndex], &unmapped) < 0) mapped[file_c][refIndex] = 0;
+      }
+      hts_idx_destroy(sidx);
+      sam_close(sfile);
+    }
+    for(uint32_t file_c = 0; file_c < c.files.size(); ++file_c) {
+      if (failed[file_c] == 1) {
+	std::cerr << "Fail to open file " << c.files[file_c].string() << std::endl;
+	return false;
+      }
+      if (failed[file_c] == 2) {
+	std::cerr << "Fail to open index for " << c.files[file_c].string() << std::endl;
+	return false;
+      }
+    }
+    return true;
+  }
+
+  // Blocks until the memory estimate of task t fits into the budget
+  inline void
+  startTask(TaskScheduler& ts, int32_t const t) {
+#ifdef OPENMP
+    std::unique_lock<std::mutex> guard(ts.lock);
+    while ((ts.budget) && (ts.running) && (ts.inUse + ts.tasks[t].memory > ts.budget)) ts.released.wait(guard);
+#endif
+    ts.inUse += ts.tasks[t].memory;
+    ++ts.running;
+  }
+
+  // True for the last task of a sample
+  inline bool
+  finishTask(TaskScheduler& ts, int32_t const t) {
+    bool last = false;
+    {
+#ifdef OPENMP
+      std::lock_guard<std::mutex> guard(ts.lock);
+#endif
+      ts.inUse -= ts.tasks[t].memory;
+      --ts.running;
+      if (!(--ts.open[ts.tasks[t].file_c])) last = true;
+    }
+#ifdef OPENMP
+    ts.released.notify_all();
+#endif
+    return last;
+  }
+
+}
+
+#endif
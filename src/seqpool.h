@@ -0,0 +1,201 @@
+#ifndef SEQPOOL_H
+#define SEQPOOL_H
+
+#include <string>
+#include <cstdlib>
+#include <iostream>
+#include <boost/unordered_map.hpp>
+
+#include "arena.h"
+#include "readid.h"
+
+namespace torali
+{
+
+  // Block directory of each pool arena, 2^16 blocks of 2^16 values
+  #ifndef DELLY_SEQPOOL_BLOCKS
+  #define DELLY_SEQPOOL_BLOCKS 65536
+  #endif
+
+  // Interned sequence, ACGT runs are packed with 32 bases per word, anything else is kept verbatim
+  struct PoolEntry {
+    uint64_t pos;
+    uint32_t len;
+    bool packed;
+
+    PoolEntry() : pos(0), len(0), packed(false) {}
+    PoolEntry(uint64_t const p, uint32_t const l, bool const pk) : pos(p), len(l), packed(pk) {}
+  };
+
+  // Consensus and allele sequences of the SVs of one run, identical sequences share one entry
+  // Entries are append-only and the block directories are reserved up front, so lookups by handle need no lock
+  struct SequencePool {
+    typedef boost::unordered_multimap<uint64_t, uint32_t> TLookup;
+
+    Arena<uint64_t> packed;
+    Arena<char> raw;
+    Arena<PoolEntry> entry;
+    TLookup lookup;
+
+    SequencePool() : packed(16), raw(16), entry(16) {
+      reserveArena(packed, DELLY_SEQPOOL_BLOCKS);
+      reserveArena(raw, DELLY_SEQPOOL_BLOCKS);
+      reserveArena(entry, DELLY_SEQPOOL_BLOCKS);
+    }
+  };
+
+  // Pool of the running command, appends are serialized by the seqpool critical section
+  inline SequencePool&
+  _sequencePool() {
+    static SequencePool pool;
+    return pool;
+  }
+
+  // Frees all interned sequences, handles of the released pool are invalid afterwards
+  inline void
+  releaseSequencePool() {
+#pragma omp critical (seqpool)
+    {
+      SequencePool& sp = _sequencePool();
+      releaseArena(sp.packed);
+      releaseArena(sp.raw);
+      releaseArena(sp.entry);
+      SequencePool::TLookup().swap(sp.lookup);
+      reserveArena(sp.packed, DELLY_SEQPOOL_BLOCKS);
+      reserveArena(sp.raw, DELLY_SEQPOOL_BLOCKS);
+      reserveArena(sp.entry, DELLY_SEQPOOL_BLOCKS);
+    }
+  }
+
+  // Scope of a command run, declared before the SVs so the pool is released after them
+  struct SequencePoolScope {
+    SequencePoolScope() {}
+    ~SequencePoolScope() {
+      releaseSequencePool();
+    }
+  };
+
+  inline bool
+  _packable(std::string const& s) {
+    for(uint32_t i = 0; i < s.size(); ++i) {
+      if ((s[i] != 'A') && (s[i] != 'C') && (s[i] != 'G') && (s[i] != 'T')) return false;
+    }
+    return true;
+  }
+
+  inline void
+  _unpackEntry(SequencePool const& sp, PoolEntry const& e, std::string& s) {
+    static char const base[4] = {'A', 'C', 'G', 'T'};
+    s.resize(e.len);
+    if (!e.len) return;
+    if (e.packed) {
+      uint64_t const* w = arenaPtr(sp.packed, e.pos);
+      for(uint32_t i = 0; i < e.len; ++i) s[i] = base[(w[i >> 5] >> ((i & 31) << 1)) & 3];
+    } else s.assign(arenaPtr(sp.raw, e.pos), e.len);
+  }
+
+  // Handle of the sequence, 0 for the empty sequence
+  inline uint32_t
+  internSequence(std::string const& s) {
+    if (s.empty()) return 0;
+    uint64_t hv = hashReadId(s.data(), s.size(), 0);
+    bool packable = _packable(s);
+    uint32_t words = (s.size() + 31) / 32;
+    uint32_t id = 0;
+    bool full = false;
+#pragma omp critical (seqpool)
+    {
+      SequencePool& sp = _sequencePool();
+      std::string other;
+      std::pair<SequencePool::TLookup::const_iterator, SequencePool::TLookup::const_iterator> range = sp.lookup.equal_range(hv);
+      for(SequencePool::TLookup::const_iterator it = range.first; it != range.second; ++it) {
+	PoolEntry const& e = arenaAt(sp.entry, it->second - 1);
+	if (e.len != s.size()) continue;
+	_unpackEntry(sp, e, other);
+	if (other == s) {
+	  id = it->second;
+	  break;
+	}
+      }
+      if (!id) {
+	if ((!arenaFits(sp.entry, 1)) || ((packable) && (!arenaFits(sp.packed, words))) || ((!packable) && (!arenaFits(sp.raw, s.size())))) full = true;
+	else if (packable) {
+	  static uint8_t const code[4] = {0, 1, 3, 2};  // A, C, T, G by bits 1-2 of the ASCII code
+	  uint64_t pos = arenaAllocate(sp.packed, words);
+	  uint64_t* w = arenaPtr(sp.packed, pos);
+	  std::fill(w, w + words, 0);
+	  for(uint32_t i = 0; i < s.size(); ++i) w[i >> 5] |= ((uint64_t) code[(s[i] >> 1) & 3] << ((i & 31) << 1));
+	  arenaPush(sp.entry, PoolEntry(pos, s.size(), true));
+	} else {
+	  uint64_t pos = arenaAllocate(sp.raw, s.size());
+	  std::copy(s.begin(), s.end(), arenaPtr(sp.raw, pos));
+	  arenaPush(sp.entry, PoolEntry(pos, s.size(), false));
+	}
+	if (!full) {
+	  id = sp.entry.count;
+	  sp.lookup.insert(std::make_pair(hv, id));
+	}
+      }
+    }
+    if (full) {
+      std::cerr << "Error: Sequence pool is full!" << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+    return id;
+  }
+
+  // Lock-free, the entry of a handle never changes once the handle was handed out
+  inline void
+  unpackSequence(uint32_t const id, std::string& s) {
+    s.clear();
+    if (!id) return;
+    SequencePool const& sp = _sequencePool();
+    _unpackEntry(sp, arenaAt(sp.entry, id - 1), s);
+  }
+
+  inline uint32_t
+  sequenceLength(uint32_t const id) {
+    if (!id) return 0;
+    SequencePool const& sp = _sequencePool();
+    return arenaAt(sp.entry, id - 1).len;
+  }
+
+  // Sequence of a StructuralVariantRecord, a 4-byte handle into the pool
+  struct PooledSeq {
+    uint32_t id;
+
+    PooledSeq() : id(0) {}
+
+    PooledSeq&
+    operator=(std::string const& s) {
+      id = internSequence(s);
+      return *this;
+    }
+
+    inline std::string
+    str() const {
+      std::string s;
+      unpackSequence(id, s);
+      return s;
+    }
+
+    // Unpack into a reused buffer
+    inline void
+    str(std::string& s) const {
+      unpackSequence(id, s);
+    }
+
+    inline uint32_t
+    size() const {
+      return sequenceLength(id);
+    }
+
+    inline bool
+    empty() const {
+      return (!id);
+    }
+  };
+
+}
+
+#endif
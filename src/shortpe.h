@@ -35,6 +35,8 @@
 #include "split.h"
 #include "junction.h"
 #include "cluster.h"
+#include "evidence.h"
+#include "schedule.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -59,6 +61,7 @@ namespace torali
     TIndex idx(c.files.size());
     for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
       samfile[file_c] = sam_open(c.files[file_c].string().c_str(), "r");
+      attachHtsThreadPool(samfile[file_c]);
       hts_set_fai_filename(samfile[file_c], c.genome.string().c_str());
       idx[file_c] = sam_index_load(samfile[file_c], c.files[file_c].string().c_str());
     }
@@ -77,6 +80,8 @@ namespace torali
     boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
     std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] " << "Split-read assembly" << std::endl;
 
+    uint64_t cacheHits = 0;
+    uint64_t cacheMisses = 0;
     faidx_t* fai = fai_load(c.genome.string().c_str());
     for(int32_t refIndex = 0; refIndex < hdr->n_targets; ++refIndex) {
       if (validRegions[refIndex].empty()) continue;
@@ -97,7 +102,11 @@ namespace torali
       TQualVectors qualStore(svs.size(), TQualities());
       
       // Collect reads from all samples
+      ReadCache rc;
       for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
+	// Reads spanning adjacent regions are decoded once
+	clearReadCache(rc);
+	
 	// Read alignments
 	for(typename TChrIntervals::const_iterator vRIt = validRegions[refIndex].begin(); vRIt != validRegions[refIndex].end(); ++vRIt) {
 	  hts_itr_t* iter = sam_itr_queryi(idx[file_c], refIndex, vRIt->lower(), vRIt->upper());
@@ -106,6 +115,7 @@ namespace torali
 	    if (rec->core.flag & (BAM_FQCFAIL | BAM_FDUP | BAM_FUNMAP | BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) continue;
 	    if ((rec->core.qual < c.minMapQual) || (rec->core.tid<0)) continue;
 	    if (!hits[rec->core.pos]) continue;
+	    evictReads(rc, rec->core.pos);
 
 	    // Valid split-read
 	    std::size_t seed = hash_string(bam_get_qname(rec));
@@ -115,11 +125,6 @@ namespace torali
 
 	      // Get the sequence
 	      if (svid == (int32_t) svs[svid].id) {  // Should be always true
-		std::string sequence;
-		sequence.resize(rec->core.l_qseq);
-		uint8_t* seqptr = bam_get_seq(rec);
-		for (int i = 0; i < rec->core.l_qseq; ++i) sequence[i] = "=ACMGRSVTWYHKDBN"[bam_seqi(seqptr, i)];
-
 		// Adjust orientation
 		bool bpPoint = false;
 		if (_translocation(svs[svid].svt)) {
@@ -134,7 +139,8 @@ namespace torali
 		    else bpPoint = false;
 		  }
 		}
-		_adjustOrientation(sequence, bpPoint, svs[svid].svt);
+		std::string sequence;
+		unpackRead(cachedRead(rc, rec), _reverseOrientation(bpPoint, svs[svid].svt), sequence);
 		
 		// At most n split-reads
 		if (seqStore[svid].size() < maxReadPerSV) {
@@ -154,6 +160,8 @@ namespace torali
           hts_itr_destroy(iter);
 	}
       }
+      cacheHits += rc.hits;
+      cacheMisses += rc.misses;
 
       // Process all SVs on this chromosome
       for(uint32_t svid = 0; svid < seqStore.size(); ++svid) {
@@ -163,8 +171,9 @@ namespace torali
 	// MSA
 	bool msaSuccess = false;
 	if (seqStore[svid].size() > 1) {
-	  msa(c, seqStore[svid], svs[svid].consensus);
-	  if (alignConsensus(c, hdr, seq, NULL, svs[svid])) msaSuccess = true;
+	  std::string cons;
+	  msa(c, seqStore[svid], cons);
+	  if (alignConsensus(c, hdr, seq, NULL, cons, svs[svid])) msaSuccess = true;
 	}
 	if (!msaSuccess) {
 	  svs[svid].consensus = "";
@@ -209,8 +218,9 @@ namespace torali
 	      std::string tname(hdr->target_name[refIndex2]);
 	      sndSeq = faidx_fetch_seq(fai, tname.c_str(), 0, hdr->target_len[refIndex2], &seqlen);
 	    }
-	    msa(c, traStore[svid], svs[svid].consensus);
-	    if (alignConsensus(c, hdr, seq, sndSeq, svs[svid])) msaSuccess = true;
+	    std::string cons;
+	    msa(c, traStore[svid], cons);
+	    if (alignConsensus(c, hdr, seq, sndSeq, cons, svs[svid])) msaSuccess = true;
 	  }
 	  if (!msaSuccess) {
 	    svs[svid].consensus = "";
@@ -230,6 +240,9 @@ namespace torali
       if (sndSeq != NULL) free(sndSeq);
     }
 
+    now = boost::posix_time::second_clock::local_time();
+    std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] " << "Read cache hits: " << cacheHits << ", misses: " << cacheMisses << std::endl;
+
     // Clean-up
     fai_destroy(fai);
     bam_hdr_destroy(hdr);
@@ -240,23 +253,203 @@ namespace torali
   }
 
       
+  // Inter-chromosomal read of a chromosome task, mates are paired in chromosome order once the sample is scanned
+  struct TraRead {
+    bool first;
+    int32_t svt;
+    uint8_t qual;
+    int32_t alen;
+    std::size_t hv;
+    BamAlignRecord br;
+    EvidencePair ep;
+
+    TraRead(bam1_t* rec, bool const f, std::size_t const h, int32_t const s, LibraryInfo const& lib) : first(f), svt(s), qual(rec->core.qual), alen(alignmentLength(rec)), hv(h), br(rec, 0, alignmentLength(rec), 0, lib.median, lib.maxNormalISize), ep(_evidencePair(rec, 0, s, lib)) {}
+  };
+
+  // Split-read junctions, inter-chromosomal reads and discordant pairs of one scan task
+  struct PEandSRScan {
+    typedef std::vector<Junction> TJunctionVector;
+    typedef std::map<std::size_t, TJunctionVector> TReadBp;
+    typedef std::vector<std::vector<BamAlignRecord> > TSvtBamRecord;
+    TReadBp readBp;
+    std::vector<TraRead> tra;
+    TSvtBamRecord bamRecord;
+    uint32_t abnormal;
+
+    PEandSRScan() : bamRecord(2 * DELLY_SVT_TRANS), abnormal(0) {}
+  };
+
+  // Pairs inter-chromosomal reads in scan order, first reads are on the lower chromosome and precede their mates
+  template<typename TMateMap, typename TSvtBamRecord>
+  inline uint32_t
+  _pairTraReads(std::vector<TraRead>& tra, TMateMap& matetra, TSvtBamRecord& bamRecord, bool const evValid, EvidenceIndex& evidence) {
+    uint32_t paired = 0;
+    for(uint32_t i = 0; i < tra.size(); ++i) {
+      if (tra[i].first) matetra[tra[i].hv] = std::make_pair(tra[i].qual, tra[i].alen);
+      else {
+	typename TMateMap::iterator itMate = matetra.find(tra[i].hv);
+	if ((itMate == matetra.end()) || (!itMate->second.first)) continue; // Mate discarded
+	uint8_t pairQuality = std::min((uint8_t) itMate->second.first, tra[i].qual);
+	tra[i].br.MapQuality = pairQuality;
+	tra[i].br.malen = itMate->second.second;
+	itMate->second.first = 0;
+	bamRecord[tra[i].svt].push_back(tra[i].br);
+	++paired;
+	if (evValid) {
+	  tra[i].ep.qual = pairQuality;
+	  evidence.pairs.push_back(tra[i].ep);
+	}
+      }
+    }
+    tra.clear();
+    return paired;
+  }
+
+  // Abnormal pairs and split-read junctions of one chromosome, false if there is no data
+  template<typename TConfig, typename TValidRegion>
+  inline bool
+  _scanPEandSRChromosome(TConfig const& c, TValidRegion const& validRegions, samFile* samfile, hts_idx_t* idx, bam_hdr_t* hdr, uint32_t const file_c, int32_t const refIndex, LibraryInfo const& lib, bool const evValid, EvidenceIndex& evidence, PEandSRScan& ps) {
+    typedef typename TValidRegion::value_type TChrIntervals;
+    typedef std::pair<uint8_t, int32_t> TQualLen;
+    typedef boost::unordered_map<std::size_t, TQualLen> TMateMap;
+    PEandSRScan::TReadBp& readBp = ps.readBp;
+
+    // Any data?
+    if (validRegions[refIndex].empty()) return false;
+    bool nodata = true;
+    std::string suffix("cram");
+    std::string str(c.files[file_c].string());
+    if ((str.size() >= suffix.size()) && (str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0)) nodata = false;
+    uint64_t mapped = 0;
+    uint64_t unmapped = 0;
+    hts_idx_get_stat(idx, refIndex, &mapped, &unmapped);
+    if (mapped) nodata = false;
+    if (nodata) return false;
+
+    // Intra-chromosomal mate map and alignment length
+    TMateMap mateMap;
+    if (evValid) initEvidence(hdr, refIndex, evidence);
+
+    // Read alignments
+    for(typename TChrIntervals::const_iterator vRIt = validRegions[refIndex].begin(); vRIt != validRegions[refIndex].end(); ++vRIt) {
+      hts_itr_t* iter = sam_itr_queryi(idx, refIndex, vRIt->lower(), vRIt->upper());
+      bam1_t* rec = bam_init1();
+      int32_t lastAlignedPos = 0;
+      std::set<std::size_t> lastAlignedPosReads;
+      while (sam_itr_next(samfile, iter, rec) >= 0) {
+	if (rec->core.flag & (BAM_FQCFAIL | BAM_FDUP | BAM_FUNMAP)) continue;
+	if ((rec->core.qual < c.minMapQual) || (rec->core.tid<0)) continue;
+
+	std::size_t seed = hash_string(bam_get_qname(rec));
+	if (evValid) _addEvidenceRead(c, rec, lib, evidence);
+
+	// SV detection using single-end read
+	uint32_t rp = rec->core.pos; // reference pointer
+	uint32_t sp = 0; // sequence pointer
+
+	// Parse the CIGAR
+	uint32_t* cigar = bam_get_cigar(rec);
+	for (std::size_t i = 0; i < rec->core.n_cigar; ++i) {
+	  if ((bam_cigar_op(cigar[i]) == BAM_CMATCH) || (bam_cigar_op(cigar[i]) == BAM_CEQUAL) || (bam_cigar_op(cigar[i]) == BAM_CDIFF)) {
+	    sp += bam_cigar_oplen(cigar[i]);
+	    rp += bam_cigar_oplen(cigar[i]);
+	  } else if (bam_cigar_op(cigar[i]) == BAM_CDEL) {
+	    if (bam_cigar_oplen(cigar[i]) > c.minRefSep) _insertJunction(readBp, seed, rec, rp, sp, false);
+	    rp += bam_cigar_oplen(cigar[i]);
+	    if (bam_cigar_oplen(cigar[i]) > c.minRefSep) _insertJunction(readBp, seed, rec, rp, sp, true);
+	  } else if (bam_cigar_op(cigar[i]) == BAM_CINS) {
+	    if (bam_cigar_oplen(cigar[i]) > c.minRefSep) _insertJunction(readBp, seed, rec, rp, sp, false);
+	    sp += bam_cigar_oplen(cigar[i]);
+	    if (bam_cigar_oplen(cigar[i]) > c.minRefSep) _insertJunction(readBp, seed, rec, rp, sp, true);
+	  } else if ((bam_cigar_op(cigar[i]) == BAM_CSOFT_CLIP) || (bam_cigar_op(cigar[i]) == BAM_CHARD_CLIP)) {
+	    int32_t finalsp = sp;
+	    bool scleft = false;
+	    if (sp == 0) {
+	      finalsp += bam_cigar_oplen(cigar[i]); // Leading soft-clip / hard-clip
+	      scleft = true;
+	    }
+	    sp += bam_cigar_oplen(cigar[i]);
+	    if (bam_cigar_oplen(cigar[i]) > c.minClip) _insertJunction(readBp, seed, rec, rp, finalsp, scleft);
+	  } else if (bam_cigar_op(cigar[i]) == BAM_CREF_SKIP) {
+	    rp += bam_cigar_oplen(cigar[i]);
+	  } else {
+	    std::cerr << "Warning: Unknown Cigar operation!" << std::endl;
+	  }
+	}
+
+	// Paired-end clustering
+	if (rec->core.flag & BAM_FPAIRED) {
+	  // Single-end library
+	  if (lib.median == 0) continue; // Single-end library
+
+	  // Secondary/supplementary alignments, mate unmapped or blacklisted chr
+	  if (rec->core.flag & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) continue;
+	  if ((rec->core.mtid<0) || (rec->core.flag & BAM_FMUNMAP)) continue;
+	  if (validRegions[rec->core.mtid].empty()) continue;
+	  if ((_translocation(rec)) && (rec->core.qual < c.minTraQual)) continue;
+
+	  // SV type	      
+	  int32_t svt = _isizeMappingPos(rec, lib.maxISizeCutoff);
+	  if (svt == -1) continue;
+	  if ((!c.svtset.empty()) && (c.svtset.find(svt) == c.svtset.end())) continue;
+
+	  // Check library-specific insert size for deletions
+	  if ((svt == 2) && (lib.maxISizeCutoff > std::abs(rec->core.isize))) continue;
+
+	  // Clean-up the read store for identical alignment positions
+	  if (rec->core.pos > lastAlignedPos) {
+	    lastAlignedPosReads.clear();
+	    lastAlignedPos = rec->core.pos;
+	  }
+
+	  // Get or store the mapping quality for the partner
+	  if (_firstPairObs(rec, lastAlignedPosReads)) {
+	    // First read
+	    lastAlignedPosReads.insert(seed);
+	    std::size_t hv = hash_pair(rec);
+	    if (_translocation(svt)) ps.tra.push_back(TraRead(rec, true, hv, svt, lib));
+	    else mateMap[hv]= std::make_pair((uint8_t) rec->core.qual, alignmentLength(rec));
+	  } else {
+	    // Second read
+	    std::size_t hv = hash_pair_mate(rec);
+	    int32_t alenmate = 0;
+	    uint8_t pairQuality = 0;
+	    if (_translocation(svt)) {
+	      // Inter-chromosomal, paired once all chromosomes of the sample are scanned
+	      ps.tra.push_back(TraRead(rec, false, hv, svt, lib));
+	      continue;
+	    } else {
+	      // Intra-chromosomal
+	      if ((mateMap.find(hv) == mateMap.end()) || (!mateMap[hv].first)) continue; // Mate discarded
+	      TQualLen p = mateMap[hv];
+	      pairQuality = std::min((uint8_t) p.first, (uint8_t) rec->core.qual);
+	      alenmate = p.second;
+	      mateMap[hv].first = 0;
+	    }
+
+	    ps.bamRecord[svt].push_back(BamAlignRecord(rec, pairQuality, alignmentLength(rec), alenmate, lib.median, lib.maxNormalISize));
+	    ++ps.abnormal;
+	    if (evValid) _addEvidencePair(rec, pairQuality, svt, lib, evidence);
+	  }
+	}
+      }
+      bam_destroy1(rec);
+      hts_itr_destroy(iter);
+    }
+    return true;
+  }
+
   template<typename TConfig, typename TValidRegion, typename TSRStore, typename TSampleLib>
-  inline void
+  inline bool
   scanPEandSR(TConfig const& c, TValidRegion const& validRegions, std::vector<StructuralVariantRecord>& svs, std::vector<StructuralVariantRecord>& srSVs, TSRStore& srStore, TSampleLib& sampleLib)
   {
-    typedef typename TValidRegion::value_type TChrIntervals;
+    typedef std::pair<uint8_t, int32_t> TQualLen;
+    typedef boost::unordered_map<std::size_t, TQualLen> TMateMap;
 
-    // Open file handles
-    typedef std::vector<samFile*> TSamFile;
-    typedef std::vector<hts_idx_t*> TIndex;
-    TSamFile samfile(c.files.size());
-    TIndex idx(c.files.size());
-    for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-      samfile[file_c] = sam_open(c.files[file_c].string().c_str(), "r");
-      hts_set_fai_filename(samfile[file_c], c.genome.string().c_str());
-      idx[file_c] = sam_index_load(samfile[file_c], c.files[file_c].string().c_str());
-    }
-    bam_hdr_t* hdr = sam_hdr_read(samfile[0]);
+    // Reference header
+    samFile* samfile = sam_open(c.files[0].string().c_str(), "r");
+    hts_set_fai_filename(samfile, c.genome.string().c_str());
+    bam_hdr_t* hdr = sam_hdr_read(samfile);
 
     // Split-read records
     typedef std::vector<SRBamRecord> TSRBamRecord;
@@ -267,166 +460,152 @@ namespace torali
     typedef std::vector<BamAlignRecord> TBamRecord;
     typedef std::vector<TBamRecord> TSvtBamRecord;
     TSvtBamRecord bamRecord(2 * DELLY_SVT_TRANS, TBamRecord());
-     
-    // Parse genome, process chromosome by chromosome
-    boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
-    std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] " << "Paired-end and split-read scanning" << std::endl;
-    // Iterate all samples
-#pragma omp parallel for default(shared)
-    for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-      // Inter-chromosomal mate map and alignment length
-      typedef std::pair<uint8_t, int32_t> TQualLen;
-      typedef boost::unordered_map<std::size_t, TQualLen> TMateMap;
-      std::vector<TMateMap> matetra(c.files.size());
-
-      // Split-read junctions
-      typedef std::vector<Junction> TJunctionVector;
-      typedef std::map<unsigned, TJunctionVector> TReadBp;
-      TReadBp readBp;
-      
-      // Iterate all chromosomes for that sample
-      for(int32_t refIndex=0; refIndex < (int32_t) hdr->n_targets; ++refIndex) {
 
-	// Any data?
+    // Sample x chromosome tasks, whole samples if an evidence index is written as its chromosome blocks need the paired mates
+    TaskScheduler ts;
+    initScheduler(c, ts);
+    std::vector<std::vector<uint64_t> > mapped;
+    if (!loadMappedReads(c, hdr, mapped)) {
+      bam_hdr_destroy(hdr);
+      sam_close(samfile);
+      return false;
+    }
+    for(uint32_t file_c = 0; file_c < c.files.size(); ++file_c) {
+      uint64_t sampleReads = 0;
+      for(int32_t refIndex = 0; refIndex < (int32_t) hdr->n_targets; ++refIndex) {
 	if (validRegions[refIndex].empty()) continue;
-	bool nodata = true;
-	std::string suffix("cram");
-	std::string str(c.files[file_c].string());
-	if ((str.size() >= suffix.size()) && (str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0)) nodata = false;
-	uint64_t mapped = 0;
-	uint64_t unmapped = 0;
-	hts_idx_get_stat(idx[file_c], refIndex, &mapped, &unmapped);
-	if (mapped) nodata = false;
-	if (nodata) continue;
-
-	// Intra-chromosomal mate map and alignment length
-	TMateMap mateMap;
+	uint64_t reads = _mappedReads(mapped[file_c], hdr, refIndex);
+	if (c.hasEvidenceDir) sampleReads += reads;
+	else addTask(ts, file_c, refIndex, reads, reads * DELLY_SCAN_BYTES_PER_READ);
+      }
+      if (c.hasEvidenceDir) addTask(ts, file_c, -1, sampleReads, sampleReads * DELLY_SCAN_BYTES_PER_READ);
+    }
+    sortTasks(ts);
+    std::vector<std::vector<std::pair<int32_t, int32_t> > > sampleTasks(c.files.size());
+    for(int32_t t = 0; t < (int32_t) ts.tasks.size(); ++t) sampleTasks[ts.tasks[t].file_c].push_back(std::make_pair(ts.tasks[t].refIndex, t));
+    for(uint32_t file_c = 0; file_c < c.files.size(); ++file_c) std::sort(sampleTasks[file_c].begin(), sampleTasks[file_c].end());
+    std::vector<PEandSRScan> taskScan(ts.tasks.size());
+    std::vector<TSvtSRBamRecord> sampleSR(c.files.size());
 
-	// Read alignments
-	for(typename TChrIntervals::const_iterator vRIt = validRegions[refIndex].begin(); vRIt != validRegions[refIndex].end(); ++vRIt) {
-	  hts_itr_t* iter = sam_itr_queryi(idx[file_c], refIndex, vRIt->lower(), vRIt->upper());
-	  bam1_t* rec = bam_init1();
-	  int32_t lastAlignedPos = 0;
-	  std::set<std::size_t> lastAlignedPosReads;
-	  while (sam_itr_next(samfile[file_c], iter, rec) >= 0) {
-	    if (rec->core.flag & (BAM_FQCFAIL | BAM_FDUP | BAM_FUNMAP)) continue;
-	    if ((rec->core.qual < c.minMapQual) || (rec->core.tid<0)) continue;
+    // Parse genome, process chromosome by chromosome
+    boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
+    std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] " << "Paired-end and split-read scanning" << std::endl;
+    now = boost::posix_time::second_clock::local_time();
+    std::cerr << '[' << boost::posix_time::to_simple_string(now) << "] " << "Scan tasks: " << ts.tasks.size() << ", threads: " << ts.nthreads << std::endl;
+#pragma omp parallel num_threads(ts.nthreads) default(shared)
+    {
+      // Alignment file of the last task
+      int32_t tfile_c = -1;
+      samFile* tfile = NULL;
+      hts_idx_t* tidx = NULL;
+#pragma omp for schedule(dynamic, 1)
+      for(int32_t t = 0; t < (int32_t) ts.tasks.size(); ++t) {
+	uint32_t file_c = ts.tasks[t].file_c;
+	startTask(ts, t);
+	if (tfile_c != (int32_t) file_c) {
+	  if (tfile != NULL) {
+	    hts_idx_destroy(tidx);
+	    sam_close(tfile);
+	  }
+	  tfile = sam_open(c.files[file_c].string().c_str(), "r");
+	  attachHtsThreadPool(tfile);
+	  hts_set_fai_filename(tfile, c.genome.string().c_str());
+	  tidx = sam_index_load(tfile, c.files[file_c].string().c_str());
+	  tfile_c = file_c;
+	}
 
-	    unsigned seed = hash_string(bam_get_qname(rec));
-	    
-	    // SV detection using single-end read
-	    uint32_t rp = rec->core.pos; // reference pointer
-	    uint32_t sp = 0; // sequence pointer
-
-	    // Parse the CIGAR
-	    uint32_t* cigar = bam_get_cigar(rec);
-	    for (std::size_t i = 0; i < rec->core.n_cigar; ++i) {
-	      if ((bam_cigar_op(cigar[i]) == BAM_CMATCH) || (bam_cigar_op(cigar[i]) == BAM_CEQUAL) || (bam_cigar_op(cigar[i]) == BAM_CDIFF)) {
-		sp += bam_cigar_oplen(cigar[i]);
-		rp += bam_cigar_oplen(cigar[i]);
-	      } else if (bam_cigar_op(cigar[i]) == BAM_CDEL) {
-		if (bam_cigar_oplen(cigar[i]) > c.minRefSep) _insertJunction(readBp, seed, rec, rp, sp, false);
-		rp += bam_cigar_oplen(cigar[i]);
-		if (bam_cigar_oplen(cigar[i]) > c.minRefSep) _insertJunction(readBp, seed, rec, rp, sp, true);
-	      } else if (bam_cigar_op(cigar[i]) == BAM_CINS) {
-		if (bam_cigar_oplen(cigar[i]) > c.minRefSep) _insertJunction(readBp, seed, rec, rp, sp, false);
-		sp += bam_cigar_oplen(cigar[i]);
-		if (bam_cigar_oplen(cigar[i]) > c.minRefSep) _insertJunction(readBp, seed, rec, rp, sp, true);
-	      } else if ((bam_cigar_op(cigar[i]) == BAM_CSOFT_CLIP) || (bam_cigar_op(cigar[i]) == BAM_CHARD_CLIP)) {
-		int32_t finalsp = sp;
-		bool scleft = false;
-		if (sp == 0) {
-		  finalsp += bam_cigar_oplen(cigar[i]); // Leading soft-clip / hard-clip
-		  scleft = true;
-		}
-		sp += bam_cigar_oplen(cigar[i]);
-		if (bam_cigar_oplen(cigar[i]) > c.minClip) _insertJunction(readBp, seed, rec, rp, finalsp, scleft);
-	      } else if (bam_cigar_op(cigar[i]) == BAM_CREF_SKIP) {
-		rp += bam_cigar_oplen(cigar[i]);
-	      } else {
-		std::cerr << "Warning: Unknown Cigar operation!" << std::endl;
+	// Evidence index
+	EvidenceFile evFile;
+	EvidenceIndex evidence;
+	bool evValid = false;
+	if (ts.tasks[t].refIndex >= 0) _scanPEandSRChromosome(c, validRegions, tfile, tidx, hdr, file_c, ts.tasks[t].refIndex, sampleLib[file_c], false, evidence, taskScan[t]);
+	else {
+	  // Whole sample, mates are paired chromosome by chromosome to complete each evidence block
+	  if (c.hasEvidenceDir) {
+	    evValid = openEvidence(c, file_c, hdr, sampleLib[file_c], evFile);
+	    if (!evValid) {
+#pragma omp critical
+	      {
+		std::cerr << "Warning: Fail to open evidence index " << evidenceFile(c, file_c).string() << std::endl;
 	      }
 	    }
-	    
-	    // Paired-end clustering
-	    if (rec->core.flag & BAM_FPAIRED) {
-	      // Single-end library
-	      if (sampleLib[file_c].median == 0) continue; // Single-end library
-
-	      // Secondary/supplementary alignments, mate unmapped or blacklisted chr
-	      if (rec->core.flag & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) continue;
-	      if ((rec->core.mtid<0) || (rec->core.flag & BAM_FMUNMAP)) continue;
-	      if (validRegions[rec->core.mtid].empty()) continue;
-	      if ((_translocation(rec)) && (rec->core.qual < c.minTraQual)) continue;
-
-	      // SV type	      
-	      int32_t svt = _isizeMappingPos(rec, sampleLib[file_c].maxISizeCutoff);
-	      if (svt == -1) continue;
-	      if ((!c.svtset.empty()) && (c.svtset.find(svt) == c.svtset.end())) continue;
-
-	      // Check library-specific insert size for deletions
-	      if ((svt == 2) && (sampleLib[file_c].maxISizeCutoff > std::abs(rec->core.isize))) continue;
-	      
-	      // Clean-up the read store for identical alignment positions
-	      if (rec->core.pos > lastAlignedPos) {
-		lastAlignedPosReads.clear();
-		lastAlignedPos = rec->core.pos;
-	      }
-	      
-	      // Get or store the mapping quality for the partner
-	      if (_firstPairObs(rec, lastAlignedPosReads)) {
-		// First read
-		lastAlignedPosReads.insert(seed);
-		std::size_t hv = hash_pair(rec);
-		if (_translocation(svt)) matetra[file_c][hv]= std::make_pair((uint8_t) rec->core.qual, alignmentLength(rec));
-		else mateMap[hv]= std::make_pair((uint8_t) rec->core.qual, alignmentLength(rec));
-	      } else {
-		// Second read
-		std::size_t hv = hash_pair_mate(rec);
-		int32_t alenmate = 0;
-		uint8_t pairQuality = 0;
-	        if (_translocation(svt)) {
-		  // Inter-chromosomal
-		  if ((matetra[file_c].find(hv) == matetra[file_c].end()) || (!matetra[file_c][hv].first)) continue; // Mate discarded
-		  TQualLen p = matetra[file_c][hv];
-		  pairQuality = std::min((uint8_t) p.first, (uint8_t) rec->core.qual);
-		  alenmate = p.second;
-		  matetra[file_c][hv].first = 0;
-		} else {
-		  // Intra-chromosomal
-		  if ((mateMap.find(hv) == mateMap.end()) || (!mateMap[hv].first)) continue; // Mate discarded
-		  TQualLen p = mateMap[hv];
-		  pairQuality = std::min((uint8_t) p.first, (uint8_t) rec->core.qual);
-		  alenmate = p.second;
-		  mateMap[hv].first = 0;
-		}
+	  }
+	  TMateMap matetra;
+	  for(int32_t refIndex = 0; refIndex < (int32_t) hdr->n_targets; ++refIndex) {
+	    if (!_scanPEandSRChromosome(c, validRegions, tfile, tidx, hdr, file_c, refIndex, sampleLib[file_c], evValid, evidence, taskScan[t])) continue;
+	    taskScan[t].abnormal += _pairTraReads(taskScan[t].tra, matetra, taskScan[t].bamRecord, evValid, evidence);
+	    if (evValid) writeEvidenceBlock(evFile, refIndex, evidence);
+	  }
+	}
+	if (!finishTask(ts, t)) continue;
+
+	// Last task of the sample, merge all tasks in chromosome order, paired-end records stay with their task
+	PEandSRScan::TReadBp readBp;
+	TMateMap matetra;
+	TSvtBamRecord traRecord(2 * DELLY_SVT_TRANS, TBamRecord());
+	uint32_t abnormal = 0;
+	for(uint32_t k = 0; k < sampleTasks[file_c].size(); ++k) {
+	  PEandSRScan& ps = taskScan[sampleTasks[file_c][k].second];
+	  if (readBp.empty()) readBp.swap(ps.readBp);
+	  else {
+	    for(PEandSRScan::TReadBp::iterator it = ps.readBp.begin(); it != ps.readBp.end(); ++it) {
+	      PEandSRScan::TJunctionVector& jv = readBp[it->first];
+	      jv.insert(jv.end(), it->second.begin(), it->second.end());
+	    }
+	  }
+	  abnormal += ps.abnormal + _pairTraReads(ps.tra, matetra, traRecord, false, evidence);
+	  PEandSRScan::TReadBp().swap(ps.readBp);
+	  std::vector<TraRead>().swap(ps.tra);
+	}
+	for(uint32_t svt = 0; svt < traRecord.size(); ++svt) taskScan[t].bamRecord[svt].insert(taskScan[t].bamRecord[svt].end(), traRecord[svt].begin(), traRecord[svt].end());
+	sampleLib[file_c].abnormal_pairs += abnormal;
 
+	// Process all junctions for this BAM file
+	for(PEandSRScan::TReadBp::iterator it = readBp.begin(); it != readBp.end(); ++it) {
+	  std::sort(it->second.begin(), it->second.end(), SortJunction<Junction>());
+	}
+
+	// Collect split-read SVs of the sample
+	TSvtSRBamRecord& sampleBR = sampleSR[file_c];
+	sampleBR.resize(2 * DELLY_SVT_TRANS, TSRBamRecord());
+	if ((c.svtset.empty()) || (c.svtset.find(2) != c.svtset.end())) selectDeletions(c, readBp, sampleBR);
+	if ((c.svtset.empty()) || (c.svtset.find(3) != c.svtset.end())) selectDuplications(c, readBp, sampleBR);
+	if ((c.svtset.empty()) || (c.svtset.find(0) != c.svtset.end()) || (c.svtset.find(1) != c.svtset.end())) selectInversions(c, readBp, sampleBR);
+	if ((c.svtset.empty()) || (c.svtset.find(4) != c.svtset.end())) selectInsertions(c, readBp, sampleBR);
+	if ((c.svtset.empty()) || (c.svtset.find(DELLY_SVT_TRANS) != c.svtset.end()) || (c.svtset.find(DELLY_SVT_TRANS + 1) != c.svtset.end()) || (c.svtset.find(DELLY_SVT_TRANS + 2) != c.svtset.end()) || (c.svtset.find(DELLY_SVT_TRANS + 3) != c.svtset.end())) selectTranslocations(c, readBp, sampleBR);
+
+	// Close evidence index
+	if (evValid) {
+	  if (!closeEvidence(evFile)) {
 #pragma omp critical
-		{
-		  bamRecord[svt].push_back(BamAlignRecord(rec, pairQuality, alignmentLength(rec), alenmate, sampleLib[file_c].median, sampleLib[file_c].mad, sampleLib[file_c].maxNormalISize));
-		}
-		++sampleLib[file_c].abnormal_pairs;
-	      }
+	    {
+	      std::cerr << "Warning: Fail to write evidence index " << evidenceFile(c, file_c).string() << std::endl;
 	    }
 	  }
-	  bam_destroy1(rec);
-	  hts_itr_destroy(iter);
 	}
       }
+      if (tfile != NULL) {
+	hts_idx_destroy(tidx);
+	sam_close(tfile);
+      }
+    }
 
-      // Process all junctions for this BAM file
-      for(typename TReadBp::iterator it = readBp.begin(); it != readBp.end(); ++it) {
-	std::sort(it->second.begin(), it->second.end(), SortJunction<Junction>());
+    // Merge paired-end records by task and split-read records by sample, in task and sample order
+    for(uint32_t svt = 0; svt < bamRecord.size(); ++svt) {
+      uint64_t nrec = 0;
+      for(uint32_t t = 0; t < taskScan.size(); ++t) nrec += taskScan[t].bamRecord[svt].size();
+      bamRecord[svt].reserve(nrec);
+      for(uint32_t t = 0; t < taskScan.size(); ++t) {
+	bamRecord[svt].insert(bamRecord[svt].end(), taskScan[t].bamRecord[svt].begin(), taskScan[t].bamRecord[svt].end());
+	TBamRecord().swap(taskScan[t].bamRecord[svt]);
       }
-	
-      // Collect split-read SVs
-#pragma omp critical
-      {
-	if ((c.svtset.empty()) || (c.svtset.find(2) != c.svtset.end())) selectDeletions(c, readBp, srBR);
-	if ((c.svtset.empty()) || (c.svtset.find(3) != c.svtset.end())) selectDuplications(c, readBp, srBR);
-	if ((c.svtset.empty()) || (c.svtset.find(0) != c.svtset.end()) || (c.svtset.find(1) != c.svtset.end())) selectInversions(c, readBp, srBR);
-	if ((c.svtset.empty()) || (c.svtset.find(4) != c.svtset.end())) selectInsertions(c, readBp, srBR);
-	if ((c.svtset.empty()) || (c.svtset.find(DELLY_SVT_TRANS) != c.svtset.end()) || (c.svtset.find(DELLY_SVT_TRANS + 1) != c.svtset.end()) || (c.svtset.find(DELLY_SVT_TRANS + 2) != c.svtset.end()) || (c.svtset.find(DELLY_SVT_TRANS + 3) != c.svtset.end())) selectTranslocations(c, readBp, srBR);
+    }
+    std::vector<PEandSRScan>().swap(taskScan);
+    for(uint32_t svt = 0; svt < srBR.size(); ++svt) {
+      for(uint32_t file_c = 0; file_c < sampleSR.size(); ++file_c) {
+	if (svt >= sampleSR[file_c].size()) continue;
+	srBR[svt].insert(srBR[svt].end(), sampleSR[file_c][svt].begin(), sampleSR[file_c][svt].end());
+	TSRBamRecord().swap(sampleSR[file_c][svt]);
       }
     }
 
@@ -465,6 +644,9 @@ namespace torali
 
       // Cluster
       cluster(c, bamRecord[svt], svs, varisize, svt);
+
+      // Release records of this SV type before clustering the next one
+      TBamRecord().swap(bamRecord[svt]);
     }
 
     // Track split-reads
@@ -483,10 +665,8 @@ namespace torali
 
     // Clean-up
     bam_hdr_destroy(hdr);
-    for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-      hts_idx_destroy(idx[file_c]);
-      sam_close(samfile[file_c]);
-    }
+    sam_close(samfile);
+    return true;
   }
 
 
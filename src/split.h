@@ -22,18 +22,22 @@ namespace torali
   };
 
   template<typename TBPoint>
-  inline void
-  _adjustOrientation(std::string& sequence, TBPoint bpPoint, int32_t const svt) {
+  inline bool
+  _reverseOrientation(TBPoint bpPoint, int32_t const svt) {
     if (_translocation(svt)) {
       uint8_t ct = _getSpanOrientation(svt);
-      if (((ct==0) && (bpPoint)) || ((ct==1) && (!bpPoint))) reverseComplement(sequence);
+      return (((ct==0) && (bpPoint)) || ((ct==1) && (!bpPoint)));
     } else {
-      if (svt == 0) {
-	if (bpPoint) reverseComplement(sequence);
-      } else if (svt == 1) {
-	if (!bpPoint) reverseComplement(sequence);
-      }
+      if (svt == 0) return bpPoint;
+      else if (svt == 1) return !bpPoint;
     }
+    return false;
+  }
+
+  template<typename TBPoint>
+  inline void
+  _adjustOrientation(std::string& sequence, TBPoint bpPoint, int32_t const svt) {
+    if (_reverseOrientation(bpPoint, svt)) reverseComplement(sequence);
   }
 
   inline bool
@@ -431,26 +435,33 @@ namespace torali
 
   template<typename TAlign>
   inline bool
-  _consRefAlignment(std::string const& cons, std::string const& svRefStr, TAlign& aln, int32_t const svt) {
+  _consRefAlignment(std::string const& cons, std::string const& svRefStr, TAlign& aln, int32_t const svt, AlignWorkspace<int>& ws) {
     AlignConfig<true, false> semiglobal;
     DnaScore<int> lnsc(5, -4, -4, -4);
     bool reNeedle = false;
     if (svt == 4) {
-      reNeedle = longNeedle(svRefStr, cons, aln, semiglobal, lnsc);
+      reNeedle = longNeedle(svRefStr, cons, aln, semiglobal, lnsc, ws);
       for(uint32_t j = 0; j < aln.shape()[1]; ++j) {
 	char tmp = aln[0][j];
 	aln[0][j] = aln[1][j];
 	aln[1][j] = tmp;
       }	
     } else {
-      reNeedle = longNeedle(cons, svRefStr, aln, semiglobal, lnsc);
+      reNeedle = longNeedle(cons, svRefStr, aln, semiglobal, lnsc, ws);
     }
     return reNeedle;
   }
 
+  template<typename TAlign>
+  inline bool
+  _consRefAlignment(std::string const& cons, std::string const& svRefStr, TAlign& aln, int32_t const svt) {
+    ThreadWorkspace<int> tw;
+    return _consRefAlignment(cons, svRefStr, aln, svt, tw.ws);
+  }
+
   template<typename TConfig>
   inline bool
-  _alignConsensus(TConfig const& c, std::string& consensus, std::string& svRefStr, int32_t svt, AlignDescriptor& ad, bool const realign) {
+  _alignConsensus(TConfig const& c, std::string& consensus, std::string& svRefStr, int32_t svt, AlignDescriptor& ad, bool const realign, AlignWorkspace<int>& ws) {
     // Realign?
     if (realign) {
       std::string revc = consensus;
@@ -466,7 +477,7 @@ namespace torali
     typedef boost::multi_array<char, 2> TAlign;
     TAlign align;
     //std::cerr << "Consensus-to-Reference alignment" << std::endl;
-    if (!_consRefAlignment(consensus, svRefStr, align, svt)) return false;
+    if (!_consRefAlignment(consensus, svRefStr, align, svt, ws)) return false;
 
     // Debug consensus to reference alignment
     //for(uint32_t i = 0; i < align.shape()[0]; ++i) {
@@ -482,24 +493,32 @@ namespace torali
     // All fine
     return true;
   }
+
+  template<typename TConfig>
+  inline bool
+  _alignConsensus(TConfig const& c, std::string& consensus, std::string& svRefStr, int32_t svt, AlignDescriptor& ad, bool const realign) {
+    ThreadWorkspace<int> tw;
+    return _alignConsensus(c, consensus, svRefStr, svt, ad, realign, tw.ws);
+  }
   
+  // The consensus is interned into the SV only if it aligns
   template<typename TConfig>
   inline bool
-  alignConsensus(TConfig const& c, bam_hdr_t* hdr, char const* seq, char const* sndSeq, StructuralVariantRecord& sv, bool const realign) {
-    if ( (int32_t) sv.consensus.size() < (2 * c.minimumFlankSize + sv.insLen)) return false;
+  alignConsensus(TConfig const& c, bam_hdr_t* hdr, char const* seq, char const* sndSeq, std::string& consensus, StructuralVariantRecord& sv, bool const realign, AlignWorkspace<int>& ws) {
+    if ( (int32_t) consensus.size() < (2 * c.minimumFlankSize + sv.insLen)) return false;
     
     // Get reference slice
     Breakpoint bp(sv);
     if (sv.svt ==4) {
-      int32_t bufferSpace = std::max((int32_t) ((sv.consensus.size() - sv.insLen) / 3), c.minimumFlankSize);
+      int32_t bufferSpace = std::max((int32_t) ((consensus.size() - sv.insLen) / 3), c.minimumFlankSize);
       _initBreakpoint(hdr, bp, bufferSpace, sv.svt);
-    } else _initBreakpoint(hdr, bp, sv.consensus.size(), sv.svt);
+    } else _initBreakpoint(hdr, bp, consensus.size(), sv.svt);
     if (bp.chr != bp.chr2) bp.part1 = _getSVRef(c, sndSeq, bp, bp.chr2, sv.svt);
     std::string svRefStr = _getSVRef(c, seq, bp, bp.chr, sv.svt);
 
     // Generate consensus alignment
     AlignDescriptor ad;
-    if (!_alignConsensus(c, sv.consensus, svRefStr, sv.svt, ad, realign)) return false;
+    if (!_alignConsensus(c, consensus, svRefStr, sv.svt, ad, realign, ws)) return false;
 
     // Get the start and end of the structural variant
     unsigned int finalGapStart = 0;
@@ -517,13 +536,21 @@ namespace torali
     sv.ciposhigh = ci_wiggle;
     sv.ciendlow = -ci_wiggle;
     sv.ciendhigh = ci_wiggle;
+    sv.consensus = consensus;
     return true;
   }
 
   template<typename TConfig>
   inline bool
-  alignConsensus(TConfig const& c, bam_hdr_t* hdr, char const* seq, char const* sndSeq, StructuralVariantRecord& sv) {
-    return alignConsensus(c, hdr, seq, sndSeq, sv, false);
+  alignConsensus(TConfig const& c, bam_hdr_t* hdr, char const* seq, char const* sndSeq, std::string& consensus, StructuralVariantRecord& sv, bool const realign) {
+    ThreadWorkspace<int> tw;
+    return alignConsensus(c, hdr, seq, sndSeq, consensus, sv, realign, tw.ws);
+  }
+
+  template<typename TConfig>
+  inline bool
+  alignConsensus(TConfig const& c, bam_hdr_t* hdr, char const* seq, char const* sndSeq, std::string& consensus, StructuralVariantRecord& sv) {
+    return alignConsensus(c, hdr, seq, sndSeq, consensus, sv, false);
   }
 
 
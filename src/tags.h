@@ -1,6 +1,9 @@
 #ifndef TAGS_H
 #define TAGS_H
 
+#include "readid.h"
+#include "seqpool.h"
+
 namespace torali {
 
   #ifndef DELLY_SVT_TRANS
@@ -52,8 +55,8 @@ namespace torali {
     int32_t peMapQuality;
     float srAlignQuality;
     bool precise;
-    std::string alleles;
-    std::string consensus;
+    PooledSeq alleles;
+    PooledSeq consensus;
 
     
     StructuralVariantRecord() : chr(0), svStart(0), chr2(0), svEnd(0), ciposlow(0), ciposhigh(0), ciendlow(0), ciendhigh(0), srSupport(0), srMapQuality(0), mapq(0), insLen(0), svt(-1), id(0), homLen(0), peSupport(0), peMapQuality(0), srAlignQuality(0), precise(false) {}
@@ -212,13 +215,8 @@ namespace torali {
     }
   }
 
-  inline unsigned hash_string(const char *s) {
-    unsigned h = 37;
-    while (*s) {
-      h = (h * 54059) ^ (s[0] * 76963);
-      s++;
-    }
-    return h;
+  inline std::size_t hash_string(const char *s) {
+    return hashReadId(s);
   }
   
   template<typename TAlignedReads>
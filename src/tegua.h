@@ -40,6 +40,7 @@ namespace torali {
     bool hasVcfFile;
     uint16_t minMapQual;
     uint16_t minGenoQual;
+    uint16_t ioThreads;
     uint32_t minClip;
     uint32_t minRefSep;
     uint32_t maxReadSep;
@@ -72,7 +73,8 @@ namespace torali {
    ProfilerStart("delly.prof");
 #endif
 
-   // Structural Variants
+   // Structural Variants, their sequences live in the pool of this run
+   SequencePoolScope poolScope;
    typedef std::vector<StructuralVariantRecord> TVariants;
    TVariants svs;
 
@@ -192,6 +194,7 @@ namespace torali {
      ("genome,g", boost::program_options::value<boost::filesystem::path>(&c.genome), "genome fasta file")
      ("exclude,x", boost::program_options::value<boost::filesystem::path>(&c.exclude), "file with regions to exclude")
      ("outfile,o", boost::program_options::value<boost::filesystem::path>(&c.outfile), "BCF output file")
+     ("io-threads", boost::program_options::value<uint16_t>(&c.ioThreads)->default_value(0), "threads for BAM/CRAM decoding and BCF encoding")
      ;
    
    boost::program_options::options_description disc("Discovery options");
@@ -373,7 +376,10 @@ namespace torali {
    // Run Tegua
    if (mode == "pb") c.indelExtension = 0.7;
    else if (mode == "ont") c.indelExtension = 0.5;
-   return runTegua(c);
+   if (!initHtsThreadPool(c.ioThreads)) return 1;
+   int ret = runTegua(c);
+   destroyHtsThreadPool();
+   return ret;
  }
 
 }
@@ -8,7 +8,10 @@
 #include <boost/iostreams/copy.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
 #include <htslib/sam.h>
+#include <htslib/thread_pool.h>
 #include <sstream>
+#include <cstring>
+#include <iterator>
 #include <math.h>
 #include "tags.h"
 
@@ -77,6 +80,93 @@ namespace torali
   };
 
 
+  inline uint32_t
+  _popcount64(uint64_t x) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (x * 0x0101010101010101ULL) >> 56;
+#endif
+  }
+
+  // Index of the lowest set bit, x != 0
+  inline uint32_t
+  _ctz64(uint64_t x) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(x);
+#else
+    return _popcount64((x & (~x + 1)) - 1);
+#endif
+  }
+
+  // Word of 8 bytes as laid out in memory
+  inline uint64_t
+  _load64(char const* p) {
+    uint64_t x;
+    std::memcpy(&x, p, sizeof(uint64_t));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    x = __builtin_bswap64(x);
+#endif
+    return x;
+  }
+
+  // Bit i is set if byte i of x is zero
+  inline uint32_t
+  _zeroBytes64(uint64_t x) {
+    uint64_t const lo7 = 0x7F7F7F7F7F7F7F7FULL;
+    uint64_t z = ~(((x & lo7) + lo7) | x | lo7);
+    return (uint32_t) (((z >> 7) * 0x0102040810204080ULL) >> 56);
+  }
+
+  // Binary primitives
+  template<typename TValue>
+  inline void
+  _ckpWrite(std::ostream& out, TValue const& val) {
+    out.write(reinterpret_cast<char const*>(&val), sizeof(TValue));
+  }
+
+  template<typename TValue>
+  inline bool
+  _ckpRead(std::istream& in, TValue& val) {
+    in.read(reinterpret_cast<char*>(&val), sizeof(TValue));
+    return in.good();
+  }
+
+  inline void
+  _ckpWrite(std::ostream& out, std::string const& str) {
+    uint32_t len = str.size();
+    _ckpWrite(out, len);
+    out.write(str.data(), len);
+  }
+
+  inline bool
+  _ckpRead(std::istream& in, std::string& str) {
+    uint32_t len = 0;
+    if (!_ckpRead(in, len)) return false;
+    str.resize(len);
+    if (len) in.read(&str[0], len);
+    return in.good();
+  }
+
+  inline void
+  _ckpWrite(std::ostream& out, std::vector<uint8_t> const& v) {
+    uint32_t len = v.size();
+    _ckpWrite(out, len);
+    if (len) out.write(reinterpret_cast<char const*>(&v[0]), len);
+  }
+
+  inline bool
+  _ckpRead(std::istream& in, std::vector<uint8_t>& v) {
+    uint32_t len = 0;
+    if (!_ckpRead(in, len)) return false;
+    v.resize(len);
+    if (len) in.read(reinterpret_cast<char*>(&v[0]), len);
+    return in.good();
+  }
+
   template<typename TConfig>
   inline void
   checkSampleNames(TConfig& c) {
@@ -295,36 +385,25 @@ namespace torali
   }
   
   inline std::size_t hash_pair(bam1_t* rec) {
-    std::size_t seed = hash_string(bam_get_qname(rec));
-    boost::hash_combine(seed, rec->core.tid);
-    boost::hash_combine(seed, rec->core.pos);
-    boost::hash_combine(seed, rec->core.mtid);
-    boost::hash_combine(seed, rec->core.mpos);
+    uint64_t seed = hash_string(bam_get_qname(rec));
+    seed = hashReadIdCombine(seed, rec->core.tid, rec->core.pos);
+    seed = hashReadIdCombine(seed, rec->core.mtid, rec->core.mpos);
     return seed;
   }
 
   inline std::size_t hash_pair_mate(bam1_t* rec) {
-    std::size_t seed = hash_string(bam_get_qname(rec));
-    boost::hash_combine(seed, rec->core.mtid);
-    boost::hash_combine(seed, rec->core.mpos);
-    boost::hash_combine(seed, rec->core.tid);
-    boost::hash_combine(seed, rec->core.pos);
+    uint64_t seed = hash_string(bam_get_qname(rec));
+    seed = hashReadIdCombine(seed, rec->core.mtid, rec->core.mpos);
+    seed = hashReadIdCombine(seed, rec->core.tid, rec->core.pos);
     return seed;
   }
 
   inline std::size_t hash_lr(bam1_t* rec) {
-    boost::hash<std::string> string_hash;
-    std::string qname = bam_get_qname(rec);
-    std::size_t seed = hash_string(qname.c_str());
-    boost::hash_combine(seed, string_hash(qname));
-    return seed;
+    return hashReadId(bam_get_qname(rec));
   }
 
   inline std::size_t hash_lr(std::string const& qname) {
-    boost::hash<std::string> string_hash;
-    std::size_t seed = hash_string(qname.c_str());
-    boost::hash_combine(seed, string_hash(qname));
-    return seed;
+    return hashReadId(qname.c_str(), qname.size(), 0);
   }
   
   inline void
@@ -382,6 +461,49 @@ namespace torali
   }
 
 
+  // Shared htslib thread pool for BGZF/CRAM (de-)compression
+  inline htsThreadPool*
+  _htsThreadPool() {
+    static htsThreadPool tp = {NULL, 0};
+    return &tp;
+  }
+
+  inline bool
+  initHtsThreadPool(uint16_t const nthreads) {
+    htsThreadPool* tp = _htsThreadPool();
+    if ((!nthreads) || (tp->pool != NULL)) return true;
+    tp->pool = hts_tpool_init(nthreads);
+    if (tp->pool == NULL) {
+      std::cerr << "Fail to create htslib thread pool with " << nthreads << " threads!" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  inline void
+  destroyHtsThreadPool() {
+    htsThreadPool* tp = _htsThreadPool();
+    if (tp->pool != NULL) {
+      hts_tpool_destroy(tp->pool);
+      tp->pool = NULL;
+    }
+  }
+
+  // Destroys the shared pool when a command returns, on every path
+  struct HtsThreadPoolScope {
+    HtsThreadPoolScope() {}
+    ~HtsThreadPoolScope() {
+      destroyHtsThreadPool();
+    }
+  };
+
+  // Attach an open BAM/CRAM/BCF file to the shared pool; files must be closed before the pool is destroyed
+  inline void
+  attachHtsThreadPool(htsFile* fp) {
+    htsThreadPool* tp = _htsThreadPool();
+    if ((fp != NULL) && (tp->pool != NULL)) hts_set_thread_pool(fp, tp);
+  }
+
   inline uint32_t
   setMinChrLen(bam_hdr_t const* hdr, double const xx) {
     uint32_t minChrLen = 0;
@@ -417,10 +539,7 @@ namespace torali
   }    
   
   inline std::size_t hash_se(bam1_t* rec) {
-    std::size_t seed = hash_string(bam_get_qname(rec));
-    boost::hash_combine(seed, rec->core.tid);
-    boost::hash_combine(seed, rec->core.pos);
-    return seed;
+    return hashReadIdCombine(hash_string(bam_get_qname(rec)), rec->core.tid, rec->core.pos);
   }
   
   inline void
@@ -547,6 +666,35 @@ namespace torali
     median = *(begin + (end - begin) / 2);
   }
   
+  // Lower bound of value in a sorted range, galloping from the hint of the previous query and moving the hint to the result
+  // Queries of a coordinate-sorted read stream are amortised O(1)
+  template<typename TIterator, typename TValue, typename TCompare>
+  inline TIterator
+  _gallopLowerBound(TIterator const begin, TIterator const end, TIterator& hint, TValue const& value, TCompare comp) {
+    typename std::iterator_traits<TIterator>::difference_type step = 1;
+    TIterator lo = begin;
+    TIterator hi = end;
+    if ((hint != end) && (comp(*hint, value))) {
+      // Gallop forward
+      lo = hint + 1;
+      while ((end - hint > step) && (comp(*(hint + step), value))) {
+	lo = hint + step + 1;
+	step *= 2;
+      }
+      if (end - hint > step) hi = hint + step;
+    } else {
+      // Gallop backward
+      hi = hint;
+      while ((hint - begin >= step) && (!comp(*(hint - step), value))) {
+	hi = hint - step;
+	step *= 2;
+      }
+      if (hint - begin >= step) lo = hint - step + 1;
+    }
+    hint = std::lower_bound(lo, hi, value, comp);
+    return hint;
+  }
+
   template<typename TVector, typename TPercentile, typename TValue>
   inline void
   getPercentile(TVector& vec, TPercentile p, TValue& percentile) 
@@ -612,6 +760,7 @@ namespace torali
     TSamHeader hdr(c.files.size());
     for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
       samfile[file_c] = sam_open(c.files[file_c].string().c_str(), "r");
+      attachHtsThreadPool(samfile[file_c]);
       hts_set_fai_filename(samfile[file_c], c.genome.string().c_str());
       idx[file_c] = sam_index_load(samfile[file_c], c.files[file_c].string().c_str());
       hdr[file_c] = sam_hdr_read(samfile[file_c]);
@@ -0,0 +1,104 @@
+#ifndef WINPLAN_H
+#define WINPLAN_H
+
+#include <iostream>
+
+#include "util.h"
+#include "cnv.h"
+
+namespace torali
+{
+
+  typedef std::vector<std::pair<uint32_t, uint32_t> > TWindowPlan;
+
+  // Windows of window_size valid bases, one every window_offset valid bases, counting only valid bases inside the sorted, disjoint intervals
+  // A window starts right after the last valid base skipped, or at the next interval if that is the end of an interval
+  template<typename TConfig, typename TMaskedCoverage>
+  inline void
+  planAdaptiveWindows(TConfig const& c, TMaskedCoverage const& mc, TWindowPlan const& itv, uint32_t const firstStart, TWindowPlan& wp) {
+    wp.clear();
+    if ((itv.empty()) || (!c.window_size)) return;
+
+    // Valid bases ahead of each interval
+    std::vector<uint32_t> cum(itv.size() + 1, 0);
+    std::vector<uint32_t> rank(itv.size(), 0);
+    for(uint32_t i = 0; i < itv.size(); ++i) {
+      rank[i] = _maskedRank(mc, itv[i].first);
+      cum[i + 1] = cum[i] + (_maskedRank(mc, itv[i].second) - rank[i]);
+    }
+    uint64_t nvalid = cum[itv.size()];
+
+    for(uint64_t r = 0; r + c.window_size <= nvalid; r += c.window_offset) {
+      uint32_t start = firstStart;
+      if (r) {
+	uint32_t i = std::upper_bound(cum.begin(), cum.end(), r - 1) - cum.begin() - 1;
+	start = _maskedSelect(mc, rank[i] + (r - 1 - cum[i])) + 1;
+	if ((start == itv[i].second) && (i + 1 < itv.size())) start = itv[i + 1].first;
+      }
+      uint64_t last = r + c.window_size - 1;
+      uint32_t i = std::upper_bound(cum.begin(), cum.end(), last) - cum.begin() - 1;
+      wp.push_back(std::make_pair(start, _maskedSelect(mc, rank[i] + (last - cum[i])) + 1));
+      if (!c.window_offset) break;
+    }
+  }
+
+  // Observed over expected ratios of valid bases as prefix sums every 64 bp
+  template<typename TMaskedCoverage>
+  inline void
+  _obsExpPrefix(TMaskedCoverage const& mc, std::vector<double>& oe) {
+    oe.assign(mc.mask.size() + 1, 0);
+    for(uint32_t b = 0; b < mc.mask.size(); ++b) {
+      double sum = 0;
+      for(uint64_t m = mc.mask[b]; m; m &= m - 1) sum += mc.gcbias[mc.gcContent[b * 64 + _ctz64(m)]].obsexp;
+      oe[b + 1] = oe[b] + sum;
+    }
+  }
+
+  template<typename TMaskedCoverage>
+  inline double
+  _obsExpSum(TMaskedCoverage const& mc, std::vector<double> const& oe, uint32_t const start, uint32_t const end) {
+    double sum = oe[end / 64] - oe[start / 64];
+    if (end & 63) {
+      for(uint64_t m = mc.mask[end / 64] & ((1ULL << (end & 63)) - 1); m; m &= m - 1) sum += mc.gcbias[mc.gcContent[(end / 64) * 64 + _ctz64(m)]].obsexp;
+    }
+    if (start & 63) {
+      for(uint64_t m = mc.mask[start / 64] & ((1ULL << (start & 63)) - 1); m; m &= m - 1) sum -= mc.gcbias[mc.gcContent[(start / 64) * 64 + _ctz64(m)]].obsexp;
+    }
+    return sum;
+  }
+
+  // Read-depth of each planned window, summed over its valid bases inside the intervals
+  template<typename TConfig, typename TMaskedCoverage>
+  inline void
+  adaptiveWindowCoverage(TConfig const& c, TMaskedCoverage const& mc, TWindowPlan const& itv, TWindowPlan const& wp, std::string const& chrName, std::ostream& dataOut) {
+    std::vector<double> oe;
+    _obsExpPrefix(mc, oe);
+    for(uint32_t w = 0; w < wp.size(); ++w) {
+      double covsum = 0;
+      double expcov = 0;
+      double obsexp = 0;
+      uint32_t winlen = 0;
+      TWindowPlan::const_iterator it = std::upper_bound(itv.begin(), itv.end(), std::make_pair(wp[w].first, std::numeric_limits<uint32_t>::max()));
+      if (it != itv.begin()) --it;
+      for(; ((it != itv.end()) && (it->first < wp[w].second)); ++it) {
+	uint32_t s = std::max(it->first, wp[w].first);
+	uint32_t e = std::min(it->second, wp[w].second);
+	if (s >= e) continue;
+	double cs = 0;
+	double ec = 0;
+	winlen += maskedSum(mc, s, e, cs, ec);
+	covsum += cs;
+	expcov += ec;
+	obsexp += _obsExpSum(mc, oe, s, e);
+      }
+      obsexp /= (double) winlen;
+      double count = ((double) covsum / obsexp ) * (double) c.window_size / (double) winlen;
+      double cn = c.ploidy;
+      if (expcov > 0) cn = c.ploidy * covsum / expcov;
+      dataOut << chrName << "\t" << wp[w].first << "\t" << wp[w].second << "\t" << winlen << "\t" << count << "\t" << cn << std::endl;
+    }
+  }
+
+}
+
+#endif
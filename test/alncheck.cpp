@@ -0,0 +1,145 @@
+// Equivalence checks of the alignment fast paths against their reference implementations
+
+// Small trace-back blocks so the row recomputation of longNeedleLinear is exercised
+#define DELLY_LONGNEEDLE_TRACEBLOCK 256
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <boost/lexical_cast.hpp>
+#include <boost/tokenizer.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+
+#include "util.h"
+#include "needle.h"
+
+using namespace torali;
+
+typedef boost::multi_array<char, 2> TAlign;
+typedef boost::random::mt19937 TRng;
+
+inline int32_t
+_rand(TRng& rng, int32_t const lo, int32_t const hi) {
+  boost::random::uniform_int_distribution<int32_t> dist(lo, hi);
+  return dist(rng);
+}
+
+inline std::string
+_randomSeq(TRng& rng, int32_t const len) {
+  static char const nuc[4] = {'A', 'C', 'G', 'T'};
+  std::string s(len, 'A');
+  for(int32_t i = 0; i < len; ++i) s[i] = nuc[_rand(rng, 0, 3)];
+  return s;
+}
+
+// Consensus of a deletion with point mutations and small indels, the reference partly soft-masked
+inline void
+_deletionPair(TRng& rng, std::string& cons, std::string& ref) {
+  ref = _randomSeq(rng, _rand(rng, 40, 400));
+  int32_t delStart = _rand(rng, 10, ref.size() / 2);
+  int32_t delEnd = _rand(rng, delStart + 1, ref.size() - 10);
+  cons = ref.substr(0, delStart) + ref.substr(delEnd);
+  for(int32_t k = _rand(rng, 0, 3); k > 0; --k) cons[_rand(rng, 0, cons.size() - 1)] = "ACGT"[_rand(rng, 0, 3)];
+  for(int32_t k = _rand(rng, 0, 2); k > 0; --k) {
+    int32_t pos = _rand(rng, 0, cons.size() - 4);
+    if (_rand(rng, 0, 1)) cons.erase(pos, _rand(rng, 1, 3));
+    else cons.insert(pos, _randomSeq(rng, _rand(rng, 1, 3)));
+  }
+  if (_rand(rng, 0, 1)) {
+    int32_t mStart = _rand(rng, 0, ref.size() - 1);
+    int32_t mEnd = std::min((int32_t) ref.size(), mStart + _rand(rng, 1, 50));
+    for(int32_t i = mStart; i < mEnd; ++i) ref[i] = std::tolower(ref[i]);
+  }
+}
+
+inline std::string
+_row(TAlign const& align, uint32_t const r) {
+  std::string s;
+  for(uint32_t j = 0; j < align.shape()[1]; ++j) s.push_back(align[r][j]);
+  return s;
+}
+
+// longNeedleLinear must return the same split and alignment as _longNeedleFull
+inline uint32_t
+checkLongNeedle(TRng& rng, uint32_t const rounds) {
+  AlignConfig<true, false> semiglobal;
+  DnaScore<int> lnsc(5, -4, -4, -4);
+  AlignWorkspace<int> ws;
+  uint32_t fail = 0;
+  uint32_t splits = 0;
+  for(uint32_t i = 0; i < rounds; ++i) {
+    std::string cons;
+    std::string ref;
+    _deletionPair(rng, cons, ref);
+    TAlign full;
+    TAlign linear;
+    bool fullSplit = _longNeedleFull(cons, ref, full, semiglobal, lnsc, ws);
+    bool linearSplit = longNeedleLinear(cons, ref, linear, semiglobal, lnsc);
+    if (fullSplit) ++splits;
+    if (fullSplit != linearSplit) ++fail;
+    else if ((fullSplit) && ((_row(full, 0) != _row(linear, 0)) || (_row(full, 1) != _row(linear, 1)))) ++fail;
+  }
+  std::cout << "longNeedleLinear: " << rounds << " alignments, " << splits << " splits, " << fail << " mismatches" << std::endl;
+  return fail;
+}
+
+// Random multiple alignment with leading and trailing gaps, the first row is ungapped so no column is empty
+inline void
+_randomAlignment(TRng& rng, int32_t const rows, int32_t const cols, TAlign& align) {
+  static char const c[10] = {'A', 'C', 'G', 'T', 'N', 'a', 'c', 'g', 't', '-'};
+  align.resize(boost::extents[rows][cols]);
+  for(int32_t r = 0; r < rows; ++r) {
+    int32_t lead = (r) ? _rand(rng, 0, cols / 4) : 0;
+    int32_t trail = (r) ? _rand(rng, 0, cols / 4) : 0;
+    for(int32_t j = 0; j < cols; ++j) {
+      if ((j < lead) || (j >= cols - trail)) align[r][j] = '-';
+      else align[r][j] = c[_rand(rng, 0, (r) ? 9 : 8)];
+    }
+  }
+}
+
+// Cell scores of the column profiles must equal the 5x5 loop over the profile matrices
+template<typename TProfileValue>
+inline uint32_t
+checkProfileScore(TRng& rng, uint32_t const rounds, std::string const& name) {
+  typedef boost::multi_array<TProfileValue, 2> TProfile;
+  DnaScore<int> sc(5, -4, -10, -1);
+  uint32_t cells = 0;
+  uint32_t fail = 0;
+  for(uint32_t i = 0; i < rounds; ++i) {
+    TAlign a1;
+    TAlign a2;
+    _randomAlignment(rng, _rand(rng, 1, 12), _rand(rng, 1, 60), a1);
+    _randomAlignment(rng, _rand(rng, 2, 12), _rand(rng, 1, 60), a2);
+    TProfile p1;
+    TProfile p2;
+    _createProfile(a1, p1);
+    _createProfile(a2, p2);
+    ScoreProfile<TProfileValue> sp1;
+    ScoreProfile<TProfileValue> sp2;
+    _createScoreProfile(a1, a2, sp1, sp2);
+    for(uint32_t row = 0; row < a1.shape()[1]; ++row) {
+      for(uint32_t col = 0; col < a2.shape()[1]; ++col, ++cells) {
+	float score = 0;
+	for(int k1 = 0; k1 < 5; ++k1)
+	  for(int k2 = 0; k2 < 5; ++k2)
+	    score += p1[k1][row] * p2[k2][col] * ( (k1 == k2) ? sc.match : sc.mismatch );
+	if (_score(a1, a2, sp1, sp2, row, col, sc) != (int) score) ++fail;
+      }
+    }
+  }
+  std::cout << "Profile scores (" << name << "): " << cells << " cells, " << fail << " mismatches" << std::endl;
+  return fail;
+}
+
+int main() {
+  TRng rng(5489u);
+  uint32_t fail = 0;
+  fail += checkLongNeedle(rng, 2000);
+  fail += checkProfileScore<float>(rng, 2000, "gotoh, float");
+  fail += checkProfileScore<double>(rng, 2000, "needle, double");
+  return (fail == 0) ? 0 : 1;
+}